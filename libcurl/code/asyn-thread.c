@@ -74,6 +74,7 @@
 #include "inet_ntop.h"
 #include "curl_threads.h"
 #include "connect.h"
+#include "strcase.h"
 /* The last 3 #include files should be in this order */
 #include "curl_printf.h"
 #include "curl_memory.h"
@@ -83,23 +84,84 @@ struct resdata {
   struct curltime start;
 };
 
+/* The most resolver threads the process runs at once */
+#ifndef CURL_RESOLVER_THREADS
+#define CURL_RESOLVER_THREADS 8
+#endif
+
+struct resolve_job;
+
+/*
+ * Names are resolved by a pool of threads shared by all handles of the
+ * process. The threads are started as the lookups need them, up to
+ * CURL_RESOLVER_THREADS, and then wait for more work until
+ * curl_global_cleanup(). Lookups of the same name that overlap share one
+ * job.
+ *
+ * The pool is allocated, each thread keeps a pointer to its own, so that
+ * curl_global_cleanup() need not wait for a getaddrinfo() that hangs: such
+ * a thread is left to finish on its own, and the last one out frees the
+ * pool.
+ */
+struct resolver_pool {
+  curl_mutex_t mtx;
+  curl_cond_t wakeup;          /* a job was queued, or the pool stops */
+  curl_cond_t finished;        /* a job was done */
+  struct resolve_job *queue;   /* jobs no thread has taken yet, in order */
+  struct resolve_job *queue_tail;
+  int queued;
+  struct resolve_job *running; /* jobs being resolved */
+  curl_thread_t threads[CURL_RESOLVER_THREADS];
+  int nthreads;
+  int alive;                   /* threads that have not returned yet */
+  int idle;                    /* threads waiting for a job */
+  int busy;                    /* threads running a job */
+  bool stopping;
+  bool released;               /* curl_global_cleanup() is done with it */
+};
+
+static struct resolver_pool *pool;
+
+static void pool_stop(void);
+
 /*
  * Curl_resolver_global_init()
  * Called from curl_global_init() to initialize global resolver environment.
- * Does nothing here.
+ * Sets up the resolver pool, the threads start with the first lookups.
  */
 int Curl_resolver_global_init(void)
 {
+  pool = calloc(1, sizeof(struct resolver_pool));
+  if(!pool)
+    return CURLE_OUT_OF_MEMORY;
+  Curl_mutex_init(&pool->mtx);
+  Curl_cond_init(&pool->wakeup);
+  Curl_cond_init(&pool->finished);
   return CURLE_OK;
 }
 
+static void pool_free(struct resolver_pool *p)
+{
+  Curl_cond_destroy(&p->finished);
+  Curl_cond_destroy(&p->wakeup);
+  Curl_mutex_destroy(&p->mtx);
+  free(p);
+}
+
 /*
  * Curl_resolver_global_cleanup()
  * Called from curl_global_cleanup() to destroy global resolver environment.
- * Does nothing here.
+ * Stops the resolver pool. Lookups still under way are not waited for,
+ * their threads free the pool when they are done. Their memory is freed
+ * with the allocator set at that time, so an application must not switch
+ * to other ones with curl_global_init_mem() before they are.
  */
 void Curl_resolver_global_cleanup(void)
 {
+  if(pool) {
+    pool_stop();
+    pool = NULL;
+  }
 }
 
 /*
@@ -173,10 +235,10 @@ struct thread_sync_data {
   struct addrinfo hints;
 #endif
   struct thread_data *td; /* for thread-self cleanup */
+  struct thread_sync_data *next_waiter; /* on the same job */
 };
 
 struct thread_data {
-  curl_thread_t thread_hnd;
   unsigned int poll_interval;
   time_t interval_end;
   struct thread_sync_data tsd;
@@ -218,11 +280,16 @@ static
 int init_thread_sync_data(struct thread_data * td,
                            const char *hostname,
                            int port,
-                           const struct addrinfo *hints)
+                           const struct addrinfo *hints,
+                           bool wakeup)
 {
   struct thread_sync_data *tsd = &td->tsd;
 
   memset(tsd, 0, sizeof(*tsd));
+#ifdef HAVE_SOCKETPAIR
+  tsd->sock_pair[0] = CURL_SOCKET_BAD;
+  tsd->sock_pair[1] = CURL_SOCKET_BAD;
+#endif
 
   tsd->td = td;
   tsd->port = port;
@@ -244,12 +311,15 @@ int init_thread_sync_data(struct thread_data * td,
   Curl_mutex_init(tsd->mtx);
 
 #ifdef HAVE_SOCKETPAIR
-  /* create socket pair */
-  if(socketpair(AF_LOCAL, SOCK_STREAM, 0, &tsd->sock_pair[0]) < 0) {
+  /* create socket pair, for the owner to poll */
+  if(wakeup &&
+     (socketpair(AF_LOCAL, SOCK_STREAM, 0, &tsd->sock_pair[0]) < 0)) {
     tsd->sock_pair[0] = CURL_SOCKET_BAD;
     tsd->sock_pair[1] = CURL_SOCKET_BAD;
     goto err_exit;
   }
+#else
+  (void)wakeup;
 #endif
   tsd->sock_error = CURL_ASYNC_SUCCESS;
 
@@ -268,11 +338,34 @@ int init_thread_sync_data(struct thread_data * td,
   return 0;
 }
 
+/*
+ * resolve_error_final() tells a name that does not exist from a lookup that
+ * failed for now, like EAI_AGAIN, which is worth asking again at once.
+ */
+static bool resolve_error_final(int error)
+{
+#ifdef HAVE_GETADDRINFO
+  if(error == EAI_NONAME)
+    return TRUE;
+#if defined(EAI_NODATA) && (EAI_NODATA != EAI_NONAME)
+  if(error == EAI_NODATA)
+    return TRUE;
+#endif
+#else
+  (void)error;
+#endif
+  return FALSE;
+}
+
 static int getaddrinfo_complete(struct connectdata *conn)
 {
   struct thread_sync_data *tsd = conn_thread_sync_data(conn);
   int rc;
 
+  if(!tsd->res && resolve_error_final(tsd->sock_error))
+    /* the name does not resolve, spare the next lookups the wait */
+    Curl_cache_negative(conn->data, tsd->hostname, tsd->port);
+
   rc = Curl_addrinfo_callback(conn, tsd->sock_error, tsd->res);
   /* The tsd->res structure has been copied to async.dns and perhaps the DNS
      cache.  Set our copy to NULL so destroy_thread_sync_data doesn't free it.
@@ -283,38 +376,56 @@ static int getaddrinfo_complete(struct connectdata *conn)
 }
 
 
-#ifdef HAVE_GETADDRINFO
-
 /*
- * getaddrinfo_thread() resolves a name and then exits.
- *
- * For builds without ARES, but with ENABLE_IPV6, create a resolver thread
- * and wait on it.
+ * job_resolve() does the lookup of a job, for the name and hints of its
+ * first waiter. Returns 0 or the error.
  */
-static unsigned int CURL_STDCALL getaddrinfo_thread(void *arg)
+static int job_resolve(struct thread_sync_data *tsd, Curl_addrinfo **res)
 {
-  struct thread_sync_data *tsd = (struct thread_sync_data*)arg;
-  struct thread_data *td = tsd->td;
+  int error = 0;
+#ifdef HAVE_GETADDRINFO
   char service[12];
   int rc;
-#ifdef HAVE_SOCKETPAIR
-  char buf[1];
-#endif
 
   msnprintf(service, sizeof(service), "%d", tsd->port);
 
-  rc = Curl_getaddrinfo_ex(tsd->hostname, service, &tsd->hints, &tsd->res);
+  rc = Curl_getaddrinfo_ex(tsd->hostname, service, &tsd->hints, res);
 
   if(rc != 0) {
-    tsd->sock_error = SOCKERRNO?SOCKERRNO:rc;
-    if(tsd->sock_error == 0)
-      tsd->sock_error = RESOLVER_ENOMEM;
+    error = SOCKERRNO?SOCKERRNO:rc;
+    if(error == 0)
+      error = RESOLVER_ENOMEM;
   }
   else {
-    Curl_addrinfo_set_port(tsd->res, tsd->port);
+    Curl_addrinfo_set_port(*res, tsd->port);
+  }
+#else
+  *res = Curl_ipv4_resolve_r(tsd->hostname, tsd->port);
+
+  if(!*res) {
+    error = SOCKERRNO;
+    if(error == 0)
+      error = RESOLVER_ENOMEM;
   }
+#endif
+  return error;
+}
+
+/*
+ * tsd_deliver() hands a waiter its result, or cleans up after a waiter that
+ * has given up on it.
+ */
+static void tsd_deliver(struct thread_sync_data *tsd, Curl_addrinfo *res,
+                        int error)
+{
+  struct thread_data *td = tsd->td;
+#ifdef HAVE_SOCKETPAIR
+  char buf[1];
+#endif
 
   Curl_mutex_acquire(tsd->mtx);
+  tsd->res = res;
+  tsd->sock_error = error;
   if(tsd->done) {
     /* too late, gotta clean up the mess */
     Curl_mutex_release(tsd->mtx);
@@ -335,44 +446,219 @@ static unsigned int CURL_STDCALL getaddrinfo_thread(void *arg)
     tsd->done = 1;
     Curl_mutex_release(tsd->mtx);
   }
-
-  return 0;
 }
 
-#else /* HAVE_GETADDRINFO */
+/* A name being looked up for one or more waiters */
+struct resolve_job {
+  struct resolve_job *next;
+  struct thread_sync_data *waiters; /* the first one's name is looked up */
+};
 
 /*
- * gethostbyname_thread() resolves a name and then exits.
+ * job_done() gives every waiter of a job its own copy of the result and
+ * frees the job. Called with the pool lock held.
  */
-static unsigned int CURL_STDCALL gethostbyname_thread(void *arg)
+static void job_done(struct resolver_pool *p, struct resolve_job *job,
+                     Curl_addrinfo *res, int error)
 {
-  struct thread_sync_data *tsd = (struct thread_sync_data *)arg;
-  struct thread_data *td = tsd->td;
+  struct thread_sync_data *tsd = job->waiters;
+
+  while(tsd) {
+    struct thread_sync_data *next = tsd->next_waiter;
+    Curl_addrinfo *own = res;
+    int own_error = error;
+
+    if(res && next) {
+      /* the last waiter gets the original */
+      own = Curl_addrinfo_copy(res);
+      if(!own)
+        own_error = RESOLVER_ENOMEM;
+    }
+    tsd_deliver(tsd, own, own_error);
+    tsd = next;
+  }
+  free(job);
+  Curl_cond_broadcast(&p->finished);
+}
+
+static bool job_matches(struct resolve_job *job,
+                        const struct thread_sync_data *tsd)
+{
+  const struct thread_sync_data *first = job->waiters;
 
-  tsd->res = Curl_ipv4_resolve_r(tsd->hostname, tsd->port);
+  return (first->port == tsd->port) &&
+#ifdef HAVE_GETADDRINFO
+    (first->hints.ai_family == tsd->hints.ai_family) &&
+    (first->hints.ai_socktype == tsd->hints.ai_socktype) &&
+#endif
+    strcasecompare(first->hostname, tsd->hostname);
+}
+
+static struct resolve_job *job_find(struct resolve_job *job,
+                                    const struct thread_sync_data *tsd)
+{
+  for(; job; job = job->next)
+    if(job_matches(job, tsd))
+      return job;
+  return NULL;
+}
 
-  if(!tsd->res) {
-    tsd->sock_error = SOCKERRNO;
-    if(tsd->sock_error == 0)
-      tsd->sock_error = RESOLVER_ENOMEM;
+/*
+ * pool_thread() runs the queued jobs, one at a time, until the pool stops.
+ */
+static unsigned int CURL_STDCALL pool_thread(void *arg)
+{
+  struct resolver_pool *p = arg;
+  bool last;
+
+  Curl_mutex_acquire(&p->mtx);
+  for(;;) {
+    struct resolve_job *job;
+    struct resolve_job **jobp;
+    Curl_addrinfo *res = NULL;
+    int error;
+
+    while(!p->queue && !p->stopping) {
+      p->idle++;
+      Curl_cond_wait(&p->wakeup, &p->mtx);
+      p->idle--;
+    }
+    if(p->stopping)
+      break;
+
+    job = p->queue;
+    p->queue = job->next;
+    if(!p->queue)
+      p->queue_tail = NULL;
+    p->queued--;
+    job->next = p->running;
+    p->running = job;
+    p->busy++;
+    Curl_mutex_release(&p->mtx);
+
+    error = job_resolve(job->waiters, &res);
+
+    Curl_mutex_acquire(&p->mtx);
+    p->busy--;
+    for(jobp = &p->running; *jobp != job; jobp = &(*jobp)->next)
+      ;
+    *jobp = job->next;
+    job_done(p, job, res, error);
   }
+  p->alive--;
+  last = p->released && !p->alive;
+  Curl_cond_broadcast(&p->finished);
+  Curl_mutex_release(&p->mtx);
 
-  Curl_mutex_acquire(tsd->mtx);
-  if(tsd->done) {
-    /* too late, gotta clean up the mess */
-    Curl_mutex_release(tsd->mtx);
-    destroy_thread_sync_data(tsd);
-    free(td);
+  if(last)
+    pool_free(p);
+  return 0;
+}
+
+/*
+ * pool_submit() queues the lookup of a waiter, or joins it to the job
+ * already looking up the same name. Returns FALSE if no thread is there to
+ * run it.
+ */
+static bool pool_submit(struct thread_sync_data *tsd)
+{
+  struct resolve_job *job;
+  bool ok = TRUE;
+
+  tsd->next_waiter = NULL;
+
+  Curl_mutex_acquire(&pool->mtx);
+  job = job_find(pool->running, tsd);
+  if(!job)
+    job = job_find(pool->queue, tsd);
+
+  if(job) {
+    /* wait for the lookup under way */
+    tsd->next_waiter = job->waiters->next_waiter;
+    job->waiters->next_waiter = tsd;
   }
   else {
-    tsd->done = 1;
-    Curl_mutex_release(tsd->mtx);
+    if((pool->queued >= pool->idle) && (pool->nthreads < CURL_RESOLVER_THREADS)) {
+      /* every idle thread has a job coming, start another one */
+      curl_thread_t thread_hnd = Curl_thread_create(pool_thread, pool);
+      if(thread_hnd) {
+        pool->threads[pool->nthreads++] = thread_hnd;
+        pool->alive++;
+      }
+    }
+
+    job = pool->nthreads ? calloc(1, sizeof(struct resolve_job)) : NULL;
+    if(job) {
+      job->waiters = tsd;
+      if(pool->queue_tail)
+        pool->queue_tail->next = job;
+      else
+        pool->queue = job;
+      pool->queue_tail = job;
+      pool->queued++;
+      Curl_cond_signal(&pool->wakeup);
+    }
+    else
+      ok = FALSE;
   }
+  Curl_mutex_release(&pool->mtx);
 
-  return 0;
+  return ok;
 }
 
-#endif /* HAVE_GETADDRINFO */
+/*
+ * pool_wait() blocks until the lookup of a waiter is done.
+ */
+static void pool_wait(struct thread_sync_data *tsd)
+{
+  Curl_mutex_acquire(&pool->mtx);
+  for(;;) {
+    int done;
+
+    Curl_mutex_acquire(tsd->mtx);
+    done = tsd->done;
+    Curl_mutex_release(tsd->mtx);
+    if(done)
+      break;
+    Curl_cond_wait(&pool->finished, &pool->mtx);
+  }
+  Curl_mutex_release(&pool->mtx);
+}
+
+/*
+ * pool_stop() fails the queued jobs and waits for the idle threads to
+ * return. The threads running a job are detached instead of waited for,
+ * a getaddrinfo() may take the full system DNS timeout. The last thread
+ * to return frees the pool, or this does when none is left.
+ */
+static void pool_stop(void)
+{
+  struct resolver_pool *p = pool;
+  bool last;
+  int i;
+
+  Curl_mutex_acquire(&p->mtx);
+  p->stopping = TRUE;
+  Curl_cond_broadcast(&p->wakeup);
+  while(p->queue) {
+    struct resolve_job *job = p->queue;
+    p->queue = job->next;
+    job_done(p, job, NULL, RESOLVER_ENOMEM);
+  }
+  p->queue_tail = NULL;
+  p->queued = 0;
+  while(p->alive > p->busy)
+    Curl_cond_wait(&p->finished, &p->mtx);
+  for(i = 0; i < p->nthreads; i++)
+    Curl_thread_destroy(p->threads[i]);
+  p->nthreads = 0;
+  p->released = TRUE;
+  last = !p->alive;
+  Curl_mutex_release(&p->mtx);
+
+  if(last)
+    pool_free(p);
+}
 
 /*
  * destroy_async_data() cleans up async resolver data and thread handle.
@@ -388,21 +674,15 @@ static void destroy_async_data(struct Curl_async *async)
 #endif
 
     /*
-     * if the thread is still blocking in the resolve syscall, detach it and
-     * let the thread do the cleanup...
+     * if the lookup is still under way, leave the cleanup to the thread that
+     * finishes it...
      */
     Curl_mutex_acquire(td->tsd.mtx);
     done = td->tsd.done;
     td->tsd.done = 1;
     Curl_mutex_release(td->tsd.mtx);
 
-    if(!done) {
-      Curl_thread_destroy(td->thread_hnd);
-    }
-    else {
-      if(td->thread_hnd != curl_thread_t_null)
-        Curl_thread_join(&td->thread_hnd);
-
+    if(done) {
       destroy_thread_sync_data(&td->tsd);
 
       free(async->os_specific);
@@ -424,8 +704,8 @@ static void destroy_async_data(struct Curl_async *async)
 }
 
 /*
- * init_resolve_thread() starts a new thread that performs the actual
- * resolve. This function returns before the resolve is done.
+ * init_resolve_thread() hands the resolve to the resolver pool. This
+ * function returns before the resolve is done.
  *
  * Returns FALSE in case of failure, otherwise TRUE.
  */
@@ -444,9 +724,8 @@ static bool init_resolve_thread(struct connectdata *conn,
   conn->async.done = FALSE;
   conn->async.status = 0;
   conn->async.dns = NULL;
-  td->thread_hnd = curl_thread_t_null;
 
-  if(!init_thread_sync_data(td, hostname, port, hints)) {
+  if(!init_thread_sync_data(td, hostname, port, hints, TRUE)) {
     conn->async.os_specific = NULL;
     free(td);
     goto errno_exit;
@@ -457,19 +736,13 @@ static bool init_resolve_thread(struct connectdata *conn,
   if(!conn->async.hostname)
     goto err_exit;
 
-  /* The thread will set this to 1 when complete. */
+  /* The pool will set this to 1 when complete. */
   td->tsd.done = 0;
 
-#ifdef HAVE_GETADDRINFO
-  td->thread_hnd = Curl_thread_create(getaddrinfo_thread, &td->tsd);
-#else
-  td->thread_hnd = Curl_thread_create(gethostbyname_thread, &td->tsd);
-#endif
-
-  if(!td->thread_hnd) {
-    /* The thread never started, so mark it as done here for proper cleanup. */
+  if(!pool_submit(&td->tsd)) {
+    /* Nothing was queued, so mark it as done here for proper cleanup. */
     td->tsd.done = 1;
-    err = errno;
+    err = EAGAIN;
     goto err_exit;
   }
 
@@ -516,15 +789,11 @@ static CURLcode thread_wait_resolv(struct connectdata *conn,
   CURLcode result = CURLE_OK;
 
   DEBUGASSERT(conn && td);
-  DEBUGASSERT(td->thread_hnd != curl_thread_t_null);
 
-  /* wait for the thread to resolve the name */
-  if(Curl_thread_join(&td->thread_hnd)) {
-    if(entry)
-      result = getaddrinfo_complete(conn);
-  }
-  else
-    DEBUGASSERT(0);
+  /* wait for the pool to resolve the name */
+  pool_wait(&td->tsd);
+  if(entry)
+    result = getaddrinfo_complete(conn);
 
   conn->async.done = TRUE;
 
@@ -545,20 +814,12 @@ static CURLcode thread_wait_resolv(struct connectdata *conn,
 
 
 /*
- * Until we gain a way to signal the resolver threads to stop early, we must
- * simply wait for them and ignore their results.
+ * A lookup that is no longer wanted is cleaned up by the pool thread that
+ * finishes it, so there is nothing to wait for.
  */
 void Curl_resolver_kill(struct connectdata *conn)
 {
-  struct thread_data *td = (struct thread_data*) conn->async.os_specific;
-
-  /* If we're still resolving, we must wait for the threads to fully clean up,
-     unfortunately.  Otherwise, we can simply cancel to clean up any resolver
-     data. */
-  if(td && td->thread_hnd != curl_thread_t_null)
-    (void)thread_wait_resolv(conn, NULL, FALSE);
-  else
-    Curl_resolver_cancel(conn);
+  Curl_resolver_cancel(conn);
 }
 
 /*
@@ -681,6 +942,125 @@ int Curl_resolver_getsock(struct connectdata *conn,
   return ret_val;
 }
 
+#ifdef HAVE_GETADDRINFO
+/*
+ * resolve_hints() fills in the getaddrinfo() hints for the connection's IP
+ * version and transport.
+ */
+static void resolve_hints(struct connectdata *conn, struct addrinfo *hints)
+{
+  int pf = PF_INET;
+
+#ifdef CURLRES_IPV6
+  /*
+   * Check if a limited name resolve has been requested.
+   */
+  switch(conn->ip_version) {
+  case CURL_IPRESOLVE_V4:
+    pf = PF_INET;
+    break;
+  case CURL_IPRESOLVE_V6:
+    pf = PF_INET6;
+    break;
+  default:
+    pf = PF_UNSPEC;
+    break;
+  }
+
+  if((pf != PF_INET) && !Curl_ipv6works())
+    /* The stack seems to be a non-IPv6 one */
+    pf = PF_INET;
+#endif /* CURLRES_IPV6 */
+
+  memset(hints, 0, sizeof(*hints));
+  hints->ai_family = pf;
+  hints->ai_socktype = (conn->transport == TRNSPRT_TCP)?
+    SOCK_STREAM : SOCK_DGRAM;
+}
+#endif /* HAVE_GETADDRINFO */
+
+/* A name resolved again in the background for the DNS cache, a lookup
+   without a connection waiting on it */
+struct Curl_dns_refresh {
+  struct thread_data td; /* first, freed as one */
+};
+
+/*
+ * Curl_resolver_refresh() queues the lookup of a name again on the resolver
+ * pool, for the DNS cache to swap in when done. Returns NULL if it could not
+ * be queued.
+ */
+struct Curl_dns_refresh *Curl_resolver_refresh(struct connectdata *conn,
+                                               const char *hostname,
+                                               int port)
+{
+  struct Curl_dns_refresh *refresh;
+  struct addrinfo *hintsp = NULL;
+#ifdef HAVE_GETADDRINFO
+  struct addrinfo hints;
+
+  resolve_hints(conn, &hints);
+  hintsp = &hints;
+#else
+  (void)conn;
+#endif
+
+  refresh = calloc(1, sizeof(struct Curl_dns_refresh));
+  if(!refresh)
+    return NULL;
+  if(!init_thread_sync_data(&refresh->td, hostname, port, hintsp, FALSE)) {
+    free(refresh);
+    return NULL;
+  }
+
+  refresh->td.tsd.done = 0;
+  if(!pool_submit(&refresh->td.tsd)) {
+    destroy_thread_sync_data(&refresh->td.tsd);
+    free(refresh);
+    return NULL;
+  }
+  return refresh;
+}
+
+bool Curl_resolver_refresh_done(struct Curl_dns_refresh *refresh)
+{
+  int done;
+
+  Curl_mutex_acquire(refresh->td.tsd.mtx);
+  done = refresh->td.tsd.done;
+  Curl_mutex_release(refresh->td.tsd.mtx);
+  return done ? TRUE : FALSE;
+}
+
+/* The addresses of a done refresh, NULL if the name did not resolve. The
+   caller owns them. */
+Curl_addrinfo *Curl_resolver_refresh_take(struct Curl_dns_refresh *refresh)
+{
+  Curl_addrinfo *res;
+
+  Curl_mutex_acquire(refresh->td.tsd.mtx);
+  res = refresh->td.tsd.res;
+  refresh->td.tsd.res = NULL;
+  Curl_mutex_release(refresh->td.tsd.mtx);
+  return res;
+}
+
+void Curl_resolver_refresh_release(struct Curl_dns_refresh *refresh)
+{
+  int done;
+
+  Curl_mutex_acquire(refresh->td.tsd.mtx);
+  done = refresh->td.tsd.done;
+  refresh->td.tsd.done = 1;
+  Curl_mutex_release(refresh->td.tsd.mtx);
+
+  /* unless the pool thread cleans up when it finishes */
+  if(done) {
+    destroy_thread_sync_data(&refresh->td.tsd);
+    free(refresh);
+  }
+}
+
 #ifndef HAVE_GETADDRINFO
 /*
  * Curl_getaddrinfo() - for platforms without getaddrinfo
@@ -725,7 +1105,6 @@ Curl_addrinfo *Curl_resolver_getaddrinfo(struct connectdata *conn,
 {
   struct addrinfo hints;
   char sbuf[12];
-  int pf = PF_INET;
   struct Curl_easy *data = conn->data;
   struct resdata *reslv = (struct resdata *)data->state.resolver;
 
@@ -750,31 +1129,7 @@ Curl_addrinfo *Curl_resolver_getaddrinfo(struct connectdata *conn,
 #endif /* CURLRES_IPV6 */
 #endif /* !USE_RESOLVE_ON_IPS */
 
-#ifdef CURLRES_IPV6
-  /*
-   * Check if a limited name resolve has been requested.
-   */
-  switch(conn->ip_version) {
-  case CURL_IPRESOLVE_V4:
-    pf = PF_INET;
-    break;
-  case CURL_IPRESOLVE_V6:
-    pf = PF_INET6;
-    break;
-  default:
-    pf = PF_UNSPEC;
-    break;
-  }
-
-  if((pf != PF_INET) && !Curl_ipv6works())
-    /* The stack seems to be a non-IPv6 one */
-    pf = PF_INET;
-#endif /* CURLRES_IPV6 */
-
-  memset(&hints, 0, sizeof(hints));
-  hints.ai_family = pf;
-  hints.ai_socktype = (conn->transport == TRNSPRT_TCP)?
-    SOCK_STREAM : SOCK_DGRAM;
+  resolve_hints(conn, &hints);
 
   msnprintf(sbuf, sizeof(sbuf), "%d", port);
 
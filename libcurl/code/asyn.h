@@ -158,6 +158,34 @@ Curl_addrinfo *Curl_resolver_getaddrinfo(struct connectdata *conn,
                                          int port,
                                          int *waitp);
 
+#ifdef CURLRES_THREADED
+struct Curl_dns_refresh;
+
+/*
+ * Curl_resolver_refresh() starts resolving a name again in the background,
+ * for the DNS cache to replace an entry before it expires. Returns NULL if
+ * no lookup could be started.
+ */
+struct Curl_dns_refresh *Curl_resolver_refresh(struct connectdata *conn,
+                                               const char *hostname,
+                                               int port);
+
+/* TRUE once the background lookup has finished */
+bool Curl_resolver_refresh_done(struct Curl_dns_refresh *refresh);
+
+/* The addresses of a finished lookup, NULL if it failed. The caller owns
+   them. */
+Curl_addrinfo *Curl_resolver_refresh_take(struct Curl_dns_refresh *refresh);
+
+/* Lets go of a lookup, finished or not */
+void Curl_resolver_refresh_release(struct Curl_dns_refresh *refresh);
+#else
+#define Curl_resolver_refresh(x,y,z) NULL
+#define Curl_resolver_refresh_done(x) FALSE
+#define Curl_resolver_refresh_take(x) NULL
+#define Curl_resolver_refresh_release(x) Curl_nop_stmt
+#endif
+
 #ifndef CURLRES_ASYNCH
 /* convert these functions if an asynch resolver isn't used */
 #define Curl_resolver_cancel(x) Curl_nop_stmt
@@ -40,28 +40,70 @@
 #include "curl_memory.h"
 #include "memdebug.h"
 
+/*
+ * A cache owned by a share handle locks each shard with its own mutex, so
+ * threads working on different hosts do not wait for each other. Without
+ * thread support, and for caches of a single multi handle, the share's
+ * CURL_LOCK_DATA_CONNECT callback is used as before.
+ */
+static void shard_lock(struct Curl_easy *data, struct conncache *connc,
+                       int shard)
+{
+#ifdef CONNCACHE_MUTEX
+  if(connc && connc->threaded)
+    Curl_mutex_acquire(&connc->shard[shard].lock);
+  else
+#else
+  (void)connc;
+#endif
+  if(data->share)
+    Curl_share_lock(data, CURL_LOCK_DATA_CONNECT, CURL_LOCK_ACCESS_SINGLE);
 #ifdef CURLDEBUG
-/* the debug versions of these macros make extra certain that the lock is
-   never doubly locked or unlocked */
-#define CONN_LOCK(x) if((x)->share) {                                   \
-    Curl_share_lock((x), CURL_LOCK_DATA_CONNECT, CURL_LOCK_ACCESS_SINGLE); \
-    DEBUGASSERT(!(x)->state.conncache_lock);                            \
-    (x)->state.conncache_lock = TRUE;                                   \
-  }
+  /* make extra certain that the lock is never doubly locked */
+  DEBUGASSERT(!data->state.conncache_lock);
+  data->state.conncache_lock = TRUE;
+#endif
+  data->state.conncache_shard = shard;
+}
 
-#define CONN_UNLOCK(x) if((x)->share) {                                 \
-    DEBUGASSERT((x)->state.conncache_lock);                             \
-    (x)->state.conncache_lock = FALSE;                                  \
-    Curl_share_unlock((x), CURL_LOCK_DATA_CONNECT);                     \
-  }
+static void shard_unlock(struct Curl_easy *data, struct conncache *connc)
+{
+#ifdef CURLDEBUG
+  DEBUGASSERT(data->state.conncache_lock);
+  data->state.conncache_lock = FALSE;
+#endif
+#ifdef CONNCACHE_MUTEX
+  if(connc && connc->threaded)
+    Curl_mutex_release(&connc->shard[data->state.conncache_shard].lock);
+  else
 #else
-#define CONN_LOCK(x) if((x)->share)                                     \
-    Curl_share_lock((x), CURL_LOCK_DATA_CONNECT, CURL_LOCK_ACCESS_SINGLE)
-#define CONN_UNLOCK(x) if((x)->share)                   \
-    Curl_share_unlock((x), CURL_LOCK_DATA_CONNECT)
+  (void)connc;
 #endif
+  if(data->share)
+    Curl_share_unlock(data, CURL_LOCK_DATA_CONNECT);
+}
 
-#define HASHKEY_SIZE 128
+/* The count lock is only needed between shards; in the other modes the
+   single share lock is already held. */
+static void count_lock(struct conncache *connc)
+{
+#ifdef CONNCACHE_MUTEX
+  if(connc->threaded)
+    Curl_mutex_acquire(&connc->count_lock);
+#else
+  (void)connc;
+#endif
+}
+
+static void count_unlock(struct conncache *connc)
+{
+#ifdef CONNCACHE_MUTEX
+  if(connc->threaded)
+    Curl_mutex_release(&connc->count_lock);
+#else
+  (void)connc;
+#endif
+}
 
 static void conn_llist_dtor(void *user, void *element)
 {
@@ -81,6 +123,7 @@ static CURLcode bundle_create(struct Curl_easy *data,
 
   (*cb_ptr)->num_connections = 0;
   (*cb_ptr)->multiuse = BUNDLE_UNKNOWN;
+  (*cb_ptr)->key[0] = 0;
 
   Curl_llist_init(&(*cb_ptr)->conn_list, (curl_llist_dtor) conn_llist_dtor);
   return CURLE_OK;
@@ -110,21 +153,36 @@ static void bundle_add_conn(struct connectbundle *cb_ptr,
 static int bundle_remove_conn(struct connectbundle *cb_ptr,
                               struct connectdata *conn)
 {
-  struct curl_llist_element *curr;
-
-  curr = cb_ptr->conn_list.head;
-  while(curr) {
-    if(curr->ptr == conn) {
-      Curl_llist_remove(&cb_ptr->conn_list, curr, NULL);
-      cb_ptr->num_connections--;
-      conn->bundle = NULL;
-      return 1; /* we removed a handle */
-    }
-    curr = curr->next;
+  if(conn->bundle == cb_ptr) {
+    Curl_llist_remove(&cb_ptr->conn_list, &conn->bundle_node, NULL);
+    cb_ptr->num_connections--;
+    conn->bundle = NULL;
+    return 1; /* we removed a handle */
   }
   return 0;
 }
 
+/* Move a connection to the front (just returned, idle) or the back (in use)
+   of its bundle, so that the idle ones are found first */
+static void bundle_move_conn(struct connectbundle *cb_ptr,
+                             struct connectdata *conn, bool to_front)
+{
+  Curl_llist_remove(&cb_ptr->conn_list, &conn->bundle_node, NULL);
+  Curl_llist_insert_next(&cb_ptr->conn_list,
+                         to_front ? NULL : cb_ptr->conn_list.tail, conn,
+                         &conn->bundle_node);
+  conn->bundle = cb_ptr; /* cleared by the list dtor */
+}
+
+static void idle_unlink(struct conncache *connc, struct connectdata *conn)
+{
+  if(conn->idle_listed) {
+    Curl_llist_remove(&connc->shard[conn->conncache_shard].idle,
+                      &conn->idle_node, NULL);
+    conn->idle_listed = FALSE;
+  }
+}
+
 static void free_bundle_hash_entry(void *freethis)
 {
   struct connectbundle *b = (struct connectbundle *) freethis;
@@ -132,31 +190,60 @@ static void free_bundle_hash_entry(void *freethis)
   bundle_destroy(b);
 }
 
-int Curl_conncache_init(struct conncache *connc, int size)
+int Curl_conncache_init(struct conncache *connc, int size, bool shared)
 {
-  int rc;
+  int rc = 0;
+  int i;
+  /* keep the slot count odd, the shard is picked by the same hash */
+  int shardsize = (size / CONNCACHE_SHARDS) | 1;
 
   /* allocate a new easy handle to use when closing cached connections */
   connc->closure_handle = curl_easy_init();
   if(!connc->closure_handle)
     return 1; /* bad */
 
-  rc = Curl_hash_init(&connc->hash, size, Curl_hash_str,
-                      Curl_str_key_compare, free_bundle_hash_entry);
-  if(rc) {
-    Curl_close(connc->closure_handle);
-    connc->closure_handle = NULL;
+  for(i = 0; i < CONNCACHE_SHARDS; i++) {
+    rc = Curl_hash_init(&connc->shard[i].hash, shardsize, Curl_hash_str,
+                        Curl_str_key_compare, free_bundle_hash_entry);
+    if(rc) {
+      while(i--)
+        Curl_hash_destroy(&connc->shard[i].hash);
+      Curl_close(connc->closure_handle);
+      connc->closure_handle = NULL;
+      return rc;
+    }
+    Curl_llist_init(&connc->shard[i].idle, NULL);
   }
-  else
-    connc->closure_handle->state.conn_cache = connc;
 
-  return rc;
+#ifdef CONNCACHE_MUTEX
+  for(i = 0; i < CONNCACHE_SHARDS; i++)
+    Curl_mutex_init(&connc->shard[i].lock);
+  Curl_mutex_init(&connc->count_lock);
+  connc->mutexes = TRUE;
+  connc->threaded = shared;
+#else
+  (void)shared;
+#endif
+
+  connc->closure_handle->state.conn_cache = connc;
+  return 0;
 }
 
 void Curl_conncache_destroy(struct conncache *connc)
 {
-  if(connc)
-    Curl_hash_destroy(&connc->hash);
+  if(connc) {
+    int i;
+    for(i = 0; i < CONNCACHE_SHARDS; i++)
+      Curl_hash_destroy(&connc->shard[i].hash);
+#ifdef CONNCACHE_MUTEX
+    if(connc->mutexes) {
+      for(i = 0; i < CONNCACHE_SHARDS; i++)
+        Curl_mutex_destroy(&connc->shard[i].lock);
+      Curl_mutex_destroy(&connc->count_lock);
+      connc->mutexes = FALSE;
+    }
+#endif
+  }
 }
 
 /* creates a key to find a bundle for this connection */
@@ -184,9 +271,14 @@ static void hashkey(struct connectdata *conn, char *buf,
   msnprintf(buf, len, "%ld%s", port, hostname);
 }
 
+static int hashkey_shard(const char *key)
+{
+  return (int)Curl_hash_str((void *)key, strlen(key), CONNCACHE_SHARDS);
+}
+
 void Curl_conncache_unlock(struct Curl_easy *data)
 {
-  CONN_UNLOCK(data);
+  shard_unlock(data, data->state.conn_cache);
 }
 
 /* Returns number of connections currently held in the connection cache.
@@ -194,10 +286,19 @@ void Curl_conncache_unlock(struct Curl_easy *data)
 */
 size_t Curl_conncache_size(struct Curl_easy *data)
 {
+  struct conncache *connc = data->state.conn_cache;
   size_t num;
-  CONN_LOCK(data);
-  num = data->state.conn_cache->num_conn;
-  CONN_UNLOCK(data);
+#ifdef CONNCACHE_MUTEX
+  if(connc->threaded) {
+    count_lock(connc);
+    num = connc->num_conn;
+    count_unlock(connc);
+    return num;
+  }
+#endif
+  shard_lock(data, connc, 0);
+  num = connc->num_conn;
+  shard_unlock(data, connc);
   return num;
 }
 
@@ -206,63 +307,76 @@ size_t Curl_conncache_size(struct Curl_easy *data)
 */
 size_t Curl_conncache_bundle_size(struct connectdata *conn)
 {
+  struct Curl_easy *data = conn->data;
   size_t num;
-  CONN_LOCK(conn->data);
+  shard_lock(data, data->state.conn_cache, conn->conncache_shard);
   num = conn->bundle->num_connections;
-  CONN_UNLOCK(conn->data);
+  shard_unlock(data, data->state.conn_cache);
   return num;
 }
 
-/* Look up the bundle with all the connections to the same host this
-   connectdata struct is setup to use.
-
-   **NOTE**: When it returns, it holds the connection cache lock! */
-struct connectbundle *Curl_conncache_find_bundle(struct connectdata *conn,
-                                                 struct conncache *connc,
-                                                 const char **hostp)
+/*
+ * Takes the lock of the shard 'conn' is cached in, for changes to the
+ * connection or its bundle that ConnectionExists() may look at from another
+ * thread. Returns FALSE, and does not lock, for a connection that is not in
+ * the cache. Unlock with Curl_conncache_unlock().
+ */
+bool Curl_conncache_lock_conn(struct Curl_easy *data,
+                              struct connectdata *conn)
 {
-  struct connectbundle *bundle = NULL;
-  CONN_LOCK(conn->data);
-  if(connc) {
-    char key[HASHKEY_SIZE];
-    hashkey(conn, key, sizeof(key), hostp);
-    bundle = Curl_hash_pick(&connc->hash, key, strlen(key));
-  }
-
-  return bundle;
+  if(!conn->bundle || !data->state.conn_cache)
+    return FALSE;
+  shard_lock(data, data->state.conn_cache, conn->conncache_shard);
+  return TRUE;
 }
 
-static bool conncache_add_bundle(struct conncache *connc,
-                                 char *key,
-                                 struct connectbundle *bundle)
+/* Sets the multiuse state of the connection's bundle, which other threads
+   read when they look for a connection to reuse */
+void Curl_conncache_set_multiuse(struct connectdata *conn, int multiuse)
 {
-  void *p = Curl_hash_add(&connc->hash, key, strlen(key), bundle);
-
-  return p?TRUE:FALSE;
+  struct Curl_easy *data = conn->data;
+  bool locked = Curl_conncache_lock_conn(data, conn);
+  if(conn->bundle)
+    conn->bundle->multiuse = multiuse;
+  if(locked)
+    Curl_conncache_unlock(data);
 }
 
-static void conncache_remove_bundle(struct conncache *connc,
-                                    struct connectbundle *bundle)
+/* The closure handle only ever has default timeouts set. To improve the
+   state somewhat we clone the timeouts from each added handle so that the
+   closure handle always has the same timeouts as the most recently added
+   easy handle. Multi handles on other threads may add handles to the same
+   shared cache at once. */
+void Curl_conncache_set_closure_timeouts(struct conncache *connc,
+                                         struct Curl_easy *data)
 {
-  struct curl_hash_iterator iter;
-  struct curl_hash_element *he;
+  struct Curl_easy *closure = connc->closure_handle;
+  count_lock(connc);
+  closure->set.timeout = data->set.timeout;
+  closure->set.server_response_timeout = data->set.server_response_timeout;
+  closure->set.no_signal = data->set.no_signal;
+  count_unlock(connc);
+}
 
-  if(!connc)
-    return;
+/* Look up the bundle with all the connections to the same host this
+   connectdata struct is setup to use.
 
-  Curl_hash_start_iterate(&connc->hash, &iter);
+   **NOTE**: When it returns, it holds the lock of the bundle's shard! */
+struct connectbundle *Curl_conncache_find_bundle(struct connectdata *conn,
+                                                 struct conncache *connc,
+                                                 const char **hostp)
+{
+  struct connectbundle *bundle = NULL;
+  char key[CONNCACHE_KEY_SIZE];
+  int shard;
 
-  he = Curl_hash_next_element(&iter);
-  while(he) {
-    if(he->ptr == bundle) {
-      /* The bundle is destroyed by the hash destructor function,
-         free_bundle_hash_entry() */
-      Curl_hash_delete(&connc->hash, he->key, he->key_len);
-      return;
-    }
+  hashkey(conn, key, sizeof(key), hostp);
+  shard = hashkey_shard(key);
+  shard_lock(conn->data, connc, shard);
+  if(connc)
+    bundle = Curl_hash_pick(&connc->shard[shard].hash, key, strlen(key));
 
-    he = Curl_hash_next_element(&iter);
-  }
+  return bundle;
 }
 
 CURLcode Curl_conncache_add_conn(struct conncache *connc,
@@ -272,22 +386,21 @@ CURLcode Curl_conncache_add_conn(struct conncache *connc,
   struct connectbundle *bundle;
   struct connectbundle *new_bundle = NULL;
   struct Curl_easy *data = conn->data;
+  int shard;
+  size_t num;
 
-  /* *find_bundle() locks the connection cache */
-  bundle = Curl_conncache_find_bundle(conn, data->state.conn_cache, NULL);
+  /* *find_bundle() locks the shard of the connection */
+  bundle = Curl_conncache_find_bundle(conn, connc, NULL);
+  shard = data->state.conncache_shard;
   if(!bundle) {
-    int rc;
-    char key[HASHKEY_SIZE];
-
     result = bundle_create(data, &new_bundle);
     if(result) {
       goto unlock;
     }
 
-    hashkey(conn, key, sizeof(key), NULL);
-    rc = conncache_add_bundle(data->state.conn_cache, key, new_bundle);
-
-    if(!rc) {
+    hashkey(conn, new_bundle->key, sizeof(new_bundle->key), NULL);
+    if(!Curl_hash_add(&connc->shard[shard].hash, new_bundle->key,
+                      strlen(new_bundle->key), new_bundle)) {
       bundle_destroy(new_bundle);
       result = CURLE_OUT_OF_MEMORY;
       goto unlock;
@@ -296,19 +409,51 @@ CURLcode Curl_conncache_add_conn(struct conncache *connc,
   }
 
   bundle_add_conn(bundle, conn);
+  conn->conncache_shard = shard;
+  conn->idle_listed = FALSE;
+
+  count_lock(connc);
   conn->connection_id = connc->next_connection_id++;
-  connc->num_conn++;
+  num = ++connc->num_conn;
+  count_unlock(connc);
 
   DEBUGF(infof(conn->data, "Added connection %ld. "
                "The cache now contains %zu members\n",
-               conn->connection_id, connc->num_conn));
+               conn->connection_id, num));
+  (void)num;
 
   unlock:
-  CONN_UNLOCK(data);
+  shard_unlock(data, connc);
 
   return result;
 }
 
+/* Takes a connection out of the cache, its shard must be locked */
+static void conncache_unlink(struct Curl_easy *data, struct conncache *connc,
+                             struct connectdata *conn, bool drop_empty)
+{
+  struct connectbundle *bundle = conn->bundle;
+  size_t num = 0;
+
+  if(connc)
+    idle_unlink(connc, conn);
+  bundle_remove_conn(bundle, conn);
+  if(connc && drop_empty && bundle->num_connections == 0)
+    /* The bundle is destroyed by the hash destructor function,
+       free_bundle_hash_entry() */
+    Curl_hash_delete(&connc->shard[conn->conncache_shard].hash,
+                     bundle->key, strlen(bundle->key));
+  conn->bundle = NULL; /* removed from it */
+  if(connc) {
+    count_lock(connc);
+    num = --connc->num_conn;
+    count_unlock(connc);
+  }
+  DEBUGF(infof(data, "The cache now contains %zu members\n", num));
+  (void)num;
+  (void)data;
+}
+
 /*
  * Removes the connectdata object from the connection cache *and* clears the
  * ->data pointer association. Pass TRUE/FALSE in the 'lock' argument
@@ -317,27 +462,18 @@ CURLcode Curl_conncache_add_conn(struct conncache *connc,
 void Curl_conncache_remove_conn(struct Curl_easy *data,
                                 struct connectdata *conn, bool lock)
 {
-  struct connectbundle *bundle = conn->bundle;
   struct conncache *connc = data->state.conn_cache;
 
   /* The bundle pointer can be NULL, since this function can be called
      due to a failed connection attempt, before being added to a bundle */
-  if(bundle) {
+  if(conn->bundle) {
     if(lock) {
-      CONN_LOCK(data);
-    }
-    bundle_remove_conn(bundle, conn);
-    if(bundle->num_connections == 0)
-      conncache_remove_bundle(connc, bundle);
-    conn->bundle = NULL; /* removed from it */
-    if(connc) {
-      connc->num_conn--;
-      DEBUGF(infof(data, "The cache now contains %zu members\n",
-                   connc->num_conn));
+      shard_lock(data, connc, conn->conncache_shard);
     }
+    conncache_unlink(data, connc, conn, TRUE);
     conn->data = NULL; /* clear the association */
     if(lock) {
-      CONN_UNLOCK(data);
+      shard_unlock(data, connc);
     }
   }
 }
@@ -346,9 +482,9 @@ void Curl_conncache_remove_conn(struct Curl_easy *data,
    func() with the connection pointer as the first argument and the supplied
    'param' argument as the other.
 
-   The conncache lock is still held when the callback is called. It needs it,
+   The shard lock is still held when the callback is called. It needs it,
    so that it can safely continue traversing the lists once the callback
-   returns.
+   returns. The shards are locked one at a time.
 
    Returns 1 if the loop was aborted due to the callback's return code.
 
@@ -362,34 +498,37 @@ bool Curl_conncache_foreach(struct Curl_easy *data,
   struct curl_hash_iterator iter;
   struct curl_llist_element *curr;
   struct curl_hash_element *he;
+  int i;
 
   if(!connc)
     return FALSE;
 
-  CONN_LOCK(data);
-  Curl_hash_start_iterate(&connc->hash, &iter);
-
-  he = Curl_hash_next_element(&iter);
-  while(he) {
-    struct connectbundle *bundle;
+  for(i = 0; i < CONNCACHE_SHARDS; i++) {
+    shard_lock(data, connc, i);
+    Curl_hash_start_iterate(&connc->shard[i].hash, &iter);
 
-    bundle = he->ptr;
     he = Curl_hash_next_element(&iter);
-
-    curr = bundle->conn_list.head;
-    while(curr) {
-      /* Yes, we need to update curr before calling func(), because func()
-         might decide to remove the connection */
-      struct connectdata *conn = curr->ptr;
-      curr = curr->next;
-
-      if(1 == func(conn, param)) {
-        CONN_UNLOCK(data);
-        return TRUE;
+    while(he) {
+      struct connectbundle *bundle;
+
+      bundle = he->ptr;
+      he = Curl_hash_next_element(&iter);
+
+      curr = bundle->conn_list.head;
+      while(curr) {
+        /* Yes, we need to update curr before calling func(), because func()
+           might decide to remove the connection */
+        struct connectdata *conn = curr->ptr;
+        curr = curr->next;
+
+        if(1 == func(conn, param)) {
+          shard_unlock(data, connc);
+          return TRUE;
+        }
       }
     }
+    shard_unlock(data, connc);
   }
-  CONN_UNLOCK(data);
   return FALSE;
 }
 
@@ -405,20 +544,23 @@ conncache_find_first_connection(struct conncache *connc)
   struct curl_hash_iterator iter;
   struct curl_hash_element *he;
   struct connectbundle *bundle;
+  int i;
 
-  Curl_hash_start_iterate(&connc->hash, &iter);
+  for(i = 0; i < CONNCACHE_SHARDS; i++) {
+    Curl_hash_start_iterate(&connc->shard[i].hash, &iter);
 
-  he = Curl_hash_next_element(&iter);
-  while(he) {
-    struct curl_llist_element *curr;
-    bundle = he->ptr;
+    he = Curl_hash_next_element(&iter);
+    while(he) {
+      struct curl_llist_element *curr;
+      bundle = he->ptr;
 
-    curr = bundle->conn_list.head;
-    if(curr) {
-      return curr->ptr;
-    }
+      curr = bundle->conn_list.head;
+      if(curr) {
+        return curr->ptr;
+      }
 
-    he = Curl_hash_next_element(&iter);
+      he = Curl_hash_next_element(&iter);
+    }
   }
 
   return NULL;
@@ -433,6 +575,7 @@ conncache_find_first_connection(struct conncache *connc)
 bool Curl_conncache_return_conn(struct connectdata *conn)
 {
   struct Curl_easy *data = conn->data;
+  struct conncache *connc = data->state.conn_cache;
 
   /* data->multi->maxconnects can be negative, deal with it. */
   size_t maxconnects =
@@ -440,8 +583,22 @@ bool Curl_conncache_return_conn(struct connectdata *conn)
     data->multi->maxconnects;
   struct connectdata *conn_candidate = NULL;
 
-  conn->data = NULL; /* no owner anymore */
-  conn->lastused = Curl_now(); /* it was used up until now */
+  if(conn->bundle) {
+    /* first in its bundle and its shard's idle list */
+    shard_lock(data, connc, conn->conncache_shard);
+    bundle_move_conn(conn->bundle, conn, TRUE);
+    idle_unlink(connc, conn);
+    Curl_llist_insert_next(&connc->shard[conn->conncache_shard].idle, NULL,
+                           conn, &conn->idle_node);
+    conn->idle_listed = TRUE;
+    conn->data = NULL; /* no owner anymore */
+    conn->lastused = Curl_now(); /* it was used up until now */
+    shard_unlock(data, connc);
+  }
+  else {
+    conn->data = NULL; /* no owner anymore */
+    conn->lastused = Curl_now(); /* it was used up until now */
+  }
   if(maxconnects > 0 &&
      Curl_conncache_size(data) > maxconnects) {
     infof(data, "Connection cache is full, closing the oldest one.\n");
@@ -457,6 +614,23 @@ bool Curl_conncache_return_conn(struct connectdata *conn)
 
 }
 
+/*
+ * Marks a connection found with Curl_conncache_find_bundle() as used by
+ * 'data'. It leaves the idle list and moves to the back of its bundle, so
+ * the next lookup for the host finds an idle one first.
+ *
+ * Does not lock the connection cache!
+ */
+void Curl_conncache_claim_conn(struct Curl_easy *data,
+                               struct connectdata *conn)
+{
+  conn->data = data; /* own it! */
+  if(data->state.conn_cache)
+    idle_unlink(data->state.conn_cache, conn);
+  if(conn->bundle)
+    bundle_move_conn(conn->bundle, conn, FALSE);
+}
+
 /*
  * This function finds the connection in the connection bundle that has been
  * unused for the longest time.
@@ -471,102 +645,95 @@ Curl_conncache_extract_bundle(struct Curl_easy *data,
                               struct connectbundle *bundle)
 {
   struct curl_llist_element *curr;
-  timediff_t highscore = -1;
-  timediff_t score;
-  struct curltime now;
   struct connectdata *conn_candidate = NULL;
-  struct connectdata *conn;
-
-  (void)data;
 
-  now = Curl_now();
-
-  curr = bundle->conn_list.head;
+  /* the idle connections are ordered by when they were returned, with the
+     ones in use after them, so the last idle one is the oldest */
+  curr = bundle->conn_list.tail;
   while(curr) {
-    conn = curr->ptr;
+    struct connectdata *conn = curr->ptr;
 
     if(!CONN_INUSE(conn) && !conn->data) {
-      /* Set higher score for the age passed since the connection was used */
-      score = Curl_timediff(now, conn->lastused);
-
-      if(score > highscore) {
-        highscore = score;
-        conn_candidate = conn;
-      }
+      conn_candidate = conn;
+      break;
     }
-    curr = curr->next;
+    curr = curr->prev;
   }
   if(conn_candidate) {
     /* remove it to prevent another thread from nicking it */
-    bundle_remove_conn(bundle, conn_candidate);
-    data->state.conn_cache->num_conn--;
-    DEBUGF(infof(data, "The cache now contains %zu members\n",
-                 data->state.conn_cache->num_conn));
+    conncache_unlink(data, data->state.conn_cache, conn_candidate, FALSE);
     conn_candidate->data = data; /* associate! */
   }
 
   return conn_candidate;
 }
 
+/* Returns the least recently returned idle connection of a shard, dropping
+   entries that have been taken into use again on the way. The shard must be
+   locked. */
+static struct connectdata *shard_oldest(struct conncache *connc, int shard)
+{
+  struct curl_llist *idle = &connc->shard[shard].idle;
+
+  while(idle->tail) {
+    struct connectdata *conn = idle->tail->ptr;
+    if(!CONN_INUSE(conn) && !conn->data)
+      return conn;
+    idle_unlink(connc, conn);
+  }
+  return NULL;
+}
+
 /*
  * This function finds the connection in the connection cache that has been
  * unused for the longest time and extracts that from the bundle.
  *
+ * Each shard keeps its idle connections in the order they were returned,
+ * so only the tail of each needs a look.
+ *
  * Returns the pointer to the connection, or NULL if none was found.
  */
 struct connectdata *
 Curl_conncache_extract_oldest(struct Curl_easy *data)
 {
   struct conncache *connc = data->state.conn_cache;
-  struct curl_hash_iterator iter;
-  struct curl_llist_element *curr;
-  struct curl_hash_element *he;
-  timediff_t highscore =- 1;
+  timediff_t highscore = -1;
   timediff_t score;
   struct curltime now;
   struct connectdata *conn_candidate = NULL;
-  struct connectbundle *bundle;
-  struct connectbundle *bundle_candidate = NULL;
+  int shard_candidate = -1;
+  int i;
 
   now = Curl_now();
 
-  CONN_LOCK(data);
-  Curl_hash_start_iterate(&connc->hash, &iter);
-
-  he = Curl_hash_next_element(&iter);
-  while(he) {
+  for(i = 0; i < CONNCACHE_SHARDS; i++) {
     struct connectdata *conn;
+    shard_lock(data, connc, i);
+    conn = shard_oldest(connc, i);
+    if(conn) {
+      /* Set higher score for the age passed since the connection was used */
+      score = Curl_timediff(now, conn->lastused);
 
-    bundle = he->ptr;
-
-    curr = bundle->conn_list.head;
-    while(curr) {
-      conn = curr->ptr;
-
-      if(!CONN_INUSE(conn) && !conn->data) {
-        /* Set higher score for the age passed since the connection was used */
-        score = Curl_timediff(now, conn->lastused);
-
-        if(score > highscore) {
-          highscore = score;
-          conn_candidate = conn;
-          bundle_candidate = bundle;
-        }
+      if(score > highscore) {
+        highscore = score;
+        shard_candidate = i;
       }
-      curr = curr->next;
     }
-
-    he = Curl_hash_next_element(&iter);
+    shard_unlock(data, connc);
   }
-  if(conn_candidate) {
-    /* remove it to prevent another thread from nicking it */
-    bundle_remove_conn(bundle_candidate, conn_candidate);
-    connc->num_conn--;
-    DEBUGF(infof(data, "The cache now contains %zu members\n",
-                 connc->num_conn));
-    conn_candidate->data = data; /* associate! */
+
+  if(shard_candidate >= 0) {
+    /* another thread may have been there meanwhile, take what is oldest
+       in the shard now */
+    shard_lock(data, connc, shard_candidate);
+    conn_candidate = shard_oldest(connc, shard_candidate);
+    if(conn_candidate) {
+      /* remove it to prevent another thread from nicking it */
+      conncache_unlink(data, connc, conn_candidate, FALSE);
+      conn_candidate->data = data; /* associate! */
+    }
+    shard_unlock(data, connc);
   }
-  CONN_UNLOCK(data);
 
   return conn_candidate;
 }
@@ -607,32 +774,35 @@ void Curl_conncache_print(struct conncache *connc)
   struct curl_hash_iterator iter;
   struct curl_llist_element *curr;
   struct curl_hash_element *he;
+  int i;
 
   if(!connc)
     return;
 
   fprintf(stderr, "=Bundle cache=\n");
 
-  Curl_hash_start_iterate(connc->hash, &iter);
+  for(i = 0; i < CONNCACHE_SHARDS; i++) {
+    Curl_hash_start_iterate(&connc->shard[i].hash, &iter);
 
-  he = Curl_hash_next_element(&iter);
-  while(he) {
-    struct connectbundle *bundle;
-    struct connectdata *conn;
+    he = Curl_hash_next_element(&iter);
+    while(he) {
+      struct connectbundle *bundle;
+      struct connectdata *conn;
 
-    bundle = he->ptr;
+      bundle = he->ptr;
 
-    fprintf(stderr, "%s -", he->key);
-    curr = bundle->conn_list->head;
-    while(curr) {
-      conn = curr->ptr;
+      fprintf(stderr, "%d %s -", i, he->key);
+      curr = bundle->conn_list.head;
+      while(curr) {
+        conn = curr->ptr;
 
-      fprintf(stderr, " [%p %d]", (void *)conn, conn->inuse);
-      curr = curr->next;
-    }
-    fprintf(stderr, "\n");
+        fprintf(stderr, " [%p %d]", (void *)conn, conn->inuse);
+        curr = curr->next;
+      }
+      fprintf(stderr, "\n");
 
-    he = Curl_hash_next_element(&iter);
+      he = Curl_hash_next_element(&iter);
+    }
   }
 }
 #endif
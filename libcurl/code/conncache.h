@@ -23,16 +23,52 @@
  *
  ***************************************************************************/
 
+#if defined(USE_THREADS_POSIX)
+#  ifdef HAVE_PTHREAD_H
+#    include <pthread.h>
+#  endif
+#endif
+
+#include "curl_threads.h"
+
 /*
  * All accesses to struct fields and changing of data in the connection cache
  * and connectbundles must be done with the conncache LOCKED. The cache might
  * be shared.
+ *
+ * The bundles are spread over CONNCACHE_SHARDS shards by host key, each with
+ * its own hash, lock and list of idle connections, so that threads sharing
+ * the cache only contend when they use hosts in the same shard. A bundle and
+ * its connections are protected by the lock of their shard; num_conn and
+ * next_connection_id by the count lock, which is always taken last.
  */
 
-struct conncache {
+#if defined(USE_THREADS_POSIX) || defined(USE_THREADS_WIN32)
+#define CONNCACHE_MUTEX
+#endif
+
+#define CONNCACHE_SHARDS 16
+
+struct conncache_shard {
   struct curl_hash hash;
+  /* idle connections, the most recently returned one first */
+  struct curl_llist idle;
+#ifdef CONNCACHE_MUTEX
+  curl_mutex_t lock;
+#endif
+};
+
+struct conncache {
+  struct conncache_shard shard[CONNCACHE_SHARDS];
   size_t num_conn;
   long next_connection_id;
+#ifdef CONNCACHE_MUTEX
+  curl_mutex_t count_lock;
+  /* TRUE when the cache belongs to a share handle and may be used from
+     several threads at once */
+  bool threaded;
+  bool mutexes; /* the locks are initialized */
+#endif
   struct curltime last_cleanup;
   /* handle used for closing cached connections */
   struct Curl_easy *closure_handle;
@@ -42,14 +78,19 @@ struct conncache {
 #define BUNDLE_UNKNOWN     0  /* initial value */
 #define BUNDLE_MULTIPLEX   2
 
+#define CONNCACHE_KEY_SIZE 128
+
 struct connectbundle {
   int multiuse;                 /* supports multi-use */
   size_t num_connections;       /* Number of connections in the bundle */
-  struct curl_llist conn_list;  /* The connectdata members of the bundle */
+  struct curl_llist conn_list;  /* The connectdata members of the bundle,
+                                   idle ones most recently returned first */
+  char key[CONNCACHE_KEY_SIZE]; /* hash key, to remove it without a scan */
 };
 
-/* returns 1 on error, 0 is fine */
-int Curl_conncache_init(struct conncache *, int size);
+/* returns 1 on error, 0 is fine. 'shared' makes the cache lock its shards
+   with built-in mutexes, when libcurl is built with thread support */
+int Curl_conncache_init(struct conncache *, int size, bool shared);
 void Curl_conncache_destroy(struct conncache *connc);
 
 /* return the correct bundle, to a host or a proxy */
@@ -60,8 +101,18 @@ void Curl_conncache_unlock(struct Curl_easy *data);
 /* returns number of connections currently held in the connection cache */
 size_t Curl_conncache_size(struct Curl_easy *data);
 size_t Curl_conncache_bundle_size(struct connectdata *conn);
+/* locks the shard of a cached connection, returns FALSE if not cached */
+bool Curl_conncache_lock_conn(struct Curl_easy *data,
+                              struct connectdata *conn);
+void Curl_conncache_set_multiuse(struct connectdata *conn, int multiuse);
+void Curl_conncache_set_closure_timeouts(struct conncache *connc,
+                                         struct Curl_easy *data);
 
 bool Curl_conncache_return_conn(struct connectdata *conn);
+/* hands an idle or multiplexed connection found in a bundle to 'data', to
+   be called with the bundle lock held (from Curl_conncache_find_bundle) */
+void Curl_conncache_claim_conn(struct Curl_easy *data,
+                               struct connectdata *conn);
 CURLcode Curl_conncache_add_conn(struct conncache *connc,
                                  struct connectdata *conn) WARN_UNUSED_RESULT;
 void Curl_conncache_remove_conn(struct Curl_easy *data,
@@ -293,6 +293,15 @@ static size_t cookiehash(const char * const domain)
   return cookie_hash_domain(top, len);
 }
 
+/*
+ * The jar bucket of the cookies for a host. A cookie set by the host always
+ * lands in it, as its domain has the same top-level domain.
+ */
+size_t Curl_cookie_bucket(const char *host)
+{
+  return cookiehash(host);
+}
+
 /*
  * cookie path sanitize
  */
@@ -373,35 +382,47 @@ static void strstore(char **str, const char *newstr)
 }
 
 /*
- * remove_expired() removes expired cookies.
+ * remove_expired_bucket() removes the expired cookies of one hash bucket and
+ * returns how many there were, leaving the count to the caller.
  */
-static void remove_expired(struct CookieInfo *cookies)
+static long remove_expired_bucket(struct CookieInfo *cookies, size_t i,
+                                  curl_off_t now)
 {
   struct Cookie *co, *nx;
-  curl_off_t now = (curl_off_t)time(NULL);
-  unsigned int i;
+  struct Cookie *pv = NULL;
+  long removed = 0;
 
-  for(i = 0; i < COOKIE_HASH_SIZE; i++) {
-    struct Cookie *pv = NULL;
-    co = cookies->cookies[i];
-    while(co) {
-      nx = co->next;
-      if(co->expires && co->expires < now) {
-        if(!pv) {
-          cookies->cookies[i] = co->next;
-        }
-        else {
-          pv->next = co->next;
-        }
-        cookies->numcookies--;
-        freecookie(co);
+  co = cookies->cookies[i];
+  while(co) {
+    nx = co->next;
+    if(co->expires && co->expires < now) {
+      if(!pv) {
+        cookies->cookies[i] = co->next;
       }
       else {
-        pv = co;
+        pv->next = co->next;
       }
-      co = nx;
+      removed++;
+      freecookie(co);
+    }
+    else {
+      pv = co;
     }
+    co = nx;
   }
+  return removed;
+}
+
+/*
+ * remove_expired() removes expired cookies.
+ */
+static void remove_expired(struct CookieInfo *cookies)
+{
+  curl_off_t now = (curl_off_t)time(NULL);
+  size_t i;
+
+  for(i = 0; i < COOKIE_HASH_SIZE; i++)
+    cookies->numcookies -= remove_expired_bucket(cookies, i, now);
 }
 
 /* Make sure domain contains a dot or is localhost. */
@@ -929,15 +950,33 @@ Curl_cookie_add(struct Curl_easy *data,
   }
 
   co->livecookie = c->running;
+  Curl_share_lock_counts(data);
   co->creationtime = ++c->lastct;
+  Curl_share_unlock_counts(data);
 
   /* now, we have parsed the incoming line, we must now check if this
      supersedes an already existing cookie, which it may if the previous have
      the same domain and path as this */
 
-  /* at first, remove expired cookies */
-  if(!noexpire)
-    remove_expired(c);
+  myhash = cookiehash(co->domain);
+  if(httpheader && domain && (myhash != cookiehash(domain))) {
+    /* only the bucket of the host is locked for a header cookie, and the
+       host would never be sent one from another bucket */
+    infof(data, "cookie '%s' dropped, domain '%s' is stored apart from "
+          "host '%s'\n", co->name, co->domain, domain);
+    freecookie(co);
+    return NULL;
+  }
+
+  /* at first, remove expired cookies of the bucket */
+  if(!noexpire) {
+    long removed = remove_expired_bucket(c, myhash, (curl_off_t)now);
+    if(removed) {
+      Curl_share_lock_counts(data);
+      c->numcookies -= removed;
+      Curl_share_unlock_counts(data);
+    }
+  }
 
 #ifdef USE_LIBPSL
   /* Check if the domain is a Public Suffix and if yes, ignore the cookie. */
@@ -961,7 +1000,6 @@ Curl_cookie_add(struct Curl_easy *data,
   }
 #endif
 
-  myhash = cookiehash(co->domain);
   clist = c->cookies[myhash];
   replace_old = FALSE;
   while(clist) {
@@ -1074,7 +1112,9 @@ Curl_cookie_add(struct Curl_easy *data,
       lastc->next = co;
     else
       c->cookies[myhash] = co;
+    Curl_share_lock_counts(data);
     c->numcookies++; /* one more cookie in the jar */
+    Curl_share_unlock_counts(data);
   }
 
   return co;
@@ -1258,7 +1298,8 @@ static struct Cookie *dup_cookie(struct Cookie *src)
  * client should send to the server if used now. The secure boolean informs
  * the cookie if a secure connection is achieved or not.
  *
- * It shall only return cookies that haven't expired.
+ * It shall only return cookies that haven't expired. The jar is only read,
+ * expired cookies are skipped and left for Curl_cookie_add() to remove.
  *
  ****************************************************************************/
 
@@ -1272,13 +1313,11 @@ struct Cookie *Curl_cookie_getlist(struct CookieInfo *c,
   size_t matches = 0;
   bool is_ip;
   const size_t myhash = cookiehash(host);
+  curl_off_t now = (curl_off_t)time(NULL);
 
   if(!c || !c->cookies[myhash])
     return NULL; /* no cookie struct or no cookies in the struct */
 
-  /* at first, remove expired cookies */
-  remove_expired(c);
-
   /* check if host is an IP(v4|v6) address */
   is_ip = isip(host);
 
@@ -1286,7 +1325,7 @@ struct Cookie *Curl_cookie_getlist(struct CookieInfo *c,
 
   while(co) {
     /* if the cookie requires we're secure we must only continue if we are! */
-    if(co->secure?secure:TRUE) {
+    if((co->secure?secure:TRUE) && !(co->expires && co->expires < now)) {
 
       /* now check if the domain is correct */
       if(!co->domain ||
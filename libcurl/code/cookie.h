@@ -99,6 +99,7 @@ struct Cookie *Curl_cookie_add(struct Curl_easy *data,
 struct Cookie *Curl_cookie_getlist(struct CookieInfo *, const char *,
                                    const char *, bool);
 void Curl_cookie_freelist(struct Cookie *cookies);
+size_t Curl_cookie_bucket(const char *host);
 void Curl_cookie_clearall(struct CookieInfo *cookies);
 void Curl_cookie_clearsess(struct CookieInfo *cookies);
 
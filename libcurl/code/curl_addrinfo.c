@@ -97,6 +97,61 @@ Curl_freeaddrinfo(Curl_addrinfo *cahead)
 }
 
 
+/*
+ * Curl_addrinfo_copy()
+ *
+ * This makes a deep copy of a Curl_addrinfo list, for when more than one
+ * owner needs the same result.
+ *
+ * Returns NULL on failure or for an empty list.
+ */
+
+Curl_addrinfo *
+Curl_addrinfo_copy(const Curl_addrinfo *orig)
+{
+  Curl_addrinfo *cafirst = NULL;
+  Curl_addrinfo *calast = NULL;
+  const Curl_addrinfo *ca;
+
+  for(ca = orig; ca != NULL; ca = ca->ai_next) {
+    Curl_addrinfo *cacopy = malloc(sizeof(Curl_addrinfo));
+    if(!cacopy)
+      break;
+    *cacopy = *ca;
+    cacopy->ai_next = NULL;
+    cacopy->ai_canonname = NULL;
+    cacopy->ai_addr = NULL;
+
+    /* link it in first, so that a failure below frees it with the rest */
+    if(!cafirst)
+      cafirst = cacopy;
+    if(calast)
+      calast->ai_next = cacopy;
+    calast = cacopy;
+
+    if(ca->ai_addr) {
+      cacopy->ai_addr = malloc(ca->ai_addrlen);
+      if(!cacopy->ai_addr)
+        break;
+      memcpy(cacopy->ai_addr, ca->ai_addr, ca->ai_addrlen);
+    }
+    if(ca->ai_canonname) {
+      cacopy->ai_canonname = strdup(ca->ai_canonname);
+      if(!cacopy->ai_canonname)
+        break;
+    }
+  }
+
+  if(ca) {
+    /* ran out of memory */
+    Curl_freeaddrinfo(cafirst);
+    return NULL;
+  }
+
+  return cafirst;
+}
+
+
 #ifdef HAVE_GETADDRINFO
 /*
  * Curl_getaddrinfo_ex()
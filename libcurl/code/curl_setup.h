@@ -231,6 +231,13 @@
 #define USE_RESOLVE_ON_IPS 1
 #endif
 
+/*
+ * curl_multi_wait() keeps the transfer sockets in an epoll set on Linux.
+ */
+#if defined(__linux__) && !defined(CURL_DISABLE_EPOLL)
+#define USE_EPOLL 1
+#endif
+
 /*
  * Include header files for windows builds before redefining anything.
  * Use this preprocessor block only to include or exclude windows.h,
@@ -98,6 +98,29 @@ int Curl_thread_join(curl_thread_t *hnd)
   return ret;
 }
 
+void Curl_rwlock_init(curl_rwlock_t *lock)
+{
+  pthread_rwlock_init(lock, NULL);
+}
+
+void Curl_rwlock_acquire(curl_rwlock_t *lock, bool shared)
+{
+  if(shared)
+    pthread_rwlock_rdlock(lock);
+  else
+    pthread_rwlock_wrlock(lock);
+}
+
+void Curl_rwlock_release(curl_rwlock_t *lock)
+{
+  pthread_rwlock_unlock(lock);
+}
+
+void Curl_rwlock_destroy(curl_rwlock_t *lock)
+{
+  pthread_rwlock_destroy(lock);
+}
+
 #elif defined(USE_THREADS_WIN32)
 
 /* !checksrc! disable SPACEBEFOREPAREN 1 */
@@ -152,4 +175,103 @@ int Curl_thread_join(curl_thread_t *hnd)
   return ret;
 }
 
+#ifdef CURL_WIN_SRWLOCK
+
+void Curl_rwlock_init(curl_rwlock_t *lock)
+{
+  InitializeSRWLock(&lock->srw);
+  lock->exclusive = FALSE;
+}
+
+void Curl_rwlock_acquire(curl_rwlock_t *lock, bool shared)
+{
+  if(shared)
+    AcquireSRWLockShared(&lock->srw);
+  else {
+    AcquireSRWLockExclusive(&lock->srw);
+    lock->exclusive = TRUE;
+  }
+}
+
+void Curl_rwlock_release(curl_rwlock_t *lock)
+{
+  /* only the exclusive owner ever sets the note, and no reader can hold
+     the lock at the same time */
+  if(lock->exclusive) {
+    lock->exclusive = FALSE;
+    ReleaseSRWLockExclusive(&lock->srw);
+  }
+  else
+    ReleaseSRWLockShared(&lock->srw);
+}
+
+void Curl_rwlock_destroy(curl_rwlock_t *lock)
+{
+  (void)lock; /* SRW locks need no cleanup */
+}
+
+#else
+
+void Curl_rwlock_init(curl_rwlock_t *lock)
+{
+  Curl_mutex_init(lock);
+}
+
+void Curl_rwlock_acquire(curl_rwlock_t *lock, bool shared)
+{
+  (void)shared;
+  Curl_mutex_acquire(lock);
+}
+
+void Curl_rwlock_release(curl_rwlock_t *lock)
+{
+  Curl_mutex_release(lock);
+}
+
+void Curl_rwlock_destroy(curl_rwlock_t *lock)
+{
+  Curl_mutex_destroy(lock);
+}
+
+#endif /* CURL_WIN_SRWLOCK */
+
+#ifdef CURL_WIN_COND
+
+void Curl_cond_init(curl_cond_t *cond)
+{
+  cond->sem = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+  cond->waiters = 0;
+}
+
+void Curl_cond_wait(curl_cond_t *cond, curl_mutex_t *mutex)
+{
+  cond->waiters++;
+  Curl_mutex_release(mutex);
+  WaitForSingleObject(cond->sem, INFINITE);
+  Curl_mutex_acquire(mutex);
+}
+
+void Curl_cond_signal(curl_cond_t *cond)
+{
+  if(cond->waiters) {
+    cond->waiters--;
+    ReleaseSemaphore(cond->sem, 1, NULL);
+  }
+}
+
+void Curl_cond_broadcast(curl_cond_t *cond)
+{
+  if(cond->waiters) {
+    ReleaseSemaphore(cond->sem, cond->waiters, NULL);
+    cond->waiters = 0;
+  }
+}
+
+void Curl_cond_destroy(curl_cond_t *cond)
+{
+  CloseHandle(cond->sem);
+}
+
+#endif /* CURL_WIN_COND */
+
 #endif /* USE_THREADS_* */
@@ -32,6 +32,13 @@
 #  define Curl_mutex_acquire(m)  pthread_mutex_lock(m)
 #  define Curl_mutex_release(m)  pthread_mutex_unlock(m)
 #  define Curl_mutex_destroy(m)  pthread_mutex_destroy(m)
+#  define curl_rwlock_t          pthread_rwlock_t
+#  define curl_cond_t            pthread_cond_t
+#  define Curl_cond_init(c)      pthread_cond_init(c, NULL)
+#  define Curl_cond_wait(c,m)    pthread_cond_wait(c, m)
+#  define Curl_cond_signal(c)    pthread_cond_signal(c)
+#  define Curl_cond_broadcast(c) pthread_cond_broadcast(c)
+#  define Curl_cond_destroy(c)   pthread_cond_destroy(c)
 #elif defined(USE_THREADS_WIN32)
 #  define CURL_STDCALL           __stdcall
 #  define curl_mutex_t           CRITICAL_SECTION
@@ -43,10 +50,48 @@
 #    define Curl_mutex_init(m)   InitializeCriticalSection(m)
 #  else
 #    define Curl_mutex_init(m)   InitializeCriticalSectionEx(m, 0, 1)
+#    define CURL_WIN_SRWLOCK
 #  endif
 #  define Curl_mutex_acquire(m)  EnterCriticalSection(m)
 #  define Curl_mutex_release(m)  LeaveCriticalSection(m)
 #  define Curl_mutex_destroy(m)  DeleteCriticalSection(m)
+#  ifdef CURL_WIN_SRWLOCK
+/* SRW locks are released per mode, the exclusive owner leaves a note */
+struct curl_win_rwlock {
+  SRWLOCK srw;
+  bool exclusive;
+};
+#    define curl_rwlock_t        struct curl_win_rwlock
+#    define curl_cond_t          CONDITION_VARIABLE
+#    define Curl_cond_init(c)    InitializeConditionVariable(c)
+#    define Curl_cond_wait(c,m)  SleepConditionVariableCS(c, m, INFINITE)
+#    define Curl_cond_signal(c)  WakeConditionVariable(c)
+#    define Curl_cond_broadcast(c) WakeAllConditionVariable(c)
+#    define Curl_cond_destroy(c) Curl_nop_stmt
+#  else
+/* before Vista a reader/writer lock is a plain critical section */
+#    define curl_rwlock_t        CRITICAL_SECTION
+/* and a condition variable is a semaphore counting the sleepers, who are
+   only woken with the mutex held */
+struct curl_win_cond {
+  HANDLE sem;
+  int waiters;
+};
+#    define curl_cond_t          struct curl_win_cond
+#    define CURL_WIN_COND
+#  endif
+#endif
+
+/* Reference counts shared between threads, for the compilers that have
+   atomic builtins */
+#if defined(USE_THREADS_POSIX) && defined(__GNUC__)
+#  define CURL_ATOMIC_REFS
+#  define Curl_atomic_inc(p)     __sync_add_and_fetch(p, 1)
+#  define Curl_atomic_dec(p)     __sync_sub_and_fetch(p, 1)
+#elif defined(USE_THREADS_WIN32)
+#  define CURL_ATOMIC_REFS
+#  define Curl_atomic_inc(p)     InterlockedIncrement((volatile LONG *)(p))
+#  define Curl_atomic_dec(p)     InterlockedDecrement((volatile LONG *)(p))
 #endif
 
 #if defined(USE_THREADS_POSIX) || defined(USE_THREADS_WIN32)
@@ -59,6 +104,21 @@ void Curl_thread_destroy(curl_thread_t hnd);
 
 int Curl_thread_join(curl_thread_t *hnd);
 
+void Curl_rwlock_init(curl_rwlock_t *lock);
+/* 'shared' for readers, FALSE for the one writer */
+void Curl_rwlock_acquire(curl_rwlock_t *lock, bool shared);
+void Curl_rwlock_release(curl_rwlock_t *lock);
+void Curl_rwlock_destroy(curl_rwlock_t *lock);
+
+#ifdef CURL_WIN_COND
+void Curl_cond_init(curl_cond_t *cond);
+/* spurious wakeups happen, wait in a loop */
+void Curl_cond_wait(curl_cond_t *cond, curl_mutex_t *mutex);
+void Curl_cond_signal(curl_cond_t *cond);
+void Curl_cond_broadcast(curl_cond_t *cond);
+void Curl_cond_destroy(curl_cond_t *cond);
+#endif
+
 #endif /* USE_THREADS_POSIX || USE_THREADS_WIN32 */
 
 #endif /* HEADER_CURL_THREADS_H */
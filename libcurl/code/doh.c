@@ -927,6 +927,7 @@ CURLcode Curl_doh_is_resolved(struct connectdata *conn,
     if(!rc || !rc2) {
       struct Curl_dns_entry *dns;
       struct Curl_addrinfo *ai;
+      size_t bucket;
 
       infof(data, "DOH Host name: %s\n", data->req.doh.host);
       showdoh(data, &de);
@@ -937,14 +938,19 @@ CURLcode Curl_doh_is_resolved(struct connectdata *conn,
         return CURLE_OUT_OF_MEMORY;
       }
 
+      bucket = Curl_hostcache_bucket(data, data->req.doh.host,
+                                     data->req.doh.port);
       if(data->share)
-        Curl_share_lock(data, CURL_LOCK_DATA_DNS, CURL_LOCK_ACCESS_SINGLE);
+        Curl_share_lock_bucket(data, CURL_LOCK_DATA_DNS,
+                               CURL_LOCK_ACCESS_SINGLE, bucket);
 
-      /* we got a response, store it in the cache */
-      dns = Curl_cache_addr(data, ai, data->req.doh.host, data->req.doh.port);
+      /* we got a response, store it in the cache for as long as the
+         records live */
+      dns = Curl_cache_addr(data, ai, data->req.doh.host, data->req.doh.port,
+                            (long)de.ttl);
 
       if(data->share)
-        Curl_share_unlock(data, CURL_LOCK_DATA_DNS);
+        Curl_share_unlock_bucket(data, CURL_LOCK_DATA_DNS, bucket);
 
       de_cleanup(&de);
       if(!dns)
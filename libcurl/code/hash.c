@@ -67,7 +67,6 @@ Curl_hash_init(struct curl_hash *h,
   h->hash_func = hfunc;
   h->comp_func = comparator;
   h->dtor = dtor;
-  h->size = 0;
   h->slots = slots;
 
   h->table = malloc(slots * sizeof(struct curl_llist));
@@ -116,7 +115,6 @@ Curl_hash_add(struct curl_hash *h, void *key, size_t key_len, void *p)
     he = (struct curl_hash_element *) le->ptr;
     if(h->comp_func(he->key, he->key_len, key, key_len)) {
       Curl_llist_remove(l, le, (void *)h);
-      --h->size;
       break;
     }
   }
@@ -124,7 +122,6 @@ Curl_hash_add(struct curl_hash *h, void *key, size_t key_len, void *p)
   he = mk_hash_element(key, key_len, p);
   if(he) {
     Curl_llist_insert_next(l, l->tail, he, &he->list);
-    ++h->size;
     return p; /* return the new entry */
   }
 
@@ -145,7 +142,6 @@ int Curl_hash_delete(struct curl_hash *h, void *key, size_t key_len)
     struct curl_hash_element *he = le->ptr;
     if(h->comp_func(he->key, he->key_len, key, key_len)) {
       Curl_llist_remove(l, le, (void *) h);
-      --h->size;
       return 0;
     }
   }
@@ -211,7 +207,6 @@ Curl_hash_destroy(struct curl_hash *h)
   }
 
   Curl_safefree(h->table);
-  h->size = 0;
   h->slots = 0;
 }
 
@@ -247,13 +242,30 @@ Curl_hash_clean_with_criterium(struct curl_hash *h, void *user,
       /* ask the callback function if we shall remove this entry or not */
       if(comp == NULL || comp(user, he->ptr)) {
         Curl_llist_remove(list, le, (void *) h);
-        --h->size; /* one less entry in the hash now */
       }
       le = lnext;
     }
   }
 }
 
+/* The number of entries, summed over the slots so that a hash locked per
+   slot stripe needs no shared counter. */
+size_t Curl_hash_count(struct curl_hash *h)
+{
+  size_t count = 0;
+  int i;
+
+  for(i = 0; i < h->slots; ++i)
+    count += h->table[i].size;
+  return count;
+}
+
+/* The slot a key lives in */
+int Curl_hash_slot(struct curl_hash *h, void *key, size_t key_len)
+{
+  return (int)h->hash_func(key, key_len, h->slots);
+}
+
 size_t Curl_hash_str(void *key, size_t key_length, size_t slots_num)
 {
   const char *key_str = (const char *) key;
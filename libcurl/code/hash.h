@@ -53,7 +53,6 @@ struct curl_hash {
   comp_function comp_func;
   curl_hash_dtor   dtor;
   int slots;
-  size_t size;
 };
 
 struct curl_hash_element {
@@ -80,7 +79,8 @@ int Curl_hash_delete(struct curl_hash *h, void *key, size_t key_len);
 void *Curl_hash_pick(struct curl_hash *, void *key, size_t key_len);
 void Curl_hash_apply(struct curl_hash *h, void *user,
                      void (*cb)(void *user, void *ptr));
-#define Curl_hash_count(h) ((h)->size)
+size_t Curl_hash_count(struct curl_hash *h);
+int Curl_hash_slot(struct curl_hash *h, void *key, size_t key_len);
 void Curl_hash_destroy(struct curl_hash *h);
 void Curl_hash_clean(struct curl_hash *h);
 void Curl_hash_clean_with_criterium(struct curl_hash *h, void *user,
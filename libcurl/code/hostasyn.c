@@ -78,15 +78,18 @@ CURLcode Curl_addrinfo_callback(struct connectdata *conn,
   if(CURL_ASYNC_SUCCESS == status) {
     if(ai) {
       struct Curl_easy *data = conn->data;
+      size_t bucket = Curl_hostcache_bucket(data, conn->async.hostname,
+                                            conn->async.port);
 
       if(data->share)
-        Curl_share_lock(data, CURL_LOCK_DATA_DNS, CURL_LOCK_ACCESS_SINGLE);
+        Curl_share_lock_bucket(data, CURL_LOCK_DATA_DNS,
+                               CURL_LOCK_ACCESS_SINGLE, bucket);
 
       dns = Curl_cache_addr(data, ai,
                             conn->async.hostname,
-                            conn->async.port);
+                            conn->async.port, -1);
       if(data->share)
-        Curl_share_unlock(data, CURL_LOCK_DATA_DNS);
+        Curl_share_unlock_bucket(data, CURL_LOCK_DATA_DNS, bucket);
 
       if(!dns) {
         /* failed to store, cleanup and return error */
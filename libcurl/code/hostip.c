@@ -56,6 +56,7 @@
 #include "hash.h"
 #include "rand.h"
 #include "share.h"
+#include "curl_threads.h"
 #include "strerror.h"
 #include "url.h"
 #include "inet_ntop.h"
@@ -75,6 +76,45 @@
 
 #define MAX_HOSTCACHE_LEN (255 + 7) /* max FQDN + colon + port number + zero */
 
+/* With atomic reference counts lookups only read the cache, and a shared
+   cache can take the bucket lock in shared mode for them */
+#ifdef CURL_ATOMIC_REFS
+#define DNS_REF(dns)      Curl_atomic_inc(&(dns)->inuse)
+#define DNS_UNREF(dns)    Curl_atomic_dec(&(dns)->inuse)
+#define DNS_LOOKUP_ACCESS CURL_LOCK_ACCESS_SHARED
+#else
+#define DNS_REF(dns)      (++(dns)->inuse)
+#define DNS_UNREF(dns)    (--(dns)->inuse)
+#define DNS_LOOKUP_ACCESS CURL_LOCK_ACCESS_SINGLE
+#endif
+
+#ifdef CURL_ATOMIC_REFS
+#define DNS_HIT(dns)      Curl_atomic_inc(&(dns)->hits)
+#else
+#define DNS_HIT(dns)      (++(dns)->hits)
+#endif
+
+#if defined(USE_THREADS_POSIX) || defined(USE_THREADS_WIN32)
+#define TIMER_LOCK(c)     Curl_mutex_acquire(&(c)->timerlock)
+#define TIMER_UNLOCK(c)   Curl_mutex_release(&(c)->timerlock)
+#else
+#define TIMER_LOCK(c)     Curl_nop_stmt
+#define TIMER_UNLOCK(c)   Curl_nop_stmt
+#endif
+
+/* seconds a name found not to exist is remembered, unless the cache timeout
+   is shorter. Temporary failures are not remembered, the caller may retry
+   them right away. */
+#define DNS_NEGATIVE_TIMEOUT 5
+
+/* An entry that has served this many lookups is resolved again in the
+   background once only 1/DNS_REFRESH_FRACTION of its lifetime is left, and
+   served for up to DNS_REFRESH_GRACE milliseconds past its expiry while the
+   refresh is still under way. */
+#define DNS_REFRESH_HITS 2
+#define DNS_REFRESH_FRACTION 5
+#define DNS_REFRESH_GRACE 10000
+
 /*
  * hostip.c explained
  * ==================
@@ -91,8 +131,8 @@
  * asynchronous name resolves. This can be Windows or *nix.
  *
  * CURLRES_THREADED - is defined if libcurl is built to run under (native)
- * Windows, and then the name resolve will be done in a new thread, and the
- * supported API will be the same as for ares-builds.
+ * Windows, and then the name resolve will be done by a pool of resolver
+ * threads, and the supported API will be the same as for ares-builds.
  *
  * If any of the two previous are defined, CURLRES_ASYNCH is defined too. If
  * libcurl is not built to use an asynchronous resolver, CURLRES_SYNCH is
@@ -115,6 +155,7 @@
  */
 
 static void freednsentry(void *freethis);
+static void hostcache_dtor(void *freethis);
 
 /*
  * Return # of addresses in a Curl_addrinfo struct
@@ -181,70 +222,146 @@ create_hostcache_id(const char *name, int port, char *ptr, size_t buflen)
   msnprintf(ptr, 7, ":%u", port);
 }
 
-struct hostcache_prune_data {
-  long cache_timeout;
-  time_t now;
-};
+/* 'when' plus 'ms' milliseconds */
+static struct curltime time_after(struct curltime when, timediff_t ms)
+{
+  when.tv_sec += (time_t)(ms / 1000);
+  when.tv_usec += (unsigned int)(ms % 1000) * 1000;
+  if(when.tv_usec >= 1000000) {
+    when.tv_sec++;
+    when.tv_usec -= 1000000;
+  }
+  return when;
+}
 
 /*
- * This function is set as a callback to be called for every entry in the DNS
- * cache when we want to prune old unused entries.
- *
- * Returning non-zero means remove the entry, return 0 to keep it in the
- * cache.
+ * The timer tree of a cache holds the entries that expire, keyed by when they
+ * do. The callers hold the bucket lock of the entry, the tree lock is taken
+ * here.
  */
-static int
-hostcache_timestamp_remove(void *datap, void *hc)
+static void timer_add(struct Curl_dns_entry *dns, struct curltime when)
 {
-  struct hostcache_prune_data *data =
-    (struct hostcache_prune_data *) datap;
-  struct Curl_dns_entry *c = (struct Curl_dns_entry *) hc;
+  struct Curl_dnscache *cache = dns->cache;
 
-  return (0 != c->timestamp)
-    && (data->now - c->timestamp >= data->cache_timeout);
+  TIMER_LOCK(cache);
+  dns->timenode.payload = dns;
+  cache->timers = Curl_splayinsert(when, cache->timers, &dns->timenode);
+  dns->timed = TRUE;
+  TIMER_UNLOCK(cache);
 }
 
-/*
- * Prune the DNS cache. This assumes that a lock has already been taken.
- */
-static void
-hostcache_prune(struct curl_hash *hostcache, long cache_timeout, time_t now)
+static void timer_remove(struct Curl_dns_entry *dns)
+{
+  struct Curl_dnscache *cache = dns->cache;
+
+  TIMER_LOCK(cache);
+  if(dns->timed) {
+    Curl_splayremovebyaddr(cache->timers, &dns->timenode, &cache->timers);
+    dns->timed = FALSE;
+  }
+  TIMER_UNLOCK(cache);
+}
+
+/* Takes out an entry that expired by 'now', with a reference to keep it
+   alive until its bucket is locked, or returns NULL */
+static struct Curl_dns_entry *timer_pop(struct Curl_dnscache *cache,
+                                        struct curltime now)
 {
-  struct hostcache_prune_data user;
+  struct Curl_tree *node = NULL;
+  struct Curl_dns_entry *dns = NULL;
 
-  user.cache_timeout = cache_timeout;
-  user.now = now;
+  TIMER_LOCK(cache);
+  cache->timers = Curl_splaygetbest(now, cache->timers, &node);
+  if(node) {
+    dns = (struct Curl_dns_entry *)node->payload;
+    dns->timed = FALSE;
+    DNS_REF(dns);
+  }
+  TIMER_UNLOCK(cache);
+  return dns;
+}
 
-  Curl_hash_clean_with_criterium(hostcache,
-                                 (void *) &user,
-                                 hostcache_timestamp_remove);
+static bool entry_expired(struct Curl_dns_entry *dns, struct curltime now)
+{
+  if(dns->lifetime < 0)
+    return FALSE;
+  if(Curl_timediff(now, dns->expire) < 0)
+    return FALSE;
+  /* an entry waiting on its refresh is served a little longer */
+  return !dns->refresh ||
+    (Curl_timediff(now, dns->expire) >= DNS_REFRESH_GRACE);
+}
+
+static bool refresh_due(struct Curl_dns_entry *dns, long hits,
+                        struct curltime now)
+{
+  if(!dns->addr || (dns->lifetime <= 0) || dns->refresh || dns->refreshed ||
+     (hits < DNS_REFRESH_HITS))
+    return FALSE;
+  return Curl_timediff(dns->expire, now) <=
+    dns->lifetime / DNS_REFRESH_FRACTION;
+}
+
+/* the hash bucket, and so the share lock stripe, of a cache id */
+static size_t hostcache_bucket(struct Curl_easy *data,
+                               const char *entry_id, size_t entry_len)
+{
+  return (size_t)Curl_hash_slot(&data->dns.hostcache->hash,
+                                (void *)entry_id, entry_len + 1);
+}
+
+size_t Curl_hostcache_bucket(struct Curl_easy *data,
+                             const char *hostname, int port)
+{
+  char entry_id[MAX_HOSTCACHE_LEN];
+
+  create_hostcache_id(hostname, port, entry_id, sizeof(entry_id));
+  return hostcache_bucket(data, entry_id, strlen(entry_id));
 }
 
 /*
- * Library-wide function for pruning the DNS cache. This function takes and
- * returns the appropriate locks.
+ * Library-wide function for pruning the DNS cache. Only the expired entries
+ * are visited, in expiry order. This function takes and returns the
+ * appropriate locks.
  */
 void Curl_hostcache_prune(struct Curl_easy *data)
 {
-  time_t now;
+  struct Curl_dnscache *cache = data->dns.hostcache;
+  struct Curl_dns_entry *dns;
+  struct curltime now;
 
-  if((data->set.dns_cache_timeout == -1) || !data->dns.hostcache)
-    /* cache forever means never prune, and NULL hostcache means
-       we can't do it */
+  if(!cache)
+    /* NULL hostcache means we can't do it */
     return;
 
-  if(data->share)
-    Curl_share_lock(data, CURL_LOCK_DATA_DNS, CURL_LOCK_ACCESS_SINGLE);
+  now = Curl_now();
+  while((dns = timer_pop(cache, now)) != NULL) {
+    char entry_id[MAX_HOSTCACHE_LEN];
+    size_t entry_len;
+    size_t bucket;
 
-  time(&now);
+    create_hostcache_id(dns->hostname, dns->port, entry_id, sizeof(entry_id));
+    entry_len = strlen(entry_id);
+    bucket = hostcache_bucket(data, entry_id, entry_len);
 
-  /* Remove outdated and unused entries from the hostcache */
-  hostcache_prune(data->dns.hostcache,
-                  data->set.dns_cache_timeout,
-                  now);
+    if(data->share)
+      Curl_share_lock_bucket(data, CURL_LOCK_DATA_DNS,
+                             CURL_LOCK_ACCESS_SINGLE, bucket);
 
-  if(data->share)
-    Curl_share_unlock(data, CURL_LOCK_DATA_DNS);
+    /* unless another handle replaced or removed it meanwhile */
+    if(Curl_hash_pick(&cache->hash, entry_id, entry_len + 1) == dns) {
+      if(entry_expired(dns, now))
+        Curl_hash_delete(&cache->hash, entry_id, entry_len + 1);
+      else
+        /* its refresh is under way */
+        timer_add(dns, time_after(dns->expire, DNS_REFRESH_GRACE));
+    }
+
+    if(data->share)
+      Curl_share_unlock_bucket(data, CURL_LOCK_DATA_DNS, bucket);
+
+    freednsentry(dns);
+  }
 }
 
 #ifdef HAVE_SIGSETJMP
@@ -254,45 +371,197 @@ void Curl_hostcache_prune(struct Curl_easy *data)
 sigjmp_buf curl_jmpenv;
 #endif
 
-/* lookup address, returns entry if found and not stale */
+/* how long a new entry lives, in milliseconds, -1 for good */
+static timediff_t entry_lifetime(struct Curl_easy *data, long ttl)
+{
+  if(data->set.dns_cache_timeout == -1)
+    return -1;
+  if(ttl >= 0)
+    return (timediff_t)ttl * 1000;
+  return (timediff_t)data->set.dns_cache_timeout * 1000;
+}
+
+/*
+ * Stores a new entry, replacing any older one for the host, with only the
+ * reference of the cache. This assumes that a lock has already been taken.
+ */
 static struct Curl_dns_entry *
-fetch_addr(struct connectdata *conn,
-                const char *hostname,
-                int port)
+cache_entry(struct Curl_easy *data, Curl_addrinfo *addr,
+            const char *hostname, int port, timediff_t lifetime)
 {
-  struct Curl_dns_entry *dns = NULL;
-  size_t entry_len;
-  struct Curl_easy *data = conn->data;
   char entry_id[MAX_HOSTCACHE_LEN];
+  size_t entry_len;
+  struct Curl_dns_entry *dns;
+
+  /* Create a new cache entry */
+  dns = calloc(1, sizeof(struct Curl_dns_entry));
+  if(!dns)
+    return NULL;
+  dns->hostname = strdup(hostname);
+  if(!dns->hostname) {
+    free(dns);
+    return NULL;
+  }
 
   /* Create an entry id, based upon the hostname and port */
   create_hostcache_id(hostname, port, entry_id, sizeof(entry_id));
   entry_len = strlen(entry_id);
 
+  dns->inuse = 1;   /* the cache has the first reference */
+  dns->addr = addr; /* this is the address(es) */
+  dns->port = port;
+  dns->lifetime = lifetime;
+  dns->expire = time_after(Curl_now(), lifetime > 0 ? lifetime : 0);
+  dns->cache = data->dns.hostcache;
+
+  /* Store the resolved data in our DNS cache. */
+  if(!Curl_hash_add(&data->dns.hostcache->hash, entry_id, entry_len + 1,
+                    (void *)dns)) {
+    free(dns->hostname);
+    free(dns);
+    return NULL;
+  }
+
+  if(lifetime >= 0)
+    timer_add(dns, dns->expire);
+  return dns;
+}
+
+/*
+ * Looks up one cache id with its bucket locked, exclusively or not. Sets
+ * 'again' and returns NULL when the entry needs a change that only the
+ * exclusive lock allows: zapping it when stale, swapping in the result of
+ * its refresh or starting one. Returns the entry with a reference taken if
+ * found and usable.
+ */
+static struct Curl_dns_entry *
+fetch_locked(struct connectdata *conn, const char *entry_id,
+             size_t entry_len, struct curltime now, bool exclusive,
+             bool *again)
+{
+  struct Curl_easy *data = conn->data;
+  struct curl_hash *hash = &data->dns.hostcache->hash;
+  struct Curl_dns_entry *dns;
+  long hits;
+
+  *again = FALSE;
+
   /* See if its already in our dns cache */
-  dns = Curl_hash_pick(data->dns.hostcache, entry_id, entry_len + 1);
+  dns = Curl_hash_pick(hash, (void *)entry_id, entry_len + 1);
+  if(!dns)
+    return NULL;
 
-  /* No entry found in cache, check if we might have a wildcard entry */
-  if(!dns && data->change.wildcard_resolve) {
-    create_hostcache_id("*", port, entry_id, sizeof(entry_id));
-    entry_len = strlen(entry_id);
+  if(dns->refresh && Curl_resolver_refresh_done(dns->refresh)) {
+    Curl_addrinfo *addr;
 
-    /* See if it's already in our dns cache */
-    dns = Curl_hash_pick(data->dns.hostcache, entry_id, entry_len + 1);
+    if(!exclusive) {
+      *again = TRUE;
+      return NULL;
+    }
+    addr = Curl_resolver_refresh_take(dns->refresh);
+    Curl_resolver_refresh_release(dns->refresh);
+    dns->refresh = NULL;
+    if(addr) {
+      /* replaces the old entry, which then goes with its last user, and
+         keeps its lifetime */
+      struct Curl_dns_entry *fresh =
+        cache_entry(data, addr, dns->hostname, dns->port, dns->lifetime);
+      if(!fresh) {
+        /* the old entry may be gone from the hash, and freed, already */
+        Curl_freeaddrinfo(addr);
+        return NULL;
+      }
+      infof(data, "Hostname %s was refreshed in DNS cache\n",
+            fresh->hostname);
+      dns = fresh;
+    }
   }
 
-  if(dns && (data->set.dns_cache_timeout != -1)) {
-    /* See whether the returned entry is stale. Done before we release lock */
-    struct hostcache_prune_data user;
-
-    time(&user.now);
-    user.cache_timeout = data->set.dns_cache_timeout;
+  /* See whether the entry is stale. Done before we release lock */
+  if(entry_expired(dns, now)) {
+    if(!exclusive) {
+      *again = TRUE;
+      return NULL;
+    }
+    infof(data, "Hostname in DNS cache was stale, zapped\n");
+    /* the memory deallocation is being handled by the hash */
+    Curl_hash_delete(hash, (void *)entry_id, entry_len + 1);
+    return NULL;
+  }
 
-    if(hostcache_timestamp_remove(&user, dns)) {
-      infof(data, "Hostname in DNS cache was stale, zapped\n");
-      dns = NULL; /* the memory deallocation is being handled by the hash */
-      Curl_hash_delete(data->dns.hostcache, entry_id, entry_len + 1);
+  hits = DNS_HIT(dns);
+  /* the refresh resolves through the system resolver, not over DoH */
+  if(!data->set.doh && refresh_due(dns, hits, now)) {
+    if(!exclusive) {
+      *again = TRUE;
+      return NULL;
     }
+    /* resolve it again while this entry is still served */
+    dns->refreshed = TRUE;
+    dns->refresh = Curl_resolver_refresh(conn, dns->hostname, dns->port);
+    if(dns->refresh)
+      infof(data, "Hostname %s is refreshed ahead of expiry\n",
+            dns->hostname);
+  }
+
+  DNS_REF(dns); /* we use it! */
+  return dns;
+}
+
+/*
+ * Look up one cache id, taking and releasing the lock of its bucket. Returns
+ * the entry with a reference taken if found and usable.
+ */
+static struct Curl_dns_entry *
+fetch_id(struct connectdata *conn, const char *entry_id, size_t entry_len)
+{
+  struct Curl_easy *data = conn->data;
+  struct Curl_dns_entry *dns;
+  size_t bucket = hostcache_bucket(data, entry_id, entry_len);
+  struct curltime now = Curl_now();
+  bool exclusive = !data->share ||
+    (DNS_LOOKUP_ACCESS == CURL_LOCK_ACCESS_SINGLE);
+  bool again;
+
+  if(data->share)
+    Curl_share_lock_bucket(data, CURL_LOCK_DATA_DNS, DNS_LOOKUP_ACCESS,
+                           bucket);
+
+  dns = fetch_locked(conn, entry_id, entry_len, now, exclusive, &again);
+
+  if(data->share)
+    Curl_share_unlock_bucket(data, CURL_LOCK_DATA_DNS, bucket);
+
+  if(again) {
+    /* another handle may have changed the entry before we got the bucket
+       to ourselves, so look again */
+    Curl_share_lock_bucket(data, CURL_LOCK_DATA_DNS, CURL_LOCK_ACCESS_SINGLE,
+                           bucket);
+    dns = fetch_locked(conn, entry_id, entry_len, now, TRUE, &again);
+    Curl_share_unlock_bucket(data, CURL_LOCK_DATA_DNS, bucket);
+  }
+
+  return dns;
+}
+
+/* lookup address, returns referenced entry if found and not stale */
+static struct Curl_dns_entry *
+fetch_addr(struct connectdata *conn,
+                const char *hostname,
+                int port)
+{
+  struct Curl_dns_entry *dns = NULL;
+  struct Curl_easy *data = conn->data;
+  char entry_id[MAX_HOSTCACHE_LEN];
+
+  /* Create an entry id, based upon the hostname and port */
+  create_hostcache_id(hostname, port, entry_id, sizeof(entry_id));
+  dns = fetch_id(conn, entry_id, strlen(entry_id));
+
+  /* No entry found in cache, check if we might have a wildcard entry */
+  if(!dns && data->change.wildcard_resolve) {
+    create_hostcache_id("*", port, entry_id, sizeof(entry_id));
+    dns = fetch_id(conn, entry_id, strlen(entry_id));
   }
 
   return dns;
@@ -307,7 +576,8 @@ fetch_addr(struct connectdata *conn,
  * the DNS cache. This short circuits waiting for a lot of pending
  * lookups for the same hostname requested by different handles.
  *
- * Returns the Curl_dns_entry entry pointer or NULL if not in the cache.
+ * Returns the Curl_dns_entry entry pointer or NULL if not in the cache. A
+ * cached failure is left for the pending lookup to report.
  *
  * The returned data *MUST* be "unlocked" with Curl_resolv_unlock() after
  * use, or we'll leak memory!
@@ -317,20 +587,12 @@ Curl_fetch_addr(struct connectdata *conn,
                 const char *hostname,
                 int port)
 {
-  struct Curl_easy *data = conn->data;
-  struct Curl_dns_entry *dns = NULL;
-
-  if(data->share)
-    Curl_share_lock(data, CURL_LOCK_DATA_DNS, CURL_LOCK_ACCESS_SINGLE);
-
-  dns = fetch_addr(conn, hostname, port);
-
-  if(dns)
-    dns->inuse++; /* we use it! */
-
-  if(data->share)
-    Curl_share_unlock(data, CURL_LOCK_DATA_DNS);
+  struct Curl_dns_entry *dns = fetch_addr(conn, hostname, port);
 
+  if(dns && !dns->addr) {
+    Curl_resolv_unlock(conn->data, dns);
+    dns = NULL;
+  }
   return dns;
 }
 
@@ -416,12 +678,10 @@ struct Curl_dns_entry *
 Curl_cache_addr(struct Curl_easy *data,
                 Curl_addrinfo *addr,
                 const char *hostname,
-                int port)
+                int port,
+                long ttl)
 {
-  char entry_id[MAX_HOSTCACHE_LEN];
-  size_t entry_len;
   struct Curl_dns_entry *dns;
-  struct Curl_dns_entry *dns2;
 
 #ifndef CURL_DISABLE_SHUFFLE_DNS
   /* shuffle addresses if requested */
@@ -432,33 +692,38 @@ Curl_cache_addr(struct Curl_easy *data,
   }
 #endif
 
-  /* Create a new cache entry */
-  dns = calloc(1, sizeof(struct Curl_dns_entry));
-  if(!dns) {
-    return NULL;
-  }
+  dns = cache_entry(data, addr, hostname, port, entry_lifetime(data, ttl));
+  if(dns)
+    DNS_REF(dns);         /* mark entry as in-use */
+  return dns;
+}
 
-  /* Create an entry id, based upon the hostname and port */
-  create_hostcache_id(hostname, port, entry_id, sizeof(entry_id));
-  entry_len = strlen(entry_id);
+/*
+ * Curl_cache_negative() stores a failed lookup for a short while.
+ */
+void Curl_cache_negative(struct Curl_easy *data,
+                         const char *hostname, int port)
+{
+  timediff_t lifetime = DNS_NEGATIVE_TIMEOUT * 1000;
+  size_t bucket;
 
-  dns->inuse = 1;   /* the cache has the first reference */
-  dns->addr = addr; /* this is the address(es) */
-  time(&dns->timestamp);
-  if(dns->timestamp == 0)
-    dns->timestamp = 1;   /* zero indicates CURLOPT_RESOLVE entry */
+  if(!data->dns.hostcache)
+    return;
+  if((data->set.dns_cache_timeout >= 0) &&
+     (data->set.dns_cache_timeout < DNS_NEGATIVE_TIMEOUT))
+    lifetime = (timediff_t)data->set.dns_cache_timeout * 1000;
+  if(!lifetime)
+    return;
 
-  /* Store the resolved data in our DNS cache. */
-  dns2 = Curl_hash_add(data->dns.hostcache, entry_id, entry_len + 1,
-                       (void *)dns);
-  if(!dns2) {
-    free(dns);
-    return NULL;
-  }
+  bucket = Curl_hostcache_bucket(data, hostname, port);
+  if(data->share)
+    Curl_share_lock_bucket(data, CURL_LOCK_DATA_DNS,
+                           CURL_LOCK_ACCESS_SINGLE, bucket);
 
-  dns = dns2;
-  dns->inuse++;         /* mark entry as in-use */
-  return dns;
+  (void)cache_entry(data, NULL, hostname, port, lifetime);
+
+  if(data->share)
+    Curl_share_unlock_bucket(data, CURL_LOCK_DATA_DNS, bucket);
 }
 
 /*
@@ -495,20 +760,19 @@ int Curl_resolv(struct connectdata *conn,
 
   *entry = NULL;
 
-  if(data->share)
-    Curl_share_lock(data, CURL_LOCK_DATA_DNS, CURL_LOCK_ACCESS_SINGLE);
-
   dns = fetch_addr(conn, hostname, port);
 
+  if(dns && !dns->addr) {
+    infof(data, "Hostname %s failed to resolve moments ago\n", hostname);
+    Curl_resolv_unlock(data, dns);
+    return CURLRESOLV_ERROR;
+  }
+
   if(dns) {
     infof(data, "Hostname %s was found in DNS cache\n", hostname);
-    dns->inuse++; /* we use it! */
     rc = CURLRESOLV_RESOLVED;
   }
 
-  if(data->share)
-    Curl_share_unlock(data, CURL_LOCK_DATA_DNS);
-
   if(!dns) {
     /* The entry was not in the cache. Resolve it to IP address */
 
@@ -561,14 +825,17 @@ int Curl_resolv(struct connectdata *conn,
       }
     }
     else {
+      size_t bucket = Curl_hostcache_bucket(data, hostname, port);
+
       if(data->share)
-        Curl_share_lock(data, CURL_LOCK_DATA_DNS, CURL_LOCK_ACCESS_SINGLE);
+        Curl_share_lock_bucket(data, CURL_LOCK_DATA_DNS,
+                               CURL_LOCK_ACCESS_SINGLE, bucket);
 
       /* we got a response, store it in the cache */
-      dns = Curl_cache_addr(data, addr, hostname, port);
+      dns = Curl_cache_addr(data, addr, hostname, port, -1);
 
       if(data->share)
-        Curl_share_unlock(data, CURL_LOCK_DATA_DNS);
+        Curl_share_unlock_bucket(data, CURL_LOCK_DATA_DNS, bucket);
 
       if(!dns)
         /* returned failure, bail out nicely */
@@ -778,6 +1045,12 @@ clean_up:
  */
 void Curl_resolv_unlock(struct Curl_easy *data, struct Curl_dns_entry *dns)
 {
+#ifdef CURL_ATOMIC_REFS
+  /* the cache holds its own reference while the entry can be found, so
+     the last one is never dropped under a lookup */
+  (void)data;
+  freednsentry(dns);
+#else
   if(data && data->share)
     Curl_share_lock(data, CURL_LOCK_DATA_DNS, CURL_LOCK_ACCESS_SINGLE);
 
@@ -785,6 +1058,7 @@ void Curl_resolv_unlock(struct Curl_easy *data, struct Curl_dns_entry *dns)
 
   if(data && data->share)
     Curl_share_unlock(data, CURL_LOCK_DATA_DNS);
+#endif
 }
 
 /*
@@ -795,20 +1069,49 @@ static void freednsentry(void *freethis)
   struct Curl_dns_entry *dns = (struct Curl_dns_entry *) freethis;
   DEBUGASSERT(dns && (dns->inuse>0));
 
-  dns->inuse--;
-  if(dns->inuse == 0) {
+  if(DNS_UNREF(dns) == 0) {
+    if(dns->refresh)
+      Curl_resolver_refresh_release(dns->refresh);
     Curl_freeaddrinfo(dns->addr);
+    free(dns->hostname);
     free(dns);
   }
 }
 
 /*
- * Curl_mk_dnscache() inits a new DNS cache and returns success/failure.
+ * File-internal: the hash's destructor, for an entry leaving the cache
  */
-int Curl_mk_dnscache(struct curl_hash *hash)
+static void hostcache_dtor(void *freethis)
 {
-  return Curl_hash_init(hash, 7, Curl_hash_str, Curl_str_key_compare,
-                        freednsentry);
+  struct Curl_dns_entry *dns = (struct Curl_dns_entry *) freethis;
+
+  timer_remove(dns);
+  freednsentry(dns);
+}
+
+/*
+ * Curl_mk_dnscache() inits a new DNS cache of 'slots' buckets and returns
+ * success/failure.
+ */
+int Curl_mk_dnscache(struct Curl_dnscache *cache, int slots)
+{
+  cache->timers = NULL;
+#if defined(USE_THREADS_POSIX) || defined(USE_THREADS_WIN32)
+  Curl_mutex_init(&cache->timerlock);
+#endif
+  return Curl_hash_init(&cache->hash, slots, Curl_hash_str,
+                        Curl_str_key_compare, hostcache_dtor);
+}
+
+/*
+ * Curl_hostcache_destroy() frees all entries and the cache's lock.
+ */
+void Curl_hostcache_destroy(struct Curl_dnscache *cache)
+{
+  Curl_hash_destroy(&cache->hash);
+#if defined(USE_THREADS_POSIX) || defined(USE_THREADS_WIN32)
+  Curl_mutex_destroy(&cache->timerlock);
+#endif
 }
 
 /*
@@ -819,12 +1122,12 @@ int Curl_mk_dnscache(struct curl_hash *hash)
  */
 
 void Curl_hostcache_clean(struct Curl_easy *data,
-                          struct curl_hash *hash)
+                          struct Curl_dnscache *cache)
 {
   if(data && data->share)
     Curl_share_lock(data, CURL_LOCK_DATA_DNS, CURL_LOCK_ACCESS_SINGLE);
 
-  Curl_hash_clean(hash);
+  Curl_hash_clean(&cache->hash);
 
   if(data && data->share)
     Curl_share_unlock(data, CURL_LOCK_DATA_DNS);
@@ -861,7 +1164,7 @@ CURLcode Curl_loadhostpairs(struct Curl_easy *data)
         Curl_share_lock(data, CURL_LOCK_DATA_DNS, CURL_LOCK_ACCESS_SINGLE);
 
       /* delete entry, ignore if it didn't exist */
-      Curl_hash_delete(data->dns.hostcache, entry_id, entry_len + 1);
+      Curl_hash_delete(&data->dns.hostcache->hash, entry_id, entry_len + 1);
 
       if(data->share)
         Curl_share_unlock(data, CURL_LOCK_DATA_DNS);
@@ -971,7 +1274,8 @@ CURLcode Curl_loadhostpairs(struct Curl_easy *data)
         Curl_share_lock(data, CURL_LOCK_DATA_DNS, CURL_LOCK_ACCESS_SINGLE);
 
       /* See if its already in our dns cache */
-      dns = Curl_hash_pick(data->dns.hostcache, entry_id, entry_len + 1);
+      dns = Curl_hash_pick(&data->dns.hostcache->hash, entry_id,
+                           entry_len + 1);
 
       if(dns) {
         infof(data, "RESOLVE %s:%d is - old addresses discarded!\n",
@@ -983,17 +1287,12 @@ CURLcode Curl_loadhostpairs(struct Curl_easy *data)
             request is made, it can get expired and pruned because old
             entry is not necessarily marked as added by CURLOPT_RESOLVE. */
 
-        Curl_hash_delete(data->dns.hostcache, entry_id, entry_len + 1);
+        Curl_hash_delete(&data->dns.hostcache->hash, entry_id,
+                         entry_len + 1);
       }
 
-      /* put this new host in the cache */
-      dns = Curl_cache_addr(data, head, hostname, port);
-      if(dns) {
-        dns->timestamp = 0; /* mark as added by CURLOPT_RESOLVE */
-        /* release the returned reference; the cache itself will keep the
-         * entry alive: */
-            dns->inuse--;
-      }
+      /* put this new host in the cache, for good */
+      dns = cache_entry(data, head, hostname, port, -1);
 
       if(data->share)
         Curl_share_unlock(data, CURL_LOCK_DATA_DNS);
@@ -24,10 +24,19 @@
 
 #include "curl_setup.h"
 #include "hash.h"
+#include "splay.h"
 #include "curl_addrinfo.h"
 #include "timeval.h" /* for timediff_t */
 #include "asyn.h"
 
+#if defined(USE_THREADS_POSIX)
+#  ifdef HAVE_PTHREAD_H
+#    include <pthread.h>
+#  endif
+#endif
+
+#include "curl_threads.h"
+
 #ifdef HAVE_SETJMP_H
 #include <setjmp.h>
 #endif
@@ -63,12 +72,36 @@ struct connectdata;
  */
 struct curl_hash *Curl_global_host_cache_init(void);
 
+/*
+ * The DNS cache. Entries that expire are also kept in a splay tree ordered
+ * by expiry time, so that pruning only visits the expired ones. The tree
+ * spans all buckets and has its own lock, taken after a bucket lock.
+ */
+struct Curl_dnscache {
+  struct curl_hash hash;
+  struct Curl_tree *timers;
+#if defined(USE_THREADS_POSIX) || defined(USE_THREADS_WIN32)
+  curl_mutex_t timerlock;
+#endif
+};
+
 struct Curl_dns_entry {
-  Curl_addrinfo *addr;
-  /* timestamp == 0 -- CURLOPT_RESOLVE entry, doesn't timeout */
-  time_t timestamp;
+  Curl_addrinfo *addr; /* NULL for a cached failure */
   /* use-counter, use Curl_resolv_unlock to release reference */
   long inuse;
+  char *hostname;
+  int port;
+  /* milliseconds the entry lives, -1 for CURLOPT_RESOLVE entries and
+     caches that never expire */
+  timediff_t lifetime;
+  struct curltime expire;
+  struct Curl_dnscache *cache; /* the cache whose timer tree holds us */
+  struct Curl_tree timenode;
+  bool timed;     /* timenode is in the tree */
+  long hits;      /* lookups served, hot entries are refreshed ahead */
+  /* the lookup replacing this entry before it expires */
+  struct Curl_dns_refresh *refresh;
+  bool refreshed; /* a refresh was made, don't start another */
 };
 
 /*
@@ -125,9 +158,17 @@ void Curl_resolv_unlock(struct Curl_easy *data,
                         struct Curl_dns_entry *dns);
 
 /* init a new dns cache and return success */
-int Curl_mk_dnscache(struct curl_hash *hash);
+int Curl_mk_dnscache(struct Curl_dnscache *cache, int slots);
+
+/* destroy a dns cache made with Curl_mk_dnscache() */
+void Curl_hostcache_destroy(struct Curl_dnscache *cache);
+
+/* the DNS cache bucket of a host, for Curl_share_lock_bucket() around
+   Curl_cache_addr() */
+size_t Curl_hostcache_bucket(struct Curl_easy *data,
+                             const char *hostname, int port);
 
-/* prune old entries from the DNS cache */
+/* prune expired entries from the DNS cache */
 void Curl_hostcache_prune(struct Curl_easy *data);
 
 /* Return # of addresses in a Curl_addrinfo struct */
@@ -179,13 +220,23 @@ Curl_fetch_addr(struct connectdata *conn,
                 int port);
 
 /*
- * Curl_cache_addr() stores a 'Curl_addrinfo' struct in the DNS cache.
+ * Curl_cache_addr() stores a 'Curl_addrinfo' struct in the DNS cache. 'ttl'
+ * is the time to live of the records in seconds, or -1 when the resolver
+ * doesn't tell and the entry lives for CURLOPT_DNS_CACHE_TIMEOUT.
  *
  * Returns the Curl_dns_entry entry pointer or NULL if the storage failed.
  */
 struct Curl_dns_entry *
 Curl_cache_addr(struct Curl_easy *data, Curl_addrinfo *addr,
-                const char *hostname, int port);
+                const char *hostname, int port, long ttl);
+
+/*
+ * Curl_cache_negative() remembers for a few seconds that a host name does not
+ * exist, so that lookups of it fail at once. Only for definite answers, not
+ * for temporary resolver failures. Takes and releases the lock.
+ */
+void Curl_cache_negative(struct Curl_easy *data,
+                         const char *hostname, int port);
 
 #ifndef INADDR_NONE
 #define CURL_INADDR_NONE (in_addr_t) ~0
@@ -231,7 +282,8 @@ CURLcode Curl_set_dns_local_ip6(struct Curl_easy *data,
 /*
  * Clean off entries from the cache
  */
-void Curl_hostcache_clean(struct Curl_easy *data, struct curl_hash *hash);
+void Curl_hostcache_clean(struct Curl_easy *data,
+                          struct Curl_dnscache *cache);
 
 /*
  * Populate the cache with specified entries from CURLOPT_RESOLVE.
@@ -68,6 +68,7 @@
 #include "parsedate.h" /* for the week day and month names */
 #include "strtoofft.h"
 #include "multiif.h"
+#include "conncache.h"
 #include "strcase.h"
 #include "content_encoding.h"
 #include "http_proxy.h"
@@ -2680,14 +2681,18 @@ CURLcode Curl_http(struct connectdata *conn, bool *done)
     int count = 0;
 
     if(data->cookies) {
-      Curl_share_lock(data, CURL_LOCK_DATA_COOKIE, CURL_LOCK_ACCESS_SINGLE);
-      co = Curl_cookie_getlist(data->cookies,
-                               conn->allocptr.cookiehost?
-                               conn->allocptr.cookiehost:host,
+      const char *cookiehost = conn->allocptr.cookiehost?
+        conn->allocptr.cookiehost:host;
+      size_t bucket = Curl_cookie_bucket(cookiehost);
+
+      /* the lookup only reads the jar */
+      Curl_share_lock_bucket(data, CURL_LOCK_DATA_COOKIE,
+                             CURL_LOCK_ACCESS_SHARED, bucket);
+      co = Curl_cookie_getlist(data->cookies, cookiehost,
                                data->state.up.path,
                                (conn->handler->protocol&CURLPROTO_HTTPS)?
                                TRUE:FALSE);
-      Curl_share_unlock(data, CURL_LOCK_DATA_COOKIE);
+      Curl_share_unlock_bucket(data, CURL_LOCK_DATA_COOKIE, bucket);
     }
     if(co) {
       struct Cookie *store = co;
@@ -3722,7 +3727,7 @@ CURLcode Curl_http_readwrite_headers(struct Curl_easy *data,
               infof(data, "Lying server, not serving HTTP/2\n");
           }
           if(conn->httpversion < 20) {
-            conn->bundle->multiuse = BUNDLE_NO_MULTIUSE;
+            Curl_conncache_set_multiuse(conn, BUNDLE_NO_MULTIUSE);
             infof(data, "Mark bundle as not supporting multiuse\n");
           }
         }
@@ -3810,7 +3815,7 @@ CURLcode Curl_http_readwrite_headers(struct Curl_easy *data,
 
           /* HTTP/2 cannot blacklist multiplexing since it is a core
              functionality of the protocol */
-          conn->bundle->multiuse = BUNDLE_MULTIPLEX;
+          Curl_conncache_set_multiuse(conn, BUNDLE_MULTIPLEX);
         }
         else if(conn->httpversion >= 11 &&
                 !conn->bits.close) {
@@ -4019,18 +4024,21 @@ CURLcode Curl_http_readwrite_headers(struct Curl_easy *data,
 #if !defined(CURL_DISABLE_COOKIES)
     else if(data->cookies &&
             checkprefix("Set-Cookie:", k->p)) {
-      Curl_share_lock(data, CURL_LOCK_DATA_COOKIE,
-                      CURL_LOCK_ACCESS_SINGLE);
+      /* If there is a custom-set Host: name, use it here, or else use real
+         peer host name. */
+      const char *cookiehost = conn->allocptr.cookiehost?
+        conn->allocptr.cookiehost:conn->host.name;
+      size_t bucket = Curl_cookie_bucket(cookiehost);
+
+      Curl_share_lock_bucket(data, CURL_LOCK_DATA_COOKIE,
+                             CURL_LOCK_ACCESS_SINGLE, bucket);
       Curl_cookie_add(data,
                       data->cookies, TRUE, FALSE, k->p + 11,
-                      /* If there is a custom-set Host: name, use it
-                         here, or else use real peer host name. */
-                      conn->allocptr.cookiehost?
-                      conn->allocptr.cookiehost:conn->host.name,
+                      cookiehost,
                       data->state.up.path,
                       (conn->handler->protocol&CURLPROTO_HTTPS)?
                       TRUE:FALSE);
-      Curl_share_unlock(data, CURL_LOCK_DATA_COOKIE);
+      Curl_share_unlock_bucket(data, CURL_LOCK_DATA_COOKIE, bucket);
     }
 #endif
     else if(!k->http_bodyless && checkprefix("Last-Modified:", k->p) &&
@@ -32,6 +32,7 @@
 #include "curl_base64.h"
 #include "strcase.h"
 #include "multiif.h"
+#include "conncache.h"
 #include "url.h"
 #include "connect.h"
 #include "strtoofft.h"
@@ -2197,7 +2198,7 @@ CURLcode Curl_http2_setup(struct connectdata *conn)
 
   conn->bits.multiplex = TRUE; /* at least potentially multiplexed */
   conn->httpversion = 20;
-  conn->bundle->multiuse = BUNDLE_MULTIPLEX;
+  Curl_conncache_set_multiuse(conn, BUNDLE_MULTIPLEX);
 
   infof(conn->data, "Connection state changed (HTTP/2 confirmed)\n");
   multi_connchanged(conn->data->multi);
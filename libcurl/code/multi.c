@@ -46,6 +46,12 @@
 #include "connect.h"
 #include "http_proxy.h"
 #include "http2.h"
+
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#include <unistd.h>
+#endif
+
 /* The last 3 #include files should be in this order */
 #include "curl_printf.h"
 #include "curl_memory.h"
@@ -351,13 +357,13 @@ struct Curl_multi *Curl_multi_handle(int hashsize, /* socket hash */
 
   multi->type = CURL_MULTI_HANDLE;
 
-  if(Curl_mk_dnscache(&multi->hostcache))
+  if(Curl_mk_dnscache(&multi->hostcache, 7))
     goto error;
 
   if(sh_init(&multi->sockhash, hashsize))
     goto error;
 
-  if(Curl_conncache_init(&multi->conn_cache, chashsize))
+  if(Curl_conncache_init(&multi->conn_cache, chashsize, FALSE))
     goto error;
 
   Curl_llist_init(&multi->msglist, NULL);
@@ -367,12 +373,17 @@ struct Curl_multi *Curl_multi_handle(int hashsize, /* socket hash */
 
   /* -1 means it not set by user, use the default value */
   multi->maxconnects = -1;
+#ifdef USE_EPOLL
+  /* made by the first curl_multi_wait(), users of the socket API never wait
+     in it */
+  multi->epfd = -1;
+#endif
   return multi;
 
   error:
 
   Curl_hash_destroy(&multi->sockhash);
-  Curl_hash_destroy(&multi->hostcache);
+  Curl_hostcache_destroy(&multi->hostcache);
   Curl_conncache_destroy(&multi->conn_cache);
   Curl_llist_destroy(&multi->msglist, NULL);
   Curl_llist_destroy(&multi->pending, NULL);
@@ -486,15 +497,8 @@ CURLMcode curl_multi_add_handle(struct Curl_multi *multi,
      easy handle is added */
   memset(&multi->timer_lastcall, 0, sizeof(multi->timer_lastcall));
 
-  /* The closure handle only ever has default timeouts set. To improve the
-     state somewhat we clone the timeouts from each added handle so that the
-     closure handle always has the same timeouts as the most recently added
-     easy handle. */
-  data->state.conn_cache->closure_handle->set.timeout = data->set.timeout;
-  data->state.conn_cache->closure_handle->set.server_response_timeout =
-    data->set.server_response_timeout;
-  data->state.conn_cache->closure_handle->set.no_signal =
-    data->set.no_signal;
+  /* let the closure handle use the timeouts of the latest added handle */
+  Curl_conncache_set_closure_timeouts(data->state.conn_cache, data);
 
   Curl_update_timer(multi);
   return CURLM_OK;
@@ -636,6 +640,13 @@ static CURLcode multi_done(struct Curl_easy *data,
               conn->bits.conn_to_host ? conn->conn_to_host.dispname :
               conn->host.dispname);
 
+#ifdef CONNCACHE_MUTEX
+    /* another thread may take the connection from a shared cache, close it
+       and get its socket number again, so stop watching it before that */
+    if(data->state.conn_cache && data->state.conn_cache->threaded)
+      singlesocket(data->multi, data);
+#endif
+
     /* the connection is no longer in use by this transfer */
     if(Curl_conncache_return_conn(conn)) {
       /* remember the most recently used connection */
@@ -797,12 +808,18 @@ bool Curl_multiplex_wanted(const struct Curl_multi *multi)
 }
 
 /* This is the only function that should clear data->conn. This will
-   occasionally be called with the pointer already cleared. */
+   occasionally be called with the pointer already cleared. The easy queue
+   is changed with the connection's shard locked, as ConnectionExists()
+   reads it. */
 static void detach_connnection(struct Curl_easy *data)
 {
   struct connectdata *conn = data->conn;
-  if(conn)
+  if(conn) {
+    bool locked = Curl_conncache_lock_conn(data, conn);
     Curl_llist_remove(&conn->easyq, &data->conn_queue, NULL);
+    if(locked)
+      Curl_conncache_unlock(data);
+  }
   data->conn = NULL;
 }
 
@@ -810,11 +827,15 @@ static void detach_connnection(struct Curl_easy *data)
 void Curl_attach_connnection(struct Curl_easy *data,
                              struct connectdata *conn)
 {
+  bool locked;
   DEBUGASSERT(!data->conn);
   DEBUGASSERT(conn);
   data->conn = conn;
+  locked = Curl_conncache_lock_conn(data, conn);
   Curl_llist_insert_next(&conn->easyq, conn->easyq.tail, data,
                          &data->conn_queue);
+  if(locked)
+    Curl_conncache_unlock(data);
 }
 
 static int waitconnect_getsock(struct connectdata *conn,
@@ -900,7 +921,8 @@ static int multi_getsock(struct Curl_easy *data,
   if(data->mstate > CURLM_STATE_CONNECT &&
      data->mstate < CURLM_STATE_COMPLETED) {
     /* Set up ownership correctly */
-    data->conn->data = data;
+    if(data->conn->data != data)
+      data->conn->data = data;
   }
 
   switch(data->mstate) {
@@ -1000,6 +1022,241 @@ CURLMcode curl_multi_fdset(struct Curl_multi *multi,
 
 #define NUM_POLLS_ON_STACK 10
 
+/* Add external file descriptions from poll-like struct curl_waitfd */
+static void extra_to_pollfds(struct pollfd *ufds,
+                             const struct curl_waitfd extra_fds[],
+                             unsigned int extra_nfds)
+{
+  unsigned int i;
+  for(i = 0; i < extra_nfds; i++) {
+    ufds[i].fd = extra_fds[i].fd;
+    ufds[i].events = 0;
+    if(extra_fds[i].events & CURL_WAIT_POLLIN)
+      ufds[i].events |= POLLIN;
+    if(extra_fds[i].events & CURL_WAIT_POLLPRI)
+      ufds[i].events |= POLLPRI;
+    if(extra_fds[i].events & CURL_WAIT_POLLOUT)
+      ufds[i].events |= POLLOUT;
+  }
+}
+
+/* copy revents results from the poll to the curl_multi_wait poll struct, the
+   bit values of the actual underlying poll() implementation may not be the
+   same as the ones in the public libcurl API! */
+static void extra_from_pollfds(struct curl_waitfd extra_fds[],
+                               unsigned int extra_nfds,
+                               const struct pollfd *ufds)
+{
+  unsigned int i;
+  for(i = 0; i < extra_nfds; i++) {
+    unsigned short mask = 0;
+    unsigned r = ufds[i].revents;
+
+    if(r & POLLIN)
+      mask |= CURL_WAIT_POLLIN;
+    if(r & POLLOUT)
+      mask |= CURL_WAIT_POLLOUT;
+    if(r & POLLPRI)
+      mask |= CURL_WAIT_POLLPRI;
+
+    extra_fds[i].revents = mask;
+  }
+}
+
+#ifdef USE_EPOLL
+/* ready sockets taken per epoll_wait(), the count curl_multi_wait() returns
+   stops there */
+#define NUM_EPOLL_EVENTS 64
+
+/*
+ * multi_epoll_set() mirrors what singlesocket() tells the socket callback
+ * into the epoll set: 'action' is the combined action of socket 's' or
+ * CURL_POLL_REMOVE, 'added' is set when 's' just got into the socket hash.
+ */
+static void multi_epoll_set(struct Curl_multi *multi, curl_socket_t s,
+                            unsigned int action, bool added)
+{
+  struct epoll_event ev;
+
+  if(multi->epfd == -1)
+    return;
+
+  memset(&ev, 0, sizeof(ev));
+  if(action == CURL_POLL_REMOVE) {
+    /* a socket already closed has left the set on its own */
+    (void)epoll_ctl(multi->epfd, EPOLL_CTL_DEL, s, &ev);
+    multi->epoll_nfds--;
+    return;
+  }
+
+  if(action & CURL_POLL_IN)
+    ev.events |= EPOLLIN;
+  if(action & CURL_POLL_OUT)
+    ev.events |= EPOLLOUT;
+  ev.data.fd = s;
+
+  if(added) {
+    multi->epoll_nfds++;
+    /* the kernel may still hold a socket of this number that was never
+       removed from the hash, and that has no other users now */
+    if(epoll_ctl(multi->epfd, EPOLL_CTL_ADD, s, &ev) && (errno == EEXIST))
+      (void)epoll_ctl(multi->epfd, EPOLL_CTL_MOD, s, &ev);
+  }
+  else if(epoll_ctl(multi->epfd, EPOLL_CTL_MOD, s, &ev) &&
+          (errno == ENOENT))
+    /* closed without Curl_multi_closed() and the number reused since */
+    (void)epoll_ctl(multi->epfd, EPOLL_CTL_ADD, s, &ev);
+}
+
+/*
+ * multi_epoll_ready() marks the transfers using the 'ready' sockets an
+ * epoll_wait() returned, for the next curl_multi_perform() to run like
+ * curl_multi_socket_action() would. A full array may have left sockets out,
+ * then all transfers are run.
+ */
+static void multi_epoll_ready(struct Curl_multi *multi,
+                              const struct epoll_event *events, int ready)
+{
+  int i;
+
+  multi->epoll_round++;
+  multi->epoll_sparse = (ready < NUM_EPOLL_EVENTS);
+  for(i = 0; i < ready; i++) {
+    struct Curl_sh_entry *entry =
+      sh_getentry(&multi->sockhash, events[i].data.fd);
+    if(entry) {
+      struct curl_hash_iterator iter;
+      struct curl_hash_element *he;
+
+      Curl_hash_start_iterate(&entry->transfers, &iter);
+      for(he = Curl_hash_next_element(&iter); he;
+          he = Curl_hash_next_element(&iter)) {
+        struct Curl_easy *data = he->ptr;
+        data->epoll_round = multi->epoll_round;
+      }
+    }
+  }
+}
+
+/*
+ * multi_epoll_start() creates the epoll set and fills it with the sockets of
+ * all transfers. From then on curl_multi_perform() keeps it up to date.
+ */
+static void multi_epoll_start(struct Curl_multi *multi)
+{
+  struct curl_hash_iterator iter;
+  struct curl_hash_element *he;
+  struct Curl_easy *data;
+
+  multi->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if(multi->epfd == -1) {
+    /* out of descriptors, wait with poll() */
+    multi->no_epoll = TRUE;
+    return;
+  }
+  multi->epoll_nfds = 0;
+
+  /* the sockets the socket hash knows from before */
+  Curl_hash_start_iterate(&multi->sockhash, &iter);
+  for(he = Curl_hash_next_element(&iter); he;
+      he = Curl_hash_next_element(&iter)) {
+    struct Curl_sh_entry *entry = he->ptr;
+    multi_epoll_set(multi, *(curl_socket_t *)he->key, entry->action, TRUE);
+  }
+
+  /* and where the transfers are at now */
+  for(data = multi->easyp; data; data = data->next)
+    (void)singlesocket(multi, data);
+}
+
+static void multi_epoll_stop(struct Curl_multi *multi)
+{
+  if(multi->epfd != -1) {
+    close(multi->epfd);
+    multi->epfd = -1;
+  }
+  multi->epoll_sparse = FALSE;
+}
+
+/* has the nearest timer of this transfer expired */
+static bool multi_timer_due(struct Curl_easy *data, struct curltime now)
+{
+  struct curltime *tv = &data->state.expiretime;
+  return (tv->tv_sec || tv->tv_usec) && (Curl_timediff(*tv, now) <= 0);
+}
+
+/*
+ * multi_epoll_wait() is Curl_multi_wait() over the epoll set: a single
+ * epoll_wait() whatever the number of transfers. Extra descriptors are
+ * polled along with the set, which is readable when one of its sockets is
+ * ready.
+ */
+static CURLMcode multi_epoll_wait(struct Curl_multi *multi,
+                                  struct curl_waitfd extra_fds[],
+                                  unsigned int extra_nfds,
+                                  int timeout_ms,
+                                  int *ret,
+                                  bool extrawait)
+{
+  struct epoll_event events[NUM_EPOLL_EVENTS];
+  int retcode = 0;
+
+  multi->epoll_sparse = FALSE;
+  if(!multi->epoll_nfds && !extra_nfds && !extrawait)
+    /* nothing to wait for */
+    ;
+  else if(!extra_nfds) {
+    /* with no socket this sleeps, avoiding a busy-loop in curl_multi_poll */
+    retcode = epoll_wait(multi->epfd, events, NUM_EPOLL_EVENTS, timeout_ms);
+    if(retcode >= 0)
+      multi_epoll_ready(multi, events, retcode);
+  }
+  else {
+    struct pollfd a_few_on_stack[NUM_POLLS_ON_STACK];
+    struct pollfd *ufds = &a_few_on_stack[0];
+    unsigned int nfds = extra_nfds + 1;
+    int pollrc;
+
+    if(nfds > NUM_POLLS_ON_STACK) {
+      ufds = malloc(nfds * sizeof(struct pollfd));
+      if(!ufds)
+        return CURLM_OUT_OF_MEMORY;
+    }
+    ufds[0].fd = multi->epfd;
+    ufds[0].events = POLLIN;
+    extra_to_pollfds(&ufds[1], extra_fds, extra_nfds);
+
+    pollrc = Curl_poll(ufds, nfds, timeout_ms);
+    if(pollrc > 0) {
+      extra_from_pollfds(extra_fds, extra_nfds, &ufds[1]);
+      retcode = pollrc;
+      if(ufds[0].revents & POLLIN) {
+        /* count the ready sockets instead of the set */
+        int ready = epoll_wait(multi->epfd, events, NUM_EPOLL_EVENTS, 0);
+        retcode += (ready > 0) ? ready - 1 : -1;
+        if(ready >= 0)
+          multi_epoll_ready(multi, events, ready);
+      }
+      else
+        multi_epoll_ready(multi, events, 0);
+    }
+    else if(!pollrc)
+      multi_epoll_ready(multi, events, 0);
+    if(ufds != &a_few_on_stack[0])
+      free(ufds);
+  }
+
+  if(retcode < 0)
+    /* interrupted by a signal */
+    retcode = 0;
+  if(ret)
+    *ret = retcode;
+  return CURLM_OK;
+}
+#else
+#define multi_epoll_set(a,b,c,added) (void)(added)
+#endif
+
 static CURLMcode Curl_multi_wait(struct Curl_multi *multi,
                                  struct curl_waitfd extra_fds[],
                                  unsigned int extra_nfds,
@@ -1025,6 +1282,21 @@ static CURLMcode Curl_multi_wait(struct Curl_multi *multi,
   if(multi->in_callback)
     return CURLM_RECURSIVE_API_CALL;
 
+  /* If the internally desired timeout is actually shorter than requested from
+     the outside, then use the shorter time! But only if the internal timer
+     is actually larger than -1! */
+  (void)multi_timeout(multi, &timeout_internal);
+  if((timeout_internal >= 0) && (timeout_internal < (long)timeout_ms))
+    timeout_ms = (int)timeout_internal;
+
+#ifdef USE_EPOLL
+  if((multi->epfd == -1) && !multi->no_epoll)
+    multi_epoll_start(multi);
+  if(multi->epfd != -1)
+    return multi_epoll_wait(multi, extra_fds, extra_nfds, timeout_ms, ret,
+                            extrawait);
+#endif
+
   /* Count up how many fds we have from the multi handle */
   data = multi->easyp;
   while(data) {
@@ -1049,13 +1321,6 @@ static CURLMcode Curl_multi_wait(struct Curl_multi *multi,
     data = data->next; /* check next handle */
   }
 
-  /* If the internally desired timeout is actually shorter than requested from
-     the outside, then use the shorter time! But only if the internal timer
-     is actually larger than -1! */
-  (void)multi_timeout(multi, &timeout_internal);
-  if((timeout_internal >= 0) && (timeout_internal < (long)timeout_ms))
-    timeout_ms = (int)timeout_internal;
-
   curlfds = nfds; /* number of internal file descriptors */
   nfds += extra_nfds; /* add the externally provided ones */
 
@@ -1104,18 +1369,8 @@ static CURLMcode Curl_multi_wait(struct Curl_multi *multi,
     }
   }
 
-  /* Add external file descriptions from poll-like struct curl_waitfd */
-  for(i = 0; i < extra_nfds; i++) {
-    ufds[nfds].fd = extra_fds[i].fd;
-    ufds[nfds].events = 0;
-    if(extra_fds[i].events & CURL_WAIT_POLLIN)
-      ufds[nfds].events |= POLLIN;
-    if(extra_fds[i].events & CURL_WAIT_POLLPRI)
-      ufds[nfds].events |= POLLPRI;
-    if(extra_fds[i].events & CURL_WAIT_POLLOUT)
-      ufds[nfds].events |= POLLOUT;
-    ++nfds;
-  }
+  extra_to_pollfds(&ufds[nfds], extra_fds, extra_nfds);
+  nfds += extra_nfds;
 
   if(nfds) {
     int pollrc;
@@ -1124,22 +1379,7 @@ static CURLMcode Curl_multi_wait(struct Curl_multi *multi,
 
     if(pollrc > 0) {
       retcode = pollrc;
-      /* copy revents results from the poll to the curl_multi_wait poll
-         struct, the bit values of the actual underlying poll() implementation
-         may not be the same as the ones in the public libcurl API! */
-      for(i = 0; i < extra_nfds; i++) {
-        unsigned short mask = 0;
-        unsigned r = ufds[curlfds + i].revents;
-
-        if(r & POLLIN)
-          mask |= CURL_WAIT_POLLIN;
-        if(r & POLLOUT)
-          mask |= CURL_WAIT_POLLOUT;
-        if(r & POLLPRI)
-          mask |= CURL_WAIT_POLLPRI;
-
-        extra_fds[i].revents = mask;
-      }
+      extra_from_pollfds(extra_fds, extra_nfds, &ufds[curlfds]);
     }
   }
 
@@ -1428,8 +1668,11 @@ static CURLMcode multi_runsingle(struct Curl_multi *multi,
 
     if(data->conn && data->mstate > CURLM_STATE_CONNECT &&
        data->mstate < CURLM_STATE_COMPLETED) {
-      /* Make sure we set the connection's current owner */
-      data->conn->data = data;
+      /* Make sure we set the connection's current owner, without writing
+         to a connection another thread may be looking at when it already
+         is */
+      if(data->conn->data != data)
+        data->conn->data = data;
     }
 
     if(data->conn &&
@@ -2222,10 +2465,29 @@ CURLMcode curl_multi_perform(struct Curl_multi *multi, int *running_handles)
     CURLMcode result;
     SIGPIPE_VARIABLE(pipe_st);
 
+#ifdef USE_EPOLL
+    if(multi->epoll_sparse && data->numsocks &&
+       (data->epoll_round != multi->epoll_round) &&
+       !multi_timer_due(data, now)) {
+      /* waits on sockets the last wait did not find ready */
+      data = data->next;
+      continue;
+    }
+#endif
+
     sigpipe_ignore(data, &pipe_st);
     result = multi_runsingle(multi, now, data);
     sigpipe_restore(&pipe_st);
 
+#ifdef USE_EPOLL
+    if(multi->epfd != -1) {
+      /* keep the epoll set in step with the sockets of this transfer */
+      CURLMcode sresult = singlesocket(multi, data);
+      if(sresult)
+        result = sresult;
+    }
+#endif
+
     if(result)
       returncode = result;
 
@@ -2251,6 +2513,10 @@ CURLMcode curl_multi_perform(struct Curl_multi *multi, int *running_handles)
   } while(t);
 
   *running_handles = multi->num_alive;
+#ifdef USE_EPOLL
+  /* a perform without a wait before runs everything */
+  multi->epoll_sparse = FALSE;
+#endif
 
   if(CURLM_OK >= returncode)
     Curl_update_timer(multi);
@@ -2299,11 +2565,14 @@ CURLMcode curl_multi_cleanup(struct Curl_multi *multi)
     Curl_conncache_close_all_connections(&multi->conn_cache);
 
     Curl_hash_destroy(&multi->sockhash);
+#ifdef USE_EPOLL
+    multi_epoll_stop(multi);
+#endif
     Curl_conncache_destroy(&multi->conn_cache);
     Curl_llist_destroy(&multi->msglist, NULL);
     Curl_llist_destroy(&multi->pending, NULL);
 
-    Curl_hash_destroy(&multi->hostcache);
+    Curl_hostcache_destroy(&multi->hostcache);
     Curl_psl_destroy(&multi->psl);
     free(multi);
 
@@ -2384,6 +2653,7 @@ static CURLMcode singlesocket(struct Curl_multi *multi,
     unsigned int prevaction = 0;
     unsigned int comboaction;
     bool sincebefore = FALSE;
+    bool added = FALSE;
 
     s = socks[i];
 
@@ -2413,6 +2683,7 @@ static CURLMcode singlesocket(struct Curl_multi *multi,
       if(!entry)
         /* fatal */
         return CURLM_OUT_OF_MEMORY;
+      added = TRUE;
     }
     if(sincebefore && (prevaction != action)) {
       /* Socket was used already, but different action now */
@@ -2450,6 +2721,7 @@ static CURLMcode singlesocket(struct Curl_multi *multi,
     if(multi->socket_cb)
       multi->socket_cb(data, s, comboaction, multi->socket_userp,
                        entry->socketp);
+    multi_epoll_set(multi, s, comboaction, added);
 
     entry->action = comboaction; /* store the current action state */
   }
@@ -2488,6 +2760,7 @@ static CURLMcode singlesocket(struct Curl_multi *multi,
           multi->socket_cb(data, s, CURL_POLL_REMOVE,
                            multi->socket_userp,
                            entry->socketp);
+        multi_epoll_set(multi, s, CURL_POLL_REMOVE, FALSE);
         sh_delentry(entry, &multi->sockhash, s);
       }
       else {
@@ -2537,6 +2810,7 @@ void Curl_multi_closed(struct Curl_easy *data, curl_socket_t s)
           multi->socket_cb(data, s, CURL_POLL_REMOVE,
                            multi->socket_userp,
                            entry->socketp);
+        multi_epoll_set(multi, s, CURL_POLL_REMOVE, FALSE);
 
         /* now remove it from the socket hash */
         sh_delentry(entry, &multi->sockhash, s);
@@ -2772,6 +3046,17 @@ CURLMcode curl_multi_setopt(struct Curl_multi *multi,
     break;
   case CURLMOPT_PIPELINING_SERVER_BL:
     break;
+  case CURLMOPT_WAIT_EPOLL:
+#ifdef USE_EPOLL
+    /* a set wanted back is made by the next curl_multi_wait() */
+    multi->no_epoll = !va_arg(param, long);
+    if(multi->no_epoll)
+      multi_epoll_stop(multi);
+#else
+    if(va_arg(param, long))
+      res = CURLM_UNKNOWN_OPTION;
+#endif
+    break;
   default:
     res = CURLM_UNKNOWN_OPTION;
     break;
@@ -3136,7 +3421,7 @@ void Curl_multiuse_state(struct connectdata *conn,
   DEBUGASSERT(conn->data);
   DEBUGASSERT(conn->data->multi);
 
-  conn->bundle->multiuse = bundlestate;
+  Curl_conncache_set_multiuse(conn, bundlestate);
   process_pending_handles(conn->data->multi);
 }
 
@@ -94,7 +94,7 @@ struct Curl_multi {
   void *push_userp;
 
   /* Hostname cache */
-  struct curl_hash hostcache;
+  struct Curl_dnscache hostcache;
 
 #ifdef USE_LIBPSL
   /* PSL cache. */
@@ -110,6 +110,19 @@ struct Curl_multi {
      same actual socket) */
   struct curl_hash sockhash;
 
+#ifdef USE_EPOLL
+  /* the epoll set curl_multi_wait() waits in, -1 until the first wait or
+     when waiting with poll(). It holds every socket of 'sockhash', updated
+     by singlesocket() as the transfers move on */
+  int epfd;
+  unsigned int epoll_nfds; /* sockets in the set */
+  unsigned int epoll_round; /* counts the waits that saw all ready sockets */
+  bool epoll_sparse; /* the next curl_multi_perform() only runs the transfers
+                        that last wait found ready, or that have a timer due
+                        or no socket to wait on */
+  bool no_epoll; /* CURLMOPT_WAIT_EPOLL set to 0, or no set to be had */
+#endif
+
   /* multiplexing wanted */
   bool multiplexing;
 
@@ -26,12 +26,106 @@
 #include "urldata.h"
 #include "share.h"
 #include "psl.h"
+#include "strcase.h"
 #include "vtls/vtls.h"
+#ifdef USE_MBEDTLS
+#include "vtls/mbedtls.h"
+#endif
 #include "curl_memory.h"
 
 /* The last #include file should be: */
 #include "memdebug.h"
 
+#ifdef SHARE_RWLOCKS
+static curl_rwlock_t *share_stripes(struct Curl_share *share,
+                                    curl_lock_data type)
+{
+  if(type == CURL_LOCK_DATA_DNS)
+    return share->dns_stripes;
+  if(type == CURL_LOCK_DATA_COOKIE)
+    return share->cookie_stripes;
+  return NULL;
+}
+
+static void share_init_locks(struct Curl_share *share)
+{
+  int i;
+  for(i = 0; i < CURL_LOCK_DATA_LAST; i++)
+    Curl_rwlock_init(&share->locks[i]);
+  for(i = 0; i < SHARE_STRIPES; i++) {
+    Curl_rwlock_init(&share->dns_stripes[i]);
+    Curl_rwlock_init(&share->cookie_stripes[i]);
+  }
+  Curl_mutex_init(&share->counts);
+}
+
+static void share_destroy_locks(struct Curl_share *share)
+{
+  int i;
+  for(i = 0; i < CURL_LOCK_DATA_LAST; i++)
+    Curl_rwlock_destroy(&share->locks[i]);
+  for(i = 0; i < SHARE_STRIPES; i++) {
+    Curl_rwlock_destroy(&share->dns_stripes[i]);
+    Curl_rwlock_destroy(&share->cookie_stripes[i]);
+  }
+  Curl_mutex_destroy(&share->counts);
+}
+#endif
+
+/*
+ * Locks 'type' of the share, all of it or, with built-in locks, only the
+ * stripe of a DNS or cookie hash bucket when 'bucket' is not -1. Whole
+ * type locks take the stripes in order, so they never deadlock with each
+ * other.
+ */
+static void share_lock(struct Curl_share *share, struct Curl_easy *data,
+                       curl_lock_data type, curl_lock_access accesstype,
+                       long bucket)
+{
+#ifdef SHARE_RWLOCKS
+  curl_rwlock_t *stripes = share_stripes(share, type);
+  bool shared = (accesstype == CURL_LOCK_ACCESS_SHARED);
+  (void)data;
+
+  if(!stripes)
+    Curl_rwlock_acquire(&share->locks[type], shared);
+  else if(bucket >= 0)
+    Curl_rwlock_acquire(&stripes[bucket % SHARE_STRIPES], shared);
+  else {
+    int i;
+    for(i = 0; i < SHARE_STRIPES; i++)
+      Curl_rwlock_acquire(&stripes[i], shared);
+  }
+#else
+  (void)bucket;
+  if(share->lockfunc) /* only call this if set! */
+    share->lockfunc(data, type, accesstype, share->clientdata);
+#endif
+}
+
+static void share_unlock(struct Curl_share *share, struct Curl_easy *data,
+                         curl_lock_data type, long bucket)
+{
+#ifdef SHARE_RWLOCKS
+  curl_rwlock_t *stripes = share_stripes(share, type);
+  (void)data;
+
+  if(!stripes)
+    Curl_rwlock_release(&share->locks[type]);
+  else if(bucket >= 0)
+    Curl_rwlock_release(&stripes[bucket % SHARE_STRIPES]);
+  else {
+    int i;
+    for(i = SHARE_STRIPES - 1; i >= 0; i--)
+      Curl_rwlock_release(&stripes[i]);
+  }
+#else
+  (void)bucket;
+  if(share->unlockfunc) /* only call this if set! */
+    share->unlockfunc(data, type, share->clientdata);
+#endif
+}
+
 struct Curl_share *
 curl_share_init(void)
 {
@@ -39,10 +133,15 @@ curl_share_init(void)
   if(share) {
     share->specifier |= (1<<CURL_LOCK_DATA_SHARE);
 
-    if(Curl_mk_dnscache(&share->hostcache)) {
+    /* enough buckets for the stripes to spread the hosts */
+    if(Curl_mk_dnscache(&share->hostcache, SHARE_STRIPES * 16 - 1)) {
+      Curl_hostcache_destroy(&share->hostcache);
       free(share);
       return NULL;
     }
+#ifdef SHARE_RWLOCKS
+    share_init_locks(share);
+#endif
   }
 
   return share;
@@ -102,8 +201,9 @@ curl_share_setopt(struct Curl_share *share, CURLSHoption option, ...)
 #endif
       break;
 
-    case CURL_LOCK_DATA_CONNECT:     /* not supported (yet) */
-      if(Curl_conncache_init(&share->conn_cache, 103))
+    case CURL_LOCK_DATA_CONNECT:
+      /* locked per shard with built-in mutexes where libcurl has threads */
+      if(Curl_conncache_init(&share->conn_cache, 103, TRUE))
         res = CURLSHE_NOMEM;
       break;
 
@@ -155,6 +255,7 @@ curl_share_setopt(struct Curl_share *share, CURLSHoption option, ...)
     break;
 
   case CURLSHOPT_LOCKFUNC:
+    /* kept, but not called when the share locks itself (SHARE_RWLOCKS) */
     lockfunc = va_arg(param, curl_lock_function);
     share->lockfunc = lockfunc;
     break;
@@ -185,19 +286,16 @@ curl_share_cleanup(struct Curl_share *share)
   if(share == NULL)
     return CURLSHE_INVALID;
 
-  if(share->lockfunc)
-    share->lockfunc(NULL, CURL_LOCK_DATA_SHARE, CURL_LOCK_ACCESS_SINGLE,
-                    share->clientdata);
+  share_lock(share, NULL, CURL_LOCK_DATA_SHARE, CURL_LOCK_ACCESS_SINGLE, -1);
 
   if(share->dirty) {
-    if(share->unlockfunc)
-      share->unlockfunc(NULL, CURL_LOCK_DATA_SHARE, share->clientdata);
+    share_unlock(share, NULL, CURL_LOCK_DATA_SHARE, -1);
     return CURLSHE_IN_USE;
   }
 
   Curl_conncache_close_all_connections(&share->conn_cache);
   Curl_conncache_destroy(&share->conn_cache);
-  Curl_hash_destroy(&share->hostcache);
+  Curl_hostcache_destroy(&share->hostcache);
 
 #if !defined(CURL_DISABLE_HTTP) && !defined(CURL_DISABLE_COOKIES)
   Curl_cookie_cleanup(share->cookies);
@@ -214,8 +312,10 @@ curl_share_cleanup(struct Curl_share *share)
 
   Curl_psl_destroy(&share->psl);
 
-  if(share->unlockfunc)
-    share->unlockfunc(NULL, CURL_LOCK_DATA_SHARE, share->clientdata);
+  share_unlock(share, NULL, CURL_LOCK_DATA_SHARE, -1);
+#ifdef SHARE_RWLOCKS
+  share_destroy_locks(share);
+#endif
   free(share);
 
   return CURLSHE_OK;
@@ -231,10 +331,8 @@ Curl_share_lock(struct Curl_easy *data, curl_lock_data type,
   if(share == NULL)
     return CURLSHE_INVALID;
 
-  if(share->specifier & (1<<type)) {
-    if(share->lockfunc) /* only call this if set! */
-      share->lockfunc(data, type, accesstype, share->clientdata);
-  }
+  if(share->specifier & (1<<type))
+    share_lock(share, data, type, accesstype, -1);
   /* else if we don't share this, pretend successful lock */
 
   return CURLSHE_OK;
@@ -248,10 +346,189 @@ Curl_share_unlock(struct Curl_easy *data, curl_lock_data type)
   if(share == NULL)
     return CURLSHE_INVALID;
 
-  if(share->specifier & (1<<type)) {
-    if(share->unlockfunc) /* only call this if set! */
-      share->unlockfunc (data, type, share->clientdata);
+  if(share->specifier & (1<<type))
+    share_unlock(share, data, type, -1);
+
+  return CURLSHE_OK;
+}
+
+CURLSHcode
+Curl_share_lock_bucket(struct Curl_easy *data, curl_lock_data type,
+                       curl_lock_access accesstype, size_t bucket)
+{
+  struct Curl_share *share = data->share;
+
+  if(share == NULL)
+    return CURLSHE_INVALID;
+
+  if(share->specifier & (1<<type))
+    share_lock(share, data, type, accesstype,
+               (long)(bucket % SHARE_STRIPES));
+
+  return CURLSHE_OK;
+}
+
+CURLSHcode
+Curl_share_unlock_bucket(struct Curl_easy *data, curl_lock_data type,
+                         size_t bucket)
+{
+  struct Curl_share *share = data->share;
+
+  if(share == NULL)
+    return CURLSHE_INVALID;
+
+  if(share->specifier & (1<<type))
+    share_unlock(share, data, type, (long)(bucket % SHARE_STRIPES));
+
+  return CURLSHE_OK;
+}
+
+/* Without built-in locks every holder has the whole type, and the counters
+   are safe already. */
+void Curl_share_lock_counts(struct Curl_easy *data)
+{
+#ifdef SHARE_RWLOCKS
+  if(data && data->share)
+    Curl_mutex_acquire(&data->share->counts);
+#else
+  (void)data;
+#endif
+}
+
+void Curl_share_unlock_counts(struct Curl_easy *data)
+{
+#ifdef SHARE_RWLOCKS
+  if(data && data->share)
+    Curl_mutex_release(&data->share->counts);
+#else
+  (void)data;
+#endif
+}
+
+#ifdef USE_SSL
+static void share_lock_sessions(struct Curl_share *share)
+{
+  if(share->specifier & (1 << CURL_LOCK_DATA_SSL_SESSION))
+    share_lock(share, NULL, CURL_LOCK_DATA_SSL_SESSION,
+               CURL_LOCK_ACCESS_SINGLE, -1);
+}
+
+static void share_unlock_sessions(struct Curl_share *share)
+{
+  if(share->specifier & (1 << CURL_LOCK_DATA_SSL_SESSION))
+    share_unlock(share, NULL, CURL_LOCK_DATA_SSL_SESSION, -1);
+}
+#endif
+
+CURLSHcode
+curl_share_export_ssl_sessions(struct Curl_share *share,
+                               curl_ssl_session_callback callback,
+                               void *userptr)
+{
+#ifdef USE_MBEDTLS
+  size_t i;
+
+  if(!share || !callback)
+    return CURLSHE_INVALID;
+  if(!share->sslsession)
+    return CURLSHE_OK;
+
+  share_lock_sessions(share);
+  for(i = 0; i < share->max_ssl_sessions; i++) {
+    struct curl_ssl_session *check = &share->sslsession[i];
+    unsigned char *blob;
+    size_t bloblen;
+
+    /* sessions made through a connect-to override belong to another host */
+    if(!check->sessionid || check->conn_to_host ||
+       !strcasecompare(check->scheme, "https"))
+      continue;
+    if(Curl_mbedtls_session_save(check->sessionid, &blob, &bloblen))
+      continue;
+    callback(check->name, check->remote_port, blob, bloblen, userptr);
+    free(blob);
   }
+  share_unlock_sessions(share);
+  return CURLSHE_OK;
+#else
+  (void)share;
+  (void)callback;
+  (void)userptr;
+  return CURLSHE_NOT_BUILT_IN;
+#endif
+}
+
+CURLSHcode
+curl_share_import_ssl_session(struct Curl_share *share, const char *host,
+                              int port, const unsigned char *blob,
+                              size_t bloblen)
+{
+#ifdef USE_MBEDTLS
+  struct curl_ssl_session *store;
+  void *sessionid;
+  char *name;
+  size_t i;
 
+  if(!share || !host || !blob)
+    return CURLSHE_INVALID;
+  if(!share->sslsession)
+    return CURLSHE_BAD_OPTION;
+
+  if(Curl_mbedtls_session_load(blob, bloblen, &sessionid))
+    return CURLSHE_INVALID;
+  name = strdup(host);
+  if(!name) {
+    Curl_ssl->session_free(sessionid);
+    return CURLSHE_NOMEM;
+  }
+
+  share_lock_sessions(share);
+  /* an empty slot, or else the oldest one */
+  store = &share->sslsession[0];
+  for(i = 1; i < share->max_ssl_sessions && store->sessionid; i++) {
+    if(!share->sslsession[i].sessionid ||
+       share->sslsession[i].age < store->age)
+      store = &share->sslsession[i];
+  }
+  if(store->sessionid)
+    Curl_ssl_kill_session(store);
+
+  store->name = name;
+  store->conn_to_host = NULL;
+  store->scheme = "https";
+  store->sessionid = sessionid;
+  store->idsize = 0;
+  store->remote_port = port;
+  store->conn_to_port = -1;
+  store->imported = TRUE;
+  store->age = ++share->sessionage;
+  share_unlock_sessions(share);
+  return CURLSHE_OK;
+#else
+  (void)share;
+  (void)host;
+  (void)port;
+  (void)blob;
+  (void)bloblen;
+  return CURLSHE_NOT_BUILT_IN;
+#endif
+}
+
+CURLSHcode
+curl_share_ssl_session_stats(struct Curl_share *share, long *handshakes,
+                             long *resumed)
+{
+  if(!share)
+    return CURLSHE_INVALID;
+#ifdef USE_SSL
+  share_lock_sessions(share);
+#endif
+  if(handshakes)
+    *handshakes = share->ssl_handshakes;
+  if(resumed)
+    *resumed = share->ssl_resumed;
+#ifdef USE_SSL
+  share_unlock_sessions(share);
+#endif
   return CURLSHE_OK;
 }
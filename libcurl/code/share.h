@@ -28,6 +28,7 @@
 #include "psl.h"
 #include "urldata.h"
 #include "conncache.h"
+#include "curl_threads.h"
 
 /* SalfordC says "A structure member may not be volatile". Hence:
  */
@@ -37,6 +38,16 @@
 #define CURL_VOLATILE volatile
 #endif
 
+/* With thread support the share locks itself: a reader/writer lock per
+   data type, and for DNS and cookies one per stripe of hash buckets so
+   that lookups of different hosts never meet. The application's lock
+   callbacks are then not called. */
+#if defined(USE_THREADS_POSIX) || defined(USE_THREADS_WIN32)
+#define SHARE_RWLOCKS
+#endif
+
+#define SHARE_STRIPES 16
+
 /* this struct is libcurl-private, don't export details */
 struct Curl_share {
   unsigned int specifier;
@@ -46,7 +57,7 @@ struct Curl_share {
   curl_unlock_function unlockfunc;
   void *clientdata;
   struct conncache conn_cache;
-  struct curl_hash hostcache;
+  struct Curl_dnscache hostcache;
 #if !defined(CURL_DISABLE_HTTP) && !defined(CURL_DISABLE_COOKIES)
   struct CookieInfo *cookies;
 #endif
@@ -57,10 +68,30 @@ struct Curl_share {
   struct curl_ssl_session *sslsession;
   size_t max_ssl_sessions;
   long sessionage;
+  long ssl_handshakes; /* TLS handshakes made by handles of this share */
+  long ssl_resumed;    /* ... of which resumed a cached session */
+
+#ifdef SHARE_RWLOCKS
+  curl_rwlock_t locks[CURL_LOCK_DATA_LAST];
+  curl_rwlock_t dns_stripes[SHARE_STRIPES];
+  curl_rwlock_t cookie_stripes[SHARE_STRIPES];
+  /* leaf lock for the counters that holders of different stripes update */
+  curl_mutex_t counts;
+#endif
 };
 
 CURLSHcode Curl_share_lock(struct Curl_easy *, curl_lock_data,
                            curl_lock_access);
 CURLSHcode Curl_share_unlock(struct Curl_easy *, curl_lock_data);
 
+/* Lock only the stripe of one hash bucket of the DNS cache or the cookie
+   jar; other data types, and shares without built-in locks, lock all of
+   the type. */
+CURLSHcode Curl_share_lock_bucket(struct Curl_easy *, curl_lock_data,
+                                  curl_lock_access, size_t bucket);
+CURLSHcode Curl_share_unlock_bucket(struct Curl_easy *, curl_lock_data,
+                                    size_t bucket);
+void Curl_share_lock_counts(struct Curl_easy *);
+void Curl_share_unlock_counts(struct Curl_easy *);
+
 #endif /* HEADER_CURL_SHARE_H */
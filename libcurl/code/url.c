@@ -1074,6 +1074,14 @@ ConnectionExists(struct Curl_easy *data,
       check = curr->ptr;
       curr = curr->next;
 
+#ifdef CONNCACHE_MUTEX
+      /* A cache shared between threads only hands out idle connections.
+         The others are changed by the thread using them, without the
+         shard lock held here. */
+      if(data->state.conn_cache->threaded && !check->idle_listed)
+        continue;
+#endif
+
       if(check->bits.connect_only)
         /* connect-only connections will not be reused */
         continue;
@@ -1356,7 +1364,7 @@ ConnectionExists(struct Curl_easy *data,
 
   if(chosen) {
     /* mark it as used before releasing the lock */
-    chosen->data = data; /* own it! */
+    Curl_conncache_claim_conn(data, chosen);
     Curl_conncache_unlock(data);
     *usethis = chosen;
     return TRUE; /* yes, we found one to use! */
@@ -266,6 +266,7 @@ struct curl_ssl_session {
   int remote_port;  /* remote port */
   int conn_to_port; /* remote port for the connection (may be -1) */
   struct ssl_primary_config ssl_config; /* setup for this session */
+  bool imported;    /* restored from a previous run, ssl_config not set */
 };
 
 #ifdef USE_WINDOWS_SSPI
@@ -793,6 +794,9 @@ struct connectdata {
   struct Curl_easy *data;
 
   struct curl_llist_element bundle_node; /* conncache */
+  struct curl_llist_element idle_node; /* conncache shard's idle list */
+  int conncache_shard; /* shard holding the bundle */
+  bool idle_listed; /* idle_node is in the shard's idle list */
 
   /* chunk is for HTTP chunked encoding, but is in the general connectdata
      struct only because we can do just about any protocol through a HTTP proxy
@@ -1362,6 +1366,7 @@ struct UrlState {
 #endif
   trailers_state trailers_state; /* whether we are sending trailers
                                        and what stage are we at */
+  int conncache_shard; /* conncache shard this handle has locked */
 #ifdef CURLDEBUG
   bit conncache_lock:1;
 #endif
@@ -1769,7 +1774,7 @@ struct UserDefined {
 };
 
 struct Names {
-  struct curl_hash *hostcache;
+  struct Curl_dnscache *hostcache;
   enum {
     HCACHE_NONE,    /* not pointing to anything */
     HCACHE_MULTI,   /* points to a shared one in the multi handle */
@@ -1809,6 +1814,10 @@ struct Curl_easy {
   int actions[MAX_SOCKSPEREASYHANDLE]; /* action for each socket in
                                           sockets[] */
   int numsocks;
+#ifdef USE_EPOLL
+  unsigned int epoll_round; /* the wait that last found one of sockets[] ready,
+                               see multi_epoll_ready() */
+#endif
 
   struct Names dns;
   struct Curl_multi *multi;    /* if non-NULL, points to the multi handle
@@ -73,6 +73,8 @@ struct ssl_backend_data {
   mbedtls_pk_context pk;
   mbedtls_ssl_config config;
   const char *protocols[3];
+  bool offered_session;               /* a cached session was offered */
+  unsigned char offered_master[48];   /* ... with this master secret */
 };
 
 #define BACKEND connssl->backend
@@ -445,10 +447,11 @@ mbed_connect_step1(struct connectdata *conn,
 
 #if defined(MBEDTLS_SSL_SESSION_TICKETS)
   mbedtls_ssl_conf_session_tickets(&BACKEND->config,
-                                   MBEDTLS_SSL_SESSION_TICKETS_DISABLED);
+                                   MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
 #endif
 
   /* Check if there's a cached ID we can/should use here! */
+  BACKEND->offered_session = FALSE;
   if(SSL_SET_OPTION(primary.sessionid)) {
     void *old_session = NULL;
 
@@ -460,6 +463,10 @@ mbed_connect_step1(struct connectdata *conn,
         failf(data, "mbedtls_ssl_set_session returned -0x%x", -ret);
         return CURLE_SSL_CONNECT_ERROR;
       }
+      BACKEND->offered_session = TRUE;
+      memcpy(BACKEND->offered_master,
+             ((mbedtls_ssl_session *)old_session)->master,
+             sizeof(BACKEND->offered_master));
       infof(data, "mbedTLS re-using session\n");
     }
     Curl_ssl_sessionid_unlock(conn);
@@ -569,6 +576,16 @@ mbed_connect_step2(struct connectdata *conn,
         mbedtls_ssl_get_ciphersuite(&BACKEND->ssl)
     );
 
+  {
+    /* a resumed handshake keeps the master secret of the offered session,
+       a full one negotiates a new one */
+    bool resumed = BACKEND->offered_session && BACKEND->ssl.session &&
+      !memcmp(BACKEND->ssl.session->master, BACKEND->offered_master,
+              sizeof(BACKEND->offered_master));
+    infof(data, "mbedTLS: %s handshake\n", resumed ? "abbreviated" : "full");
+    Curl_ssl_count_handshake(conn, resumed);
+  }
+
   ret = mbedtls_ssl_get_verify_result(&BACKEND->ssl);
 
   if(!SSL_CONN_CONFIG(verifyhost))
@@ -807,6 +824,196 @@ static ssize_t mbed_recv(struct connectdata *conn, int num,
   return len;
 }
 
+/*
+ * mbedTLS 2.16 has no session serialization, so the fields the client side
+ * needs to resume are written out here. All integers are little endian:
+ *
+ *   u8  version (1)        u64 start              u32 ciphersuite
+ *   u32 compression        u8  id_len, id[32]     master[48]
+ *   u32 verify_result      u32 cert_len, peer cert DER
+ *   u32 ticket_len, ticket u32 ticket_lifetime    u8  mfl_code
+ *   u8  trunc_hmac         u8  encrypt_then_mac
+ *
+ * Fields compiled out of this mbedTLS are written as zero.
+ */
+#define MBED_SESSION_BLOB_VERSION 1
+
+static void mbed_put(unsigned char **p, unsigned long long v, int bytes)
+{
+  int i;
+  for(i = 0; i < bytes; i++)
+    *(*p)++ = (unsigned char)(v >> (8 * i));
+}
+
+static unsigned long long mbed_get(const unsigned char **p, int bytes)
+{
+  unsigned long long v = 0;
+  int i;
+  for(i = 0; i < bytes; i++)
+    v |= (unsigned long long)(*(*p)++) << (8 * i);
+  return v;
+}
+
+CURLcode Curl_mbedtls_session_save(const void *sessionid,
+                                   unsigned char **blob, size_t *bloblen)
+{
+  const mbedtls_ssl_session *session = sessionid;
+  const unsigned char *cert = NULL;
+  size_t cert_len = 0;
+  const unsigned char *ticket = NULL;
+  size_t ticket_len = 0;
+  unsigned long long start = 0;
+  uint32_t ticket_lifetime = 0;
+  int mfl_code = 0, trunc_hmac = 0, etm = 0;
+  unsigned char *p;
+
+#if defined(MBEDTLS_HAVE_TIME)
+  start = (unsigned long long)session->start;
+#endif
+#if defined(MBEDTLS_X509_CRT_PARSE_C)
+  if(session->peer_cert) {
+    cert = session->peer_cert->raw.p;
+    cert_len = session->peer_cert->raw.len;
+  }
+#endif
+#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_CLI_C)
+  ticket = session->ticket;
+  ticket_len = session->ticket_len;
+  ticket_lifetime = session->ticket_lifetime;
+#endif
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+  mfl_code = session->mfl_code;
+#endif
+#if defined(MBEDTLS_SSL_TRUNCATED_HMAC)
+  trunc_hmac = session->trunc_hmac;
+#endif
+#if defined(MBEDTLS_SSL_ENCRYPT_THEN_MAC)
+  etm = session->encrypt_then_mac;
+#endif
+
+  *bloblen = 1 + 8 + 4 + 4 + 1 + 32 + 48 + 4 + 4 + cert_len + 4 +
+    ticket_len + 4 + 3;
+  *blob = malloc(*bloblen);
+  if(!*blob)
+    return CURLE_OUT_OF_MEMORY;
+
+  p = *blob;
+  mbed_put(&p, MBED_SESSION_BLOB_VERSION, 1);
+  mbed_put(&p, start, 8);
+  mbed_put(&p, (unsigned int)session->ciphersuite, 4);
+  mbed_put(&p, (unsigned int)session->compression, 4);
+  mbed_put(&p, session->id_len, 1);
+  memcpy(p, session->id, 32);
+  p += 32;
+  memcpy(p, session->master, 48);
+  p += 48;
+  mbed_put(&p, session->verify_result, 4);
+  mbed_put(&p, cert_len, 4);
+  if(cert_len)
+    memcpy(p, cert, cert_len);
+  p += cert_len;
+  mbed_put(&p, ticket_len, 4);
+  if(ticket_len)
+    memcpy(p, ticket, ticket_len);
+  p += ticket_len;
+  mbed_put(&p, ticket_lifetime, 4);
+  mbed_put(&p, (unsigned int)mfl_code, 1);
+  mbed_put(&p, (unsigned int)trunc_hmac, 1);
+  mbed_put(&p, (unsigned int)etm, 1);
+  return CURLE_OK;
+}
+
+CURLcode Curl_mbedtls_session_load(const unsigned char *blob,
+                                   size_t bloblen, void **sessionid)
+{
+  const unsigned char *p = blob;
+  const unsigned char *end = blob + bloblen;
+  mbedtls_ssl_session *session;
+  size_t cert_len, ticket_len;
+  unsigned long long start;
+
+  *sessionid = NULL;
+  /* the fixed part without the certificate and the ticket */
+  if(bloblen < 1 + 8 + 4 + 4 + 1 + 32 + 48 + 4 + 4 + 4 + 4 + 3 ||
+     mbed_get(&p, 1) != MBED_SESSION_BLOB_VERSION)
+    return CURLE_BAD_FUNCTION_ARGUMENT;
+
+  session = malloc(sizeof(mbedtls_ssl_session));
+  if(!session)
+    return CURLE_OUT_OF_MEMORY;
+  mbedtls_ssl_session_init(session);
+
+  start = mbed_get(&p, 8);
+#if defined(MBEDTLS_HAVE_TIME)
+  session->start = (mbedtls_time_t)start;
+#else
+  (void)start;
+#endif
+  session->ciphersuite = (int)mbed_get(&p, 4);
+  session->compression = (int)mbed_get(&p, 4);
+  session->id_len = (size_t)mbed_get(&p, 1);
+  memcpy(session->id, p, 32);
+  p += 32;
+  memcpy(session->master, p, 48);
+  p += 48;
+  session->verify_result = (uint32_t)mbed_get(&p, 4);
+
+  cert_len = (size_t)mbed_get(&p, 4);
+  if(cert_len > (size_t)(end - p) || session->id_len > 32)
+    goto bad;
+#if defined(MBEDTLS_X509_CRT_PARSE_C)
+  if(cert_len) {
+    session->peer_cert = Curl_mbedtls_calloc(1, sizeof(mbedtls_x509_crt));
+    if(!session->peer_cert)
+      goto bad;
+    mbedtls_x509_crt_init(session->peer_cert);
+    if(mbedtls_x509_crt_parse_der(session->peer_cert, p, cert_len))
+      goto bad;
+  }
+#endif
+  p += cert_len;
+
+  if((size_t)(end - p) < 4)
+    goto bad;
+  ticket_len = (size_t)mbed_get(&p, 4);
+  if(ticket_len > (size_t)(end - p) || (size_t)(end - p) - ticket_len != 7)
+    goto bad;
+#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_CLI_C)
+  if(ticket_len) {
+    session->ticket = Curl_mbedtls_calloc(1, ticket_len);
+    if(!session->ticket)
+      goto bad;
+    memcpy(session->ticket, p, ticket_len);
+    session->ticket_len = ticket_len;
+  }
+  p += ticket_len;
+  session->ticket_lifetime = (uint32_t)mbed_get(&p, 4);
+#else
+  p += ticket_len + 4;
+#endif
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+  session->mfl_code = (unsigned char)mbed_get(&p, 1);
+#else
+  p++;
+#endif
+#if defined(MBEDTLS_SSL_TRUNCATED_HMAC)
+  session->trunc_hmac = (int)mbed_get(&p, 1);
+#else
+  p++;
+#endif
+#if defined(MBEDTLS_SSL_ENCRYPT_THEN_MAC)
+  session->encrypt_then_mac = (int)mbed_get(&p, 1);
+#endif
+
+  *sessionid = session;
+  return CURLE_OK;
+
+bad:
+  mbedtls_ssl_session_free(session);
+  free(session);
+  return CURLE_BAD_FUNCTION_ARGUMENT;
+}
+
 static void Curl_mbedtls_session_free(void *ptr)
 {
   mbedtls_ssl_session_free(ptr);
@@ -28,5 +28,15 @@
 
 extern const struct Curl_ssl Curl_ssl_mbedtls;
 
+/* write a cached session to a malloc'ed blob, and make one from a blob */
+CURLcode Curl_mbedtls_session_save(const void *sessionid,
+                                   unsigned char **blob, size_t *bloblen);
+CURLcode Curl_mbedtls_session_load(const unsigned char *blob,
+                                   size_t bloblen, void **sessionid);
+
+/* mbedtls_calloc() as mbedTLS itself sees it, for memory handed over to
+   mbedTLS, which frees it with mbedtls_free() and not with curl's free() */
+void *Curl_mbedtls_calloc(size_t nmemb, size_t size);
+
 #endif /* USE_MBEDTLS */
 #endif /* HEADER_CURL_MBEDTLS_H */
@@ -338,7 +338,8 @@ bool Curl_ssl_getsessionid(struct connectdata *conn,
     if(!check->sessionid)
       /* not session ID means blank entry */
       continue;
-    if(strcasecompare(name, check->name) &&
+    if(!check->imported &&
+       strcasecompare(name, check->name) &&
        ((!conn->bits.conn_to_host && !check->conn_to_host) ||
         (conn->bits.conn_to_host && check->conn_to_host &&
          strcasecompare(conn->conn_to_host.name, check->conn_to_host))) &&
@@ -357,6 +358,24 @@ bool Curl_ssl_getsessionid(struct connectdata *conn,
       no_match = FALSE;
       break;
     }
+    if(check->imported &&
+       strcasecompare(name, check->name) &&
+       !conn->bits.conn_to_host && !conn->bits.conn_to_port &&
+       (port == check->remote_port) &&
+       strcasecompare(conn->handler->scheme, check->scheme)) {
+      /* restored from disk without an ssl config, the first connection to
+         the host adopts it */
+      if(!Curl_clone_primary_ssl_config(ssl_config, &check->ssl_config))
+        continue;
+      check->imported = FALSE;
+      (*general_age)++;
+      check->age = *general_age;
+      *ssl_sessionid = check->sessionid;
+      if(idsize)
+        *idsize = check->idsize;
+      no_match = FALSE;
+      break;
+    }
   }
 
   return no_match;
@@ -376,7 +395,10 @@ void Curl_ssl_kill_session(struct curl_ssl_session *session)
     session->sessionid = NULL;
     session->age = 0; /* fresh */
 
-    Curl_free_primary_ssl_config(&session->ssl_config);
+    if(session->imported)
+      session->imported = FALSE;
+    else
+      Curl_free_primary_ssl_config(&session->ssl_config);
 
     Curl_safefree(session->name);
     Curl_safefree(session->conn_to_host);
@@ -401,6 +423,24 @@ void Curl_ssl_delsessionid(struct connectdata *conn, void *ssl_sessionid)
   }
 }
 
+/*
+ * Count a completed handshake, and whether it resumed a cached session, in
+ * the share so that the application can report the resumption rate.
+ */
+void Curl_ssl_count_handshake(struct connectdata *conn, bool resumed)
+{
+  struct Curl_easy *data = conn->data;
+
+  if(!SSLSESSION_SHARED(data))
+    return;
+
+  Curl_ssl_sessionid_lock(conn);
+  data->share->ssl_handshakes++;
+  if(resumed)
+    data->share->ssl_resumed++;
+  Curl_ssl_sessionid_unlock(conn);
+}
+
 /*
  * Store session id in the session cache. The ID passed on to this function
  * must already have been extracted and allocated the proper way for the SSL
@@ -474,6 +514,7 @@ CURLcode Curl_ssl_addsessionid(struct connectdata *conn,
   /* now init the session struct wisely */
   store->sessionid = ssl_sessionid;
   store->idsize = idsize;
+  store->imported = FALSE;
   store->age = *general_age;    /* set current age */
   /* free it if there's one already present */
   free(store->name);
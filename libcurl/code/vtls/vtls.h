@@ -228,6 +228,10 @@ void Curl_ssl_kill_session(struct curl_ssl_session *session);
  * (e.g. decrement refcount).
  */
 void Curl_ssl_delsessionid(struct connectdata *conn, void *ssl_sessionid);
+/* count a finished handshake in the share, if the session cache is shared
+ * Sessionid mutex must NOT be locked.
+ */
+void Curl_ssl_count_handshake(struct connectdata *conn, bool resumed);
 
 /* get N random bytes into the buffer */
 CURLcode Curl_ssl_random(struct Curl_easy *data, unsigned char *buffer,
@@ -268,6 +272,7 @@ bool Curl_ssl_false_start(void);
 #define Curl_ssl_free_certinfo(x) Curl_nop_stmt
 #define Curl_ssl_connect_nonblocking(x,y,z) CURLE_NOT_BUILT_IN
 #define Curl_ssl_kill_session(x) Curl_nop_stmt
+#define Curl_ssl_count_handshake(x,y) Curl_nop_stmt
 #define Curl_ssl_random(x,y,z) ((void)x, CURLE_NOT_BUILT_IN)
 #define Curl_ssl_cert_status_request() FALSE
 #define Curl_ssl_false_start() FALSE
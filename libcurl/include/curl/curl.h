@@ -2693,6 +2693,12 @@ typedef enum {
   CURLSHE_LAST        /* never use */
 } CURLSHcode;
 
+/*
+ * When libcurl is built with thread support (POSIX threads or Windows
+ * threads) a share handle locks its data itself, and the functions set with
+ * CURLSHOPT_LOCKFUNC and CURLSHOPT_UNLOCKFUNC are never called. They are
+ * still accepted, so the same application code works with both builds.
+ */
 typedef enum {
   CURLSHOPT_NONE,  /* don't use */
   CURLSHOPT_SHARE,   /* specify a data type to share */
@@ -2708,6 +2714,30 @@ CURL_EXTERN CURLSH *curl_share_init(void);
 CURL_EXTERN CURLSHcode curl_share_setopt(CURLSH *, CURLSHoption option, ...);
 CURL_EXTERN CURLSHcode curl_share_cleanup(CURLSH *);
 
+/*
+ * Keeping the TLS sessions of a share across process restarts (mbedTLS
+ * builds only). curl_share_export_ssl_sessions() calls the callback once
+ * for every cached session with an opaque blob; handing the blob back to
+ * curl_share_import_ssl_session() lets the next connection to that host
+ * and port resume with an abbreviated handshake. The blobs hold session
+ * secrets and should be stored accordingly.
+ */
+typedef void (*curl_ssl_session_callback)(const char *host, int port,
+                                          const unsigned char *blob,
+                                          size_t bloblen, void *userptr);
+CURL_EXTERN CURLSHcode curl_share_export_ssl_sessions(CURLSH *share,
+                                          curl_ssl_session_callback callback,
+                                          void *userptr);
+CURL_EXTERN CURLSHcode curl_share_import_ssl_session(CURLSH *share,
+                                                     const char *host,
+                                                     int port,
+                                                     const unsigned char *blob,
+                                                     size_t bloblen);
+/* TLS handshakes made through the share, and how many of them resumed */
+CURL_EXTERN CURLSHcode curl_share_ssl_session_stats(CURLSH *share,
+                                                    long *handshakes,
+                                                    long *resumed);
+
 /****************************************************************************
  * Structures for querying information about the curl library at runtime.
  */
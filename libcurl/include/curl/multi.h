@@ -396,6 +396,11 @@ typedef enum {
   /* This is the argument passed to the server push callback */
   CINIT(PUSHDATA, OBJECTPOINT, 15),
 
+  /* Wait in curl_multi_wait() and curl_multi_poll() with epoll (1, the
+     default on Linux) or with poll() (0). Builds without epoll return
+     CURLM_UNKNOWN_OPTION for 1 */
+  CINIT(WAIT_EPOLL, LONG, 16),
+
   CURLMOPT_LASTENTRY /* the last unused */
 } CURLMoption;
 
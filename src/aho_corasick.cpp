@@ -0,0 +1,101 @@
+#include <algorithm>
+#include <deque>
+
+#include "aho_corasick.h"
+
+AhoCorasick::AhoCorasick()
+	: patternCount( 0 )
+{
+	nodes.resize( 1 );
+	nodes[0].fail  = 0;
+	nodes[0].flags = 0;
+}
+
+int AhoCorasick::Child( int node, uint8_t c ) const
+{
+	const std::vector<Edge>& edges = nodes[node].edges;
+	auto it = std::lower_bound( edges.begin(), edges.end(), c, []( const Edge& e, uint8_t v ) { return e.c < v; } );
+	if ( it != edges.end() && it->c == c ) {
+		return it->next;
+	}
+	return -1;
+}
+
+void AhoCorasick::AddPattern( const std::string& pattern, uint32_t flags )
+{
+	if ( pattern.length() == 0 ) {
+		return;
+	}
+	int node = 0;
+	for ( size_t i = 0; i < pattern.length(); ++i ) {
+		uint8_t c = (uint8_t)pattern[i];
+		int next = Child( node, c );
+		if ( next < 0 ) {
+			next = (int)nodes.size();
+			Node n;
+			n.fail  = 0;
+			n.flags = 0;
+			nodes.push_back( n );
+
+			std::vector<Edge>& edges = nodes[node].edges;
+			Edge e;
+			e.c    = c;
+			e.next = next;
+			edges.insert( std::lower_bound( edges.begin(), edges.end(), c, []( const Edge& a, uint8_t v ) { return a.c < v; } ), e );
+		}
+		node = next;
+	}
+	nodes[node].flags |= flags;
+	patternCount++;
+}
+
+void AhoCorasick::Build()
+{
+	// Breadth first, so the fail target of a node is always done before it.
+	std::deque<int> queue;
+	for ( size_t i = 0; i < nodes[0].edges.size(); ++i ) {
+		int child = nodes[0].edges[i].next;
+		nodes[child].fail = 0;
+		queue.push_back( child );
+	}
+	while ( queue.size() > 0 ) {
+		int node = queue.front();
+		queue.pop_front();
+		for ( size_t i = 0; i < nodes[node].edges.size(); ++i ) {
+			uint8_t c   = nodes[node].edges[i].c;
+			int child   = nodes[node].edges[i].next;
+			int fail    = nodes[node].fail;
+			int target  = Child( fail, c );
+			while ( target < 0 && fail != 0 ) {
+				fail   = nodes[fail].fail;
+				target = Child( fail, c );
+			}
+			nodes[child].fail   = ( target >= 0 && target != child ) ? target : 0;
+			nodes[child].flags |= nodes[nodes[child].fail].flags;
+			queue.push_back( child );
+		}
+	}
+}
+
+int AhoCorasick::Next( int node, uint8_t c ) const
+{
+	while ( true ) {
+		int next = Child( node, c );
+		if ( next >= 0 ) {
+			return next;
+		}
+		if ( node == 0 ) {
+			return 0;
+		}
+		node = nodes[node].fail;
+	}
+}
+
+int AhoCorasick::Feed( int state, const char* text, size_t length, uint32_t& flags ) const
+{
+	for ( size_t i = 0; i < length; ++i ) {
+		state = Next( state, (uint8_t)text[i] );
+		flags |= nodes[state].flags;
+	}
+	return state;
+}
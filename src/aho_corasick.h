@@ -0,0 +1,62 @@
+#ifndef AHO_CORASICK_H_191024102218
+#define AHO_CORASICK_H_191024102218
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Byte level Aho-Corasick automaton. Every pattern carries a set of flag
+// bits, a scan returns the union of the flags of all patterns found in
+// the text. UTF-8 needs no special care since matching is byte exact.
+// Scanning costs O(text length) no matter how many patterns there are.
+class AhoCorasick
+{
+public:
+	AhoCorasick();
+
+	void AddPattern( const std::string& pattern, uint32_t flags );
+	// Must be called after the last AddPattern and before scanning.
+	void Build();
+
+	// State to start scanning from, scans can be chained through Feed.
+	int  Start() const
+	{
+		return 0;
+	}
+	int  Feed( int state, const char* text, size_t length, uint32_t& inOutFlags ) const;
+
+	uint32_t Scan( const std::string& text ) const
+	{
+		uint32_t flags = 0;
+		Feed( Start(), text.data(), text.length(), flags );
+		return flags;
+	}
+
+	bool Empty() const
+	{
+		return nodes.size() <= 1;
+	}
+	size_t PatternCount() const
+	{
+		return patternCount;
+	}
+
+private:
+	struct Edge {
+		uint8_t c;
+		int     next;
+	};
+	struct Node {
+		std::vector<Edge> edges; // Sorted by c.
+		int               fail;
+		uint32_t          flags; // Own flags plus those of the fail chain.
+	};
+
+	int  Child( int node, uint8_t c ) const;
+	int  Next( int node, uint8_t c ) const;
+
+	std::vector<Node> nodes;
+	size_t            patternCount;
+};
+
+#endif // #ifndef AHO_CORASICK_H_191024102218
@@ -0,0 +1,321 @@
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#define CURL_STATICLIB
+#include "curl/curl.h"
+#include "mbedtls/platform.h"
+
+#include "alloc_profile.h"
+
+// Every counted block starts with this header, so a free knows the size
+// and the counters it came from. 16 bytes keep the block aligned.
+struct AllocHeader {
+	size_t  size;
+	uint8_t subsystem;
+	uint8_t phase;
+	uint8_t pad[6];
+};
+static_assert( sizeof( AllocHeader ) == 16, "header must keep malloc alignment" );
+
+// Size histogram buckets: <=16, <=32, ... <=1M, larger.
+static const int ALLOC_BUCKETS     = 18;
+static const int ALLOC_FIRST_SHIFT = 4;
+
+struct AllocCounters {
+	std::atomic<int64_t> allocs;
+	std::atomic<int64_t> bytes;
+	std::atomic<int64_t> live;
+	std::atomic<int64_t> peak;
+};
+
+static struct {
+	AllocCounters        cells[ALLOC_SUBSYSTEM_COUNT][ALLOC_PHASE_COUNT];
+	AllocCounters        subsystems[ALLOC_SUBSYSTEM_COUNT];
+	std::atomic<int64_t> histogram[ALLOC_SUBSYSTEM_COUNT][ALLOC_BUCKETS];
+	std::atomic<int64_t> live;
+	std::atomic<int64_t> peak;
+	bool                 mbedtlsHooked;
+} gsAlloc;
+
+static thread_local uint8_t gtAllocPhase = ALLOC_PHASE_OTHER;
+
+static const char* ALLOC_SUBSYSTEM_NAMES[ALLOC_SUBSYSTEM_COUNT] = { "app", "curl", "mbedtls" };
+static const char* ALLOC_PHASE_NAMES[ALLOC_PHASE_COUNT] = { "other", "fetch", "tls", "parse", "layout", "render" };
+
+// Decided once, on the first allocation of the process, which happens
+// before main and before any other thread exists. Blocks with and without
+// a header can never be mixed.
+static bool Alloc_CheckEnabled( void )
+{
+	static const bool enabled = getenv( "CSMTH_ALLOC_PROFILE" ) != nullptr;
+	return enabled;
+}
+
+bool Alloc_Enabled( void )
+{
+	return Alloc_CheckEnabled();
+}
+
+static void Alloc_RaisePeak( std::atomic<int64_t>& peak, int64_t value )
+{
+	int64_t old = peak.load( std::memory_order_relaxed );
+	while ( value > old && !peak.compare_exchange_weak( old, value, std::memory_order_relaxed ) ) {
+	}
+}
+
+static int Alloc_Bucket( size_t size )
+{
+	int bucket = 0;
+	while ( bucket < ALLOC_BUCKETS - 1 && size > ( (size_t)1 << ( ALLOC_FIRST_SHIFT + bucket ) ) ) {
+		++bucket;
+	}
+	return bucket;
+}
+
+static void Alloc_Count( AllocCounters& c, int64_t delta, bool isAlloc )
+{
+	if ( isAlloc ) {
+		c.allocs.fetch_add( 1, std::memory_order_relaxed );
+		c.bytes.fetch_add( delta, std::memory_order_relaxed );
+	}
+	Alloc_RaisePeak( c.peak, c.live.fetch_add( delta, std::memory_order_relaxed ) + delta );
+}
+
+static void* Alloc_Take( size_t size, AllocSubsystem subsystem, AllocPhaseId phase, bool zero )
+{
+	AllocHeader* h = (AllocHeader*)( zero ? calloc( 1, sizeof( AllocHeader ) + size ) : malloc( sizeof( AllocHeader ) + size ) );
+	if ( h == nullptr ) {
+		return nullptr;
+	}
+	h->size      = size;
+	h->subsystem = (uint8_t)subsystem;
+	h->phase     = (uint8_t)phase;
+
+	Alloc_Count( gsAlloc.cells[subsystem][phase], (int64_t)size, true );
+	Alloc_Count( gsAlloc.subsystems[subsystem], (int64_t)size, true );
+	gsAlloc.histogram[subsystem][Alloc_Bucket( size )].fetch_add( 1, std::memory_order_relaxed );
+	Alloc_RaisePeak( gsAlloc.peak, gsAlloc.live.fetch_add( (int64_t)size, std::memory_order_relaxed ) + (int64_t)size );
+	return h + 1;
+}
+
+static AllocHeader* Alloc_Release( void* p )
+{
+	AllocHeader* h = (AllocHeader*)p - 1;
+	int64_t size = (int64_t)h->size;
+	Alloc_Count( gsAlloc.cells[h->subsystem][h->phase], -size, false );
+	Alloc_Count( gsAlloc.subsystems[h->subsystem], -size, false );
+	gsAlloc.live.fetch_sub( size, std::memory_order_relaxed );
+	return h;
+}
+
+static void Alloc_Give( void* p )
+{
+	if ( p != nullptr ) {
+		free( Alloc_Release( p ) );
+	}
+}
+
+static void* Alloc_CurlMalloc( size_t size )
+{
+	return Alloc_Take( size, ALLOC_CURL, (AllocPhaseId)gtAllocPhase, false );
+}
+
+static void* Alloc_CurlCalloc( size_t n, size_t size )
+{
+	if ( size != 0 && n > SIZE_MAX / size ) {
+		return nullptr;
+	}
+	return Alloc_Take( n * size, ALLOC_CURL, (AllocPhaseId)gtAllocPhase, true );
+}
+
+static void* Alloc_CurlRealloc( void* p, size_t size )
+{
+	if ( p == nullptr ) {
+		return Alloc_CurlMalloc( size );
+	}
+	void* q = Alloc_CurlMalloc( size );
+	if ( q != nullptr ) {
+		size_t old = ( (AllocHeader*)p - 1 )->size;
+		memcpy( q, p, old < size ? old : size );
+		Alloc_Give( p );
+	}
+	return q;
+}
+
+static char* Alloc_CurlStrdup( const char* s )
+{
+	size_t n = strlen( s ) + 1;
+	char* p = (char*)Alloc_CurlMalloc( n );
+	if ( p != nullptr ) {
+		memcpy( p, s, n );
+	}
+	return p;
+}
+
+#if defined(MBEDTLS_PLATFORM_MEMORY) && !defined(MBEDTLS_PLATFORM_CALLOC_MACRO)
+static void* Alloc_MbedtlsCalloc( size_t n, size_t size )
+{
+	if ( size != 0 && n > SIZE_MAX / size ) {
+		return nullptr;
+	}
+	return Alloc_Take( n * size, ALLOC_MBEDTLS, ALLOC_PHASE_TLS, true );
+}
+#endif
+
+static void Alloc_Report( FILE* out )
+{
+	int64_t allocs = 0, bytes = 0;
+	for ( int s = 0; s < ALLOC_SUBSYSTEM_COUNT; ++s ) {
+		allocs += gsAlloc.subsystems[s].allocs;
+		bytes  += gsAlloc.subsystems[s].bytes;
+	}
+	fprintf( out, "allocation profile: peak live %.1f KB, %lld allocations, %.1f KB total, %.1f KB still live\n",
+			gsAlloc.peak / 1024.0, (long long)allocs, bytes / 1024.0, gsAlloc.live / 1024.0 );
+	if ( !gsAlloc.mbedtlsHooked ) {
+		fprintf( out, "  mbedtls not counted, built without MBEDTLS_PLATFORM_MEMORY\n" );
+	}
+
+	fprintf( out, "\n  %-8s %-7s %10s %12s %12s %12s\n", "", "phase", "allocs", "bytes", "live", "peak live" );
+	for ( int s = 0; s < ALLOC_SUBSYSTEM_COUNT; ++s ) {
+		for ( int p = 0; p < ALLOC_PHASE_COUNT; ++p ) {
+			AllocCounters& c = gsAlloc.cells[s][p];
+			if ( c.allocs == 0 ) {
+				continue;
+			}
+			fprintf( out, "  %-8s %-7s %10lld %12lld %12lld %12lld\n", ALLOC_SUBSYSTEM_NAMES[s], ALLOC_PHASE_NAMES[p],
+					(long long)c.allocs, (long long)c.bytes, (long long)c.live, (long long)c.peak );
+		}
+		AllocCounters& t = gsAlloc.subsystems[s];
+		fprintf( out, "  %-8s %-7s %10lld %12lld %12lld %12lld\n", ALLOC_SUBSYSTEM_NAMES[s], "all",
+				(long long)t.allocs, (long long)t.bytes, (long long)t.live, (long long)t.peak );
+	}
+
+	fprintf( out, "\n  allocations by size\n  %-8s", "" );
+	for ( int b = 0; b < ALLOC_BUCKETS; ++b ) {
+		size_t limit = (size_t)1 << ( ALLOC_FIRST_SHIFT + b );
+		char label[16];
+		if ( b == ALLOC_BUCKETS - 1 ) {
+			snprintf( label, sizeof( label ), ">%uK", (unsigned)( limit / 2048 ) );
+		}
+		else if ( limit >= 1024 ) {
+			snprintf( label, sizeof( label ), "%uK", (unsigned)( limit / 1024 ) );
+		}
+		else {
+			snprintf( label, sizeof( label ), "%u", (unsigned)limit );
+		}
+		fprintf( out, " %7s", label );
+	}
+	fprintf( out, "\n" );
+	for ( int s = 0; s < ALLOC_SUBSYSTEM_COUNT; ++s ) {
+		fprintf( out, "  %-8s", ALLOC_SUBSYSTEM_NAMES[s] );
+		for ( int b = 0; b < ALLOC_BUCKETS; ++b ) {
+			fprintf( out, " %7lld", (long long)gsAlloc.histogram[s][b] );
+		}
+		fprintf( out, "\n" );
+	}
+}
+
+static void Alloc_ReportAtExit( void )
+{
+	const char* target = getenv( "CSMTH_ALLOC_PROFILE" );
+	FILE* out = ( target != nullptr && strcmp( target, "1" ) != 0 ) ? fopen( target, "w" ) : nullptr;
+	Alloc_Report( out != nullptr ? out : stderr );
+	if ( out != nullptr ) {
+		fclose( out );
+	}
+}
+
+void Alloc_Install( void )
+{
+	if ( !Alloc_Enabled() ) {
+		return;
+	}
+	curl_global_init_mem( CURL_GLOBAL_ALL, Alloc_CurlMalloc, Alloc_Give, Alloc_CurlRealloc, Alloc_CurlStrdup, Alloc_CurlCalloc );
+#if defined(MBEDTLS_PLATFORM_MEMORY) && !defined(MBEDTLS_PLATFORM_CALLOC_MACRO)
+	mbedtls_platform_set_calloc_free( Alloc_MbedtlsCalloc, Alloc_Give );
+	gsAlloc.mbedtlsHooked = true;
+#endif
+	atexit( Alloc_ReportAtExit );
+}
+
+AllocPhase::AllocPhase( AllocPhaseId phase )
+	: previous( (AllocPhaseId)gtAllocPhase )
+{
+	gtAllocPhase = (uint8_t)phase;
+}
+
+AllocPhase::~AllocPhase()
+{
+	gtAllocPhase = (uint8_t)previous;
+}
+
+void* operator new( size_t size )
+{
+	if ( size == 0 ) {
+		size = 1;
+	}
+	void* p = Alloc_CheckEnabled() ? Alloc_Take( size, ALLOC_APP, (AllocPhaseId)gtAllocPhase, false ) : malloc( size );
+	if ( p == nullptr ) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void* operator new[]( size_t size )
+{
+	return operator new( size );
+}
+
+void* operator new( size_t size, const std::nothrow_t& ) noexcept
+{
+	try {
+		return operator new( size );
+	}
+	catch ( ... ) {
+		return nullptr;
+	}
+}
+
+void* operator new[]( size_t size, const std::nothrow_t& ) noexcept
+{
+	return operator new( size, std::nothrow );
+}
+
+void operator delete( void* p ) noexcept
+{
+	if ( Alloc_CheckEnabled() ) {
+		Alloc_Give( p );
+	}
+	else {
+		free( p );
+	}
+}
+
+void operator delete[]( void* p ) noexcept
+{
+	operator delete( p );
+}
+
+void operator delete( void* p, size_t ) noexcept
+{
+	operator delete( p );
+}
+
+void operator delete[]( void* p, size_t ) noexcept
+{
+	operator delete( p );
+}
+
+void operator delete( void* p, const std::nothrow_t& ) noexcept
+{
+	operator delete( p );
+}
+
+void operator delete[]( void* p, const std::nothrow_t& ) noexcept
+{
+	operator delete( p );
+}
@@ -0,0 +1,45 @@
+#ifndef ALLOC_PROFILE_H_191113101204
+#define ALLOC_PROFILE_H_191113101204
+
+// Opt-in allocation profiler, on when CSMTH_ALLOC_PROFILE is set before
+// start: "1" reports to stderr at exit, anything else is a file to write
+// the report to. Allocations of the app (operator new), libcurl and
+// mbedTLS are counted per subsystem and per navigation phase, with peak
+// live bytes and size histograms. Off, operator new is plain malloc.
+
+enum AllocSubsystem {
+	ALLOC_APP,
+	ALLOC_CURL,
+	ALLOC_MBEDTLS,
+	ALLOC_SUBSYSTEM_COUNT,
+};
+
+enum AllocPhaseId {
+	ALLOC_PHASE_OTHER,
+	ALLOC_PHASE_FETCH,
+	ALLOC_PHASE_TLS,
+	ALLOC_PHASE_PARSE,
+	ALLOC_PHASE_LAYOUT,
+	ALLOC_PHASE_RENDER,
+	ALLOC_PHASE_COUNT,
+};
+
+bool Alloc_Enabled( void );
+
+// Routes libcurl and mbedTLS through the counting allocator; call first
+// thing in main, before any curl call.
+void Alloc_Install( void );
+
+// Marks the allocations of this thread as belonging to a phase for the
+// lifetime of the scope. mbedTLS allocations always count as TLS.
+class AllocPhase
+{
+public:
+	explicit AllocPhase( AllocPhaseId phase );
+	~AllocPhase();
+
+private:
+	AllocPhaseId previous;
+};
+
+#endif // #ifndef ALLOC_PROFILE_H_191113101204
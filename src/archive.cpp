@@ -0,0 +1,148 @@
+#include <cstdio>
+#include <cstring>
+#include <set>
+
+#include "net_util.h"
+#include "read_state.h"
+#include "archive_file.h"
+#include "smth.h"
+#include "archive.h"
+
+static std::string Archive_PageUrl( const std::string& url, size_t pageIndex )
+{
+	return pageIndex > 1 ? url + "?p=" + std::to_string( pageIndex ) : url;
+}
+
+// Fetches all pages of the threads with bounded parallelism and writes
+// one block per thread. First pages tell the page count, the remaining
+// pages of all threads go in a second batch.
+static bool Archive_AddThreads( ArchiveWriter& writer, const std::vector<std::string>& threadUrls, size_t& outPages )
+{
+	std::vector<std::string> firstPages = Net_GetAll( threadUrls );
+
+	std::vector<std::string> urls;
+	std::vector<size_t>      owners;
+	std::vector<ArchivePages> threads( threadUrls.size() );
+	for ( size_t i = 0; i < threadUrls.size(); ++i ) {
+		ArticlePage page;
+		Smth_GetArticlePage( firstPages[i], page );
+		if ( page.items.size() == 0 ) {
+			continue;
+		}
+		threads[i].push_back( std::make_pair( threadUrls[i], firstPages[i] ) );
+		for ( size_t p = 2; p <= page.pageCount; ++p ) {
+			urls.push_back( Archive_PageUrl( threadUrls[i], p ) );
+			owners.push_back( i );
+		}
+	}
+	std::vector<std::string> rest = Net_GetAll( urls );
+	for ( size_t i = 0; i < rest.size(); ++i ) {
+		threads[owners[i]].push_back( std::make_pair( urls[i], rest[i] ) );
+	}
+
+	for ( size_t i = 0; i < threads.size(); ++i ) {
+		std::string board;
+		uint32_t id = 0;
+		ReadState_ParseArticleUrl( threadUrls[i], board, id );
+		if ( !writer.AddBlock( id, threads[i] ) ) {
+			return false;
+		}
+		outPages += threads[i].size();
+	}
+	return true;
+}
+
+static int Archive_Create( const std::string& path, const std::vector<std::string>& targets, size_t maxPages )
+{
+	ArchiveWriter writer;
+	if ( !writer.Create( path ) ) {
+		wprintf( L"cannot create %S\n", path.c_str() );
+		return 1;
+	}
+
+	std::string startUrl;
+	std::set<std::string> archived;
+	size_t pageCount = 0;
+	for ( size_t t = 0; t < targets.size(); ++t ) {
+		const std::string& target = targets[t];
+		if ( target.find( "/article/" ) != std::string::npos ) {
+			std::string url = target.substr( target.find( "/article/" ) );
+			url = SMTH_DOMAIN + url.substr( 0, url.find( '?' ) );
+			if ( startUrl.length() == 0 ) {
+				startUrl = url;
+			}
+			if ( archived.insert( url ).second && !Archive_AddThreads( writer, std::vector<std::string>( 1, url ), pageCount ) ) {
+				wprintf( L"cannot write %S\n", path.c_str() );
+				return 1;
+			}
+			continue;
+		}
+
+		std::string boardUrl = SMTH_DOMAIN + "/board/" + target;
+		if ( startUrl.length() == 0 ) {
+			startUrl = boardUrl;
+		}
+		size_t lastPage = maxPages;
+		for ( size_t p = 1; p <= lastPage; ++p ) {
+			std::string url = Archive_PageUrl( boardUrl, p );
+			std::string html = Net_Get( url );
+			BoardPage page;
+			Smth_GetBoardPage( html, page );
+			if ( page.items.size() == 0 ) {
+				break;
+			}
+			if ( page.pageCount < lastPage ) {
+				lastPage = page.pageCount;
+			}
+
+			// Only the board page and its threads are in memory at a time.
+			std::vector<std::string> threadUrls;
+			for ( size_t i = 0; i < page.items.size(); ++i ) {
+				std::string threadUrl = SMTH_DOMAIN + page.items[i].url;
+				if ( archived.insert( threadUrl ).second ) {
+					threadUrls.push_back( threadUrl );
+				}
+			}
+			ArchivePages boardPages( 1, std::make_pair( url, html ) );
+			if ( !writer.AddBlock( 0, boardPages ) || !Archive_AddThreads( writer, threadUrls, pageCount ) ) {
+				wprintf( L"cannot write %S\n", path.c_str() );
+				return 1;
+			}
+			pageCount++;
+			wprintf( L"\r  %S: page %d of %d, %d pages archived   ", target.c_str(), (int)p, (int)lastPage, (int)pageCount );
+		}
+		wprintf( L"\n" );
+	}
+
+	if ( !writer.Finish( startUrl ) ) {
+		wprintf( L"cannot write %S\n", path.c_str() );
+		return 1;
+	}
+	wprintf( L"%d pages in %d blocks written to %S\n", (int)pageCount, (int)writer.BlockCount(), path.c_str() );
+	return 0;
+}
+
+int Archive_Run( int argc, char* argv[] )
+{
+	std::vector<std::string> targets;
+	size_t maxPages = (size_t)-1;
+	for ( int i = 1; i < argc; ++i ) {
+		if ( strcmp( argv[i], "--pages" ) == 0 && i + 1 < argc ) {
+			maxPages = (size_t)atoi( argv[++i] );
+		}
+		else {
+			targets.push_back( argv[i] );
+		}
+	}
+	if ( argc < 1 || targets.size() == 0 ) {
+		wprintf( L"usage: csmth archive <file> <board|article-url>... [--pages N]\n" );
+		return 1;
+	}
+
+	if ( !Smth_NetInit() ) {
+		return 1;
+	}
+	int result = Archive_Create( argv[0], targets, maxPages );
+	Smth_NetDeinit();
+	return result;
+}
@@ -0,0 +1,9 @@
+#ifndef ARCHIVE_H_191028113402
+#define ARCHIVE_H_191028113402
+
+// Runs "csmth archive <file> <board|article-url>... [--pages N]" and
+// returns the process exit code. Boards are archived with their first N
+// board pages (all by default) and every thread listed on them.
+int Archive_Run( int argc, char* argv[] );
+
+#endif // #ifndef ARCHIVE_H_191028113402
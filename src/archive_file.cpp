@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <cstring>
+
+#include "bin_stream.h"
+#include "fnv_hash.h"
+#include "lz_block.h"
+#include "archive_file.h"
+
+static const char     ARCHIVE_MAGIC[4]  = { 'C', 'A', 'R', 'C' };
+static const char     ARCHIVE_FOOTER[4] = { 'C', 'A', 'R', 'X' };
+static const uint32_t ARCHIVE_VERSION   = 1;
+// index offset, index size, magic
+static const size_t   ARCHIVE_FOOTER_SIZE = 8 + 4 + 4;
+
+ArchiveWriter::ArchiveWriter()
+	: fp( nullptr ), offset( 0 )
+{
+}
+
+ArchiveWriter::~ArchiveWriter()
+{
+	if ( fp != nullptr ) {
+		fclose( fp );
+	}
+}
+
+bool ArchiveWriter::Create( const std::string& path )
+{
+	fp = fopen( path.c_str(), "wb" );
+	if ( fp == nullptr ) {
+		return false;
+	}
+	BinWriter w;
+	w.Bytes( ARCHIVE_MAGIC, sizeof( ARCHIVE_MAGIC ) );
+	w.U32( ARCHIVE_VERSION );
+	offset = w.Size();
+	return fwrite( w.Buffer().data(), 1, w.Size(), fp ) == w.Size();
+}
+
+bool ArchiveWriter::AddBlock( uint32_t threadId, const ArchivePages& pages )
+{
+	if ( fp == nullptr || pages.size() == 0 ) {
+		return fp != nullptr;
+	}
+	BinWriter raw;
+	raw.U32( (uint32_t)pages.size() );
+	for ( size_t i = 0; i < pages.size(); ++i ) {
+		raw.Str( pages[i].first );
+		raw.Str( pages[i].second );
+		urls.push_back( std::make_pair( pages[i].first, (uint32_t)blocks.size() ) );
+	}
+	std::string packed = Lz_Compress( raw.Buffer().data(), raw.Size() );
+
+	ArchiveBlock b;
+	b.threadId = threadId;
+	b.offset   = offset;
+	b.size     = (uint32_t)packed.size();
+	b.rawSize  = (uint32_t)raw.Size();
+	b.checksum = Fnv_Hash32( packed.data(), packed.size() );
+	blocks.push_back( b );
+
+	offset += packed.size();
+	return fwrite( packed.data(), 1, packed.size(), fp ) == packed.size();
+}
+
+bool ArchiveWriter::Finish( const std::string& startUrl )
+{
+	if ( fp == nullptr ) {
+		return false;
+	}
+	std::sort( urls.begin(), urls.end() );
+	// A page fetched twice keeps its first block.
+	urls.erase( std::unique( urls.begin(), urls.end(), []( const std::pair<std::string, uint32_t>& a, const std::pair<std::string, uint32_t>& b ) {
+		return a.first == b.first;
+	} ), urls.end() );
+
+	BinWriter w;
+	w.Str( startUrl );
+	w.U32( (uint32_t)blocks.size() );
+	for ( size_t i = 0; i < blocks.size(); ++i ) {
+		w.U32( blocks[i].threadId );
+		w.U64( blocks[i].offset );
+		w.U32( blocks[i].size );
+		w.U32( blocks[i].rawSize );
+		w.U32( blocks[i].checksum );
+	}
+	w.U32( (uint32_t)urls.size() );
+	for ( size_t i = 0; i < urls.size(); ++i ) {
+		w.Str( urls[i].first );
+		w.U32( urls[i].second );
+	}
+
+	BinWriter footer;
+	footer.U64( offset );
+	footer.U32( (uint32_t)w.Size() );
+	footer.Bytes( ARCHIVE_FOOTER, sizeof( ARCHIVE_FOOTER ) );
+
+	bool ok = fwrite( w.Buffer().data(), 1, w.Size(), fp ) == w.Size()
+		&& fwrite( footer.Buffer().data(), 1, footer.Size(), fp ) == footer.Size();
+	ok = ( fclose( fp ) == 0 ) && ok;
+	fp = nullptr;
+	return ok;
+}
+
+ArchiveReader::ArchiveReader()
+	: cachedBlock( -1 )
+{
+}
+
+bool ArchiveReader::Open( const std::string& path )
+{
+	blocks.clear();
+	urls.clear();
+	threadBlocks.clear();
+	cachedBlock = -1;
+	if ( !file.Open( path ) || file.Size() < sizeof( ARCHIVE_MAGIC ) + 4 + ARCHIVE_FOOTER_SIZE ) {
+		return false;
+	}
+	if ( memcmp( file.Data(), ARCHIVE_MAGIC, sizeof( ARCHIVE_MAGIC ) ) != 0 ) {
+		return false;
+	}
+
+	BinReader footer( file.Data() + file.Size() - ARCHIVE_FOOTER_SIZE, ARCHIVE_FOOTER_SIZE );
+	uint64_t indexOffset = footer.U64();
+	uint32_t indexSize   = footer.U32();
+	char magic[4];
+	footer.Bytes( magic, sizeof( magic ) );
+	if ( memcmp( magic, ARCHIVE_FOOTER, sizeof( magic ) ) != 0
+			|| indexOffset > file.Size() || indexOffset + indexSize != file.Size() - ARCHIVE_FOOTER_SIZE ) {
+		return false;
+	}
+
+	BinReader r( file.Data() + indexOffset, indexSize );
+	startUrl = r.Str();
+	uint32_t blockCount = r.U32();
+	for ( uint32_t i = 0; i < blockCount && r.Ok(); ++i ) {
+		ArchiveBlock b;
+		b.threadId = r.U32();
+		b.offset   = r.U64();
+		b.size     = r.U32();
+		b.rawSize  = r.U32();
+		b.checksum = r.U32();
+		if ( b.offset > indexOffset || b.size > indexOffset - b.offset ) {
+			return false;
+		}
+		blocks.push_back( b );
+		if ( b.threadId != 0 ) {
+			threadBlocks.push_back( std::make_pair( b.threadId, i ) );
+		}
+	}
+	uint32_t urlCount = r.U32();
+	for ( uint32_t i = 0; i < urlCount && r.Ok(); ++i ) {
+		std::string url = r.Str();
+		uint32_t block = r.U32();
+		if ( block >= blocks.size() ) {
+			return false;
+		}
+		urls.push_back( std::make_pair( url, block ) );
+	}
+	std::sort( threadBlocks.begin(), threadBlocks.end() );
+	return r.Ok();
+}
+
+bool ArchiveReader::LoadBlock( uint32_t block )
+{
+	if ( (int)block == cachedBlock ) {
+		return true;
+	}
+	cachedBlock = -1;
+	cachedPages.clear();
+
+	const ArchiveBlock& b = blocks[block];
+	const char* packed = file.Data() + b.offset;
+	std::string raw;
+	if ( Fnv_Hash32( packed, b.size ) != b.checksum || !Lz_Decompress( packed, b.size, b.rawSize, raw ) ) {
+		return false;
+	}
+	BinReader r( raw.data(), raw.size() );
+	uint32_t count = r.U32();
+	for ( uint32_t i = 0; i < count && r.Ok(); ++i ) {
+		std::string url = r.Str();
+		std::string html = r.Str();
+		cachedPages.push_back( std::make_pair( url, html ) );
+	}
+	if ( !r.Ok() ) {
+		cachedPages.clear();
+		return false;
+	}
+	cachedBlock = (int)block;
+	return true;
+}
+
+bool ArchiveReader::Find( const std::string& url, std::string& outHtml )
+{
+	auto it = std::lower_bound( urls.begin(), urls.end(), std::make_pair( url, (uint32_t)0 ) );
+	if ( it == urls.end() || it->first != url || !LoadBlock( it->second ) ) {
+		return false;
+	}
+	for ( size_t i = 0; i < cachedPages.size(); ++i ) {
+		if ( cachedPages[i].first == url ) {
+			outHtml = cachedPages[i].second;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool ArchiveReader::ReadThread( uint32_t threadId, ArchivePages& outPages )
+{
+	auto it = std::lower_bound( threadBlocks.begin(), threadBlocks.end(), std::make_pair( threadId, (uint32_t)0 ) );
+	if ( it == threadBlocks.end() || it->first != threadId || !LoadBlock( it->second ) ) {
+		return false;
+	}
+	outPages = cachedPages;
+	return true;
+}
@@ -0,0 +1,95 @@
+#ifndef ARCHIVE_FILE_H_191028101207
+#define ARCHIVE_FILE_H_191028101207
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "mapped_file.h"
+
+// Single file archive of pages keyed by url:
+//
+//   header   "CARC", version
+//   blocks   one compressed block per thread (all its pages) or per
+//            board page, each a list of (url, html)
+//   index    per block: thread id, offset, sizes, checksum; then all
+//            urls sorted, each with its block number
+//   footer   index offset and size, "CARX"
+//
+// Opening reads only the footer and the index, a page is found by a
+// binary search over the urls and only its block is decompressed.
+
+typedef std::vector<std::pair<std::string, std::string>> ArchivePages; // url, html
+
+// Index entry of one block, as written and read back.
+struct ArchiveBlock {
+	uint32_t threadId;
+	uint64_t offset;
+	uint32_t size;
+	uint32_t rawSize;
+	uint32_t checksum;
+};
+
+// Writes blocks as they come, only the index is kept in memory.
+class ArchiveWriter
+{
+public:
+	ArchiveWriter();
+	~ArchiveWriter();
+
+	bool Create( const std::string& path );
+	// threadId is 0 for blocks that are not a thread, e.g. board pages.
+	bool AddBlock( uint32_t threadId, const ArchivePages& pages );
+	// The start url is what a browser of the archive shows first.
+	bool Finish( const std::string& startUrl );
+
+	size_t BlockCount() const
+	{
+		return blocks.size();
+	}
+
+private:
+	FILE*                                          fp;
+	uint64_t                                       offset;
+	std::vector<ArchiveBlock>                      blocks;
+	std::vector<std::pair<std::string, uint32_t>>  urls;
+};
+
+// Read-only view of an archive through a file mapping.
+class ArchiveReader
+{
+public:
+	ArchiveReader();
+
+	bool Open( const std::string& path );
+
+	// False if the url is not in the archive or its block is damaged.
+	bool Find( const std::string& url, std::string& outHtml );
+	bool ReadThread( uint32_t threadId, ArchivePages& outPages );
+
+	const std::string& StartUrl() const
+	{
+		return startUrl;
+	}
+	size_t ThreadCount() const
+	{
+		return threadBlocks.size();
+	}
+
+private:
+	bool LoadBlock( uint32_t block );
+
+	MappedFile                                     file;
+	std::string                                    startUrl;
+	std::vector<ArchiveBlock>                      blocks;
+	std::vector<std::pair<std::string, uint32_t>>  urls;         // sorted
+	std::vector<std::pair<uint32_t, uint32_t>>     threadBlocks; // sorted by thread id
+
+	// The last decompressed block, pages of one thread are read in a row.
+	int                                            cachedBlock;
+	ArchivePages                                   cachedPages;
+};
+
+#endif // #ifndef ARCHIVE_FILE_H_191028101207
@@ -0,0 +1,939 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <windows.h>
+
+#define CURL_STATICLIB
+#include "curl/curl.h"
+#include "net_util.h"
+#include "task_pool.h"
+#include "quote_dedup.h"
+#include "roaring_bitmap.h"
+#include "bin_stream.h"
+#include "smth.h"
+#include "serve.h"
+#include "filter.h"
+#include "bench.h"
+
+static double Bench_NowMs( void )
+{
+	using namespace std::chrono;
+	return duration<double, std::milli>( steady_clock::now().time_since_epoch() ).count();
+}
+
+static std::vector<std::string> Bench_LoadCorpus( const std::string& dir )
+{
+	std::vector<std::string> texts;
+
+	WIN32_FIND_DATAA fd;
+	HANDLE h = FindFirstFileA( ( dir + "/*" ).c_str(), &fd );
+	if ( h == INVALID_HANDLE_VALUE ) {
+		return texts;
+	}
+	do {
+		if ( fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY ) {
+			continue;
+		}
+		std::ifstream is( ( dir + "/" + fd.cFileName ).c_str(), std::ifstream::binary );
+		if ( is ) {
+			std::stringstream ss;
+			ss << is.rdbuf();
+			texts.push_back( ss.str() );
+		}
+	} while ( FindNextFileA( h, &fd ) );
+	FindClose( h );
+
+	return texts;
+}
+
+// Parses and lays out one captured page the same way the client does.
+static size_t Bench_ParseOne( const std::string& html )
+{
+	if ( html.find( "<ul class=\"list sec\">" ) != std::string::npos ) {
+		if ( html.find( "<div class=\"sp\">" ) != std::string::npos ) {
+			ArticlePage page;
+			PageView view;
+			Smth_GetArticlePage( html, page );
+			Smth_CreateViewFromArticlePage( page, view );
+			return (size_t)view.ItemCount();
+		}
+		BoardPage page;
+		Smth_GetBoardPage( html, page );
+		return page.items.size();
+	}
+	SectionPage page;
+	Smth_GetSectionPage( html, page );
+	return page.items.size();
+}
+
+// Parse and layout throughput of a crawl corpus for 1..N threads.
+static int Bench_Parse( int argc, char* argv[] )
+{
+	if ( argc < 1 ) {
+		wprintf( L"usage: csmth bench parse <corpus-dir> [max-threads] [rounds]\n" );
+		return 1;
+	}
+	std::vector<std::string> corpus = Bench_LoadCorpus( argv[0] );
+	if ( corpus.size() == 0 ) {
+		wprintf( L"no pages found in %S\n", argv[0] );
+		return 1;
+	}
+	unsigned int maxThreads = argc > 1 ? (unsigned int)atoi( argv[1] ) : std::thread::hardware_concurrency();
+	int rounds = argc > 2 ? atoi( argv[2] ) : 3;
+	if ( maxThreads == 0 ) maxThreads = 1;
+	if ( rounds <= 0 ) rounds = 1;
+
+	std::vector<unsigned int> threadCounts;
+	for ( unsigned int n = 1; n < maxThreads; n *= 2 ) {
+		threadCounts.push_back( n );
+	}
+	threadCounts.push_back( maxThreads );
+
+	wprintf( L"pages: %d, rounds: %d\n", (int)corpus.size(), rounds );
+	wprintf( L"%8s %12s %12s %10s %10s\n", L"threads", L"best ms", L"pages/s", L"speedup", L"effic." );
+
+	double baseMs = 0.0;
+	for ( size_t k = 0; k < threadCounts.size(); ++k ) {
+		TaskPool pool( threadCounts[k] );
+		std::vector<size_t> results( corpus.size() );
+
+		double bestMs = 0.0;
+		for ( int r = 0; r < rounds; ++r ) {
+			double t0 = Bench_NowMs();
+			pool.ParallelFor( corpus.size(), [&]( size_t i ) {
+				results[i] = Bench_ParseOne( corpus[i] );
+			} );
+			double ms = Bench_NowMs() - t0;
+			if ( r == 0 || ms < bestMs ) {
+				bestMs = ms;
+			}
+		}
+		if ( k == 0 ) {
+			baseMs = bestMs;
+		}
+		double speedup = bestMs > 0.0 ? baseMs / bestMs : 0.0;
+		wprintf( L"%8u %12.2f %12.1f %10.2f %9.0f%%\n", threadCounts[k], bestMs,
+				bestMs > 0.0 ? corpus.size() * 1000.0 / bestMs : 0.0,
+				speedup, speedup * 100.0 / threadCounts[k] );
+	}
+	return 0;
+}
+
+static void Bench_CountView( const PageView& view, size_t& outLines, size_t& outChars )
+{
+	outLines = 0;
+	outChars = 0;
+	for ( int i = 0; i < view.ItemCount(); ++i ) {
+		const PageViewItem& item = view.Item( i );
+		outLines += item.LineCount();
+		for ( size_t k = 0; k < item.LineCount(); ++k ) {
+			outChars += (size_t)item.Line( k ).Length();
+		}
+	}
+}
+
+// View size of the article pages of a corpus read as one thread, in file
+// name order, with and without quote deduplication.
+static int Bench_Dedup( int argc, char* argv[] )
+{
+	if ( argc < 1 ) {
+		wprintf( L"usage: csmth bench dedup <thread-dir>\n" );
+		return 1;
+	}
+	std::vector<std::string> corpus = Bench_LoadCorpus( argv[0] );
+	ArticlePage thread;
+	for ( size_t i = 0; i < corpus.size(); ++i ) {
+		ArticlePage page;
+		Smth_GetArticlePage( corpus[i], page );
+		thread.items.insert( thread.items.end(), page.items.begin(), page.items.end() );
+	}
+	if ( thread.items.size() == 0 ) {
+		wprintf( L"no article pages found in %S\n", argv[0] );
+		return 1;
+	}
+
+	size_t plainLines, plainChars, dedupLines, dedupChars;
+	PageView view;
+	double t0 = Bench_NowMs();
+	Smth_CreateViewFromArticlePage( thread, view );
+	double plainMs = Bench_NowMs() - t0;
+	Bench_CountView( view, plainLines, plainChars );
+
+	QuoteDedup dedup;
+	t0 = Bench_NowMs();
+	Smth_CreateViewFromArticlePage( thread, view, nullptr, &dedup );
+	double dedupMs = Bench_NowMs() - t0;
+	Bench_CountView( view, dedupLines, dedupChars );
+
+	wprintf( L"posts: %d, quote lines: %d, collapsed: %d\n", (int)thread.items.size(),
+			(int)dedup.QuoteLines(), (int)dedup.CollapsedLines() );
+	wprintf( L"%8s %12s %12s %10s\n", L"", L"view lines", L"view bytes", L"ms" );
+	wprintf( L"%8s %12d %12d %10.2f\n", L"plain", (int)plainLines, (int)( plainChars * sizeof( wchar_t ) ), plainMs );
+	wprintf( L"%8s %12d %12d %10.2f\n", L"dedup", (int)dedupLines, (int)( dedupChars * sizeof( wchar_t ) ), dedupMs );
+	return 0;
+}
+
+// Size and lookup speed of read state for many boards with ids spread
+// the way they are on the site: increasing, with read ones clustered.
+static int Bench_ReadState( int argc, char* argv[] )
+{
+	int boardCount = argc > 0 ? atoi( argv[0] ) : 300;
+	int idsPerBoard = argc > 1 ? atoi( argv[1] ) : 10000;
+	if ( boardCount <= 0 ) boardCount = 1;
+	if ( idsPerBoard <= 0 ) idsPerBoard = 1;
+
+	std::vector<RoaringBitmap> boards( boardCount );
+	uint32_t seed = 12345;
+	size_t total = 0;
+	for ( int b = 0; b < boardCount; ++b ) {
+		uint32_t id = 1000000 + (uint32_t)b * 7919;
+		for ( int i = 0; i < idsPerBoard; ++i ) {
+			seed = seed * 1103515245 + 12345;
+			id += 1 + ( seed >> 16 ) % 24;
+			total += boards[b].Add( id ) ? 1 : 0;
+		}
+	}
+
+	BinWriter w;
+	size_t containers = 0;
+	for ( int b = 0; b < boardCount; ++b ) {
+		boards[b].Write( w );
+		containers += boards[b].ContainerCount();
+	}
+
+	const int LOOKUPS = 10000000;
+	size_t found = 0;
+	double t0 = Bench_NowMs();
+	for ( int i = 0; i < LOOKUPS; ++i ) {
+		seed = seed * 1103515245 + 12345;
+		found += boards[i % boardCount].Contains( 1000000 + ( seed >> 8 ) % ( (uint32_t)idsPerBoard * 16 ) ) ? 1 : 0;
+	}
+	double ms = Bench_NowMs() - t0;
+
+	wprintf( L"boards: %d, ids: %d, containers: %d\n", boardCount, (int)total, (int)containers );
+	wprintf( L"file bytes: %d (%.2f bytes/id)\n", (int)w.Size(), (double)w.Size() / total );
+	wprintf( L"lookup: %.1f ns (%d found)\n", ms * 1000000.0 / LOOKUPS, (int)found );
+	return 0;
+}
+
+static double Bench_Percentile( std::vector<double> samples, double p )
+{
+	if ( samples.size() == 0 ) {
+		return 0;
+	}
+	size_t k = std::min( samples.size() - 1, (size_t)( samples.size() * p ) );
+	std::nth_element( samples.begin(), samples.begin() + k, samples.end() );
+	return samples[k];
+}
+
+// Latency of repeated gets of one url without hedging and then with it;
+// meant to run against a server that stalls some of its responses.
+static int Bench_Net( int argc, char* argv[] )
+{
+	if ( argc < 1 ) {
+		wprintf( L"usage: csmth bench net <url> [count]\n" );
+		return 1;
+	}
+	std::string url = argv[0];
+	int count = argc > 1 ? atoi( argv[1] ) : 200;
+	if ( count <= 0 ) count = 1;
+
+	if ( !Smth_NetInit() ) {
+		return 1;
+	}
+	NetPolicy policy = Net_GetPolicy();
+	for ( int pass = 0; pass < 2; ++pass ) {
+		// The pass without hedging also gathers the first byte times the
+		// hedging delay is taken from.
+		policy.hedge = ( pass == 1 );
+		Net_SetPolicy( policy );
+		NetStats before;
+		Net_GetStats( before );
+
+		std::vector<double> ms;
+		for ( int i = 0; i < count; ++i ) {
+			double t0 = Bench_NowMs();
+			Net_Get( url );
+			ms.push_back( Bench_NowMs() - t0 );
+		}
+
+		NetStats after;
+		Net_GetStats( after );
+		wprintf( L"hedge %-3S p50 %7.1f ms  p95 %7.1f ms  p99 %7.1f ms  max %7.1f ms  retries %d  hedges %d (%d won)  failed %d\n",
+				policy.hedge ? "on" : "off", Bench_Percentile( ms, 0.50 ), Bench_Percentile( ms, 0.95 ),
+				Bench_Percentile( ms, 0.99 ), Bench_Percentile( ms, 1.0 ), after.retries - before.retries,
+				after.hedges - before.hedges, after.hedgeWins - before.hedgeWins, after.failures - before.failures );
+	}
+	NetStats stats;
+	Net_GetStats( stats );
+	wprintf( L"hedging delay: %d ms\n", stats.hedgeDelayMs );
+	// Every get opens its own connection, so with sessions saved by an
+	// earlier run even the first handshake is abbreviated.
+	long handshakes = 0, resumed = 0;
+	Net_GetTlsStats( handshakes, resumed );
+	if ( handshakes > 0 ) {
+		wprintf( L"tls: %ld handshakes, %ld resumed (%.1f%%)\n", handshakes, resumed, resumed * 100.0 / handshakes );
+	}
+	Smth_NetDeinit();
+	return 0;
+}
+
+// Throughput of gets from 1 up to max-threads threads on the shared
+// connection cache, each get reusing a warm connection; several urls,
+// comma separated, spread the hosts over the cache shards.
+static int Bench_Conncache( int argc, char* argv[] )
+{
+	if ( argc < 1 ) {
+		wprintf( L"usage: csmth bench conncache <url>[,<url>...] [max-threads] [gets-per-thread]\n" );
+		return 1;
+	}
+	std::vector<std::string> urls;
+	std::stringstream list( argv[0] );
+	std::string url;
+	while ( std::getline( list, url, ',' ) ) {
+		if ( url.length() > 0 ) {
+			urls.push_back( url );
+		}
+	}
+	unsigned int maxThreads = argc > 1 ? (unsigned int)atoi( argv[1] ) : 32;
+	int count = argc > 2 ? atoi( argv[2] ) : 200;
+	if ( urls.size() == 0 ) return 1;
+	if ( maxThreads == 0 ) maxThreads = 1;
+	if ( count <= 0 ) count = 1;
+
+	if ( !Smth_NetInit() ) {
+		return 1;
+	}
+	std::vector<unsigned int> threadCounts;
+	for ( unsigned int n = 1; n < maxThreads; n *= 2 ) {
+		threadCounts.push_back( n );
+	}
+	threadCounts.push_back( maxThreads );
+
+	// Warm up, so every pass finds the connections already open.
+	for ( size_t i = 0; i < urls.size(); ++i ) {
+		Net_Get( urls[i] );
+	}
+
+	wprintf( L"hosts: %d, gets per thread: %d\n", (int)urls.size(), count );
+	wprintf( L"%8s %12s %12s %10s %10s %8s\n", L"threads", L"ms", L"gets/s", L"speedup", L"effic.", L"failed" );
+	double baseRate = 0.0;
+	for ( size_t k = 0; k < threadCounts.size(); ++k ) {
+		TaskPool pool( threadCounts[k] );
+		size_t total = (size_t)threadCounts[k] * count;
+		NetStats before;
+		Net_GetStats( before );
+
+		double t0 = Bench_NowMs();
+		pool.ParallelFor( total, [&]( size_t i ) {
+			Net_Get( urls[i % urls.size()] );
+		} );
+		double ms = Bench_NowMs() - t0;
+
+		NetStats after;
+		Net_GetStats( after );
+		double rate = ms > 0.0 ? total * 1000.0 / ms : 0.0;
+		if ( k == 0 ) {
+			baseRate = rate;
+		}
+		double speedup = baseRate > 0.0 ? rate / baseRate : 0.0;
+		wprintf( L"%8u %12.1f %12.1f %10.2f %9.0f%% %8d\n", threadCounts[k], ms, rate,
+				speedup, speedup * 100.0 / threadCounts[k], after.failures - before.failures );
+	}
+	Smth_NetDeinit();
+	return 0;
+}
+
+static size_t Bench_Discard( char* ptr, size_t size, size_t nmemb, void* userdata )
+{
+	return size * nmemb;
+}
+
+// DNS cache and cookie jar lookups of a share used by 1..N threads. Every
+// get finds its host, one of many names mapped to the server, in the DNS
+// cache and reads that host's cookies from a preloaded jar.
+static int Bench_Share( int argc, char* argv[] )
+{
+	if ( argc < 1 ) {
+		wprintf( L"usage: csmth bench share <http://ip:port/path> [hosts] [max-threads] [gets-per-thread]\n" );
+		return 1;
+	}
+	int hosts = argc > 1 ? atoi( argv[1] ) : 64;
+	unsigned int maxThreads = argc > 2 ? (unsigned int)atoi( argv[2] ) : 32;
+	int count = argc > 3 ? atoi( argv[3] ) : 200;
+	if ( hosts <= 0 ) hosts = 1;
+	if ( maxThreads == 0 ) maxThreads = 1;
+	if ( count <= 0 ) count = 1;
+
+	CURLU* u = curl_url();
+	char* address = nullptr;
+	char* port = nullptr;
+	char* path = nullptr;
+	bool ok = curl_url_set( u, CURLUPART_URL, argv[0], 0 ) == CURLUE_OK
+		&& curl_url_get( u, CURLUPART_HOST, &address, 0 ) == CURLUE_OK
+		&& curl_url_get( u, CURLUPART_PORT, &port, CURLU_DEFAULT_PORT ) == CURLUE_OK
+		&& curl_url_get( u, CURLUPART_PATH, &path, 0 ) == CURLUE_OK;
+	std::vector<std::string> urls;
+	curl_slist* resolve = nullptr;
+	curl_slist* cookies = nullptr;
+	for ( int i = 0; ok && i < hosts; ++i ) {
+		// Different top domains, so the hosts spread over the buckets.
+		char host[64];
+		snprintf( host, sizeof( host ), "h%d.bench%d.test", i, i );
+		urls.push_back( std::string( "http://" ) + host + ":" + port + path );
+		resolve = curl_slist_append( resolve, ( std::string( host ) + ":" + port + ":" + address ).c_str() );
+		for ( int c = 0; c < 8; ++c ) {
+			char line[128];
+			snprintf( line, sizeof( line ), "Set-Cookie: b%d=%d; domain=%s; path=/", c, i, host );
+			cookies = curl_slist_append( cookies, line );
+		}
+	}
+	curl_free( address );
+	curl_free( port );
+	curl_free( path );
+	curl_url_cleanup( u );
+	if ( !ok ) {
+		wprintf( L"%S is not a url\n", argv[0] );
+		return 1;
+	}
+
+	curl_global_init( CURL_GLOBAL_ALL );
+	CURLSH* share = curl_share_init();
+	curl_share_setopt( share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS );
+	curl_share_setopt( share, CURLSHOPT_SHARE, CURL_LOCK_DATA_COOKIE );
+	curl_share_setopt( share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT );
+
+	long maxConnects = (long)hosts * maxThreads;
+	auto makeEasy = [&]() {
+		CURL* curl = curl_easy_init();
+		curl_easy_setopt( curl, CURLOPT_SHARE, share );
+		curl_easy_setopt( curl, CURLOPT_COOKIEFILE, "" );
+		curl_easy_setopt( curl, CURLOPT_NOSIGNAL, 1L );
+		curl_easy_setopt( curl, CURLOPT_MAXCONNECTS, maxConnects );
+		curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, Bench_Discard );
+		return curl;
+	};
+
+	// The names go into the shared DNS cache once, for good, and the
+	// cookies into the shared jar.
+	CURL* setup = makeEasy();
+	curl_easy_setopt( setup, CURLOPT_RESOLVE, resolve );
+	for ( curl_slist* c = cookies; c != nullptr; c = c->next ) {
+		curl_easy_setopt( setup, CURLOPT_COOKIELIST, c->data );
+	}
+	for ( size_t i = 0; i < urls.size(); ++i ) {
+		curl_easy_setopt( setup, CURLOPT_URL, urls[i].c_str() );
+		curl_easy_perform( setup );
+	}
+	curl_easy_cleanup( setup );
+
+	std::vector<unsigned int> threadCounts;
+	for ( unsigned int n = 1; n < maxThreads; n *= 2 ) {
+		threadCounts.push_back( n );
+	}
+	threadCounts.push_back( maxThreads );
+
+	wprintf( L"hosts: %d, gets per thread: %d\n", hosts, count );
+	wprintf( L"%8s %12s %12s %10s %10s %8s\n", L"threads", L"ms", L"gets/s", L"speedup", L"effic.", L"failed" );
+	double baseRate = 0.0;
+	for ( size_t k = 0; k < threadCounts.size(); ++k ) {
+		TaskPool pool( threadCounts[k] );
+		std::atomic<int> failed( 0 );
+
+		double t0 = Bench_NowMs();
+		pool.ParallelFor( threadCounts[k], [&]( size_t t ) {
+			CURL* curl = makeEasy();
+			for ( int i = 0; i < count; ++i ) {
+				curl_easy_setopt( curl, CURLOPT_URL, urls[( t * 7 + i ) % urls.size()].c_str() );
+				if ( curl_easy_perform( curl ) != CURLE_OK ) {
+					++failed;
+				}
+			}
+			curl_easy_cleanup( curl );
+		} );
+		double ms = Bench_NowMs() - t0;
+
+		double rate = ms > 0.0 ? (double)threadCounts[k] * count * 1000.0 / ms : 0.0;
+		if ( k == 0 ) {
+			baseRate = rate;
+		}
+		double speedup = baseRate > 0.0 ? rate / baseRate : 0.0;
+		wprintf( L"%8u %12.1f %12.1f %10.2f %9.0f%% %8d\n", threadCounts[k], ms, rate,
+				speedup, speedup * 100.0 / threadCounts[k], (int)failed );
+	}
+
+	curl_share_cleanup( share );
+	curl_slist_free_all( resolve );
+	curl_slist_free_all( cookies );
+	curl_global_cleanup();
+	return 0;
+}
+
+// A local listener that accepts connections and never reads from them, so
+// transfers to it wait for an answer that does not come.
+struct BenchSilentServer {
+	SOCKET              listener;
+	int                 port;
+	std::atomic<int>    accepted;
+	std::vector<SOCKET> sockets;
+	std::thread         thread;
+};
+
+static bool Bench_SilentOpen( BenchSilentServer& server )
+{
+	server.listener = socket( AF_INET, SOCK_STREAM, 0 );
+	server.accepted = 0;
+	if ( server.listener == INVALID_SOCKET ) {
+		return false;
+	}
+	sockaddr_in addr = {};
+	addr.sin_family      = AF_INET;
+	addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+	int len = sizeof( addr );
+	if ( bind( server.listener, (sockaddr*)&addr, sizeof( addr ) ) == SOCKET_ERROR
+		|| listen( server.listener, SOMAXCONN ) == SOCKET_ERROR
+		|| getsockname( server.listener, (sockaddr*)&addr, &len ) == SOCKET_ERROR ) {
+		closesocket( server.listener );
+		return false;
+	}
+	server.port = ntohs( addr.sin_port );
+	server.thread = std::thread( [&server]() {
+		while ( true ) {
+			SOCKET s = accept( server.listener, nullptr, nullptr );
+			if ( s == INVALID_SOCKET ) {
+				break;
+			}
+			server.sockets.push_back( s );
+			++server.accepted;
+		}
+	} );
+	return true;
+}
+
+static void Bench_SilentClose( BenchSilentServer& server )
+{
+	closesocket( server.listener );
+	server.thread.join();
+	for ( size_t i = 0; i < server.sockets.size(); ++i ) {
+		closesocket( server.sockets[i] );
+	}
+	server.sockets.clear();
+}
+
+// Cost of a curl_multi_perform and curl_multi_wait round of one get loop
+// beside 0..max-idle transfers that wait on a silent server, waiting in
+// poll() and in epoll where libcurl has it (CURLMOPT_WAIT_EPOLL).
+static int Bench_MultiWait( int argc, char* argv[] )
+{
+	if ( argc < 1 ) {
+		wprintf( L"usage: csmth bench multiwait <url> [max-idle] [gets]\n" );
+		return 1;
+	}
+	int maxIdle = argc > 1 ? atoi( argv[1] ) : 1000;
+	int count = argc > 2 ? atoi( argv[2] ) : 2000;
+	if ( maxIdle < 0 ) maxIdle = 0;
+	if ( count <= 0 ) count = 1;
+
+	std::vector<int> idleCounts;
+	idleCounts.push_back( 0 );
+	for ( int n = 10; n < maxIdle; n *= 10 ) {
+		idleCounts.push_back( n );
+	}
+	if ( maxIdle > 0 ) {
+		idleCounts.push_back( maxIdle );
+	}
+	static const struct {
+		const wchar_t* name;
+		long           epoll;
+	} backends[] = {
+		{ L"poll", 0L },
+		{ L"epoll", 1L },
+	};
+
+	curl_global_init( CURL_GLOBAL_ALL );
+	wprintf( L"gets per pass: %d\n", count );
+	wprintf( L"%8s %8s %12s %12s %12s %8s\n", L"idle", L"wait", L"gets/s", L"us/wait", L"us/round", L"failed" );
+	bool noEpoll = false;
+	for ( size_t k = 0; k < idleCounts.size(); ++k ) {
+		for ( size_t b = 0; b < sizeof( backends ) / sizeof( backends[0] ); ++b ) {
+			CURLM* multi = curl_multi_init();
+			if ( curl_multi_setopt( multi, CURLMOPT_WAIT_EPOLL, backends[b].epoll ) != CURLM_OK ) {
+				noEpoll = true;
+				curl_multi_cleanup( multi );
+				continue;
+			}
+			BenchSilentServer server;
+			if ( !Bench_SilentOpen( server ) ) {
+				wprintf( L"cannot listen for the idle transfers\n" );
+				curl_multi_cleanup( multi );
+				curl_global_cleanup();
+				return 1;
+			}
+			char idleUrl[64];
+			snprintf( idleUrl, sizeof( idleUrl ), "http://127.0.0.1:%d/", server.port );
+			std::vector<CURL*> idle;
+			for ( int i = 0; i < idleCounts[k]; ++i ) {
+				CURL* curl = curl_easy_init();
+				curl_easy_setopt( curl, CURLOPT_URL, idleUrl );
+				curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, Bench_Discard );
+				curl_multi_add_handle( multi, curl );
+				idle.push_back( curl );
+			}
+
+			// Until every idle transfer is connected and has sent its request.
+			int running = 0;
+			double deadline = Bench_NowMs() + 10000.0;
+			for ( int rounds = 0; rounds < 10 || ( server.accepted < idleCounts[k] && Bench_NowMs() < deadline ); ++rounds ) {
+				curl_multi_perform( multi, &running );
+				curl_multi_wait( multi, nullptr, 0, 10, nullptr );
+			}
+
+			CURL* active = curl_easy_init();
+			curl_easy_setopt( active, CURLOPT_URL, argv[0] );
+			curl_easy_setopt( active, CURLOPT_WRITEFUNCTION, Bench_Discard );
+			curl_multi_add_handle( multi, active );
+			int done = 0;
+			int failed = 0;
+			long rounds = 0;
+			double waitMs = 0.0;
+			double t0 = Bench_NowMs();
+			while ( done < count ) {
+				curl_multi_perform( multi, &running );
+				int queued;
+				while ( CURLMsg* msg = curl_multi_info_read( multi, &queued ) ) {
+					if ( msg->msg != CURLMSG_DONE ) {
+						continue;
+					}
+					if ( msg->data.result != CURLE_OK ) {
+						++failed;
+					}
+					if ( msg->easy_handle == active ) {
+						++done;
+						curl_multi_remove_handle( multi, active );
+						curl_multi_add_handle( multi, active );
+					}
+				}
+				double w0 = Bench_NowMs();
+				curl_multi_wait( multi, nullptr, 0, 1000, nullptr );
+				waitMs += Bench_NowMs() - w0;
+				++rounds;
+			}
+			double ms = Bench_NowMs() - t0;
+
+			wprintf( L"%8d %8s %12.1f %12.1f %12.1f %8d\n", idleCounts[k], backends[b].name,
+					ms > 0.0 ? count * 1000.0 / ms : 0.0, waitMs * 1000.0 / rounds, ms * 1000.0 / rounds, failed );
+
+			curl_multi_remove_handle( multi, active );
+			curl_easy_cleanup( active );
+			for ( size_t i = 0; i < idle.size(); ++i ) {
+				curl_multi_remove_handle( multi, idle[i] );
+				curl_easy_cleanup( idle[i] );
+			}
+			curl_multi_cleanup( multi );
+			Bench_SilentClose( server );
+		}
+	}
+	if ( noEpoll ) {
+		wprintf( L"epoll: not built in\n" );
+	}
+	curl_global_cleanup();
+	return 0;
+}
+
+// Pages under a fixture directory with their site paths, the reverse of
+// the mapping in serve.cpp: article/Python/100@p=2.html is
+// /article/Python/100?p=2 and index.html the site root.
+static void Bench_ListFixtures( const std::string& dir, const std::string& path, std::vector<std::pair<std::string, std::string>>& outPages )
+{
+	WIN32_FIND_DATAA fd;
+	HANDLE h = FindFirstFileA( ( dir + path + "/*" ).c_str(), &fd );
+	if ( h == INVALID_HANDLE_VALUE ) {
+		return;
+	}
+	do {
+		std::string name = fd.cFileName;
+		if ( name == "." || name == ".." ) {
+			continue;
+		}
+		if ( fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY ) {
+			Bench_ListFixtures( dir, path + "/" + name, outPages );
+			continue;
+		}
+		if ( name.length() <= 5 || name.compare( name.length() - 5, 5, ".html" ) != 0 ) {
+			continue;
+		}
+		std::ifstream is( ( dir + path + "/" + name ).c_str(), std::ifstream::binary );
+		if ( !is ) {
+			continue;
+		}
+		std::stringstream ss;
+		ss << is.rdbuf();
+		name = name.substr( 0, name.length() - 5 );
+		std::replace( name.begin(), name.end(), '@', '?' );
+		std::string sitePath = ( path.empty() && name == "index" ) ? "" : path + "/" + name;
+		outPages.push_back( std::make_pair( sitePath, ss.str() ) );
+	} while ( FindNextFileA( h, &fd ) );
+	FindClose( h );
+}
+
+// Not a timing: runs Net_Get, Net_Login and the ui's goto url against
+// "csmth serve" on the fixtures in this process and lists what went wrong.
+static int Bench_Fixtures( int argc, char* argv[] )
+{
+	if ( argc < 1 ) {
+		wprintf( L"usage: csmth bench fixtures <fixture-dir> [port]\n" );
+		return 1;
+	}
+	int port = argc > 1 ? atoi( argv[1] ) : 8089;
+	std::vector<std::pair<std::string, std::string>> pages;
+	Bench_ListFixtures( argv[0], "", pages );
+	std::sort( pages.begin(), pages.end() );
+	if ( pages.empty() ) {
+		wprintf( L"no pages found in %S\n", argv[0] );
+		return 1;
+	}
+	if ( !Serve_Start( argv[0], port ) ) {
+		wprintf( L"cannot listen on port %d\n", port );
+		return 1;
+	}
+	Net_SetBaseUrl( "http://127.0.0.1:" + std::to_string( port ) );
+	if ( !Net_Init() ) {
+		return 1;
+	}
+
+	std::vector<std::string> failures;
+	for ( size_t i = 0; i < pages.size(); ++i ) {
+		if ( Net_Get( SMTH_DOMAIN + pages[i].first ) != pages[i].second ) {
+			failures.push_back( "Net_Get " + SMTH_DOMAIN + pages[i].first );
+		}
+	}
+
+	// The server takes any id, the jar has to carry it afterwards.
+	char tempDir[MAX_PATH];
+	GetTempPathA( MAX_PATH, tempDir );
+	std::string cookiePath = std::string( tempDir ) + "csmth_fixtures.cookie";
+	remove( cookiePath.c_str() );
+	Net_Login( SMTH_DOMAIN + "/user/login", "id=fixtures&passwd=fixtures", cookiePath );
+	std::ifstream is( cookiePath.c_str(), std::ifstream::binary );
+	std::stringstream jar;
+	jar << is.rdbuf();
+	is.close();
+	remove( cookiePath.c_str() );
+	if ( jar.str().find( "fixtures" ) == std::string::npos ) {
+		failures.push_back( "Net_Login " + SMTH_DOMAIN + "/user/login" );
+	}
+
+	// Going to a page draws it, the results are listed afterwards.
+	for ( size_t i = 0; i < pages.size(); ++i ) {
+		if ( Smth_ShowUrl( SMTH_DOMAIN + pages[i].first ) == 0 ) {
+			failures.push_back( "Smth_ShowUrl " + SMTH_DOMAIN + pages[i].first );
+		}
+	}
+	Net_Deinit();
+
+	system( "cls" );
+	wprintf( L"pages: %d, failed: %d\n", (int)pages.size(), (int)failures.size() );
+	for ( size_t i = 0; i < failures.size(); ++i ) {
+		wprintf( L"  %S\n", failures[i].c_str() );
+	}
+	return failures.empty() ? 0 : 1;
+}
+
+static size_t Bench_Collect( char* ptr, size_t size, size_t nmemb, void* userdata )
+{
+	( (std::string*)userdata )->append( ptr, size * nmemb );
+	return size * nmemb;
+}
+
+// Not a timing: N threads get the fixture pages through one share of DNS,
+// cookies, connections and TLS sessions, and every body has to match its
+// file. Each thread also puts a cookie into the shared jar, all of them
+// have to be there afterwards.
+static int Bench_ShareCheck( int argc, char* argv[] )
+{
+	if ( argc < 1 ) {
+		wprintf( L"usage: csmth bench sharecheck <fixture-dir> [threads] [gets-per-thread] [port]\n" );
+		return 1;
+	}
+	unsigned int threads = argc > 1 ? (unsigned int)atoi( argv[1] ) : 8;
+	int count = argc > 2 ? atoi( argv[2] ) : 200;
+	int port = argc > 3 ? atoi( argv[3] ) : 8089;
+	if ( threads == 0 ) threads = 1;
+	if ( count <= 0 ) count = 1;
+	std::vector<std::pair<std::string, std::string>> pages;
+	Bench_ListFixtures( argv[0], "", pages );
+	if ( pages.empty() ) {
+		wprintf( L"no pages found in %S\n", argv[0] );
+		return 1;
+	}
+	if ( !Serve_Start( argv[0], port ) ) {
+		wprintf( L"cannot listen on port %d\n", port );
+		return 1;
+	}
+
+	// A few names for the server, so the threads meet in more than one
+	// bundle of the connection cache.
+	const int hosts = 4;
+	std::vector<std::string> urls;
+	std::vector<std::string> bodies;
+	curl_slist* resolve = nullptr;
+	for ( int h = 0; h < hosts; ++h ) {
+		std::string host = "h" + std::to_string( h ) + ".sharecheck.test";
+		resolve = curl_slist_append( resolve, ( host + ":" + std::to_string( port ) + ":127.0.0.1" ).c_str() );
+		for ( size_t i = 0; i < pages.size(); ++i ) {
+			std::string path = pages[i].first.empty() ? "/" : pages[i].first;
+			urls.push_back( "http://" + host + ":" + std::to_string( port ) + path );
+			bodies.push_back( pages[i].second );
+		}
+	}
+
+	curl_global_init( CURL_GLOBAL_ALL );
+	CURLSH* share = curl_share_init();
+	curl_share_setopt( share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS );
+	curl_share_setopt( share, CURLSHOPT_SHARE, CURL_LOCK_DATA_COOKIE );
+	curl_share_setopt( share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT );
+	curl_share_setopt( share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION );
+
+	std::atomic<int> failed( 0 );
+	std::atomic<int> mismatched( 0 );
+	TaskPool pool( threads );
+	pool.ParallelFor( threads, [&]( size_t t ) {
+		CURL* curl = curl_easy_init();
+		std::string body;
+		curl_easy_setopt( curl, CURLOPT_SHARE, share );
+		curl_easy_setopt( curl, CURLOPT_RESOLVE, resolve );
+		curl_easy_setopt( curl, CURLOPT_COOKIEFILE, "" );
+		curl_easy_setopt( curl, CURLOPT_NOSIGNAL, 1L );
+		curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, Bench_Collect );
+		curl_easy_setopt( curl, CURLOPT_WRITEDATA, &body );
+		std::string cookie = "Set-Cookie: t" + std::to_string( t ) + "=" + std::to_string( t ) + "; domain=sharecheck.test; path=/";
+		curl_easy_setopt( curl, CURLOPT_COOKIELIST, cookie.c_str() );
+		for ( int i = 0; i < count; ++i ) {
+			size_t k = ( t * 7 + i ) % urls.size();
+			long code = 0;
+			body.clear();
+			curl_easy_setopt( curl, CURLOPT_URL, urls[k].c_str() );
+			if ( curl_easy_perform( curl ) != CURLE_OK
+				|| curl_easy_getinfo( curl, CURLINFO_RESPONSE_CODE, &code ) != CURLE_OK
+				|| code != 200 ) {
+				++failed;
+			}
+			else if ( body != bodies[k] ) {
+				++mismatched;
+			}
+		}
+		curl_easy_cleanup( curl );
+	} );
+
+	int missing = 0;
+	CURL* curl = curl_easy_init();
+	curl_easy_setopt( curl, CURLOPT_SHARE, share );
+	curl_slist* jar = nullptr;
+	curl_easy_getinfo( curl, CURLINFO_COOKIELIST, &jar );
+	for ( unsigned int t = 0; t < threads; ++t ) {
+		std::string name = "\tt" + std::to_string( t ) + "\t" + std::to_string( t );
+		bool found = false;
+		for ( curl_slist* c = jar; c != nullptr && !found; c = c->next ) {
+			std::string line = c->data;
+			found = line.length() >= name.length() && line.compare( line.length() - name.length(), name.length(), name ) == 0;
+		}
+		if ( !found ) {
+			++missing;
+		}
+	}
+	curl_slist_free_all( jar );
+	curl_easy_cleanup( curl );
+
+	curl_share_cleanup( share );
+	curl_slist_free_all( resolve );
+	curl_global_cleanup();
+
+	wprintf( L"threads: %u, gets: %d, failed: %d, wrong bodies: %d, missing cookies: %d\n",
+			threads, (int)( threads * count ), (int)failed, (int)mismatched, missing );
+	return ( failed == 0 && mismatched == 0 && missing == 0 ) ? 0 : 1;
+}
+
+// Not a timing: loads a small kill file and checks that keyword rules
+// match the text only and author rules the whole id only.
+static int Bench_FilterCheck( int argc, char* argv[] )
+{
+	char tempDir[MAX_PATH];
+	GetTempPathA( MAX_PATH, tempDir );
+	std::string path = std::string( tempDir ) + "csmth_filtercheck.txt";
+	{
+		std::ofstream os( path.c_str() );
+		os << "kill foo\n"
+			<< "highlight re\n"
+			<< "kill-author bob\n"
+			<< "highlight-author al\n";
+	}
+	bool loaded = Filter_Load( path );
+	remove( path.c_str() );
+	if ( !loaded ) {
+		wprintf( L"cannot write %S\n", path.c_str() );
+		return 1;
+	}
+
+	static const struct {
+		const char* author;
+		const char* text;
+		uint32_t    flags;
+	} CASES[] = {
+		{ "foobar", "hello",  0 },
+		{ "tree",   "hello",  0 },
+		{ "alice",  "hello",  0 },
+		{ "bobby",  "hello",  0 },
+		{ "someone", "bob al", 0 },
+		{ "bob",    "hello",  FILTER_KILL },
+		{ "al",     "hello",  FILTER_HIGHLIGHT },
+		{ "foobar", "reply",  FILTER_HIGHLIGHT },
+		{ "al",     "food",   FILTER_KILL | FILTER_HIGHLIGHT },
+	};
+	int failed = 0;
+	for ( size_t i = 0; i < sizeof( CASES ) / sizeof( CASES[0] ); ++i ) {
+		uint32_t flags = Filter_MatchItem( CASES[i].author, CASES[i].text );
+		if ( flags != CASES[i].flags ) {
+			wprintf( L"  author %S, text \"%S\": got %u, want %u\n", CASES[i].author, CASES[i].text, flags, CASES[i].flags );
+			++failed;
+		}
+	}
+	wprintf( L"cases: %d, failed: %d\n", (int)( sizeof( CASES ) / sizeof( CASES[0] ) ), failed );
+	return failed == 0 ? 0 : 1;
+}
+
+int Bench_Run( int argc, char* argv[] )
+{
+	static const struct {
+		const char* name;
+		int ( *run )( int argc, char* argv[] );
+	} benches[] = {
+		{ "parse", Bench_Parse },
+		{ "dedup", Bench_Dedup },
+		{ "readstate", Bench_ReadState },
+		{ "net", Bench_Net },
+		{ "conncache", Bench_Conncache },
+		{ "share", Bench_Share },
+		{ "sharecheck", Bench_ShareCheck },
+		{ "multiwait", Bench_MultiWait },
+		{ "fixtures", Bench_Fixtures },
+		{ "filtercheck", Bench_FilterCheck },
+	};
+
+	int count = sizeof( benches ) / sizeof( benches[0] );
+	if ( argc > 0 ) {
+		for ( int i = 0; i < count; ++i ) {
+			if ( strcmp( argv[0], benches[i].name ) == 0 ) {
+				return benches[i].run( argc - 1, argv + 1 );
+			}
+		}
+	}
+
+	wprintf( L"usage: csmth bench <name> ...\n" );
+	for ( int i = 0; i < count; ++i ) {
+		wprintf( L"  %S\n", benches[i].name );
+	}
+	return 1;
+}
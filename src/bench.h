@@ -0,0 +1,7 @@
+#ifndef BENCH_H_191021141205
+#define BENCH_H_191021141205
+
+// Runs "csmth bench <name> ..." and returns the process exit code.
+int Bench_Run( int argc, char* argv[] );
+
+#endif // #ifndef BENCH_H_191021141205
@@ -0,0 +1,178 @@
+#ifndef BIN_STREAM_H_191022163020
+#define BIN_STREAM_H_191022163020
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Little helpers for flat binary files. Everything is written in host
+// byte order with explicit sizes and no pointers, so a file can be mapped
+// at any address. Most readers decode it into ordinary objects, e.g. the
+// page snapshot; only aligned blocks, like the read state's bitmaps, are
+// used in place.
+class BinWriter
+{
+public:
+	void U8( uint8_t v )
+	{
+		buffer.push_back( (char)v );
+	}
+	void U32( uint32_t v )
+	{
+		Bytes( &v, sizeof( v ) );
+	}
+	void U64( uint64_t v )
+	{
+		Bytes( &v, sizeof( v ) );
+	}
+	void I32( int32_t v )
+	{
+		Bytes( &v, sizeof( v ) );
+	}
+	void Str( const std::string& s )
+	{
+		U32( (uint32_t)s.length() );
+		Bytes( s.data(), s.length() );
+	}
+	void WStr( const std::wstring& s )
+	{
+		U32( (uint32_t)s.length() );
+		Bytes( s.data(), s.length() * sizeof( wchar_t ) );
+	}
+	void Bytes( const void* p, size_t n )
+	{
+		buffer.insert( buffer.end(), (const char*)p, (const char*)p + n );
+	}
+	// Pads with zeros up to a multiple of n, so a block used in place from
+	// a mapping is aligned.
+	void Align( size_t n )
+	{
+		buffer.resize( ( buffer.size() + n - 1 ) / n * n, 0 );
+	}
+	// Overwrites an already written 32-bit value, e.g. a size field.
+	void PatchU32( size_t offset, uint32_t v )
+	{
+		memcpy( &buffer[offset], &v, sizeof( v ) );
+	}
+	size_t Size() const
+	{
+		return buffer.size();
+	}
+	const std::vector<char>& Buffer() const
+	{
+		return buffer;
+	}
+
+private:
+	std::vector<char> buffer;
+};
+
+// Bounds checked reader, once a read runs past the end every further read
+// returns zeros and Ok() turns false.
+class BinReader
+{
+public:
+	BinReader( const char* p, size_t n )
+		: data( p ), size( n ), pos( 0 ), ok( true )
+	{
+	}
+	uint8_t U8()
+	{
+		uint8_t v = 0;
+		Bytes( &v, sizeof( v ) );
+		return v;
+	}
+	uint32_t U32()
+	{
+		uint32_t v = 0;
+		Bytes( &v, sizeof( v ) );
+		return v;
+	}
+	uint64_t U64()
+	{
+		uint64_t v = 0;
+		Bytes( &v, sizeof( v ) );
+		return v;
+	}
+	int32_t I32()
+	{
+		int32_t v = 0;
+		Bytes( &v, sizeof( v ) );
+		return v;
+	}
+	std::string Str()
+	{
+		uint32_t n = U32();
+		if ( !Has( n ) ) {
+			return std::string();
+		}
+		std::string s( data + pos, n );
+		pos += n;
+		return s;
+	}
+	std::wstring WStr()
+	{
+		uint32_t n = U32();
+		if ( !Has( (size_t)n * sizeof( wchar_t ) ) ) {
+			return std::wstring();
+		}
+		std::wstring s( n, L'\0' );
+		memcpy( &s[0], data + pos, n * sizeof( wchar_t ) );
+		pos += n * sizeof( wchar_t );
+		return s;
+	}
+	bool Bytes( void* p, size_t n )
+	{
+		if ( !Has( n ) ) {
+			memset( p, 0, n );
+			return false;
+		}
+		memcpy( p, data + pos, n );
+		pos += n;
+		return true;
+	}
+	// Skips the padding written by BinWriter::Align, offsets count from
+	// the start of the buffer.
+	bool Align( size_t n )
+	{
+		return Skip( ( n - pos % n ) % n );
+	}
+	const char* Current() const
+	{
+		return data + pos;
+	}
+	bool Skip( size_t n )
+	{
+		if ( !Has( n ) ) {
+			return false;
+		}
+		pos += n;
+		return true;
+	}
+	size_t Pos() const
+	{
+		return pos;
+	}
+	bool Ok() const
+	{
+		return ok;
+	}
+
+private:
+	bool Has( size_t n )
+	{
+		if ( !ok || size - pos < n ) {
+			ok = false;
+			return false;
+		}
+		return true;
+	}
+
+	const char* data;
+	size_t      size;
+	size_t      pos;
+	bool        ok;
+};
+
+#endif // #ifndef BIN_STREAM_H_191022163020
@@ -0,0 +1,126 @@
+#include <algorithm>
+
+#include "board_finder.h"
+
+static std::string Finder_Lower( const std::string& text )
+{
+	std::string s = text;
+	for ( size_t i = 0; i < s.length(); ++i ) {
+		if ( s[i] >= 'A' && s[i] <= 'Z' ) {
+			s[i] = s[i] - 'A' + 'a';
+		}
+	}
+	return s;
+}
+
+static uint32_t Finder_Trigram( const std::string& s, size_t i )
+{
+	return ( (uint32_t)(unsigned char)s[i] << 16 ) | ( (uint32_t)(unsigned char)s[i + 1] << 8 ) | (unsigned char)s[i + 2];
+}
+
+static void Finder_Trigrams( const std::string& s, std::vector<uint32_t>& out )
+{
+	out.clear();
+	for ( size_t i = 0; i + 3 <= s.length(); ++i ) {
+		out.push_back( Finder_Trigram( s, i ) );
+	}
+	std::sort( out.begin(), out.end() );
+	out.erase( std::unique( out.begin(), out.end() ), out.end() );
+}
+
+void BoardFinder::Build( const std::vector<BoardEntry>& entries )
+{
+	boards = entries;
+	keys.resize( boards.size() );
+	postings.clear();
+
+	std::vector<uint32_t> trigrams;
+	for ( size_t i = 0; i < boards.size(); ++i ) {
+		// The separator keeps trigrams from spanning both names.
+		keys[i] = Finder_Lower( boards[i].name_en ) + "\n" + Finder_Lower( boards[i].name_cn );
+		Finder_Trigrams( keys[i], trigrams );
+		for ( size_t k = 0; k < trigrams.size(); ++k ) {
+			Posting p = { trigrams[k], (uint32_t)i };
+			postings.push_back( p );
+		}
+	}
+	std::sort( postings.begin(), postings.end(), []( const Posting& a, const Posting& b ) {
+		return a.trigram != b.trigram ? a.trigram < b.trigram : a.board < b.board;
+	} );
+}
+
+// Higher is better, negative means no match.
+int BoardFinder::Score( size_t board, const std::string& query, size_t sharedTrigrams, size_t queryTrigrams ) const
+{
+	const std::string& key = keys[board];
+	size_t at = key.find( query );
+	if ( at == 0 ) {
+		// Exact board name beats every other prefix hit.
+		return key.length() == query.length() || key[query.length()] == '\n' ? 4000 : 3000;
+	}
+	if ( at != std::string::npos ) {
+		return key[at - 1] == '\n' ? 2500 : 2000;
+	}
+	if ( queryTrigrams == 0 || sharedTrigrams * 2 < queryTrigrams ) {
+		return -1;
+	}
+	return (int)( sharedTrigrams * 1000 / queryTrigrams );
+}
+
+std::vector<size_t> BoardFinder::Find( const std::string& text, size_t maxResults ) const
+{
+	std::string query = Finder_Lower( text );
+	std::vector<std::pair<int, size_t>> ranked;
+
+	if ( query.length() == 0 ) {
+		return std::vector<size_t>();
+	}
+	if ( query.length() < 3 ) {
+		for ( size_t i = 0; i < boards.size(); ++i ) {
+			int score = Score( i, query, 0, 0 );
+			if ( score >= 0 ) {
+				ranked.push_back( std::make_pair( score, i ) );
+			}
+		}
+	}
+	else {
+		std::vector<uint32_t> trigrams;
+		Finder_Trigrams( query, trigrams );
+
+		// Trigrams each board shares with the query.
+		std::vector<uint16_t> shared( boards.size(), 0 );
+		std::vector<uint32_t> candidates;
+		for ( size_t k = 0; k < trigrams.size(); ++k ) {
+			Posting key = { trigrams[k], 0 };
+			auto it = std::lower_bound( postings.begin(), postings.end(), key, []( const Posting& a, const Posting& b ) {
+				return a.trigram < b.trigram;
+			} );
+			for ( ; it != postings.end() && it->trigram == trigrams[k]; ++it ) {
+				if ( shared[it->board]++ == 0 ) {
+					candidates.push_back( it->board );
+				}
+			}
+		}
+		for ( size_t i = 0; i < candidates.size(); ++i ) {
+			int score = Score( candidates[i], query, shared[candidates[i]], trigrams.size() );
+			if ( score >= 0 ) {
+				ranked.push_back( std::make_pair( score, (size_t)candidates[i] ) );
+			}
+		}
+	}
+
+	// Best score first, shorter names first among equals.
+	size_t count = std::min( maxResults, ranked.size() );
+	std::partial_sort( ranked.begin(), ranked.begin() + count, ranked.end(), [this]( const std::pair<int, size_t>& a, const std::pair<int, size_t>& b ) {
+		if ( a.first != b.first ) {
+			return a.first > b.first;
+		}
+		return keys[a.second].length() < keys[b.second].length();
+	} );
+
+	std::vector<size_t> results;
+	for ( size_t i = 0; i < count; ++i ) {
+		results.push_back( ranked[i].second );
+	}
+	return results;
+}
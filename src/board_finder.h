@@ -0,0 +1,49 @@
+#ifndef BOARD_FINDER_H_191026101130
+#define BOARD_FINDER_H_191026101130
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct BoardEntry {
+	std::string name_en;
+	std::string name_cn;
+	std::string url;
+};
+
+// Fuzzy board lookup over a trigram index of the English and Chinese
+// board names (UTF-8 bytes, English lowercased). A query is matched by
+// counting the trigrams it shares with each board, then ranked so that
+// prefix and substring hits come first. Queries shorter than a trigram
+// fall back to a scan, which is cheap for a few thousand boards.
+class BoardFinder
+{
+public:
+	void Build( const std::vector<BoardEntry>& entries );
+
+	// Indices of at most maxResults best matching boards, best first.
+	std::vector<size_t> Find( const std::string& query, size_t maxResults ) const;
+
+	const BoardEntry& Entry( size_t i ) const
+	{
+		return boards[i];
+	}
+	size_t Count() const
+	{
+		return boards.size();
+	}
+
+private:
+	struct Posting {
+		uint32_t trigram;
+		uint32_t board;
+	};
+
+	int Score( size_t board, const std::string& query, size_t sharedTrigrams, size_t queryTrigrams ) const;
+
+	std::vector<BoardEntry>  boards;
+	std::vector<std::string> keys;     // searchable text per board
+	std::vector<Posting>     postings; // sorted by trigram, then board
+};
+
+#endif // #ifndef BOARD_FINDER_H_191026101130
@@ -0,0 +1,68 @@
+#include <cstdlib>
+#include <fstream>
+#include <map>
+
+#include "config.h"
+
+static struct ConfigModule {
+	std::map<std::string, std::string> values;
+} gsConfig;
+
+std::string Config_Trim( const std::string& text )
+{
+	size_t begin = text.find_first_not_of( " \t\r\n" );
+	if ( begin == std::string::npos ) {
+		return "";
+	}
+	size_t end = text.find_last_not_of( " \t\r\n" );
+	return text.substr( begin, end - begin + 1 );
+}
+
+bool Config_Load( const std::string& path )
+{
+	std::ifstream is( path.c_str() );
+	if ( !is ) {
+		return false;
+	}
+	std::string line;
+	while ( std::getline( is, line ) ) {
+		line = Config_Trim( line );
+		if ( line.length() == 0 || line[0] == '#' ) {
+			continue;
+		}
+		size_t eq = line.find( '=' );
+		if ( eq == std::string::npos ) {
+			continue;
+		}
+		gsConfig.values[Config_Trim( line.substr( 0, eq ) )] = Config_Trim( line.substr( eq + 1 ) );
+	}
+	return true;
+}
+
+std::string Config_GetString( const std::string& key, const std::string& defaultValue )
+{
+	auto it = gsConfig.values.find( key );
+	if ( it == gsConfig.values.end() ) {
+		return defaultValue;
+	}
+	return it->second;
+}
+
+int Config_GetInt( const std::string& key, int defaultValue )
+{
+	auto it = gsConfig.values.find( key );
+	if ( it == gsConfig.values.end() || it->second.length() == 0 ) {
+		return defaultValue;
+	}
+	return atoi( it->second.c_str() );
+}
+
+bool Config_GetBool( const std::string& key, bool defaultValue )
+{
+	auto it = gsConfig.values.find( key );
+	if ( it == gsConfig.values.end() ) {
+		return defaultValue;
+	}
+	const std::string& v = it->second;
+	return v == "1" || v == "true" || v == "yes" || v == "on";
+}
@@ -0,0 +1,17 @@
+#ifndef CONFIG_H_191023094107
+#define CONFIG_H_191023094107
+
+#include <string>
+
+// Settings from a "key = value" text file, lines starting with '#' are
+// comments. Missing keys fall back to the given defaults.
+bool Config_Load( const std::string& path );
+
+// Text without the spaces, tabs and line breaks at both ends.
+std::string Config_Trim( const std::string& text );
+
+std::string Config_GetString( const std::string& key, const std::string& defaultValue="" );
+int  Config_GetInt( const std::string& key, int defaultValue );
+bool Config_GetBool( const std::string& key, bool defaultValue );
+
+#endif // #ifndef CONFIG_H_191023094107
@@ -0,0 +1,572 @@
+#include <winsock2.h>
+#include <afunix.h>
+#include <windows.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <io.h>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "bin_stream.h"
+#include "config.h"
+#include "intern.h"
+#include "net_util.h"
+#include "smth.h"
+#include "daemon.h"
+
+enum DaemonOp {
+	DAEMON_OP_GET   = 1, // urls -> bodies
+	DAEMON_OP_PAGE  = 2, // url, raw -> page as text or html
+	DAEMON_OP_STATS = 3, // -> text
+};
+
+// Frames are a 32-bit length and a BinWriter buffer; anything larger is a
+// broken peer.
+static const uint32_t DAEMON_MAX_FRAME = 256u << 20;
+
+// Bodies fetched for one url, kept for ttlMs and dropped least recently
+// used first once more than maxBytes are held.
+class DaemonCache
+{
+public:
+	DaemonCache()
+		: ttlMs( 30000 ), maxBytes( 64 << 20 ), bytes( 0 )
+	{
+	}
+	void SetLimits( double ttl, size_t max )
+	{
+		ttlMs    = ttl;
+		maxBytes = max;
+	}
+	bool Get( const std::string& key, double nowMs, std::string& outValue )
+	{
+		std::lock_guard<std::mutex> lock( mutex );
+		auto it = entries.find( key );
+		if ( it == entries.end() ) {
+			return false;
+		}
+		if ( nowMs - it->second.storedMs > ttlMs ) {
+			Erase( it );
+			return false;
+		}
+		lru.splice( lru.begin(), lru, it->second.lru );
+		outValue = it->second.value;
+		return true;
+	}
+	void Put( const std::string& key, const std::string& value, double nowMs )
+	{
+		std::lock_guard<std::mutex> lock( mutex );
+		auto it = entries.find( key );
+		if ( it != entries.end() ) {
+			Erase( it );
+		}
+		if ( value.length() > maxBytes ) {
+			return;
+		}
+		lru.push_front( key );
+		Entry& e   = entries[key];
+		e.value    = value;
+		e.storedMs = nowMs;
+		e.lru      = lru.begin();
+		bytes += value.length();
+		while ( bytes > maxBytes ) {
+			Erase( entries.find( lru.back() ) );
+		}
+	}
+	size_t Count()
+	{
+		std::lock_guard<std::mutex> lock( mutex );
+		return entries.size();
+	}
+
+private:
+	struct Entry {
+		std::string                      value;
+		double                           storedMs;
+		std::list<std::string>::iterator lru;
+	};
+	typedef std::unordered_map<std::string, Entry>::iterator EntryIt;
+
+	void Erase( EntryIt it )
+	{
+		bytes -= it->second.value.length();
+		lru.erase( it->second.lru );
+		entries.erase( it );
+	}
+
+	std::mutex                             mutex;
+	std::unordered_map<std::string, Entry> entries;
+	std::list<std::string>                 lru;
+	double                                 ttlMs;
+	size_t                                 maxBytes;
+	size_t                                 bytes;
+};
+
+static struct {
+	std::string      cookiePath;
+	DaemonCache      http;
+	DaemonCache      pages;
+	std::atomic<int> requests;
+	std::atomic<int> urls;
+	std::atomic<int> httpHits;
+	std::atomic<int> pageHits;
+	std::mutex       logMutex;
+} gsDaemon;
+
+static struct {
+	SOCKET     s;
+	std::mutex mutex;
+} gsDaemonClient = { INVALID_SOCKET };
+
+static double Daemon_NowMs( void )
+{
+	using namespace std::chrono;
+	return duration<double, std::milli>( steady_clock::now().time_since_epoch() ).count();
+}
+
+static std::string Daemon_SocketPath( void )
+{
+	const char* path = getenv( "CSMTH_DAEMON_SOCKET" );
+	if ( path != nullptr && path[0] != '\0' ) {
+		return path;
+	}
+	return Smth_GetDataDir() + "/csmthd.sock";
+}
+
+static bool Daemon_SendAll( SOCKET s, const char* p, size_t n )
+{
+	while ( n > 0 ) {
+		int sent = send( s, p, (int)std::min( n, (size_t)( 1 << 20 ) ), 0 );
+		if ( sent <= 0 ) {
+			return false;
+		}
+		p += sent;
+		n -= (size_t)sent;
+	}
+	return true;
+}
+
+static bool Daemon_RecvAll( SOCKET s, char* p, size_t n )
+{
+	while ( n > 0 ) {
+		int got = recv( s, p, (int)std::min( n, (size_t)( 1 << 20 ) ), 0 );
+		if ( got <= 0 ) {
+			return false;
+		}
+		p += got;
+		n -= (size_t)got;
+	}
+	return true;
+}
+
+static bool Daemon_SendFrame( SOCKET s, const BinWriter& w )
+{
+	uint32_t length = (uint32_t)w.Size();
+	return Daemon_SendAll( s, (const char*)&length, sizeof( length ) ) && Daemon_SendAll( s, w.Buffer().data(), w.Size() );
+}
+
+static bool Daemon_RecvFrame( SOCKET s, std::string& outFrame )
+{
+	uint32_t length = 0;
+	if ( !Daemon_RecvAll( s, (char*)&length, sizeof( length ) ) || length > DAEMON_MAX_FRAME ) {
+		return false;
+	}
+	outFrame.resize( length );
+	return length == 0 || Daemon_RecvAll( s, &outFrame[0], length );
+}
+
+// Bodies of urls, from the HTTP cache where still fresh and the misses
+// fetched together over the warm connections.
+static std::vector<std::string> Daemon_GetBodies( const std::vector<std::string>& urls )
+{
+	double now = Daemon_NowMs();
+	std::vector<std::string> bodies( urls.size() );
+	std::vector<std::string> missUrls;
+	std::vector<size_t>      missIndex;
+	for ( size_t i = 0; i < urls.size(); ++i ) {
+		if ( gsDaemon.http.Get( urls[i], now, bodies[i] ) ) {
+			gsDaemon.httpHits++;
+		}
+		else {
+			missUrls.push_back( urls[i] );
+			missIndex.push_back( i );
+		}
+	}
+	gsDaemon.urls += (int)urls.size();
+	if ( missUrls.size() == 0 ) {
+		return bodies;
+	}
+
+	std::vector<std::string> fetched = missUrls.size() == 1
+		? std::vector<std::string>( 1, Net_Get( missUrls[0], gsDaemon.cookiePath ) )
+		: Net_GetAll( missUrls, gsDaemon.cookiePath );
+	now = Daemon_NowMs();
+	for ( size_t i = 0; i < fetched.size(); ++i ) {
+		if ( fetched[i].length() > 0 ) {
+			gsDaemon.http.Put( missUrls[i], fetched[i], now );
+		}
+		bodies[missIndex[i]].swap( fetched[i] );
+	}
+	return bodies;
+}
+
+static std::string Daemon_RenderPage( const std::string& url, const std::string& html )
+{
+	std::string text;
+	std::string cat = Smth_GetUrlCategory( url );
+	if ( cat == "board" ) {
+		BoardPage page;
+		Smth_GetBoardPage( html, page );
+		text += "=== " + page.name_cn + "(" + page.name_en + ") " + std::to_string( page.pageIndex ) + "/" + std::to_string( page.pageCount ) + " ===\n";
+		for ( size_t i = 0; i < page.items.size(); ++i ) {
+			const BoardItem& item = page.items[i];
+			text += std::string( item.is_top ? "*" : " " ) + " " + Intern_String( item.author ) + "\t" + Intern_String( item.replier_time )
+				+ "\t" + item.title + "\t" + item.url + "\n";
+		}
+	}
+	else if ( cat == "article" ) {
+		ArticlePage page;
+		Smth_GetArticlePage( html, page );
+		text += "=== " + page.name + " [" + page.boardName + "] " + std::to_string( page.pageIndex ) + "/" + std::to_string( page.pageCount ) + " ===\n";
+		for ( size_t i = 0; i < page.items.size(); ++i ) {
+			text += "\n--- " + page.items[i].author + "\n" + page.items[i].content + "\n";
+		}
+	}
+	else {
+		SectionPage page;
+		Smth_GetSectionPage( html, page );
+		text += "=== " + page.name + " ===\n";
+		for ( size_t i = 0; i < page.items.size(); ++i ) {
+			text += page.items[i].type + "\t" + page.items[i].title + "\t" + page.items[i].url + "\n";
+		}
+	}
+	return text;
+}
+
+// The text of a page, from the parsed-page cache while its html is fresh.
+static std::string Daemon_GetPage( const std::string& url, bool raw )
+{
+	std::string text;
+	if ( !raw && gsDaemon.pages.Get( url, Daemon_NowMs(), text ) ) {
+		gsDaemon.pageHits++;
+		gsDaemon.urls++;
+		return text;
+	}
+	std::string html = Daemon_GetBodies( std::vector<std::string>( 1, url ) )[0];
+	if ( raw || html.length() == 0 ) {
+		return html;
+	}
+	text = Daemon_RenderPage( url, html );
+	gsDaemon.pages.Put( url, text, Daemon_NowMs() );
+	return text;
+}
+
+static std::string Daemon_StatsText( void )
+{
+	long handshakes = 0, resumed = 0;
+	Net_GetTlsStats( handshakes, resumed );
+	char line[256];
+	snprintf( line, sizeof( line ), "requests %d  urls %d  http hits %d (%d cached)  page hits %d (%d cached)  tls %ld handshakes, %ld resumed\n",
+			gsDaemon.requests.load(), gsDaemon.urls.load(), gsDaemon.httpHits.load(), (int)gsDaemon.http.Count(),
+			gsDaemon.pageHits.load(), (int)gsDaemon.pages.Count(), handshakes, resumed );
+	return line;
+}
+
+static bool Daemon_Serve( SOCKET s, const std::string& frame )
+{
+	BinReader r( frame.data(), frame.length() );
+	BinWriter w;
+	double t0 = Daemon_NowMs();
+	uint8_t op = r.U8();
+	size_t count = 0;
+	if ( op == DAEMON_OP_GET ) {
+		// Every url takes at least its length, a larger count is a broken
+		// peer and must not size the vector.
+		uint32_t urlCount = r.U32();
+		if ( !r.Ok() || urlCount > frame.length() / sizeof( uint32_t ) ) {
+			return false;
+		}
+		std::vector<std::string> urls( urlCount );
+		for ( size_t i = 0; i < urls.size(); ++i ) {
+			urls[i] = r.Str();
+		}
+		if ( !r.Ok() ) {
+			return false;
+		}
+		std::vector<std::string> bodies = Daemon_GetBodies( urls );
+		w.U8( 1 );
+		w.U32( (uint32_t)bodies.size() );
+		for ( size_t i = 0; i < bodies.size(); ++i ) {
+			w.Str( bodies[i] );
+		}
+		count = urls.size();
+	}
+	else if ( op == DAEMON_OP_PAGE ) {
+		std::string url = r.Str();
+		bool raw = r.U8() != 0;
+		if ( !r.Ok() ) {
+			return false;
+		}
+		w.U8( 1 );
+		w.Str( Daemon_GetPage( url, raw ) );
+		count = 1;
+	}
+	else if ( op == DAEMON_OP_STATS ) {
+		w.U8( 1 );
+		w.Str( Daemon_StatsText() );
+	}
+	else {
+		return false;
+	}
+	gsDaemon.requests++;
+
+	{
+		std::lock_guard<std::mutex> lock( gsDaemon.logMutex );
+		printf( "op %d  %d url(s)  %.1f ms\n", (int)op, (int)count, Daemon_NowMs() - t0 );
+		fflush( stdout );
+	}
+	return Daemon_SendFrame( s, w );
+}
+
+static void Daemon_Connection( SOCKET s )
+{
+	std::string frame;
+	while ( Daemon_RecvFrame( s, frame ) && Daemon_Serve( s, frame ) ) {
+	}
+	closesocket( s );
+}
+
+static SOCKET Daemon_Listen( const std::string& path )
+{
+	sockaddr_un addr;
+	memset( &addr, 0, sizeof( addr ) );
+	addr.sun_family = AF_UNIX;
+	if ( path.length() >= sizeof( addr.sun_path ) ) {
+		return INVALID_SOCKET;
+	}
+	strcpy( addr.sun_path, path.c_str() );
+
+	// A socket file left behind by a daemon that did not exit cleanly
+	// would make bind fail.
+	DeleteFileA( path.c_str() );
+	SOCKET listener = socket( AF_UNIX, SOCK_STREAM, 0 );
+	if ( listener == INVALID_SOCKET ) {
+		return INVALID_SOCKET;
+	}
+	if ( bind( listener, (sockaddr*)&addr, sizeof( addr ) ) == SOCKET_ERROR || listen( listener, 64 ) == SOCKET_ERROR ) {
+		closesocket( listener );
+		return INVALID_SOCKET;
+	}
+	return listener;
+}
+
+int Daemon_Run( int argc, char* argv[] )
+{
+	std::string path;
+	bool login = false;
+	for ( int i = 0; i < argc; ++i ) {
+		if ( strcmp( argv[i], "--socket" ) == 0 && i + 1 < argc ) {
+			path = argv[++i];
+		}
+		else if ( strcmp( argv[i], "--login" ) == 0 ) {
+			login = true;
+		}
+		else {
+			fwprintf( stderr, L"usage: csmth daemon [--socket <path>] [--login]\n" );
+			return 1;
+		}
+	}
+	if ( path.length() == 0 ) {
+		path = Daemon_SocketPath();
+	}
+
+	if ( !Smth_NetInit() ) {
+		return 1;
+	}
+	gsDaemon.http.SetLimits( Config_GetInt( "daemon_cache_ttl_s", 30 ) * 1000.0, (size_t)Config_GetInt( "daemon_cache_mb", 64 ) << 20 );
+	gsDaemon.pages.SetLimits( Config_GetInt( "daemon_cache_ttl_s", 30 ) * 1000.0, (size_t)Config_GetInt( "daemon_page_cache_mb", 16 ) << 20 );
+
+	// The jar of the daemon is used for every request it makes, clients
+	// asking with a cookie file of their own fetch directly.
+	std::string jar = Smth_GetDataDir() + "/csmthd.cookie";
+	if ( login ) {
+		if ( !Smth_LoginToFile( jar ) ) {
+			fwprintf( stderr, L"login failed, continuing as guest\n" );
+			DeleteFileA( jar.c_str() );
+		}
+	}
+	if ( GetFileAttributesA( jar.c_str() ) != INVALID_FILE_ATTRIBUTES ) {
+		gsDaemon.cookiePath = jar;
+	}
+
+	WSADATA wsaData;
+	if ( WSAStartup( MAKEWORD( 2, 2 ), &wsaData ) != 0 ) {
+		Smth_NetDeinit();
+		return 1;
+	}
+	SOCKET listener = Daemon_Listen( path );
+	if ( listener == INVALID_SOCKET ) {
+		fwprintf( stderr, L"cannot listen on %S\n", path.c_str() );
+		WSACleanup();
+		Smth_NetDeinit();
+		return 1;
+	}
+	printf( "csmthd listening on %s%s\n", path.c_str(), gsDaemon.cookiePath.length() > 0 ? " (logged in)" : "" );
+	fflush( stdout );
+
+	while ( true ) {
+		SOCKET s = accept( listener, nullptr, nullptr );
+		if ( s == INVALID_SOCKET ) {
+			break;
+		}
+		std::thread( Daemon_Connection, s ).detach();
+	}
+	closesocket( listener );
+	DeleteFileA( path.c_str() );
+	WSACleanup();
+	Smth_NetDeinit();
+	return 0;
+}
+
+// One request and its answer over the connection of this process; the
+// connection is dropped on any error, or when the daemon takes longer
+// than a get of our own could, and the caller fetches directly.
+static bool Daemon_Call( const BinWriter& w, std::string& outFrame )
+{
+	std::lock_guard<std::mutex> lock( gsDaemonClient.mutex );
+	if ( gsDaemonClient.s == INVALID_SOCKET ) {
+		return false;
+	}
+	NetPolicy policy = Net_GetPolicy();
+	DWORD timeoutMs = (DWORD)( policy.connectTimeoutMs + policy.deadlineMs );
+	setsockopt( gsDaemonClient.s, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeoutMs, sizeof( timeoutMs ) );
+	setsockopt( gsDaemonClient.s, SOL_SOCKET, SO_SNDTIMEO, (const char*)&timeoutMs, sizeof( timeoutMs ) );
+	if ( Daemon_SendFrame( gsDaemonClient.s, w ) && Daemon_RecvFrame( gsDaemonClient.s, outFrame ) && outFrame.length() > 0 && outFrame[0] == 1 ) {
+		return true;
+	}
+	closesocket( gsDaemonClient.s );
+	gsDaemonClient.s = INVALID_SOCKET;
+	return false;
+}
+
+static bool Daemon_Forward( const std::vector<std::string>& urls, std::vector<std::string>& outBodies )
+{
+	BinWriter w;
+	w.U8( DAEMON_OP_GET );
+	w.U32( (uint32_t)urls.size() );
+	for ( size_t i = 0; i < urls.size(); ++i ) {
+		w.Str( urls[i] );
+	}
+	std::string frame;
+	if ( !Daemon_Call( w, frame ) ) {
+		return false;
+	}
+	BinReader r( frame.data() + 1, frame.length() - 1 );
+	if ( r.U32() != urls.size() ) {
+		return false;
+	}
+	outBodies.resize( urls.size() );
+	for ( size_t i = 0; i < urls.size(); ++i ) {
+		outBodies[i] = r.Str();
+	}
+	return r.Ok();
+}
+
+bool Daemon_Attach( void )
+{
+	std::string path = Daemon_SocketPath();
+	// Nothing to try, and no need for winsock, without the socket file.
+	if ( GetFileAttributesA( path.c_str() ) == INVALID_FILE_ATTRIBUTES ) {
+		return false;
+	}
+	sockaddr_un addr;
+	memset( &addr, 0, sizeof( addr ) );
+	addr.sun_family = AF_UNIX;
+	if ( path.length() >= sizeof( addr.sun_path ) ) {
+		return false;
+	}
+	strcpy( addr.sun_path, path.c_str() );
+
+	WSADATA wsaData;
+	if ( WSAStartup( MAKEWORD( 2, 2 ), &wsaData ) != 0 ) {
+		return false;
+	}
+	SOCKET s = socket( AF_UNIX, SOCK_STREAM, 0 );
+	if ( s == INVALID_SOCKET ) {
+		WSACleanup();
+		return false;
+	}
+	if ( connect( s, (sockaddr*)&addr, sizeof( addr ) ) == SOCKET_ERROR ) {
+		closesocket( s );
+		WSACleanup();
+		return false;
+	}
+	gsDaemonClient.s = s;
+	Net_SetForwarder( Daemon_Forward );
+	return true;
+}
+
+int Daemon_Fetch( int argc, char* argv[] )
+{
+	std::string url;
+	bool raw = false;
+	bool stats = false;
+	for ( int i = 0; i < argc; ++i ) {
+		if ( strcmp( argv[i], "--raw" ) == 0 ) {
+			raw = true;
+		}
+		else if ( strcmp( argv[i], "--stats" ) == 0 ) {
+			stats = true;
+		}
+		else {
+			url = argv[i];
+		}
+	}
+	if ( url.length() == 0 && !stats ) {
+		fwprintf( stderr, L"usage: csmth fetch <url> [--raw] | csmth fetch --stats\n" );
+		return 1;
+	}
+	_setmode( _fileno( stdout ), _O_BINARY );
+
+	std::string text;
+	BinWriter w;
+	if ( stats ) {
+		w.U8( DAEMON_OP_STATS );
+	}
+	else {
+		w.U8( DAEMON_OP_PAGE );
+		w.Str( url );
+		w.U8( raw ? 1 : 0 );
+	}
+	std::string frame;
+	if ( Daemon_Attach() && Daemon_Call( w, frame ) ) {
+		BinReader r( frame.data() + 1, frame.length() - 1 );
+		text = r.Str();
+	}
+	else if ( stats ) {
+		fwprintf( stderr, L"no daemon running\n" );
+		return 1;
+	}
+	else {
+		// Without a daemon the page is fetched the slow way, same output.
+		Net_SetForwarder( nullptr );
+		if ( !Smth_NetInit() ) {
+			return 1;
+		}
+		std::string html = Net_Get( url );
+		text = ( raw || html.length() == 0 ) ? html : Daemon_RenderPage( url, html );
+		Smth_NetDeinit();
+	}
+	if ( text.length() == 0 ) {
+		return 1;
+	}
+	fwrite( text.data(), 1, text.length(), stdout );
+	return 0;
+}
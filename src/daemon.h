@@ -0,0 +1,19 @@
+#ifndef DAEMON_H_191112090517
+#define DAEMON_H_191112090517
+
+// Runs "csmth daemon [--socket <path>] [--login]", a resident process that
+// owns the warm connections, TLS sessions, cookie jar, HTTP cache and
+// parsed-page cache, and serves other csmth processes over a Unix domain
+// socket, <data dir>/csmthd.sock by default.
+int Daemon_Run( int argc, char* argv[] );
+
+// Connects to a running daemon and routes the cookie-less gets of this
+// process through it. Returns false, leaving the Net layer as it was,
+// when no daemon answers. CSMTH_DAEMON_SOCKET overrides the socket path.
+bool Daemon_Attach( void );
+
+// Runs "csmth fetch <url> [--raw]": prints the page as text, or the raw
+// html, in one round trip to the daemon, or fetched directly without one.
+int Daemon_Fetch( int argc, char* argv[] );
+
+#endif // #ifndef DAEMON_H_191112090517
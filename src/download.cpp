@@ -0,0 +1,499 @@
+#include <windows.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <set>
+
+#include "mbedtls/sha256.h"
+
+#include "config.h"
+#include "net_util.h"
+#include "read_state.h"
+#include "smth.h"
+#include "download.h"
+
+using namespace std::chrono;
+
+static const int64_t     DOWNLOAD_CHUNK_SIZE = 1 << 20;
+static const int         DOWNLOAD_RETRIES    = 3;
+
+static const struct {
+	const char* contentType;
+	const char* ext;
+} gsDownloadExts[] = {
+	{ "image/jpeg",      ".jpg"  },
+	{ "image/png",       ".png"  },
+	{ "image/gif",       ".gif"  },
+	{ "image/webp",      ".webp" },
+	{ "application/pdf", ".pdf"  },
+	{ "application/zip", ".zip"  },
+	{ "",                ".bin"  },
+};
+
+struct DownloadFile {
+	std::string          url;
+	std::string          base;
+	std::string          ext;
+	// -1 until the first response tells the size.
+	int64_t              length;
+	std::vector<uint8_t> chunkDone;
+	size_t               chunksLeft;
+	size_t               chunksResumed;
+	FILE*                part;
+	FILE*                map;
+	long                 mapHeader;
+	int64_t              fetched;
+	steady_clock::time_point start;
+	bool                 done;
+	bool                 failed;
+};
+
+struct DownloadJob {
+	size_t file;
+	size_t chunk;
+	int    tries;
+};
+
+struct Downloader {
+	std::string                        dir;
+	std::vector<DownloadFile>          files;
+	std::vector<DownloadJob>           jobs;
+	std::map<std::string, std::string> hashes;
+	NetMultiHandle                     multi;
+};
+
+static std::string Download_ExtFromContentType( const std::string& contentType )
+{
+	size_t count = sizeof( gsDownloadExts ) / sizeof( gsDownloadExts[0] );
+	for ( size_t i = 0; i + 1 < count; ++i ) {
+		if ( contentType.compare( 0, strlen( gsDownloadExts[i].contentType ), gsDownloadExts[i].contentType ) == 0 ) {
+			return gsDownloadExts[i].ext;
+		}
+	}
+	return gsDownloadExts[count - 1].ext;
+}
+
+static bool Download_FileExists( const std::string& path )
+{
+	FILE* fp = fopen( path.c_str(), "rb" );
+	if ( fp != nullptr ) {
+		fclose( fp );
+	}
+	return fp != nullptr;
+}
+
+static std::string Download_FileName( const std::string& path )
+{
+	size_t slash = path.find_last_of( "/\\" );
+	return slash == std::string::npos ? path : path.substr( slash + 1 );
+}
+
+static std::string Download_HashFile( const std::string& path )
+{
+	std::string hex;
+	FILE* fp = fopen( path.c_str(), "rb" );
+	if ( fp == nullptr ) {
+		return hex;
+	}
+	mbedtls_sha256_context ctx;
+	mbedtls_sha256_init( &ctx );
+	mbedtls_sha256_starts_ret( &ctx, 0 );
+	std::vector<unsigned char> buffer( 64 * 1024 );
+	size_t n = 0;
+	while ( ( n = fread( buffer.data(), 1, buffer.size(), fp ) ) > 0 ) {
+		mbedtls_sha256_update_ret( &ctx, buffer.data(), n );
+	}
+	fclose( fp );
+
+	unsigned char digest[32];
+	mbedtls_sha256_finish_ret( &ctx, digest );
+	mbedtls_sha256_free( &ctx );
+
+	char text[3];
+	for ( size_t i = 0; i < sizeof( digest ); ++i ) {
+		snprintf( text, sizeof( text ), "%02x", digest[i] );
+		hex += text;
+	}
+	return hex;
+}
+
+// One "<sha256>\t<file name>" line per distinct content in the directory.
+static void Download_LoadHashes( Downloader& d )
+{
+	FILE* fp = fopen( ( d.dir + "/hashes.txt" ).c_str(), "rb" );
+	if ( fp == nullptr ) {
+		return;
+	}
+	char line[512];
+	while ( fgets( line, sizeof( line ), fp ) != nullptr ) {
+		char* tab = strchr( line, '\t' );
+		if ( tab == nullptr ) {
+			continue;
+		}
+		*tab = '\0';
+		std::string name = tab + 1;
+		while ( name.length() > 0 && ( name.back() == '\n' || name.back() == '\r' ) ) {
+			name.pop_back();
+		}
+		d.hashes[line] = name;
+	}
+	fclose( fp );
+}
+
+static void Download_AddHash( Downloader& d, const std::string& hash, const std::string& name )
+{
+	d.hashes[hash] = name;
+	FILE* fp = fopen( ( d.dir + "/hashes.txt" ).c_str(), "ab" );
+	if ( fp != nullptr ) {
+		fprintf( fp, "%s\t%s\n", hash.c_str(), name.c_str() );
+		fclose( fp );
+	}
+}
+
+// The map file is a "<length> <ext>" line followed by one byte per
+// chunk, '1' once the chunk is in the .part file.
+static bool Download_CreateMap( DownloadFile& f )
+{
+	size_t chunkCount = (size_t)( ( f.length + DOWNLOAD_CHUNK_SIZE - 1 ) / DOWNLOAD_CHUNK_SIZE );
+	f.chunkDone.assign( chunkCount, 0 );
+	f.chunksLeft = chunkCount;
+
+	FILE* part = fopen( ( f.base + ".part" ).c_str(), "wb" );
+	if ( part == nullptr ) {
+		return false;
+	}
+	fclose( part );
+	f.part = fopen( ( f.base + ".part" ).c_str(), "r+b" );
+	f.map  = fopen( ( f.base + ".part.map" ).c_str(), "w+b" );
+	if ( f.part == nullptr || f.map == nullptr ) {
+		return false;
+	}
+	fprintf( f.map, "%lld %s\n", (long long)f.length, f.ext.c_str() );
+	f.mapHeader = ftell( f.map );
+	std::vector<char> zeros( chunkCount, '0' );
+	fwrite( zeros.data(), 1, zeros.size(), f.map );
+	fflush( f.map );
+	return true;
+}
+
+static bool Download_OpenMap( DownloadFile& f )
+{
+	FILE* map = fopen( ( f.base + ".part.map" ).c_str(), "r+b" );
+	if ( map == nullptr ) {
+		return false;
+	}
+	long long length = 0;
+	char ext[16] = { 0 };
+	if ( fscanf( map, "%lld %15s", &length, ext ) != 2 || length <= 0 || fgetc( map ) != '\n' ) {
+		fclose( map );
+		return false;
+	}
+	FILE* part = fopen( ( f.base + ".part" ).c_str(), "r+b" );
+	if ( part == nullptr ) {
+		fclose( map );
+		return false;
+	}
+	f.length    = length;
+	f.ext       = ext;
+	f.mapHeader = ftell( map );
+	f.part      = part;
+	f.map       = map;
+
+	size_t chunkCount = (size_t)( ( f.length + DOWNLOAD_CHUNK_SIZE - 1 ) / DOWNLOAD_CHUNK_SIZE );
+	std::vector<char> marks( chunkCount, '0' );
+	size_t n = fread( marks.data(), 1, marks.size(), map );
+	f.chunkDone.assign( chunkCount, 0 );
+	f.chunksLeft = chunkCount;
+	for ( size_t i = 0; i < n; ++i ) {
+		if ( marks[i] == '1' ) {
+			f.chunkDone[i] = 1;
+			f.chunksLeft--;
+			f.chunksResumed++;
+		}
+	}
+	return true;
+}
+
+static void Download_CloseFile( DownloadFile& f )
+{
+	if ( f.part != nullptr ) {
+		fclose( f.part );
+		f.part = nullptr;
+	}
+	if ( f.map != nullptr ) {
+		fclose( f.map );
+		f.map = nullptr;
+	}
+}
+
+static void Download_AddJob( Downloader& d, size_t file, size_t chunk, int tries )
+{
+	DownloadJob job;
+	job.file  = file;
+	job.chunk = chunk;
+	job.tries = tries;
+	d.jobs.push_back( job );
+
+	const DownloadFile& f = d.files[file];
+	int64_t offset = (int64_t)chunk * DOWNLOAD_CHUNK_SIZE;
+	int64_t length = DOWNLOAD_CHUNK_SIZE;
+	if ( f.length >= 0 && offset + length > f.length ) {
+		length = f.length - offset;
+	}
+	Net_MultiAddRange( d.multi, (int)d.jobs.size() - 1, f.url, offset, length );
+}
+
+static void Download_Report( const DownloadFile& f, const std::string& note )
+{
+	double seconds = duration_cast<duration<double>>( steady_clock::now() - f.start ).count();
+	double rate = seconds > 0 ? f.fetched / 1024.0 / seconds : 0;
+	wprintf( L"%-28S %10lld bytes %7.2fs %9.1f KB/s%S\n", Download_FileName( f.base + f.ext ).c_str(),
+			(long long)f.length, seconds, rate, note.c_str() );
+}
+
+// Moves the finished .part file in place, or links the name to an
+// earlier file with the same content.
+static void Download_Finish( Downloader& d, DownloadFile& f )
+{
+	Download_CloseFile( f );
+	remove( ( f.base + ".part.map" ).c_str() );
+	f.done = true;
+
+	std::string partPath  = f.base + ".part";
+	std::string finalPath = f.base + f.ext;
+	std::string hash      = Download_HashFile( partPath );
+	std::string note;
+	if ( f.chunksResumed > 0 ) {
+		note += ", resumed " + std::to_string( f.chunksResumed ) + "/" + std::to_string( f.chunkDone.size() ) + " chunks";
+	}
+
+	auto it = d.hashes.find( hash );
+	if ( it != d.hashes.end() && it->second != Download_FileName( finalPath )
+			&& CreateHardLinkA( finalPath.c_str(), ( d.dir + "/" + it->second ).c_str(), nullptr ) ) {
+		remove( partPath.c_str() );
+		note += ", same as " + it->second;
+	}
+	else {
+		MoveFileExA( partPath.c_str(), finalPath.c_str(), MOVEFILE_REPLACE_EXISTING );
+		if ( hash.length() > 0 && it == d.hashes.end() ) {
+			Download_AddHash( d, hash, Download_FileName( finalPath ) );
+		}
+	}
+	Download_Report( f, note );
+}
+
+static void Download_Fail( DownloadFile& f, const std::string& reason )
+{
+	Download_CloseFile( f );
+	f.failed = true;
+	wprintf( L"%-28S failed: %S\n", Download_FileName( f.base ).c_str(), reason.c_str() );
+}
+
+static void Download_OnResult( Downloader& d, const NetResult& r )
+{
+	DownloadJob job = d.jobs[r.id];
+	DownloadFile& f = d.files[job.file];
+	if ( f.failed || f.done ) {
+		return;
+	}
+
+	bool ranged = ( r.status == 206 && r.totalLength > 0 );
+	if ( !r.ok || ( r.status != 200 && !ranged ) || ( r.status == 200 && f.length >= 0 ) ) {
+		// Failures are retried for the same chunk. A 200 after the size is
+		// known means the server ignored the range this time, the chunk is
+		// asked for again rather than taking the whole body for it.
+		if ( job.tries + 1 < DOWNLOAD_RETRIES ) {
+			Download_AddJob( d, job.file, job.chunk, job.tries + 1 );
+		}
+		else {
+			Download_Fail( f, "http status " + std::to_string( r.status ) );
+		}
+		return;
+	}
+	f.fetched += (int64_t)r.body.length();
+
+	if ( f.length < 0 ) {
+		// First answer for the file, the size and the type are known now.
+		f.ext    = Download_ExtFromContentType( r.contentType );
+		f.length = ranged ? r.totalLength : (int64_t)r.body.length();
+		if ( !Download_CreateMap( f ) ) {
+			Download_Fail( f, "cannot create " + f.base + ".part" );
+			return;
+		}
+		for ( size_t i = 1; i < f.chunkDone.size() && ranged; ++i ) {
+			Download_AddJob( d, job.file, i, 0 );
+		}
+		if ( !ranged ) {
+			// The whole body came back in one piece.
+			fwrite( r.body.data(), 1, r.body.length(), f.part );
+			Download_Finish( d, f );
+			return;
+		}
+	}
+
+	int64_t offset = (int64_t)job.chunk * DOWNLOAD_CHUNK_SIZE;
+	int64_t expected = std::min( DOWNLOAD_CHUNK_SIZE, f.length - offset );
+	if ( r.totalLength != f.length || (int64_t)r.body.length() != expected ) {
+		Download_Fail( f, "file changed on the server" );
+		return;
+	}
+
+	// Data first, then the mark, so a mark never covers missing data.
+	_fseeki64( f.part, offset, SEEK_SET );
+	fwrite( r.body.data(), 1, r.body.length(), f.part );
+	fflush( f.part );
+	fseek( f.map, f.mapHeader + (long)job.chunk, SEEK_SET );
+	fputc( '1', f.map );
+	fflush( f.map );
+
+	f.chunkDone[job.chunk] = 1;
+	f.chunksLeft--;
+	if ( f.chunksLeft == 0 ) {
+		Download_Finish( d, f );
+	}
+}
+
+static bool Download_FindFinished( const DownloadFile& f )
+{
+	size_t count = sizeof( gsDownloadExts ) / sizeof( gsDownloadExts[0] );
+	for ( size_t i = 0; i < count; ++i ) {
+		if ( Download_FileExists( f.base + gsDownloadExts[i].ext ) ) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static std::vector<std::string> Download_CollectUrls( const std::string& threadUrl )
+{
+	std::vector<std::string> htmls( 1, Net_Get( threadUrl ) );
+	ArticlePage page;
+	Smth_GetArticlePage( htmls[0], page );
+
+	std::vector<std::string> pageUrls;
+	for ( size_t p = 2; p <= page.pageCount; ++p ) {
+		pageUrls.push_back( threadUrl + "?p=" + std::to_string( p ) );
+	}
+	std::vector<std::string> rest = Net_GetAll( pageUrls );
+	htmls.insert( htmls.end(), rest.begin(), rest.end() );
+
+	// The same picture is often posted again in replies.
+	std::vector<std::string> urls;
+	std::set<std::string> seen;
+	for ( size_t i = 0; i < htmls.size(); ++i ) {
+		std::vector<std::string> pageAttachments = Smth_GetAttachmentUrls( htmls[i] );
+		for ( size_t k = 0; k < pageAttachments.size(); ++k ) {
+			if ( seen.insert( pageAttachments[k] ).second ) {
+				urls.push_back( pageAttachments[k] );
+			}
+		}
+	}
+	return urls;
+}
+
+int Download_Run( int argc, char* argv[] )
+{
+	std::string url, dir = ".";
+	int parallel = 0;
+	for ( int i = 0; i < argc; ++i ) {
+		if ( strcmp( argv[i], "--output" ) == 0 && i + 1 < argc ) {
+			dir = argv[++i];
+		}
+		else if ( strcmp( argv[i], "--parallel" ) == 0 && i + 1 < argc ) {
+			parallel = atoi( argv[++i] );
+		}
+		else {
+			url = argv[i];
+		}
+	}
+
+	std::string board;
+	uint32_t id = 0;
+	if ( url.length() == 0 || !ReadState_ParseArticleUrl( url, board, id ) ) {
+		fwprintf( stderr, L"usage: csmth download <article-url> [--output <dir>] [--parallel N]\n" );
+		return 1;
+	}
+	Config_Load( Smth_GetDataDir() + "/csmth.ini" );
+	if ( parallel <= 0 ) {
+		parallel = Config_GetInt( "download_parallel", 8 );
+	}
+	CreateDirectoryA( dir.c_str(), nullptr );
+
+	if ( !Smth_NetInit() ) {
+		return 1;
+	}
+	std::string threadUrl = SMTH_DOMAIN + "/article/" + board + "/" + std::to_string( id );
+	std::vector<std::string> urls = Download_CollectUrls( threadUrl );
+
+	Downloader d;
+	d.dir   = dir;
+	d.multi = Net_MultiCreate( "", parallel );
+	Download_LoadHashes( d );
+
+	d.files.resize( urls.size() );
+	for ( size_t i = 0; i < urls.size(); ++i ) {
+		DownloadFile& f = d.files[i];
+		f.url           = urls[i];
+		f.base          = dir + "/" + board + "-" + std::to_string( id ) + "-" + std::to_string( i + 1 );
+		f.length        = -1;
+		f.chunksLeft    = 0;
+		f.chunksResumed = 0;
+		f.part          = nullptr;
+		f.map           = nullptr;
+		f.mapHeader     = 0;
+		f.fetched       = 0;
+		f.start         = steady_clock::now();
+		f.done          = false;
+		f.failed        = false;
+	}
+
+	size_t skipped = 0;
+	for ( size_t i = 0; i < d.files.size(); ++i ) {
+		DownloadFile& f = d.files[i];
+		if ( Download_FindFinished( f ) ) {
+			f.done = true;
+			skipped++;
+		}
+		else if ( Download_OpenMap( f ) ) {
+			for ( size_t k = 0; k < f.chunkDone.size(); ++k ) {
+				if ( f.chunkDone[k] == 0 ) {
+					Download_AddJob( d, i, k, 0 );
+				}
+			}
+			if ( f.chunksLeft == 0 ) {
+				Download_Finish( d, f );
+			}
+		}
+		else {
+			// The first chunk doubles as the probe for size and range support.
+			Download_AddJob( d, i, 0, 0 );
+		}
+	}
+	wprintf( L"%S: %d attachments, %d already here\n", threadUrl.c_str(), (int)urls.size(), (int)skipped );
+
+	steady_clock::time_point start = steady_clock::now();
+	std::vector<NetResult> done;
+	while ( Net_MultiPoll( d.multi, 100, done ) > 0 || done.size() > 0 ) {
+		for ( size_t i = 0; i < done.size(); ++i ) {
+			Download_OnResult( d, done[i] );
+		}
+		done.clear();
+	}
+	Net_MultiDestroy( d.multi );
+	Smth_NetDeinit();
+
+	int64_t total = 0;
+	size_t failed = 0;
+	for ( size_t i = 0; i < d.files.size(); ++i ) {
+		total += d.files[i].fetched;
+		failed += d.files[i].failed ? 1 : 0;
+		Download_CloseFile( d.files[i] );
+	}
+	double seconds = duration_cast<duration<double>>( steady_clock::now() - start ).count();
+	wprintf( L"%lld bytes in %.2fs, %.1f KB/s, %d failed\n", (long long)total, seconds,
+			seconds > 0 ? total / 1024.0 / seconds : 0.0, (int)failed );
+	return failed == 0 ? 0 : 1;
+}
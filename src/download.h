@@ -0,0 +1,12 @@
+#ifndef DOWNLOAD_H_191104201516
+#define DOWNLOAD_H_191104201516
+
+// Runs "csmth download <article-url> [--output <dir>] [--parallel N]"
+// and returns the process exit code. All images and attachments of the
+// thread are fetched over one multi handle; files larger than a chunk are
+// fetched as parallel range requests into a .part file whose .map file
+// records the finished chunks, so an interrupted run picks up where it
+// stopped. Files with the same content are hard linked to the first copy.
+int Download_Run( int argc, char* argv[] );
+
+#endif // #ifndef DOWNLOAD_H_191104201516
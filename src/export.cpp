@@ -0,0 +1,200 @@
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <io.h>
+#include <map>
+
+#include "net_util.h"
+#include "read_state.h"
+#include "smth.h"
+#include "export.h"
+
+// Pages fetched ahead of the one being written.
+static const size_t      EXPORT_WINDOW = 8;
+
+struct ExportThread {
+	std::string url;
+	std::string board;
+	uint32_t    id;
+	std::string title;
+	size_t      floor;
+};
+
+// Calls fn for every line of text, without the newline.
+template<typename Fn>
+static void Export_ForEachLine( const std::string& text, Fn fn )
+{
+	size_t start = 0;
+	while ( start < text.length() ) {
+		size_t end = text.find( '\n', start );
+		if ( end == std::string::npos ) {
+			end = text.length();
+		}
+		fn( text.substr( start, end - start ) );
+		start = end + 1;
+	}
+}
+
+static void Export_WriteMarkdown( FILE* out, const ExportThread& thread, const ArticleItem& item )
+{
+	if ( thread.floor == 1 ) {
+		fprintf( out, "# %s\n\n%s\n\n", thread.title.c_str(), thread.url.c_str() );
+	}
+	fprintf( out, "## #%d %s\n\n", (int)thread.floor, item.author.c_str() );
+	Export_ForEachLine( item.content, [out]( const std::string& line ) {
+		// Quotes become block quotes.
+		if ( line.length() > 0 && line[0] == ':' ) {
+			fprintf( out, ">%s  \n", line.c_str() + 1 );
+		}
+		else {
+			fprintf( out, "%s  \n", line.c_str() );
+		}
+	} );
+	fprintf( out, "\n---\n\n" );
+}
+
+static void Export_WriteMbox( FILE* out, const ExportThread& thread, const ArticleItem& item )
+{
+	char date[64];
+	time_t now = time( nullptr );
+	strftime( date, sizeof( date ), "%a %b %d %H:%M:%S %Y", gmtime( &now ) );
+
+	std::string author = Smth_GetAuthorId( item.author );
+	fprintf( out, "From %s %s\n", author.length() > 0 ? author.c_str() : "unknown", date );
+	fprintf( out, "From: %s\n", item.author.c_str() );
+	fprintf( out, "Subject: %s%s\n", thread.floor > 1 ? "Re: " : "", thread.title.c_str() );
+	fprintf( out, "Message-ID: <%s.%u.%d@%s>\n", thread.board.c_str(), thread.id, (int)thread.floor, SMTH_DOMAIN.c_str() );
+	if ( thread.floor > 1 ) {
+		fprintf( out, "In-Reply-To: <%s.%u.1@%s>\n", thread.board.c_str(), thread.id, SMTH_DOMAIN.c_str() );
+	}
+	fprintf( out, "Content-Type: text/plain; charset=utf-8\n\n" );
+	Export_ForEachLine( item.content, [out]( const std::string& line ) {
+		// mboxrd quoting of lines that look like a message separator.
+		size_t i = 0;
+		while ( i < line.length() && line[i] == '>' ) {
+			++i;
+		}
+		fprintf( out, "%s%s\n", line.compare( i, 5, "From " ) == 0 ? ">" : "", line.c_str() );
+	} );
+	fprintf( out, "\n" );
+}
+
+// Keeps up to EXPORT_WINDOW pages in flight or waiting, and writes the
+// posts of each page once every page before it has been written.
+static bool Export_Thread( FILE* out, ExportThread& thread, bool mbox )
+{
+	std::string first = Net_Get( thread.url );
+	ArticlePage page;
+	Smth_GetArticlePage( first, page );
+	if ( page.items.size() == 0 ) {
+		return false;
+	}
+	thread.title = page.name;
+	size_t pageCount = page.pageCount > 0 ? page.pageCount : 1;
+
+	std::map<size_t, ArticlePage> arrived;
+	arrived[1] = page;
+	size_t nextToWrite = 1;
+	size_t nextToFetch = 2;
+	bool ok = true;
+
+	NetMultiHandle m = Net_MultiCreate( "", (int)EXPORT_WINDOW );
+	std::vector<NetResult> done;
+	int pending = 0;
+	do {
+		// Write whatever continues the written prefix.
+		for ( auto it = arrived.find( nextToWrite ); it != arrived.end(); it = arrived.find( nextToWrite ) ) {
+			for ( size_t i = 0; i < it->second.items.size(); ++i ) {
+				thread.floor++;
+				if ( mbox ) {
+					Export_WriteMbox( out, thread, it->second.items[i] );
+				}
+				else {
+					Export_WriteMarkdown( out, thread, it->second.items[i] );
+				}
+			}
+			fflush( out );
+			arrived.erase( it );
+			nextToWrite++;
+		}
+
+		// Window counts pages in flight and pages waiting to be written.
+		while ( nextToFetch <= pageCount && nextToFetch < nextToWrite + EXPORT_WINDOW ) {
+			Net_MultiAdd( m, (int)nextToFetch, thread.url + "?p=" + std::to_string( nextToFetch ) );
+			nextToFetch++;
+			pending++;
+		}
+		if ( pending == 0 ) {
+			break;
+		}
+
+		done.clear();
+		pending = Net_MultiPoll( m, 100, done );
+		for ( size_t i = 0; i < done.size(); ++i ) {
+			ArticlePage& p = arrived[(size_t)done[i].id];
+			Smth_GetArticlePage( done[i].body, p );
+			if ( !done[i].ok || p.items.size() == 0 ) {
+				ArticleItem missing;
+				missing.highlight = false;
+				missing.content = "[page " + std::to_string( done[i].id ) + " could not be loaded]";
+				p.items.push_back( missing );
+				ok = false;
+			}
+		}
+	} while ( nextToWrite <= pageCount );
+	Net_MultiDestroy( m );
+	return ok;
+}
+
+int Export_Run( int argc, char* argv[] )
+{
+	std::string url, format = "md", outPath;
+	for ( int i = 0; i < argc; ++i ) {
+		if ( strcmp( argv[i], "--format" ) == 0 && i + 1 < argc ) {
+			format = argv[++i];
+		}
+		else if ( strcmp( argv[i], "--output" ) == 0 && i + 1 < argc ) {
+			outPath = argv[++i];
+		}
+		else {
+			url = argv[i];
+		}
+	}
+
+	ExportThread thread;
+	thread.id = 0;
+	thread.floor = 0;
+	if ( url.length() == 0 || ( format != "md" && format != "mbox" )
+			|| !ReadState_ParseArticleUrl( url, thread.board, thread.id ) ) {
+		fwprintf( stderr, L"usage: csmth export <article-url> [--format md|mbox] [--output <file>]\n" );
+		return 1;
+	}
+	thread.url = SMTH_DOMAIN + "/article/" + thread.board + "/" + std::to_string( thread.id );
+
+	FILE* out = stdout;
+	if ( outPath.length() > 0 ) {
+		out = fopen( outPath.c_str(), "wb" );
+		if ( out == nullptr ) {
+			fwprintf( stderr, L"cannot create %S\n", outPath.c_str() );
+			return 1;
+		}
+	}
+	else {
+		_setmode( _fileno( stdout ), _O_BINARY );
+	}
+
+	if ( !Smth_NetInit() ) {
+		return 1;
+	}
+	bool ok = Export_Thread( out, thread, format == "mbox" );
+	Smth_NetDeinit();
+
+	if ( out != stdout ) {
+		ok = ( fclose( out ) == 0 ) && ok;
+	}
+	if ( !ok ) {
+		fwprintf( stderr, L"export of %S is incomplete\n", thread.url.c_str() );
+	}
+	return ok ? 0 : 1;
+}
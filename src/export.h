@@ -0,0 +1,10 @@
+#ifndef EXPORT_H_191029093120
+#define EXPORT_H_191029093120
+
+// Runs "csmth export <article-url> [--format md|mbox] [--output <file>]"
+// and returns the process exit code. Posts are written in thread order
+// as soon as their page arrives; only a small window of pages is held in
+// memory however long the thread is.
+int Export_Run( int argc, char* argv[] );
+
+#endif // #ifndef EXPORT_H_191029093120
@@ -0,0 +1,85 @@
+#include <fstream>
+
+#include "aho_corasick.h"
+#include "config.h"
+#include "filter.h"
+
+// Author ids are matched as whole words by wrapping them in bytes that
+// never show up in text.
+static const char FILTER_AUTHOR_BEGIN = '\x01';
+static const char FILTER_AUTHOR_END   = '\x02';
+
+// Keyword rules only ever see the title or content, author rules only the
+// wrapped id, so a keyword inside an id or an id inside a text is no hit.
+static struct FilterModule {
+	AhoCorasick keywords;
+	AhoCorasick authors;
+} gsFilter;
+
+bool Filter_Load( const std::string& path )
+{
+	std::ifstream is( path.c_str() );
+	if ( !is ) {
+		return false;
+	}
+
+	static const struct {
+		const char* name;
+		uint32_t    flags;
+		bool        author;
+	} RULES[] = {
+		{ "kill",             FILTER_KILL,      false },
+		{ "highlight",        FILTER_HIGHLIGHT, false },
+		{ "kill-author",      FILTER_KILL,      true  },
+		{ "highlight-author", FILTER_HIGHLIGHT, true  },
+	};
+
+	AhoCorasick keywords;
+	AhoCorasick authors;
+	std::string line;
+	while ( std::getline( is, line ) ) {
+		line = Config_Trim( line );
+		if ( line.length() == 0 || line[0] == '#' ) {
+			continue;
+		}
+		size_t space = line.find_first_of( " \t" );
+		if ( space == std::string::npos ) {
+			continue;
+		}
+		std::string name  = line.substr( 0, space );
+		std::string value = Config_Trim( line.substr( space ) );
+		for ( size_t i = 0; i < sizeof( RULES ) / sizeof( RULES[0] ); ++i ) {
+			if ( name != RULES[i].name ) {
+				continue;
+			}
+			if ( RULES[i].author ) {
+				authors.AddPattern( FILTER_AUTHOR_BEGIN + value + FILTER_AUTHOR_END, RULES[i].flags );
+			}
+			else {
+				keywords.AddPattern( value, RULES[i].flags );
+			}
+			break;
+		}
+	}
+	keywords.Build();
+	authors.Build();
+	gsFilter.keywords = keywords;
+	gsFilter.authors  = authors;
+	return true;
+}
+
+uint32_t Filter_MatchItem( const std::string& authorId, const std::string& text )
+{
+	uint32_t flags = 0;
+	const AhoCorasick& authors = gsFilter.authors;
+	if ( !authors.Empty() ) {
+		int state = authors.Feed( authors.Start(), &FILTER_AUTHOR_BEGIN, 1, flags );
+		state = authors.Feed( state, authorId.data(), authorId.length(), flags );
+		authors.Feed( state, &FILTER_AUTHOR_END, 1, flags );
+	}
+	const AhoCorasick& keywords = gsFilter.keywords;
+	if ( !keywords.Empty() ) {
+		keywords.Feed( keywords.Start(), text.data(), text.length(), flags );
+	}
+	return flags;
+}
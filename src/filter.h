@@ -0,0 +1,28 @@
+#ifndef FILTER_H_191024113540
+#define FILTER_H_191024113540
+
+#include <cstdint>
+#include <string>
+
+// Kill-file and highlight list applied while pages are parsed.
+//
+// The file has one rule per line, '#' starts a comment:
+//   kill <keyword>               drop items whose title or content has it
+//   highlight <keyword>          mark such items
+//   kill-author <id>             drop items by this author
+//   highlight-author <id>        mark items by this author
+//
+// Keyword rules and author rules are compiled into one Aho-Corasick
+// automaton each, so matching an item costs the same for ten rules or for
+// ten thousand. An author rule matches the whole id only.
+enum FILTER_FLAG {
+	FILTER_KILL      = 1,
+	FILTER_HIGHLIGHT = 2,
+};
+
+bool Filter_Load( const std::string& path );
+
+// authorId is the bare id, see Smth_GetAuthorId.
+uint32_t Filter_MatchItem( const std::string& authorId, const std::string& text );
+
+#endif // #ifndef FILTER_H_191024113540
@@ -0,0 +1,29 @@
+#ifndef FNV_HASH_H_191029103015
+#define FNV_HASH_H_191029103015
+
+#include <cstddef>
+#include <cstdint>
+
+// FNV-1a, the one hash for checksums in our files, ETags and hash tables.
+// Not for anything an attacker should not be able to collide.
+inline uint32_t Fnv_Hash32( const char* p, size_t n )
+{
+	uint32_t h = 2166136261u;
+	for ( size_t i = 0; i < n; ++i ) {
+		h ^= (unsigned char)p[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+inline uint64_t Fnv_Hash64( const char* p, size_t n )
+{
+	uint64_t h = 14695981039346656037ull;
+	for ( size_t i = 0; i < n; ++i ) {
+		h ^= (unsigned char)p[i];
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+#endif // #ifndef FNV_HASH_H_191029103015
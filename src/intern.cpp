@@ -0,0 +1,134 @@
+#include <atomic>
+#include <cassert>
+#include <mutex>
+#include <vector>
+
+#include "fnv_hash.h"
+#include "intern.h"
+
+// Strings live in fixed size chunks that never move, so a published id can
+// be resolved without taking a lock.
+static const uint32_t INTERN_CHUNK_BITS  = 12;
+static const uint32_t INTERN_CHUNK_SIZE  = 1u << INTERN_CHUNK_BITS;
+static const uint32_t INTERN_MAX_CHUNKS  = 1u << 16;
+static const uint32_t INTERN_SHARD_COUNT = 16;
+
+struct InternShard {
+	std::mutex            lock;
+	// Open addressing table of ids, 0 marks an empty slot (SYMBOL_EMPTY is
+	// never stored in a shard).
+	std::vector<SymbolId> slots;
+	std::vector<uint32_t> hashes;
+	size_t                count;
+};
+
+static struct InternModule {
+	std::atomic<std::string*> chunks[INTERN_MAX_CHUNKS];
+	std::atomic<uint32_t>     nextId;
+	InternShard               shards[INTERN_SHARD_COUNT];
+
+	InternModule() : nextId( 1 ) {
+		for ( uint32_t i = 0; i < INTERN_MAX_CHUNKS; ++i ) {
+			chunks[i] = nullptr;
+		}
+		chunks[0] = new std::string[INTERN_CHUNK_SIZE];
+		for ( uint32_t i = 0; i < INTERN_SHARD_COUNT; ++i ) {
+			shards[i].slots.resize( 64, SYMBOL_EMPTY );
+			shards[i].hashes.resize( 64, 0 );
+			shards[i].count = 0;
+		}
+	}
+	~InternModule() {
+		for ( uint32_t i = 0; i < INTERN_MAX_CHUNKS; ++i ) {
+			delete[] chunks[i].load();
+		}
+	}
+} gsIntern;
+
+static uint32_t Intern_Hash( const std::string& text )
+{
+	return Fnv_Hash32( text.data(), text.length() );
+}
+
+static std::string& Intern_Slot( SymbolId id )
+{
+	std::string* chunk = gsIntern.chunks[id >> INTERN_CHUNK_BITS].load( std::memory_order_acquire );
+	if ( chunk == nullptr ) {
+		std::string* fresh = new std::string[INTERN_CHUNK_SIZE];
+		if ( gsIntern.chunks[id >> INTERN_CHUNK_BITS].compare_exchange_strong( chunk, fresh ) ) {
+			chunk = fresh;
+		}
+		else {
+			delete[] fresh;
+		}
+	}
+	return chunk[id & ( INTERN_CHUNK_SIZE - 1 )];
+}
+
+static void Intern_Grow( InternShard& shard )
+{
+	std::vector<SymbolId> slots( shard.slots.size() * 2, SYMBOL_EMPTY );
+	std::vector<uint32_t> hashes( shard.hashes.size() * 2, 0 );
+	size_t mask = slots.size() - 1;
+
+	for ( size_t i = 0; i < shard.slots.size(); ++i ) {
+		if ( shard.slots[i] == SYMBOL_EMPTY ) {
+			continue;
+		}
+		size_t k = ( shard.hashes[i] / INTERN_SHARD_COUNT ) & mask;
+		while ( slots[k] != SYMBOL_EMPTY ) {
+			k = ( k + 1 ) & mask;
+		}
+		slots[k]  = shard.slots[i];
+		hashes[k] = shard.hashes[i];
+	}
+	shard.slots.swap( slots );
+	shard.hashes.swap( hashes );
+}
+
+SymbolId Intern_Get( const std::string& text )
+{
+	if ( text.length() == 0 ) {
+		return SYMBOL_EMPTY;
+	}
+
+	uint32_t hash = Intern_Hash( text );
+	InternShard& shard = gsIntern.shards[hash % INTERN_SHARD_COUNT];
+
+	std::lock_guard<std::mutex> guard( shard.lock );
+
+	size_t mask = shard.slots.size() - 1;
+	size_t k = ( hash / INTERN_SHARD_COUNT ) & mask;
+	while ( shard.slots[k] != SYMBOL_EMPTY ) {
+		if ( shard.hashes[k] == hash && Intern_String( shard.slots[k] ) == text ) {
+			return shard.slots[k];
+		}
+		k = ( k + 1 ) & mask;
+	}
+
+	SymbolId id = gsIntern.nextId.fetch_add( 1 );
+	assert( ( id >> INTERN_CHUNK_BITS ) < INTERN_MAX_CHUNKS );
+	Intern_Slot( id ) = text;
+
+	shard.slots[k]  = id;
+	shard.hashes[k] = hash;
+	shard.count++;
+	if ( shard.count * 10 > shard.slots.size() * 7 ) {
+		Intern_Grow( shard );
+	}
+	return id;
+}
+
+const std::string& Intern_String( SymbolId id )
+{
+	static const std::string EMPTY;
+	if ( id == SYMBOL_EMPTY || id >= gsIntern.nextId.load( std::memory_order_relaxed ) ) {
+		return EMPTY;
+	}
+	return gsIntern.chunks[id >> INTERN_CHUNK_BITS].load( std::memory_order_acquire )[id & ( INTERN_CHUNK_SIZE - 1 )];
+}
+
+size_t Intern_Count( void )
+{
+	return gsIntern.nextId - 1;
+}
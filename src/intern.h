@@ -0,0 +1,19 @@
+#ifndef INTERN_H_191022101833
+#define INTERN_H_191022101833
+
+#include <cstdint>
+#include <string>
+
+// Interned strings are referred to by 32-bit symbol ids. The table is
+// append-only and safe to use from several threads, so ids can be compared
+// and grouped as integers and the strings stay valid until exit.
+typedef uint32_t SymbolId;
+
+static const SymbolId SYMBOL_EMPTY = 0;
+
+SymbolId Intern_Get( const std::string& text );
+const std::string& Intern_String( SymbolId id );
+
+size_t Intern_Count( void );
+
+#endif // #ifndef INTERN_H_191022101833
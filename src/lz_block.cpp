@@ -0,0 +1,143 @@
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "lz_block.h"
+
+static const size_t LZ_MIN_MATCH  = 4;
+static const size_t LZ_MAX_OFFSET = 65535;
+static const int    LZ_HASH_BITS  = 14;
+
+static uint32_t Lz_Read32( const char* p )
+{
+	uint32_t v;
+	memcpy( &v, p, sizeof( v ) );
+	return v;
+}
+
+static uint32_t Lz_Hash( uint32_t v )
+{
+	return ( v * 2654435761u ) >> ( 32 - LZ_HASH_BITS );
+}
+
+// Lengths of 15 and more continue in extra bytes of up to 255 each.
+static void Lz_WriteLength( std::string& out, size_t length )
+{
+	while ( length >= 255 ) {
+		out.push_back( (char)255 );
+		length -= 255;
+	}
+	out.push_back( (char)length );
+}
+
+static void Lz_WriteSequence( std::string& out, const char* literals, size_t literalLength, size_t offset, size_t matchLength )
+{
+	size_t m = matchLength >= LZ_MIN_MATCH ? matchLength - LZ_MIN_MATCH : 0;
+	uint8_t token = (uint8_t)( ( literalLength < 15 ? literalLength : 15 ) << 4 );
+	token |= (uint8_t)( m < 15 ? m : 15 );
+	out.push_back( (char)token );
+	if ( literalLength >= 15 ) {
+		Lz_WriteLength( out, literalLength - 15 );
+	}
+	out.append( literals, literalLength );
+	if ( matchLength == 0 ) {
+		return;
+	}
+	out.push_back( (char)( offset & 0xFF ) );
+	out.push_back( (char)( offset >> 8 ) );
+	if ( m >= 15 ) {
+		Lz_WriteLength( out, m - 15 );
+	}
+}
+
+std::string Lz_Compress( const char* data, size_t size )
+{
+	std::string out;
+	out.reserve( size / 2 + 16 );
+	std::vector<uint32_t> table( (size_t)1 << LZ_HASH_BITS, 0 );
+
+	size_t anchor = 0;
+	size_t pos = 0;
+	while ( size >= LZ_MIN_MATCH && pos <= size - LZ_MIN_MATCH ) {
+		uint32_t v = Lz_Read32( data + pos );
+		uint32_t h = Lz_Hash( v );
+		size_t candidate = table[h];
+		table[h] = (uint32_t)pos;
+		if ( candidate >= pos || pos - candidate > LZ_MAX_OFFSET || Lz_Read32( data + candidate ) != v ) {
+			++pos;
+			continue;
+		}
+		size_t length = LZ_MIN_MATCH;
+		while ( pos + length < size && data[candidate + length] == data[pos + length] ) {
+			++length;
+		}
+		Lz_WriteSequence( out, data + anchor, pos - anchor, pos - candidate, length );
+		pos += length;
+		anchor = pos;
+	}
+	// Token with literals only ends the block.
+	Lz_WriteSequence( out, data + anchor, size - anchor, 0, 0 );
+	return out;
+}
+
+static bool Lz_ReadLength( const uint8_t*& p, const uint8_t* end, size_t& length )
+{
+	uint8_t b;
+	do {
+		if ( p >= end ) {
+			return false;
+		}
+		b = *p++;
+		length += b;
+	} while ( b == 255 );
+	return true;
+}
+
+bool Lz_Decompress( const char* data, size_t size, size_t rawSize, std::string& out )
+{
+	// A length byte makes at most 255 bytes, a larger raw size is damage and
+	// must not be allocated before the input is looked at.
+	if ( rawSize > size * 255 + 64 ) {
+		return false;
+	}
+	out.resize( rawSize );
+	const uint8_t* p   = (const uint8_t*)data;
+	const uint8_t* end = p + size;
+	size_t pos = 0;
+	while ( p < end ) {
+		uint8_t token = *p++;
+		size_t literalLength = token >> 4;
+		if ( literalLength == 15 && !Lz_ReadLength( p, end, literalLength ) ) {
+			return false;
+		}
+		if ( literalLength > (size_t)( end - p ) || literalLength > rawSize - pos ) {
+			return false;
+		}
+		memcpy( &out[pos], p, literalLength );
+		p += literalLength;
+		pos += literalLength;
+		if ( p == end ) {
+			break;
+		}
+
+		if ( end - p < 2 ) {
+			return false;
+		}
+		size_t offset = p[0] | ( p[1] << 8 );
+		p += 2;
+		size_t matchLength = token & 15;
+		if ( matchLength == 15 && !Lz_ReadLength( p, end, matchLength ) ) {
+			return false;
+		}
+		matchLength += LZ_MIN_MATCH;
+		if ( offset == 0 || offset > pos || matchLength > rawSize - pos ) {
+			return false;
+		}
+		// Byte by byte, the match may overlap what it produces.
+		for ( size_t i = 0; i < matchLength; ++i ) {
+			out[pos + i] = out[pos - offset + i];
+		}
+		pos += matchLength;
+	}
+	return pos == rawSize;
+}
@@ -0,0 +1,16 @@
+#ifndef LZ_BLOCK_H_191028094015
+#define LZ_BLOCK_H_191028094015
+
+#include <cstddef>
+#include <string>
+
+// Small LZ77 block compressor in the spirit of LZ4: a sequence of
+// (literals, back reference) pairs found through a hash of the next four
+// bytes. Fast on both ends and good enough for HTML, which repeats a lot.
+// The raw size is not stored, callers keep it next to the block.
+std::string Lz_Compress( const char* data, size_t size );
+
+// Fails on damaged input instead of reading or writing out of bounds.
+bool Lz_Decompress( const char* data, size_t size, size_t rawSize, std::string& out );
+
+#endif // #ifndef LZ_BLOCK_H_191028094015
@@ -1,8 +1,80 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "alloc_profile.h"
+#include "bench.h"
+#include "mirror.h"
+#include "archive.h"
+#include "export.h"
+#include "download.h"
+#include "serve.h"
+#include "daemon.h"
+#include "net_util.h"
 #include "smth.h"
 
 
 int main(int argc, char* argv[] )
 {
+	Alloc_Install();
+
+	// "--base-url <url>" anywhere points every command at another server.
+	for ( int i = 1; i + 1 < argc; ++i ) {
+		if ( strcmp( argv[i], "--base-url" ) == 0 ) {
+			Net_SetBaseUrl( argv[i + 1] );
+			for ( int k = i; k + 2 <= argc; ++k ) {
+				argv[k] = argv[k + 2];
+			}
+			argc -= 2;
+			break;
+		}
+	}
+	if ( argc > 1 && strcmp( argv[1], "serve" ) == 0 ) {
+		return Serve_Run( argc - 2, argv + 2 );
+	}
+	if ( argc > 1 && strcmp( argv[1], "daemon" ) == 0 ) {
+		return Daemon_Run( argc - 2, argv + 2 );
+	}
+	if ( argc > 1 && strcmp( argv[1], "fetch" ) == 0 ) {
+		return Daemon_Fetch( argc - 2, argv + 2 );
+	}
+	if ( argc > 1 && strcmp( argv[1], "bench" ) == 0 ) {
+		return Bench_Run( argc - 2, argv + 2 );
+	}
+	// The batch commands go through csmthd when one is running. The ui
+	// fetches for itself: it reloads past the daemon's cache, cancels its
+	// gets and keeps its own cookies.
+	bool batch = argc > 1 && ( strcmp( argv[1], "mirror" ) == 0 || strcmp( argv[1], "archive" ) == 0
+			|| strcmp( argv[1], "export" ) == 0 || strcmp( argv[1], "download" ) == 0 );
+	if ( batch && getenv( "CSMTH_NO_DAEMON" ) == nullptr ) {
+		Daemon_Attach();
+	}
+	if ( argc > 1 && strcmp( argv[1], "mirror" ) == 0 ) {
+		return Mirror_Run( argc - 2, argv + 2 );
+	}
+	if ( argc > 1 && strcmp( argv[1], "archive" ) == 0 ) {
+		return Archive_Run( argc - 2, argv + 2 );
+	}
+	if ( argc > 1 && strcmp( argv[1], "export" ) == 0 ) {
+		return Export_Run( argc - 2, argv + 2 );
+	}
+	if ( argc > 1 && strcmp( argv[1], "download" ) == 0 ) {
+		return Download_Run( argc - 2, argv + 2 );
+	}
+	if ( argc > 2 && strcmp( argv[1], "browse" ) == 0 ) {
+		// Read-only, no login and no network.
+		if ( Smth_Init() ) {
+			if ( Smth_OpenArchive( argv[2] ) ) {
+				Smth_RunLoop();
+			}
+			else {
+				wprintf( L"cannot open archive %S\n", argv[2] );
+			}
+			Smth_Deinit();
+		}
+		return 0;
+	}
+
 	if ( Smth_Init() ) {
 
 		Smth_Login( );
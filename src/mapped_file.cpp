@@ -0,0 +1,60 @@
+#include <windows.h>
+
+#include "mapped_file.h"
+
+MappedFile::MappedFile()
+	: file( INVALID_HANDLE_VALUE ), mapping( nullptr ), data( nullptr ), size( 0 )
+{
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::Open( const std::string& path )
+{
+	Close();
+
+	file = CreateFileA( path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+	if ( file == INVALID_HANDLE_VALUE ) {
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if ( !GetFileSizeEx( file, &fileSize ) || fileSize.QuadPart == 0 ) {
+		Close();
+		return false;
+	}
+
+	mapping = CreateFileMappingA( file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+	if ( mapping == nullptr ) {
+		Close();
+		return false;
+	}
+
+	data = (const char*)MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+	if ( data == nullptr ) {
+		Close();
+		return false;
+	}
+	size = (size_t)fileSize.QuadPart;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if ( data != nullptr ) {
+		UnmapViewOfFile( data );
+		data = nullptr;
+	}
+	if ( mapping != nullptr ) {
+		CloseHandle( mapping );
+		mapping = nullptr;
+	}
+	if ( file != INVALID_HANDLE_VALUE ) {
+		CloseHandle( file );
+		file = INVALID_HANDLE_VALUE;
+	}
+	size = 0;
+}
@@ -0,0 +1,39 @@
+#ifndef MAPPED_FILE_H_191022160412
+#define MAPPED_FILE_H_191022160412
+
+#include <string>
+
+// Read-only view of a whole file mapped into memory.
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	bool Open( const std::string& path );
+	void Close();
+
+	bool IsOpen() const
+	{
+		return data != nullptr;
+	}
+	const char* Data() const
+	{
+		return data;
+	}
+	size_t Size() const
+	{
+		return size;
+	}
+
+private:
+	void*       file;
+	void*       mapping;
+	const char* data;
+	size_t      size;
+
+	MappedFile( const MappedFile& ) = delete;
+	MappedFile& operator=( const MappedFile& ) = delete;
+};
+
+#endif // #ifndef MAPPED_FILE_H_191022160412
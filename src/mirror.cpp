@@ -0,0 +1,334 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <windows.h>
+
+#include "net_util.h"
+#include "read_state.h"
+#include "mirror_store.h"
+#include "smth.h"
+#include "mirror.h"
+
+static std::string Mirror_GetPath( const std::string& board )
+{
+	std::string dir = Smth_GetDataDir() + "/mirror";
+	CreateDirectoryA( dir.c_str(), nullptr );
+	return dir + "/" + board + ".db";
+}
+
+static std::string Mirror_ArticlePageUrl( const std::string& board, uint32_t id, size_t pageIndex )
+{
+	std::string url = SMTH_DOMAIN + "/article/" + board + "/" + std::to_string( id );
+	return pageIndex > 1 ? url + "?p=" + std::to_string( pageIndex ) : url;
+}
+
+// A thread seen on a board page whose last reply differs from the mirror.
+struct MirrorChange {
+	MirrorThread thread;
+	size_t       firstPage;  // first article page to fetch
+	size_t       firstPost;  // posts kept from the mirror
+	size_t       pageCount;
+	bool         ok;
+};
+
+// Fetches the article pages of the changed threads, starting at the page
+// that holds the first post the mirror does not have yet. The first page
+// of every thread tells how many pages there are, the rest is fetched in
+// one parallel batch.
+static void Mirror_FetchThreads( const std::string& board, std::vector<MirrorChange>& changes )
+{
+	std::vector<std::string> urls;
+	for ( size_t i = 0; i < changes.size(); ++i ) {
+		urls.push_back( Mirror_ArticlePageUrl( board, changes[i].thread.id, changes[i].firstPage ) );
+	}
+	std::vector<std::string> bodies = Net_GetAll( urls );
+
+	struct PageRef {
+		size_t change;
+		size_t pageIndex;
+	};
+	std::vector<PageRef> rest;
+	std::vector<std::map<size_t, ArticlePage>> pages( changes.size() );
+	urls.clear();
+	for ( size_t i = 0; i < changes.size(); ++i ) {
+		MirrorChange& c = changes[i];
+		ArticlePage& page = pages[i][c.firstPage];
+		Smth_GetArticlePage( bodies[i], page );
+		if ( page.items.size() == 0 ) {
+			// Past the end of a thread the mirror has complete, only its
+			// header changed. A thread without a first page is no thread.
+			c.ok = c.firstPage > 1 && bodies[i].length() > 0;
+			c.firstPost = c.thread.posts.size();
+			c.pageCount = c.firstPage;
+			continue;
+		}
+		c.ok = true;
+		c.pageCount = page.pageCount > c.firstPage ? page.pageCount : c.firstPage;
+		if ( c.firstPage == 1 && page.pageCount > 1 ) {
+			c.thread.perPage = (uint32_t)page.items.size();
+		}
+		for ( size_t p = c.firstPage + 1; c.ok && p <= c.pageCount; ++p ) {
+			PageRef ref = { i, p };
+			rest.push_back( ref );
+			urls.push_back( Mirror_ArticlePageUrl( board, c.thread.id, p ) );
+		}
+	}
+	bodies = Net_GetAll( urls );
+	for ( size_t i = 0; i < rest.size(); ++i ) {
+		ArticlePage& page = pages[rest[i].change][rest[i].pageIndex];
+		Smth_GetArticlePage( bodies[i], page );
+		if ( page.items.size() == 0 ) {
+			changes[rest[i].change].ok = false;
+		}
+	}
+
+	for ( size_t i = 0; i < changes.size(); ++i ) {
+		MirrorChange& c = changes[i];
+		c.thread.posts.resize( c.firstPost );
+		for ( auto it = pages[i].begin(); c.ok && it != pages[i].end(); ++it ) {
+			for ( size_t k = 0; k < it->second.items.size(); ++k ) {
+				MirrorPost post;
+				post.author  = it->second.items[k].author;
+				post.content = it->second.items[k].content;
+				c.thread.posts.push_back( post );
+			}
+		}
+	}
+}
+
+// Walks the board from its newest page on. The board is ordered by last
+// reply, so once a page has no changed thread the older ones have none
+// either. Each board page is one transaction.
+static int Mirror_Sync( int argc, char* argv[] )
+{
+	if ( argc < 1 ) {
+		wprintf( L"usage: csmth mirror sync <board> [max-pages]\n" );
+		return 1;
+	}
+	std::string board = argv[0];
+	size_t maxPages = argc > 1 ? (size_t)atoi( argv[1] ) : 1000000;
+
+	MirrorStore store;
+	if ( !store.Open( Mirror_GetPath( board ) ) ) {
+		wprintf( L"cannot open mirror of %S\n", board.c_str() );
+		return 1;
+	}
+
+	// All threads of a board have as many posts per page, one that never
+	// had a second page takes the number from the others.
+	uint32_t boardPerPage = 0;
+	for ( auto it = store.Threads().begin(); it != store.Threads().end() && boardPerPage == 0; ++it ) {
+		boardPerPage = it->second.perPage;
+	}
+
+	size_t fetchedThreads = 0, fetchedPosts = 0, unchanged = 0;
+	for ( size_t p = 1; p <= maxPages; ++p ) {
+		std::string url = SMTH_DOMAIN + "/board/" + board + ( p > 1 ? "?p=" + std::to_string( p ) : "" );
+		BoardPage page;
+		Smth_GetBoardPage( Net_Get( url ), page );
+		if ( page.items.size() == 0 ) {
+			break;
+		}
+		if ( page.pageCount > 0 && page.pageCount < maxPages ) {
+			maxPages = page.pageCount;
+		}
+
+		std::vector<MirrorChange> changes;
+		bool anyChanged = false;
+		for ( size_t i = 0; i < page.items.size(); ++i ) {
+			const BoardItem& item = page.items[i];
+			std::string itemBoard;
+			uint32_t id = 0;
+			if ( !ReadState_ParseArticleUrl( item.url, itemBoard, id ) ) {
+				continue;
+			}
+			const MirrorThread* known = store.FindThread( id );
+			if ( known != nullptr && known->replier_time == Intern_String( item.replier_time )
+					&& known->last_replier == Intern_String( item.last_replier ) ) {
+				unchanged++;
+				continue;
+			}
+			anyChanged = anyChanged || !item.is_top;
+
+			MirrorChange c;
+			if ( known != nullptr ) {
+				c.thread = *known;
+			}
+			else {
+				c.thread.perPage = 0;
+			}
+			c.thread.id           = id;
+			c.thread.title        = item.title;
+			c.thread.author       = Intern_String( item.author );
+			c.thread.author_time  = Intern_String( item.author_time );
+			c.thread.last_replier = Intern_String( item.last_replier );
+			c.thread.replier_time = Intern_String( item.replier_time );
+			if ( c.thread.perPage == 0 ) {
+				c.thread.perPage = boardPerPage;
+			}
+			// Replies only ever append, refetch from the last known page on,
+			// it may have been full or gained posts since.
+			c.firstPage = 1;
+			if ( c.thread.perPage > 0 && c.thread.posts.size() > 0 ) {
+				c.firstPage = ( c.thread.posts.size() - 1 ) / c.thread.perPage + 1;
+			}
+			c.firstPost = ( c.firstPage - 1 ) * c.thread.perPage;
+			if ( c.firstPost > c.thread.posts.size() ) {
+				c.firstPost = c.thread.posts.size();
+			}
+			changes.push_back( c );
+		}
+
+		Mirror_FetchThreads( board, changes );
+		store.Begin();
+		for ( size_t i = 0; i < changes.size(); ++i ) {
+			if ( boardPerPage == 0 ) {
+				boardPerPage = changes[i].thread.perPage;
+			}
+			if ( changes[i].ok ) {
+				store.PutThread( changes[i].thread, changes[i].firstPost );
+				fetchedThreads++;
+				fetchedPosts += changes[i].thread.posts.size() - changes[i].firstPost;
+			}
+		}
+		if ( !store.Commit() ) {
+			wprintf( L"cannot write mirror of %S\n", board.c_str() );
+			return 1;
+		}
+		wprintf( L"page %d: %d changed\n", (int)p, (int)changes.size() );
+		if ( !anyChanged ) {
+			break;
+		}
+	}
+
+	wprintf( L"%S: %d threads updated, %d posts fetched, %d unchanged skipped, %d threads in mirror\n",
+			board.c_str(), (int)fetchedThreads, (int)fetchedPosts, (int)unchanged, (int)store.Threads().size() );
+	return 0;
+}
+
+// Tabs and newlines would break the columns.
+static std::string Mirror_Escape( const std::string& text )
+{
+	std::string s;
+	s.reserve( text.length() );
+	for ( size_t i = 0; i < text.length(); ++i ) {
+		switch ( text[i] ) {
+		case '\t': s += "\\t"; break;
+		case '\n': s += "\\n"; break;
+		case '\r': s += "\\r"; break;
+		case '\\': s += "\\\\"; break;
+		default:   s += text[i]; break;
+		}
+	}
+	return s;
+}
+
+struct MirrorAuthor {
+	size_t posts;
+	size_t threads;
+};
+
+static int Mirror_Export( int argc, char* argv[] )
+{
+	if ( argc < 2 ) {
+		wprintf( L"usage: csmth mirror export <board> <dir>\n" );
+		return 1;
+	}
+	std::string board = argv[0];
+	std::string dir = argv[1];
+	MirrorStore store;
+	if ( !store.Open( Mirror_GetPath( board ) ) ) {
+		wprintf( L"cannot open mirror of %S\n", board.c_str() );
+		return 1;
+	}
+	CreateDirectoryA( dir.c_str(), nullptr );
+
+	std::ofstream threads( ( dir + "/threads.tsv" ).c_str(), std::ofstream::binary );
+	std::ofstream posts( ( dir + "/posts.tsv" ).c_str(), std::ofstream::binary );
+	std::ofstream authors( ( dir + "/authors.tsv" ).c_str(), std::ofstream::binary );
+	threads << "board\tthread\ttitle\tauthor\tauthor_time\tlast_replier\treplier_time\tposts\n";
+	posts << "board\tthread\tfloor\tauthor\tcontent\n";
+	authors << "author\tposts\tthreads\n";
+
+	std::map<std::string, MirrorAuthor> authorStats;
+	const std::map<uint32_t, MirrorThread>& all = store.Threads();
+	for ( auto it = all.begin(); it != all.end(); ++it ) {
+		const MirrorThread& t = it->second;
+		threads << board << "\t" << t.id << "\t" << Mirror_Escape( t.title ) << "\t" << t.author << "\t"
+			<< t.author_time << "\t" << t.last_replier << "\t" << t.replier_time << "\t" << t.posts.size() << "\n";
+		for ( size_t k = 0; k < t.posts.size(); ++k ) {
+			std::string author = Smth_GetAuthorId( t.posts[k].author );
+			posts << board << "\t" << t.id << "\t" << k << "\t" << author << "\t" << Mirror_Escape( t.posts[k].content ) << "\n";
+			MirrorAuthor& a = authorStats[author];
+			a.posts++;
+			a.threads += ( k == 0 ) ? 1 : 0;
+		}
+	}
+	for ( auto it = authorStats.begin(); it != authorStats.end(); ++it ) {
+		authors << it->first << "\t" << it->second.posts << "\t" << it->second.threads << "\n";
+	}
+
+	if ( !threads || !posts || !authors ) {
+		wprintf( L"cannot write to %S\n", dir.c_str() );
+		return 1;
+	}
+	return 0;
+}
+
+static int Mirror_Stats( int argc, char* argv[] )
+{
+	if ( argc < 1 ) {
+		wprintf( L"usage: csmth mirror stats <board>\n" );
+		return 1;
+	}
+	MirrorStore store;
+	if ( !store.Open( Mirror_GetPath( argv[0] ) ) ) {
+		wprintf( L"cannot open mirror of %S\n", argv[0] );
+		return 1;
+	}
+	size_t postCount = 0;
+	std::map<std::string, size_t> authors;
+	const std::map<uint32_t, MirrorThread>& all = store.Threads();
+	for ( auto it = all.begin(); it != all.end(); ++it ) {
+		postCount += it->second.posts.size();
+		for ( size_t k = 0; k < it->second.posts.size(); ++k ) {
+			authors[Smth_GetAuthorId( it->second.posts[k].author )]++;
+		}
+	}
+	wprintf( L"threads: %d, posts: %d, authors: %d, file bytes: %d\n",
+			(int)all.size(), (int)postCount, (int)authors.size(), (int)store.FileSize() );
+	return 0;
+}
+
+int Mirror_Run( int argc, char* argv[] )
+{
+	static const struct {
+		const char* name;
+		int ( *run )( int argc, char* argv[] );
+	} commands[] = {
+		{ "sync",   Mirror_Sync },
+		{ "export", Mirror_Export },
+		{ "stats",  Mirror_Stats },
+	};
+
+	int count = sizeof( commands ) / sizeof( commands[0] );
+	if ( argc > 0 ) {
+		for ( int i = 0; i < count; ++i ) {
+			if ( strcmp( argv[0], commands[i].name ) == 0 ) {
+				if ( !Smth_NetInit() ) {
+					return 1;
+				}
+				int result = commands[i].run( argc - 1, argv + 1 );
+				Smth_NetDeinit();
+				return result;
+			}
+		}
+	}
+
+	wprintf( L"usage: csmth mirror <command> ...\n" );
+	for ( int i = 0; i < count; ++i ) {
+		wprintf( L"  %S\n", commands[i].name );
+	}
+	return 1;
+}
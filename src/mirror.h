@@ -0,0 +1,10 @@
+#ifndef MIRROR_H_191027112050
+#define MIRROR_H_191027112050
+
+// Runs "csmth mirror <command> ..." and returns the process exit code.
+//   sync <board> [max-pages]    fetch threads that changed since the last sync
+//   export <board> <dir>        write threads.tsv, posts.tsv and authors.tsv
+//   stats <board>               thread, post and author counts
+int Mirror_Run( int argc, char* argv[] );
+
+#endif // #ifndef MIRROR_H_191027112050
@@ -0,0 +1,234 @@
+#include <cstdio>
+#include <io.h>
+#include <windows.h>
+
+#include "bin_stream.h"
+#include "fnv_hash.h"
+#include "mapped_file.h"
+#include "mirror_store.h"
+
+static const char     MIRROR_MAGIC[4]   = { 'C', 'M', 'I', 'R' };
+static const uint32_t MIRROR_VERSION    = 1;
+static const uint32_t MIRROR_FRAME      = 0x4E585443; // "CTXN"
+// magic, version
+static const size_t   MIRROR_HEADER_SIZE = 4 + 4;
+// frame tag, payload size, payload checksum
+static const size_t   MIRROR_FRAME_SIZE  = 3 * 4;
+// Compact when superseded data outweighs live data by this much.
+static const size_t   MIRROR_COMPACT_MIN = 1024 * 1024;
+
+static void Mirror_WriteThread( BinWriter& w, const MirrorThread& t, size_t firstPost )
+{
+	w.U32( t.id );
+	w.Str( t.title );
+	w.Str( t.author );
+	w.Str( t.author_time );
+	w.Str( t.last_replier );
+	w.Str( t.replier_time );
+	w.U32( t.perPage );
+	w.U32( (uint32_t)firstPost );
+	w.U32( (uint32_t)( t.posts.size() - firstPost ) );
+	for ( size_t i = firstPost; i < t.posts.size(); ++i ) {
+		w.Str( t.posts[i].author );
+		w.Str( t.posts[i].content );
+	}
+}
+
+static size_t Mirror_PostBytes( const MirrorPost& p )
+{
+	return 8 + p.author.length() + p.content.length();
+}
+
+static bool Mirror_WriteFile( FILE* fp, const std::vector<char>& payload )
+{
+	BinWriter frame;
+	frame.U32( MIRROR_FRAME );
+	frame.U32( (uint32_t)payload.size() );
+	frame.U32( Fnv_Hash32( payload.data(), payload.size() ) );
+	return fwrite( frame.Buffer().data(), 1, frame.Size(), fp ) == frame.Size()
+		&& fwrite( payload.data(), 1, payload.size(), fp ) == payload.size();
+}
+
+MirrorStore::MirrorStore()
+	: pendingCount( 0 ), fileSize( 0 ), deadBytes( 0 )
+{
+}
+
+const MirrorThread* MirrorStore::FindThread( uint32_t id ) const
+{
+	auto it = threads.find( id );
+	return it != threads.end() ? &it->second : nullptr;
+}
+
+// Applies one transaction payload to the in-memory tables.
+void MirrorStore::Apply( BinReader& r )
+{
+	uint32_t count = r.U32();
+	for ( uint32_t i = 0; i < count && r.Ok(); ++i ) {
+		uint32_t id = r.U32();
+		bool known = threads.find( id ) != threads.end();
+		MirrorThread& t = threads[id];
+		if ( known ) {
+			deadBytes += 40 + t.title.length() + t.author.length() + t.last_replier.length();
+		}
+		t.id           = id;
+		t.title        = r.Str();
+		t.author       = r.Str();
+		t.author_time  = r.Str();
+		t.last_replier = r.Str();
+		t.replier_time = r.Str();
+		t.perPage      = r.U32();
+		uint32_t firstPost = r.U32();
+		uint32_t postCount = r.U32();
+		if ( firstPost > t.posts.size() ) {
+			firstPost = (uint32_t)t.posts.size();
+		}
+		for ( size_t k = firstPost; k < t.posts.size(); ++k ) {
+			deadBytes += Mirror_PostBytes( t.posts[k] );
+		}
+		t.posts.resize( firstPost );
+		for ( uint32_t k = 0; k < postCount && r.Ok(); ++k ) {
+			MirrorPost p;
+			p.author  = r.Str();
+			p.content = r.Str();
+			t.posts.push_back( p );
+		}
+	}
+}
+
+bool MirrorStore::Open( const std::string& filePath )
+{
+	path = filePath;
+	threads.clear();
+	pending.clear();
+	pendingCount = 0;
+	fileSize = 0;
+	deadBytes = 0;
+
+	size_t validEnd = 0;
+	{
+		MappedFile file;
+		if ( !file.Open( path ) ) {
+			// A new mirror.
+			FILE* fp = fopen( path.c_str(), "wb" );
+			if ( fp == nullptr ) {
+				return false;
+			}
+			BinWriter w;
+			w.Bytes( MIRROR_MAGIC, sizeof( MIRROR_MAGIC ) );
+			w.U32( MIRROR_VERSION );
+			bool ok = fwrite( w.Buffer().data(), 1, w.Size(), fp ) == w.Size();
+			ok = ( fclose( fp ) == 0 ) && ok;
+			fileSize = w.Size();
+			return ok;
+		}
+
+		BinReader header( file.Data(), file.Size() );
+		char magic[4];
+		header.Bytes( magic, sizeof( magic ) );
+		if ( memcmp( magic, MIRROR_MAGIC, sizeof( magic ) ) != 0 || header.U32() != MIRROR_VERSION ) {
+			return false;
+		}
+
+		// Replay frames up to the first torn or damaged one.
+		validEnd = MIRROR_HEADER_SIZE;
+		while ( file.Size() - validEnd >= MIRROR_FRAME_SIZE ) {
+			BinReader frame( file.Data() + validEnd, MIRROR_FRAME_SIZE );
+			uint32_t tag      = frame.U32();
+			uint32_t size     = frame.U32();
+			uint32_t checksum = frame.U32();
+			const char* payload = file.Data() + validEnd + MIRROR_FRAME_SIZE;
+			if ( tag != MIRROR_FRAME || size > file.Size() - validEnd - MIRROR_FRAME_SIZE
+					|| Fnv_Hash32( payload, size ) != checksum ) {
+				break;
+			}
+			BinReader r( payload, size );
+			Apply( r );
+			validEnd += MIRROR_FRAME_SIZE + size;
+		}
+		fileSize = file.Size();
+	}
+
+	// Appending after a torn frame would hide everything written later.
+	if ( validEnd != fileSize ) {
+		return Compact();
+	}
+	return true;
+}
+
+void MirrorStore::Begin()
+{
+	pending.clear();
+	pendingCount = 0;
+}
+
+void MirrorStore::PutThread( const MirrorThread& thread, size_t firstPost )
+{
+	BinWriter w;
+	Mirror_WriteThread( w, thread, firstPost );
+	pending.insert( pending.end(), w.Buffer().begin(), w.Buffer().end() );
+	pendingCount++;
+}
+
+bool MirrorStore::Commit()
+{
+	if ( pendingCount == 0 ) {
+		return true;
+	}
+	BinWriter w;
+	w.U32( pendingCount );
+	w.Bytes( pending.data(), pending.size() );
+	pending.clear();
+	pendingCount = 0;
+
+	FILE* fp = fopen( path.c_str(), "ab" );
+	if ( fp == nullptr ) {
+		return false;
+	}
+	bool ok = Mirror_WriteFile( fp, w.Buffer() );
+	ok = ( fflush( fp ) == 0 ) && ok;
+	ok = ( _commit( _fileno( fp ) ) == 0 ) && ok;
+	ok = ( fclose( fp ) == 0 ) && ok;
+	if ( !ok ) {
+		return false;
+	}
+	fileSize += MIRROR_FRAME_SIZE + w.Size();
+
+	BinReader r( w.Buffer().data(), w.Size() );
+	Apply( r );
+
+	if ( deadBytes > MIRROR_COMPACT_MIN && deadBytes * 2 > fileSize ) {
+		return Compact();
+	}
+	return true;
+}
+
+// Rewrites the live tables as one transaction and swaps the file in.
+bool MirrorStore::Compact()
+{
+	BinWriter header;
+	header.Bytes( MIRROR_MAGIC, sizeof( MIRROR_MAGIC ) );
+	header.U32( MIRROR_VERSION );
+
+	BinWriter w;
+	w.U32( (uint32_t)threads.size() );
+	for ( auto it = threads.begin(); it != threads.end(); ++it ) {
+		Mirror_WriteThread( w, it->second, 0 );
+	}
+
+	std::string tempPath = path + ".tmp";
+	FILE* fp = fopen( tempPath.c_str(), "wb" );
+	if ( fp == nullptr ) {
+		return false;
+	}
+	bool ok = fwrite( header.Buffer().data(), 1, header.Size(), fp ) == header.Size();
+	ok = ok && ( threads.size() == 0 || Mirror_WriteFile( fp, w.Buffer() ) );
+	ok = ( fclose( fp ) == 0 ) && ok;
+	if ( !ok || MoveFileExA( tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING ) == 0 ) {
+		remove( tempPath.c_str() );
+		return false;
+	}
+	fileSize = header.Size() + ( threads.size() > 0 ? MIRROR_FRAME_SIZE + w.Size() : 0 );
+	deadBytes = 0;
+	return true;
+}
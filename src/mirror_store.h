@@ -0,0 +1,69 @@
+#ifndef MIRROR_STORE_H_191027103344
+#define MIRROR_STORE_H_191027103344
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+class BinWriter;
+class BinReader;
+
+struct MirrorPost {
+	std::string author;
+	std::string content;
+};
+
+struct MirrorThread {
+	uint32_t    id;
+	std::string title;
+	std::string author;
+	std::string author_time;
+	std::string last_replier;
+	std::string replier_time;
+	uint32_t    perPage;    // posts per article page, 0 if not known yet
+	std::vector<MirrorPost> posts;
+};
+
+// Local mirror of one board's threads and posts. The file is a log of
+// transactions: every Commit() appends one checksummed frame holding the
+// changed threads, so an interrupted write loses at most the last
+// transaction. Opening replays the log; it is compacted once most of it
+// is superseded.
+class MirrorStore
+{
+public:
+	MirrorStore();
+
+	bool Open( const std::string& path );
+
+	const MirrorThread* FindThread( uint32_t id ) const;
+	const std::map<uint32_t, MirrorThread>& Threads() const
+	{
+		return threads;
+	}
+
+	// Replaces the thread's header and its posts from firstPost on,
+	// buffered until Commit().
+	void Begin();
+	void PutThread( const MirrorThread& thread, size_t firstPost );
+	bool Commit();
+
+	size_t FileSize() const
+	{
+		return fileSize;
+	}
+
+private:
+	void Apply( BinReader& r );
+	bool Compact();
+
+	std::string                       path;
+	std::map<uint32_t, MirrorThread>  threads;
+	std::vector<char>                 pending;
+	uint32_t                          pendingCount;
+	size_t                            fileSize;
+	size_t                            deadBytes;
+};
+
+#endif // #ifndef MIRROR_STORE_H_191027103344
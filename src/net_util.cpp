@@ -1,11 +1,20 @@
 #include <windows.h>
+#include <wincrypt.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <random>
 #include <thread>
 #include <vector>
+#include <deque>
 
 #define CURL_STATICLIB
 
 
 #include "curl/curl.h"
+#include "alloc_profile.h"
 #include "net_util.h"
 
 #define CURL_APIENTRY
@@ -17,6 +26,23 @@ typedef CURLcode (CURL_APIENTRY* PFN_CURL_EASY_PERFORM) (CURL * easy_handle );
 typedef struct curl_slist*(CURL_APIENTRY* PFN_CURL_SLIST_APPEND) (struct curl_slist * list, const char * string );
 typedef void (CURL_APIENTRY* PFN_CURL_SLIST_FREE_ALL) (struct curl_slist * list);
 
+typedef CURLM* (CURL_APIENTRY* PFN_CURL_MULTI_INIT) ( void );
+typedef CURLMcode (CURL_APIENTRY* PFN_CURL_MULTI_CLEANUP) ( CURLM* multi_handle );
+typedef CURLMcode (CURL_APIENTRY* PFN_CURL_MULTI_ADD_HANDLE) ( CURLM* multi_handle, CURL* easy_handle );
+typedef CURLMcode (CURL_APIENTRY* PFN_CURL_MULTI_REMOVE_HANDLE) ( CURLM* multi_handle, CURL* easy_handle );
+typedef CURLMcode (CURL_APIENTRY* PFN_CURL_MULTI_PERFORM) ( CURLM* multi_handle, int* running_handles );
+typedef CURLMcode (CURL_APIENTRY* PFN_CURL_MULTI_WAIT) ( CURLM* multi_handle, struct curl_waitfd extra_fds[], unsigned int extra_nfds, int timeout_ms, int* numfds );
+typedef CURLMsg*  (CURL_APIENTRY* PFN_CURL_MULTI_INFO_READ) ( CURLM* multi_handle, int* msgs_in_queue );
+typedef CURLMcode (CURL_APIENTRY* PFN_CURL_MULTI_SETOPT) ( CURLM* multi_handle, CURLMoption option, ... );
+typedef CURLcode  (CURL_APIENTRY* PFN_CURL_EASY_GETINFO) ( CURL* handle, CURLINFO info, ... );
+
+typedef CURLSH*    (CURL_APIENTRY* PFN_CURL_SHARE_INIT) ( void );
+typedef CURLSHcode (CURL_APIENTRY* PFN_CURL_SHARE_SETOPT) ( CURLSH* share, CURLSHoption option, ... );
+typedef CURLSHcode (CURL_APIENTRY* PFN_CURL_SHARE_CLEANUP) ( CURLSH* share );
+typedef CURLSHcode (CURL_APIENTRY* PFN_CURL_SHARE_EXPORT_SSL_SESSIONS) ( CURLSH* share, curl_ssl_session_callback callback, void* userptr );
+typedef CURLSHcode (CURL_APIENTRY* PFN_CURL_SHARE_IMPORT_SSL_SESSION) ( CURLSH* share, const char* host, int port, const unsigned char* blob, size_t bloblen );
+typedef CURLSHcode (CURL_APIENTRY* PFN_CURL_SHARE_SSL_SESSION_STATS) ( CURLSH* share, long* handshakes, long* resumed );
+
 static struct {
 
 	PFN_CURL_EASY_INIT    curl_easy_init;
@@ -27,9 +53,95 @@ static struct {
 	PFN_CURL_SLIST_APPEND   curl_slist_append;
 	PFN_CURL_SLIST_FREE_ALL curl_slist_free_all;
 
+	PFN_CURL_MULTI_INIT          curl_multi_init;
+	PFN_CURL_MULTI_CLEANUP       curl_multi_cleanup;
+	PFN_CURL_MULTI_ADD_HANDLE    curl_multi_add_handle;
+	PFN_CURL_MULTI_REMOVE_HANDLE curl_multi_remove_handle;
+	PFN_CURL_MULTI_PERFORM       curl_multi_perform;
+	PFN_CURL_MULTI_WAIT          curl_multi_wait;
+	PFN_CURL_MULTI_INFO_READ     curl_multi_info_read;
+	PFN_CURL_MULTI_SETOPT        curl_multi_setopt;
+	PFN_CURL_EASY_GETINFO        curl_easy_getinfo;
+
+	PFN_CURL_SHARE_INIT                curl_share_init;
+	PFN_CURL_SHARE_SETOPT              curl_share_setopt;
+	PFN_CURL_SHARE_CLEANUP             curl_share_cleanup;
+	PFN_CURL_SHARE_EXPORT_SSL_SESSIONS curl_share_export_ssl_sessions;
+	PFN_CURL_SHARE_IMPORT_SSL_SESSION  curl_share_import_ssl_session;
+	PFN_CURL_SHARE_SSL_SESSION_STATS   curl_share_ssl_session_stats;
 
 } gsNetInst;
 
+// Default number of concurrent transfers of one multi handle.
+static const int NET_DEFAULT_MAX_PARALLEL = 16;
+// Every easy handle caps the shared connection cache at its own
+// CURLOPT_MAXCONNECTS, 5 by default; room for all threads' connections.
+static const long NET_SHARED_MAX_CONNECTS = 64;
+// Recent times to first byte kept for the hedging delay.
+static const size_t NET_TTFB_WINDOW      = 256;
+static const size_t NET_TTFB_MIN_SAMPLES = 20;
+
+static NetPolicy gsNetPolicy = {
+	5000,  // connectTimeoutMs
+	20000, // deadlineMs
+	2,     // retries
+	200,   // backoffMs
+	true,  // hedge
+	800,   // hedgeDefaultMs
+	50,    // hedgeMinMs
+};
+
+static struct {
+	std::mutex       mutex;
+	std::vector<int> ttfb;
+	size_t           ttfbNext;
+	std::atomic<int> requests;
+	std::atomic<int> retries;
+	std::atomic<int> hedges;
+	std::atomic<int> hedgeWins;
+	std::atomic<int> failures;
+} gsNetStats;
+
+const std::string SMTH_DOMAIN = "m.newsmth.net";
+
+// Requests for the site go here instead when set, see Net_SetBaseUrl.
+static std::string gsNetBaseUrl;
+
+// Scheme-less urls go out over HTTPS once turned on, see Net_SetHttps.
+static bool        gsNetHttps = false;
+static std::string gsNetCaFile;
+
+// TLS sessions and DNS answers are shared by all handles, so that a new
+// connection resumes the session of an earlier one. The share locks itself.
+static CURLSH* gsNetShare;
+
+// Cookie-less gets go here instead when set, see Net_SetForwarder.
+static NetForwardFn gsNetForward;
+
+// Magic and version of the file written by Net_SaveTlsSessions.
+static const char     NET_TLS_FILE_MAGIC[4] = { 'C', 'T', 'L', 'S' };
+static const uint32_t NET_TLS_FILE_VERSION  = 1;
+
+struct NetTransfer {
+	int               id;
+	std::string       url;
+	std::string       range;
+	int64_t           totalLength;
+	int               tries;
+	double            notBeforeMs;
+	std::vector<char> data;
+	CURL*             curl;
+	curl_slist*       headers;
+};
+
+struct NetMulti {
+	CURLM*                    multi;
+	std::string               cookieFile;
+	int                       maxParallel;
+	std::deque<NetTransfer*>  waiting;
+	std::vector<NetTransfer*> running;
+};
+
 bool Net_Init( void )
 {
 	gsNetInst.curl_easy_init = (PFN_CURL_EASY_INIT)&curl_easy_init;
@@ -40,12 +152,44 @@ bool Net_Init( void )
 	gsNetInst.curl_slist_append   = (PFN_CURL_SLIST_APPEND)&curl_slist_append;
 	gsNetInst.curl_slist_free_all = (PFN_CURL_SLIST_FREE_ALL)&curl_slist_free_all;
 
+	gsNetInst.curl_multi_init          = (PFN_CURL_MULTI_INIT)&curl_multi_init;
+	gsNetInst.curl_multi_cleanup       = (PFN_CURL_MULTI_CLEANUP)&curl_multi_cleanup;
+	gsNetInst.curl_multi_add_handle    = (PFN_CURL_MULTI_ADD_HANDLE)&curl_multi_add_handle;
+	gsNetInst.curl_multi_remove_handle = (PFN_CURL_MULTI_REMOVE_HANDLE)&curl_multi_remove_handle;
+	gsNetInst.curl_multi_perform       = (PFN_CURL_MULTI_PERFORM)&curl_multi_perform;
+	gsNetInst.curl_multi_wait          = (PFN_CURL_MULTI_WAIT)&curl_multi_wait;
+	gsNetInst.curl_multi_info_read     = (PFN_CURL_MULTI_INFO_READ)&curl_multi_info_read;
+	gsNetInst.curl_multi_setopt        = (PFN_CURL_MULTI_SETOPT)&curl_multi_setopt;
+	gsNetInst.curl_easy_getinfo        = (PFN_CURL_EASY_GETINFO)&curl_easy_getinfo;
+
+	gsNetInst.curl_share_init                = (PFN_CURL_SHARE_INIT)&curl_share_init;
+	gsNetInst.curl_share_setopt              = (PFN_CURL_SHARE_SETOPT)&curl_share_setopt;
+	gsNetInst.curl_share_cleanup             = (PFN_CURL_SHARE_CLEANUP)&curl_share_cleanup;
+	gsNetInst.curl_share_export_ssl_sessions = (PFN_CURL_SHARE_EXPORT_SSL_SESSIONS)&curl_share_export_ssl_sessions;
+	gsNetInst.curl_share_import_ssl_session  = (PFN_CURL_SHARE_IMPORT_SSL_SESSION)&curl_share_import_ssl_session;
+	gsNetInst.curl_share_ssl_session_stats   = (PFN_CURL_SHARE_SSL_SESSION_STATS)&curl_share_ssl_session_stats;
+
+	gsNetShare = gsNetInst.curl_share_init();
+	if ( gsNetShare != nullptr ) {
+		gsNetInst.curl_share_setopt( gsNetShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION );
+		gsNetInst.curl_share_setopt( gsNetShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS );
+		gsNetInst.curl_share_setopt( gsNetShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT );
+	}
 
+	const char* baseUrl = getenv( "CSMTH_BASE_URL" );
+	if ( gsNetBaseUrl.length() == 0 && baseUrl != nullptr ) {
+		Net_SetBaseUrl( baseUrl );
+	}
 	return true;
 }
 
 void Net_Deinit( void )
 {
+	if ( gsNetShare != nullptr ) {
+		gsNetInst.curl_share_cleanup( gsNetShare );
+		gsNetShare = nullptr;
+	}
+
 	gsNetInst.curl_easy_init    = nullptr;
 	gsNetInst.curl_easy_cleanup = nullptr;
 	gsNetInst.curl_easy_setopt  = nullptr;
@@ -54,6 +198,22 @@ void Net_Deinit( void )
 	gsNetInst.curl_slist_append   = nullptr;
 	gsNetInst.curl_slist_free_all = nullptr;
 
+	gsNetInst.curl_multi_init          = nullptr;
+	gsNetInst.curl_multi_cleanup       = nullptr;
+	gsNetInst.curl_multi_add_handle    = nullptr;
+	gsNetInst.curl_multi_remove_handle = nullptr;
+	gsNetInst.curl_multi_perform       = nullptr;
+	gsNetInst.curl_multi_wait          = nullptr;
+	gsNetInst.curl_multi_info_read     = nullptr;
+	gsNetInst.curl_multi_setopt        = nullptr;
+	gsNetInst.curl_easy_getinfo        = nullptr;
+
+	gsNetInst.curl_share_init                = nullptr;
+	gsNetInst.curl_share_setopt              = nullptr;
+	gsNetInst.curl_share_cleanup             = nullptr;
+	gsNetInst.curl_share_export_ssl_sessions = nullptr;
+	gsNetInst.curl_share_import_ssl_session  = nullptr;
+	gsNetInst.curl_share_ssl_session_stats   = nullptr;
 }
 
 static size_t Net_CurlWriteCallback( char* ptr, size_t size, size_t nmemb, void* userdata )
@@ -64,40 +224,492 @@ static size_t Net_CurlWriteCallback( char* ptr, size_t size, size_t nmemb, void*
 	return size*nmemb;
 }
 
-std::string Net_Get( const std::string& url, const std::string& cookie_file )
+static std::string Net_ResolveUrl( const std::string& url )
+{
+	if ( gsNetBaseUrl.length() == 0 ) {
+		if ( gsNetHttps && url.find( "://" ) == std::string::npos ) {
+			return "https://" + url;
+		}
+		return url;
+	}
+	size_t host = url.find( "://" );
+	host = ( host == std::string::npos ) ? 0 : host + 3;
+	size_t end = host + SMTH_DOMAIN.length();
+	if ( url.compare( host, SMTH_DOMAIN.length(), SMTH_DOMAIN ) != 0 || ( end < url.length() && url[end] != '/' && url[end] != '?' ) ) {
+		return url;
+	}
+	return gsNetBaseUrl + url.substr( end );
+}
+
+void Net_SetBaseUrl( const std::string& baseUrl )
+{
+	gsNetBaseUrl = baseUrl;
+	while ( gsNetBaseUrl.length() > 0 && gsNetBaseUrl.back() == '/' ) {
+		gsNetBaseUrl.pop_back();
+	}
+}
+
+void Net_SetForwarder( NetForwardFn forward )
+{
+	gsNetForward = forward;
+}
+
+void Net_SetHttps( bool https, const std::string& caFile )
+{
+	gsNetHttps  = https;
+	gsNetCaFile = caFile;
+}
+
+// Options every easy handle gets.
+static void Net_SetCommonOptions( CURL* curl )
+{
+	gsNetInst.curl_easy_setopt( curl, CURLOPT_NOSIGNAL, 1L );
+	gsNetInst.curl_easy_setopt( curl, CURLOPT_CONNECTTIMEOUT_MS, (long)Net_GetPolicy().connectTimeoutMs );
+	if ( gsNetShare != nullptr ) {
+		gsNetInst.curl_easy_setopt( curl, CURLOPT_SHARE, gsNetShare );
+		gsNetInst.curl_easy_setopt( curl, CURLOPT_MAXCONNECTS, NET_SHARED_MAX_CONNECTS );
+	}
+	if ( gsNetCaFile.length() > 0 ) {
+		gsNetInst.curl_easy_setopt( curl, CURLOPT_CAINFO, gsNetCaFile.c_str() );
+	}
+}
+
+static void Net_PutU32( std::string& out, uint32_t v )
+{
+	for ( int i = 0; i < 4; ++i ) {
+		out.push_back( (char)( v >> ( 8 * i ) ) );
+	}
+}
+
+static bool Net_GetU32( const std::string& in, size_t& pos, uint32_t& v )
+{
+	if ( in.length() - pos < 4 ) {
+		return false;
+	}
+	v = 0;
+	for ( int i = 0; i < 4; ++i ) {
+		v |= (uint32_t)(unsigned char)in[pos++] << ( 8 * i );
+	}
+	return true;
+}
+
+static void Net_ExportTlsSession( const char* host, int port, const unsigned char* blob, size_t bloblen, void* userptr )
+{
+	std::string& out = *(std::string*)userptr;
+	Net_PutU32( out, (uint32_t)strlen( host ) );
+	out += host;
+	Net_PutU32( out, (uint32_t)port );
+	Net_PutU32( out, (uint32_t)bloblen );
+	out.append( (const char*)blob, bloblen );
+}
+
+// The sessions hold the master secrets, the file is encrypted for the
+// current user with DPAPI.
+static bool Net_ProtectData( const std::string& in, std::string& out, bool protect )
+{
+	DATA_BLOB input = { (DWORD)in.length(), (BYTE*)in.data() };
+	DATA_BLOB output = { 0, nullptr };
+	BOOL ok = protect
+		? CryptProtectData( &input, L"csmth tls sessions", nullptr, nullptr, nullptr, CRYPTPROTECT_UI_FORBIDDEN, &output )
+		: CryptUnprotectData( &input, nullptr, nullptr, nullptr, nullptr, CRYPTPROTECT_UI_FORBIDDEN, &output );
+	if ( !ok ) {
+		return false;
+	}
+	out.assign( (const char*)output.pbData, output.cbData );
+	SecureZeroMemory( output.pbData, output.cbData );
+	LocalFree( output.pbData );
+	return true;
+}
+
+bool Net_SaveTlsSessions( const std::string& path )
+{
+	if ( gsNetShare == nullptr ) {
+		return false;
+	}
+	std::string plain;
+	if ( gsNetInst.curl_share_export_ssl_sessions( gsNetShare, Net_ExportTlsSession, &plain ) != CURLSHE_OK ) {
+		return false;
+	}
+	std::string sealed;
+	bool ok = Net_ProtectData( plain, sealed, true );
+	SecureZeroMemory( &plain[0], plain.length() );
+	if ( !ok ) {
+		return false;
+	}
+
+	std::string tempPath = path + ".tmp";
+	FILE* fp = fopen( tempPath.c_str(), "wb" );
+	if ( fp == nullptr ) {
+		return false;
+	}
+	std::string header( NET_TLS_FILE_MAGIC, sizeof( NET_TLS_FILE_MAGIC ) );
+	Net_PutU32( header, NET_TLS_FILE_VERSION );
+	ok = fwrite( header.data(), 1, header.length(), fp ) == header.length();
+	ok = ok && fwrite( sealed.data(), 1, sealed.length(), fp ) == sealed.length();
+	ok = ( fclose( fp ) == 0 ) && ok;
+	if ( !ok ) {
+		remove( tempPath.c_str() );
+		return false;
+	}
+	return MoveFileExA( tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING ) != 0;
+}
+
+int Net_LoadTlsSessions( const std::string& path )
 {
+	if ( gsNetShare == nullptr ) {
+		return 0;
+	}
+	std::string sealed;
+	FILE* fp = fopen( path.c_str(), "rb" );
+	if ( fp == nullptr ) {
+		return 0;
+	}
+	char buffer[4096];
+	size_t n;
+	while ( ( n = fread( buffer, 1, sizeof( buffer ), fp ) ) > 0 ) {
+		sealed.append( buffer, n );
+	}
+	fclose( fp );
+
+	size_t pos = sizeof( NET_TLS_FILE_MAGIC );
+	uint32_t version = 0;
+	if ( sealed.compare( 0, pos, NET_TLS_FILE_MAGIC, pos ) != 0 || !Net_GetU32( sealed, pos, version ) || version != NET_TLS_FILE_VERSION ) {
+		return 0;
+	}
+	std::string plain;
+	if ( !Net_ProtectData( sealed.substr( pos ), plain, false ) ) {
+		return 0;
+	}
+
+	int count = 0;
+	pos = 0;
+	uint32_t hostLength, port, blobLength;
+	while ( Net_GetU32( plain, pos, hostLength ) && hostLength <= plain.length() - pos ) {
+		std::string host = plain.substr( pos, hostLength );
+		pos += hostLength;
+		if ( !Net_GetU32( plain, pos, port ) || !Net_GetU32( plain, pos, blobLength ) || blobLength > plain.length() - pos ) {
+			break;
+		}
+		if ( gsNetInst.curl_share_import_ssl_session( gsNetShare, host.c_str(), (int)port, (const unsigned char*)plain.data() + pos, blobLength ) == CURLSHE_OK ) {
+			++count;
+		}
+		pos += blobLength;
+	}
+	SecureZeroMemory( &plain[0], plain.length() );
+	return count;
+}
+
+void Net_GetTlsStats( long& handshakes, long& resumed )
+{
+	handshakes = 0;
+	resumed    = 0;
+	if ( gsNetShare != nullptr ) {
+		gsNetInst.curl_share_ssl_session_stats( gsNetShare, &handshakes, &resumed );
+	}
+}
+
+static double Net_NowMs( void )
+{
+	using namespace std::chrono;
+	return duration<double, std::milli>( steady_clock::now().time_since_epoch() ).count();
+}
+
+// Errors worth another attempt: the next connection may well succeed.
+static bool Net_IsTransient( CURLcode res, long status )
+{
+	switch ( res ) {
+	case CURLE_OK:
+		return status >= 500;
+	case CURLE_COULDNT_RESOLVE_HOST:
+	case CURLE_COULDNT_CONNECT:
+	case CURLE_OPERATION_TIMEDOUT:
+	case CURLE_SEND_ERROR:
+	case CURLE_RECV_ERROR:
+	case CURLE_GOT_NOTHING:
+	case CURLE_PARTIAL_FILE:
+	case CURLE_SSL_CONNECT_ERROR:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Full jitter: anywhere between zero and the exponential bound, so
+// clients that failed together do not retry together.
+static int Net_BackoffMs( const NetPolicy& policy, int attempt )
+{
+	static thread_local std::minstd_rand rng( (unsigned)std::hash<std::thread::id>()( std::this_thread::get_id() ) );
+	int bound = policy.backoffMs << ( attempt < 8 ? attempt : 8 );
+	return bound > 0 ? (int)( rng() % (unsigned)( bound + 1 ) ) : 0;
+}
+
+static void Net_AddTtfbSample( int ms )
+{
+	std::lock_guard<std::mutex> lock( gsNetStats.mutex );
+	if ( gsNetStats.ttfb.size() < NET_TTFB_WINDOW ) {
+		gsNetStats.ttfb.push_back( ms );
+	}
+	else {
+		gsNetStats.ttfb[gsNetStats.ttfbNext] = ms;
+	}
+	gsNetStats.ttfbNext = ( gsNetStats.ttfbNext + 1 ) % NET_TTFB_WINDOW;
+}
+
+// How long the first attempt may go without a byte before it is hedged:
+// the observed p95 time to first byte, or the default until there are
+// enough samples.
+static int Net_HedgeDelayMs( const NetPolicy& policy )
+{
+	std::vector<int> samples;
+	{
+		std::lock_guard<std::mutex> lock( gsNetStats.mutex );
+		samples = gsNetStats.ttfb;
+	}
+	if ( samples.size() < NET_TTFB_MIN_SAMPLES ) {
+		return policy.hedgeDefaultMs;
+	}
+	size_t k = samples.size() * 95 / 100;
+	std::nth_element( samples.begin(), samples.begin() + k, samples.end() );
+	return std::max( samples[k], policy.hedgeMinMs );
+}
+
+struct NetAttempt {
+	CURL*             curl;
+	curl_slist*       headers;
 	std::vector<char> data;
+	double            startMs;
+	double            firstByteMs;
+	bool              done;
+	CURLcode          result;
+};
 
-	CURL* curl = gsNetInst.curl_easy_init();
-	if ( curl != nullptr ) {
-		curl_slist* chunk = nullptr;
-		chunk = gsNetInst.curl_slist_append( chunk, "Accept:" );
+static size_t Net_CurlAttemptWriteCallback( char* ptr, size_t size, size_t nmemb, void* userdata )
+{
+	NetAttempt* a = (NetAttempt*)userdata;
+	if ( a->firstByteMs == 0 ) {
+		a->firstByteMs = Net_NowMs();
+	}
+	a->data.insert( a->data.end(), ptr, ptr + size*nmemb );
+	return size*nmemb;
+}
 
-		gsNetInst.curl_easy_setopt( curl, CURLOPT_HTTPHEADER, chunk );
-		gsNetInst.curl_easy_setopt( curl, CURLOPT_URL, url.c_str() );
-		gsNetInst.curl_easy_setopt( curl, CURLOPT_VERBOSE, 0 );
+static bool Net_StartAttempt( CURLM* multi, NetAttempt& a, const std::string& url, const std::string& cookie_file, double deadlineMs )
+{
+	a.curl        = gsNetInst.curl_easy_init();
+	a.headers     = nullptr;
+	a.startMs     = Net_NowMs();
+	a.firstByteMs = 0;
+	a.done        = false;
+	a.result      = CURLE_FAILED_INIT;
+	if ( a.curl == nullptr ) {
+		return false;
+	}
+	a.headers = gsNetInst.curl_slist_append( nullptr, "Accept:" );
 
-		if ( cookie_file.length() > 0 ) {
-			gsNetInst.curl_easy_setopt( curl, CURLOPT_COOKIEFILE, cookie_file.c_str() );
+	gsNetInst.curl_easy_setopt( a.curl, CURLOPT_HTTPHEADER, a.headers );
+	gsNetInst.curl_easy_setopt( a.curl, CURLOPT_URL, Net_ResolveUrl( url ).c_str() );
+	gsNetInst.curl_easy_setopt( a.curl, CURLOPT_VERBOSE, 0 );
+	Net_SetCommonOptions( a.curl );
+	gsNetInst.curl_easy_setopt( a.curl, CURLOPT_TIMEOUT_MS, (long)std::max( 1.0, deadlineMs - a.startMs ) );
+
+	if ( cookie_file.length() > 0 ) {
+		gsNetInst.curl_easy_setopt( a.curl, CURLOPT_COOKIEFILE, cookie_file.c_str() );
+	}
+
+	gsNetInst.curl_easy_setopt( a.curl, CURLOPT_WRITEFUNCTION, Net_CurlAttemptWriteCallback );
+	gsNetInst.curl_easy_setopt( a.curl, CURLOPT_WRITEDATA, &a );
+
+	gsNetInst.curl_multi_add_handle( multi, a.curl );
+	return true;
+}
+
+static void Net_EndAttempt( CURLM* multi, NetAttempt& a )
+{
+	if ( a.curl != nullptr ) {
+		gsNetInst.curl_multi_remove_handle( multi, a.curl );
+		gsNetInst.curl_easy_cleanup( a.curl );
+		a.curl = nullptr;
+	}
+	gsNetInst.curl_slist_free_all( a.headers );
+	a.headers = nullptr;
+}
+
+// One try at url before the deadline. A second request on its own
+// connection is sent when the first has had no byte by the hedging delay,
+// whichever finishes well first wins and the other is dropped.
+static bool Net_FetchHedged( const std::string& url, const std::string& cookie_file, const std::atomic<bool>* cancel,
+		const NetPolicy& policy, double deadlineMs, std::string& out, bool& outTransient )
+{
+	outTransient = false;
+	CURLM* multi = gsNetInst.curl_multi_init();
+	if ( multi == nullptr ) {
+		return false;
+	}
+
+	NetAttempt attempts[2];
+	int started = 0;
+	if ( Net_StartAttempt( multi, attempts[0], url, cookie_file, deadlineMs ) ) {
+		started = 1;
+	}
+	double hedgeAtMs = attempts[0].startMs + Net_HedgeDelayMs( policy );
+
+	int winner = -1;
+	int finished = 0;
+	while ( started > finished && winner < 0 ) {
+		int runningCount = 0;
+		gsNetInst.curl_multi_perform( multi, &runningCount );
+
+		int msgCount = 0;
+		CURLMsg* msg = nullptr;
+		while ( ( msg = gsNetInst.curl_multi_info_read( multi, &msgCount ) ) != nullptr ) {
+			if ( msg->msg != CURLMSG_DONE ) {
+				continue;
+			}
+			int i = ( attempts[0].curl == msg->easy_handle ) ? 0 : 1;
+			long status = 0;
+			gsNetInst.curl_easy_getinfo( msg->easy_handle, CURLINFO_RESPONSE_CODE, &status );
+			attempts[i].done   = true;
+			attempts[i].result = msg->data.result;
+			finished++;
+			if ( msg->data.result == CURLE_OK && status < 500 ) {
+				winner = ( winner < 0 ) ? i : winner;
+			}
+			else {
+				outTransient = outTransient || Net_IsTransient( msg->data.result, status );
+			}
+		}
+		if ( winner >= 0 ) {
+			break;
 		}
 
-		gsNetInst.curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, Net_CurlWriteCallback );
-		gsNetInst.curl_easy_setopt( curl, CURLOPT_WRITEDATA, &data );
+		double now = Net_NowMs();
+		if ( ( cancel != nullptr && *cancel ) || now >= deadlineMs ) {
+			outTransient = ( cancel == nullptr || !*cancel );
+			break;
+		}
+		if ( policy.hedge && started == 1 && attempts[0].firstByteMs == 0 && now >= hedgeAtMs ) {
+			if ( Net_StartAttempt( multi, attempts[1], url, cookie_file, deadlineMs ) ) {
+				started = 2;
+				gsNetStats.hedges++;
+			}
+			else {
+				// Net_EndAttempt below frees whatever was set up.
+				started = 2;
+				finished++;
+				attempts[1].done = true;
+			}
+		}
+		if ( started > finished ) {
+			// Wake up for the hedge, and now and then for cancellation.
+			double waitMs = std::min( deadlineMs, started == 1 && policy.hedge ? hedgeAtMs : deadlineMs ) - now;
+			int numfds = 0;
+			gsNetInst.curl_multi_wait( multi, nullptr, 0, (int)std::max( 1.0, std::min( waitMs, 50.0 ) ), &numfds );
+		}
+	}
 
-		CURLcode res = gsNetInst.curl_easy_perform( curl );
+	if ( attempts[0].firstByteMs > 0 ) {
+		Net_AddTtfbSample( (int)( attempts[0].firstByteMs - attempts[0].startMs ) );
+	}
+	if ( winner >= 0 ) {
+		out.assign( attempts[winner].data.begin(), attempts[winner].data.end() );
+		if ( winner == 1 ) {
+			gsNetStats.hedgeWins++;
+		}
+	}
+	for ( int i = 0; i < started; ++i ) {
+		Net_EndAttempt( multi, attempts[i] );
+	}
+	gsNetInst.curl_multi_cleanup( multi );
+	return winner >= 0;
+}
 
-		gsNetInst.curl_slist_free_all( chunk );
+// Hedged attempts with jittered backoff between them, all within one
+// deadline. An empty string is returned on failure.
+static std::string Net_Fetch( const std::string& url, const std::string& cookie_file, const std::atomic<bool>* cancel )
+{
+	AllocPhase allocPhase( ALLOC_PHASE_FETCH );
+	if ( gsNetForward != nullptr && cookie_file.length() == 0 ) {
+		std::vector<std::string> bodies;
+		if ( gsNetForward( std::vector<std::string>( 1, url ), bodies ) ) {
+			return bodies[0];
+		}
+	}
+
+	NetPolicy policy = Net_GetPolicy();
+	double deadlineMs = Net_NowMs() + policy.deadlineMs;
+	gsNetStats.requests++;
 
+	std::string body;
+	for ( int attempt = 0; ; ++attempt ) {
+		bool transient = false;
+		if ( Net_FetchHedged( url, cookie_file, cancel, policy, deadlineMs, body, transient ) ) {
+			return body;
+		}
+		if ( !transient || attempt >= policy.retries || ( cancel != nullptr && *cancel ) ) {
+			break;
+		}
+		double sleepMs = std::min( (double)Net_BackoffMs( policy, attempt ), deadlineMs - Net_NowMs() );
+		if ( sleepMs <= 0 ) {
+			break;
+		}
+		gsNetStats.retries++;
+		for ( double endMs = Net_NowMs() + sleepMs; Net_NowMs() < endMs && !( cancel != nullptr && *cancel ); ) {
+			Sleep( 10 );
+		}
 	}
-	gsNetInst.curl_easy_cleanup( curl );
+	gsNetStats.failures++;
+	return std::string();
+}
 
-	std::string utf8_text = std::string( data.begin(), data.end() );
+std::string Net_Get( const std::string& url, const std::string& cookie_file )
+{
+	return Net_Fetch( url, cookie_file, nullptr );
+}
 
-	return utf8_text;
+std::string Net_GetCancellable( const std::string& url, const std::string& cookie_file, const std::atomic<bool>& cancel )
+{
+	return Net_Fetch( url, cookie_file, &cancel );
+}
+
+// Background threads and the daemon read the policy while the ui may set
+// it, so it is only ever copied under the stats mutex.
+void Net_SetPolicy( const NetPolicy& policy )
+{
+	std::lock_guard<std::mutex> lock( gsNetStats.mutex );
+	gsNetPolicy = policy;
+}
+
+NetPolicy Net_GetPolicy( void )
+{
+	std::lock_guard<std::mutex> lock( gsNetStats.mutex );
+	return gsNetPolicy;
+}
+
+void Net_GetStats( NetStats& outStats )
+{
+	outStats.requests  = gsNetStats.requests;
+	outStats.retries   = gsNetStats.retries;
+	outStats.hedges    = gsNetStats.hedges;
+	outStats.hedgeWins = gsNetStats.hedgeWins;
+	outStats.failures  = gsNetStats.failures;
+	outStats.hedgeDelayMs = Net_HedgeDelayMs( Net_GetPolicy() );
+}
+
+void Net_ResetStats( void )
+{
+	std::lock_guard<std::mutex> lock( gsNetStats.mutex );
+	gsNetStats.ttfb.clear();
+	gsNetStats.ttfbNext  = 0;
+	gsNetStats.requests  = 0;
+	gsNetStats.retries   = 0;
+	gsNetStats.hedges    = 0;
+	gsNetStats.hedgeWins = 0;
+	gsNetStats.failures  = 0;
 }
 
 std::string Net_Login( const std::string& url, const std::string& postData, const std::string& cookie_file )
 {
+	AllocPhase allocPhase( ALLOC_PHASE_FETCH );
 	std::vector<char> data;
 
 	CURL* curl = gsNetInst.curl_easy_init();
@@ -106,9 +718,13 @@ std::string Net_Login( const std::string& url, const std::string& postData, cons
 		chunk = gsNetInst.curl_slist_append( chunk, "Accept:" );
 
 		gsNetInst.curl_easy_setopt( curl, CURLOPT_HTTPHEADER, chunk );
-		gsNetInst.curl_easy_setopt( curl, CURLOPT_URL, url.c_str() );
+		gsNetInst.curl_easy_setopt( curl, CURLOPT_URL, Net_ResolveUrl( url ).c_str() );
 		gsNetInst.curl_easy_setopt( curl, CURLOPT_POSTFIELDS, postData.c_str() );
 		gsNetInst.curl_easy_setopt( curl, CURLOPT_VERBOSE, 0 );
+		gsNetInst.curl_easy_setopt( curl, CURLOPT_NOSIGNAL, 1L );
+		NetPolicy policy = Net_GetPolicy();
+		gsNetInst.curl_easy_setopt( curl, CURLOPT_CONNECTTIMEOUT_MS, (long)policy.connectTimeoutMs );
+		gsNetInst.curl_easy_setopt( curl, CURLOPT_TIMEOUT_MS, (long)policy.deadlineMs );
 
 		if ( cookie_file.length() > 0 ) {
 			gsNetInst.curl_easy_setopt( curl, CURLOPT_COOKIEJAR, cookie_file.c_str() );
@@ -118,6 +734,10 @@ std::string Net_Login( const std::string& url, const std::string& postData, cons
 		gsNetInst.curl_easy_setopt( curl, CURLOPT_WRITEDATA, &data );
 
 		CURLcode res = gsNetInst.curl_easy_perform( curl );
+		if ( res != CURLE_OK ) {
+			// Not retried, a login is not safe to post twice.
+			data.clear();
+		}
 
 		gsNetInst.curl_slist_free_all( chunk );
 
@@ -128,3 +748,233 @@ std::string Net_Login( const std::string& url, const std::string& postData, cons
 
 	return utf8_text;
 }
+
+// Picks the full size out of "Content-Range: bytes 0-1023/4096".
+static size_t Net_CurlRangeHeaderCallback( char* buffer, size_t size, size_t nitems, void* userdata )
+{
+	NetTransfer* t = (NetTransfer*)userdata;
+	size_t len = size*nitems;
+	const char name[] = "content-range:";
+	if ( len > sizeof( name ) - 1 && _strnicmp( buffer, name, sizeof( name ) - 1 ) == 0 ) {
+		std::string value( buffer + sizeof( name ) - 1, len - ( sizeof( name ) - 1 ) );
+		size_t slash = value.find( '/' );
+		if ( slash != std::string::npos && slash + 1 < value.length() && isdigit( (unsigned char)value[slash + 1] ) ) {
+			t->totalLength = strtoll( value.c_str() + slash + 1, nullptr, 10 );
+		}
+	}
+	return len;
+}
+
+static void Net_StartTransfer( NetMulti* m, NetTransfer* t )
+{
+	t->curl = gsNetInst.curl_easy_init();
+	if ( t->curl == nullptr ) {
+		return;
+	}
+	t->headers = gsNetInst.curl_slist_append( nullptr, "Accept:" );
+
+	gsNetInst.curl_easy_setopt( t->curl, CURLOPT_HTTPHEADER, t->headers );
+	gsNetInst.curl_easy_setopt( t->curl, CURLOPT_URL, Net_ResolveUrl( t->url ).c_str() );
+	gsNetInst.curl_easy_setopt( t->curl, CURLOPT_VERBOSE, 0 );
+	gsNetInst.curl_easy_setopt( t->curl, CURLOPT_PRIVATE, t );
+	Net_SetCommonOptions( t->curl );
+	gsNetInst.curl_easy_setopt( t->curl, CURLOPT_TIMEOUT_MS, (long)Net_GetPolicy().deadlineMs );
+
+	if ( m->cookieFile.length() > 0 ) {
+		gsNetInst.curl_easy_setopt( t->curl, CURLOPT_COOKIEFILE, m->cookieFile.c_str() );
+	}
+
+	gsNetInst.curl_easy_setopt( t->curl, CURLOPT_WRITEFUNCTION, Net_CurlWriteCallback );
+	gsNetInst.curl_easy_setopt( t->curl, CURLOPT_WRITEDATA, &t->data );
+
+	if ( t->range.length() > 0 ) {
+		// Attachments are served from another host and may redirect.
+		gsNetInst.curl_easy_setopt( t->curl, CURLOPT_RANGE, t->range.c_str() );
+		gsNetInst.curl_easy_setopt( t->curl, CURLOPT_FOLLOWLOCATION, 1L );
+		gsNetInst.curl_easy_setopt( t->curl, CURLOPT_HEADERFUNCTION, Net_CurlRangeHeaderCallback );
+		gsNetInst.curl_easy_setopt( t->curl, CURLOPT_HEADERDATA, t );
+	}
+
+	gsNetInst.curl_multi_add_handle( m->multi, t->curl );
+	m->running.push_back( t );
+}
+
+static void Net_FinishTransfer( NetMulti* m, NetTransfer* t, bool ok, std::vector<NetResult>& outDone )
+{
+	NetResult r;
+	r.id          = t->id;
+	r.url         = t->url;
+	r.body        = std::string( t->data.begin(), t->data.end() );
+	r.ok          = ok;
+	r.status      = 0;
+	r.totalLength = t->totalLength;
+
+	if ( t->curl != nullptr ) {
+		long status = 0;
+		char* contentType = nullptr;
+		gsNetInst.curl_easy_getinfo( t->curl, CURLINFO_RESPONSE_CODE, &status );
+		gsNetInst.curl_easy_getinfo( t->curl, CURLINFO_CONTENT_TYPE, &contentType );
+		r.status = (int)status;
+		if ( contentType != nullptr ) {
+			r.contentType = contentType;
+		}
+	}
+	outDone.push_back( r );
+
+	if ( t->curl != nullptr ) {
+		gsNetInst.curl_multi_remove_handle( m->multi, t->curl );
+		gsNetInst.curl_easy_cleanup( t->curl );
+	}
+	gsNetInst.curl_slist_free_all( t->headers );
+	delete t;
+}
+
+// Puts a transfer that failed transiently back in line after a backoff.
+static void Net_RequeueTransfer( NetMulti* m, NetTransfer* t )
+{
+	gsNetInst.curl_multi_remove_handle( m->multi, t->curl );
+	gsNetInst.curl_easy_cleanup( t->curl );
+	gsNetInst.curl_slist_free_all( t->headers );
+	t->curl        = nullptr;
+	t->headers     = nullptr;
+	t->totalLength = -1;
+	t->data.clear();
+	t->notBeforeMs = Net_NowMs() + Net_BackoffMs( Net_GetPolicy(), t->tries );
+	t->tries++;
+	m->waiting.push_back( t );
+	gsNetStats.retries++;
+}
+
+NetMultiHandle Net_MultiCreate( const std::string& cookie_file, int maxParallel )
+{
+	NetMulti* m = new NetMulti;
+	m->multi       = gsNetInst.curl_multi_init();
+	m->cookieFile  = cookie_file;
+	m->maxParallel = maxParallel > 0 ? maxParallel : NET_DEFAULT_MAX_PARALLEL;
+
+	// Let transfers to the same host share connections instead of opening
+	// one connection per request.
+	gsNetInst.curl_multi_setopt( m->multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)m->maxParallel );
+
+	return m;
+}
+
+void Net_MultiDestroy( NetMultiHandle m )
+{
+	if ( m == nullptr ) return;
+
+	for ( size_t i = 0; i < m->running.size(); ++i ) {
+		NetTransfer* t = m->running[i];
+		gsNetInst.curl_multi_remove_handle( m->multi, t->curl );
+		gsNetInst.curl_easy_cleanup( t->curl );
+		gsNetInst.curl_slist_free_all( t->headers );
+		delete t;
+	}
+	for ( size_t i = 0; i < m->waiting.size(); ++i ) {
+		delete m->waiting[i];
+	}
+	gsNetInst.curl_multi_cleanup( m->multi );
+	delete m;
+}
+
+void Net_MultiAdd( NetMultiHandle m, int id, const std::string& url )
+{
+	NetTransfer* t = new NetTransfer;
+	t->id          = id;
+	t->url         = url;
+	t->totalLength = -1;
+	t->tries       = 0;
+	t->notBeforeMs = 0;
+	t->curl        = nullptr;
+	t->headers     = nullptr;
+	m->waiting.push_back( t );
+}
+
+void Net_MultiAddRange( NetMultiHandle m, int id, const std::string& url, int64_t offset, int64_t length )
+{
+	Net_MultiAdd( m, id, url );
+	m->waiting.back()->range = std::to_string( offset ) + "-" + std::to_string( offset + length - 1 );
+}
+
+int Net_MultiPoll( NetMultiHandle m, int timeoutMs, std::vector<NetResult>& outDone )
+{
+	AllocPhase allocPhase( ALLOC_PHASE_FETCH );
+	// Transfers backing off stay in line until their time comes.
+	double now = Net_NowMs();
+	double nextStartMs = 0;
+	for ( size_t i = 0; i < m->waiting.size() && (int)m->running.size() < m->maxParallel; ) {
+		NetTransfer* t = m->waiting[i];
+		if ( t->notBeforeMs > now ) {
+			nextStartMs = ( nextStartMs == 0 || t->notBeforeMs < nextStartMs ) ? t->notBeforeMs : nextStartMs;
+			++i;
+			continue;
+		}
+		m->waiting.erase( m->waiting.begin() + i );
+		Net_StartTransfer( m, t );
+		if ( t->curl == nullptr ) {
+			Net_FinishTransfer( m, t, false, outDone );
+		}
+	}
+
+	int runningCount = 0;
+	gsNetInst.curl_multi_perform( m->multi, &runningCount );
+	if ( runningCount > 0 && timeoutMs > 0 ) {
+		int numfds = 0;
+		gsNetInst.curl_multi_wait( m->multi, nullptr, 0, timeoutMs, &numfds );
+		gsNetInst.curl_multi_perform( m->multi, &runningCount );
+	}
+	else if ( m->running.size() == 0 && nextStartMs > 0 && timeoutMs > 0 ) {
+		Sleep( (DWORD)std::max( 1.0, std::min( nextStartMs - now, (double)timeoutMs ) ) );
+	}
+
+	int msgCount = 0;
+	CURLMsg* msg = nullptr;
+	while ( ( msg = gsNetInst.curl_multi_info_read( m->multi, &msgCount ) ) != nullptr ) {
+		if ( msg->msg != CURLMSG_DONE ) {
+			continue;
+		}
+		NetTransfer* t = nullptr;
+		gsNetInst.curl_easy_getinfo( msg->easy_handle, CURLINFO_PRIVATE, (char**)&t );
+		bool ok = ( msg->data.result == CURLE_OK );
+		long status = 0;
+		gsNetInst.curl_easy_getinfo( msg->easy_handle, CURLINFO_RESPONSE_CODE, &status );
+
+		for ( size_t i = 0; i < m->running.size(); ++i ) {
+			if ( m->running[i] == t ) {
+				m->running.erase( m->running.begin() + i );
+				break;
+			}
+		}
+		if ( Net_IsTransient( msg->data.result, status ) && t->tries < Net_GetPolicy().retries ) {
+			Net_RequeueTransfer( m, t );
+			continue;
+		}
+		Net_FinishTransfer( m, t, ok, outDone );
+	}
+
+	return (int)( m->waiting.size() + m->running.size() );
+}
+
+std::vector<std::string> Net_GetAll( const std::vector<std::string>& urls, const std::string& cookie_file, int maxParallel )
+{
+	AllocPhase allocPhase( ALLOC_PHASE_FETCH );
+	std::vector<std::string> bodies( urls.size() );
+	if ( gsNetForward != nullptr && cookie_file.length() == 0 && gsNetForward( urls, bodies ) ) {
+		return bodies;
+	}
+
+	NetMultiHandle m = Net_MultiCreate( cookie_file, maxParallel );
+	for ( size_t i = 0; i < urls.size(); ++i ) {
+		Net_MultiAdd( m, (int)i, urls[i] );
+	}
+
+	std::vector<NetResult> done;
+	while ( Net_MultiPoll( m, 100, done ) > 0 ) {
+	}
+	for ( size_t i = 0; i < done.size(); ++i ) {
+		bodies[done[i].id].swap( done[i].body );
+	}
+	Net_MultiDestroy( m );
+
+	return bodies;
+}
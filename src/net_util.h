@@ -1,13 +1,101 @@
 #ifndef NET_UTIL_H_170508100647
 #define NET_UTIL_H_170508100647
 
+#include <atomic>
+#include <cstdint>
 #include <string>
+#include <vector>
 
 bool Net_Init( void );
 void Net_Deinit( void );
 
+// The site, urls are kept without a scheme as SMTH_DOMAIN + path.
+extern const std::string SMTH_DOMAIN;
+
+// Every request has a deadline. Gets that fail transiently are retried
+// with jittered exponential backoff, and a get that has seen no byte by
+// the observed p95 time to first byte is hedged with a second request.
+struct NetPolicy {
+	int  connectTimeoutMs;
+	int  deadlineMs;
+	int  retries;
+	int  backoffMs;
+	bool hedge;
+	// Hedging delay until enough requests have been timed, and its floor.
+	int  hedgeDefaultMs;
+	int  hedgeMinMs;
+};
+
+// Sends requests for m.newsmth.net to another server instead, such as
+// "http://127.0.0.1:8080" for "csmth serve". Net_Init takes it from the
+// CSMTH_BASE_URL environment variable unless it was set before.
+void Net_SetBaseUrl( const std::string& baseUrl );
+
+// Net_Get and Net_GetAll without a cookie file hand their urls to forward
+// first, e.g. to a running csmth daemon; a false return or a null
+// forwarder fetches them here.
+typedef bool (*NetForwardFn)( const std::vector<std::string>& urls, std::vector<std::string>& outBodies );
+void Net_SetForwarder( NetForwardFn forward );
+
+// Urls without a scheme are fetched over HTTPS when https is set, checking
+// the server against the CA bundle in caFile.
+void Net_SetHttps( bool https, const std::string& caFile );
+
+// TLS sessions survive restarts through a file encrypted for the current
+// user; loading returns the number of sessions restored. The stats count
+// the handshakes since Net_Init and how many of them resumed a session.
+int  Net_LoadTlsSessions( const std::string& path );
+bool Net_SaveTlsSessions( const std::string& path );
+void Net_GetTlsStats( long& handshakes, long& resumed );
+
+void      Net_SetPolicy( const NetPolicy& policy );
+NetPolicy Net_GetPolicy( void );
+
+struct NetStats {
+	int requests;
+	int retries;
+	int hedges;
+	int hedgeWins;
+	int failures;
+	int hedgeDelayMs;
+};
+
+void Net_GetStats( NetStats& outStats );
+void Net_ResetStats( void );
+
+// Returns an empty string when the request failed or ran out of time.
 std::string Net_Get( const std::string& url, const std::string& cookie_file="" );
 
+// Like Net_Get, but gives up as soon as *cancel turns true.
+std::string Net_GetCancellable( const std::string& url, const std::string& cookie_file, const std::atomic<bool>& cancel );
+
 std::string Net_Login( const std::string& url, const std::string& data, const std::string& cookie_file );
 
+// Concurrent fetching over one curl multi handle.
+struct NetResult {
+	int         id;
+	std::string url;
+	std::string body;
+	bool        ok;
+	int         status;
+	std::string contentType;
+	// Full size of the resource from Content-Range, -1 when not ranged.
+	int64_t     totalLength;
+};
+
+typedef struct NetMulti* NetMultiHandle;
+
+NetMultiHandle Net_MultiCreate( const std::string& cookie_file="", int maxParallel=0 );
+void Net_MultiDestroy( NetMultiHandle h );
+void Net_MultiAdd( NetMultiHandle h, int id, const std::string& url );
+// Asks for length bytes starting at offset. A server without range
+// support answers 200 with the whole body instead of 206.
+void Net_MultiAddRange( NetMultiHandle h, int id, const std::string& url, int64_t offset, int64_t length );
+// Drives the transfers for at most timeoutMs, appends finished ones to
+// outDone and returns the number of transfers still pending.
+int  Net_MultiPoll( NetMultiHandle h, int timeoutMs, std::vector<NetResult>& outDone );
+
+// Fetches all urls concurrently, results are in the order of urls.
+std::vector<std::string> Net_GetAll( const std::vector<std::string>& urls, const std::string& cookie_file="", int maxParallel=0 );
+
 #endif // #ifndef NET_UTIL_H_170508100647
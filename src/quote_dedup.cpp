@@ -0,0 +1,164 @@
+#include "fnv_hash.h"
+#include "quote_dedup.h"
+
+// Lines per fingerprinted window, shorter runs use one window for all.
+static const size_t   QUOTE_WINDOW_LINES = 3;
+// Shorter repeats are left alone, a back-reference would not save a line.
+static const size_t   QUOTE_MIN_COLLAPSE = 2;
+static const uint64_t QUOTE_HASH_BASE    = 0x9E3779B97F4A7C15ULL;
+
+static bool Quote_IsQuoteLine( const std::string& line )
+{
+	return line.length() > 0 && line[0] == ':';
+}
+
+// FNV-1a of the quoted text without the ':' prefix and trailing blanks,
+// so re-wrapped or re-indented quotes of the same text still match.
+static uint64_t Quote_HashLine( const std::string& line )
+{
+	size_t begin = 1;
+	while ( begin < line.length() && line[begin] == ' ' ) {
+		++begin;
+	}
+	size_t end = line.length();
+	while ( end > begin && ( line[end - 1] == ' ' || line[end - 1] == '\r' ) ) {
+		--end;
+	}
+	return Fnv_Hash64( line.data() + begin, end - begin );
+}
+
+static uint64_t Quote_WindowKey( uint64_t rollingHash, size_t windowLines )
+{
+	return rollingHash * 31 + windowLines;
+}
+
+QuoteDedup::QuoteDedup()
+{
+	Clear();
+}
+
+void QuoteDedup::Clear()
+{
+	windows.clear();
+	lineHashes.clear();
+	postCount      = 0;
+	quoteLines     = 0;
+	collapsedLines = 0;
+}
+
+std::string QuoteDedup::Process( const std::string& content )
+{
+	int post = ++postCount;
+
+	std::vector<std::string> lines;
+	size_t start = 0;
+	while ( start <= content.length() ) {
+		size_t end = content.find( '\n', start );
+		if ( end == std::string::npos ) {
+			lines.push_back( content.substr( start ) );
+			break;
+		}
+		lines.push_back( content.substr( start, end - start ) );
+		start = end + 1;
+	}
+
+	std::string out;
+	out.reserve( content.length() );
+	std::vector<uint64_t> hashes;
+	std::vector<int>      origins;
+	size_t i = 0;
+	while ( i < lines.size() ) {
+		if ( !Quote_IsQuoteLine( lines[i] ) ) {
+			out += lines[i];
+			if ( i + 1 < lines.size() ) {
+				out += '\n';
+			}
+			++i;
+			continue;
+		}
+
+		size_t runBegin = i;
+		hashes.clear();
+		while ( i < lines.size() && Quote_IsQuoteLine( lines[i] ) ) {
+			hashes.push_back( Quote_HashLine( lines[i] ) );
+			++i;
+		}
+		size_t n = hashes.size();
+		size_t w = n < QUOTE_WINDOW_LINES ? n : QUOTE_WINDOW_LINES;
+		quoteLines += n;
+
+		uint64_t power = 1;
+		for ( size_t k = 1; k < w; ++k ) {
+			power *= QUOTE_HASH_BASE;
+		}
+
+		// Post each line was first quoted in, 0 if it is new.
+		origins.assign( n, 0 );
+		std::vector<uint64_t> keys( n - w + 1 );
+		uint64_t h = 0;
+		for ( size_t k = 0; k < n; ++k ) {
+			if ( k >= w ) {
+				h -= hashes[k - w] * power;
+			}
+			h = h * QUOTE_HASH_BASE + hashes[k];
+			if ( k + 1 < w ) {
+				continue;
+			}
+			size_t j = k + 1 - w;
+			keys[j] = Quote_WindowKey( h, w );
+			auto it = windows.find( keys[j] );
+			if ( it == windows.end() ) {
+				continue;
+			}
+			// Guard against fingerprint collisions.
+			const Origin& o = it->second;
+			bool same = true;
+			for ( size_t m = 0; m < w && same; ++m ) {
+				same = lineHashes[o.offset + m] == hashes[j + m];
+			}
+			if ( !same ) {
+				continue;
+			}
+			for ( size_t m = j; m < j + w; ++m ) {
+				if ( origins[m] == 0 ) {
+					origins[m] = o.post;
+				}
+			}
+		}
+
+		// Remember the run once if any of it is new.
+		size_t covered = 0;
+		for ( size_t k = 0; k < n; ++k ) {
+			covered += origins[k] != 0 ? 1 : 0;
+		}
+		if ( covered < n ) {
+			size_t offset = lineHashes.size();
+			lineHashes.insert( lineHashes.end(), hashes.begin(), hashes.end() );
+			for ( size_t j = 0; j < keys.size(); ++j ) {
+				Origin o = { offset + j, post };
+				windows.insert( std::make_pair( keys[j], o ) );
+			}
+		}
+
+		size_t k = 0;
+		while ( k < n ) {
+			size_t repeat = k;
+			while ( repeat < n && origins[repeat] != 0 ) {
+				++repeat;
+			}
+			if ( repeat - k >= QUOTE_MIN_COLLAPSE ) {
+				out += ": [" + std::to_string( repeat - k ) + " quoted lines, see #" + std::to_string( origins[k] ) + "]";
+				collapsedLines += repeat - k - 1;
+				k = repeat;
+			}
+			else {
+				out += lines[runBegin + k];
+				++k;
+			}
+			if ( runBegin + k < lines.size() ) {
+				out += '\n';
+			}
+		}
+	}
+	return out;
+}
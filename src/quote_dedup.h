@@ -0,0 +1,51 @@
+#ifndef QUOTE_DEDUP_H_191025094512
+#define QUOTE_DEDUP_H_191025094512
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Collapses quoted lines (those starting with ':') that were already
+// quoted by an earlier post of the same thread. Quote runs are cut into
+// windows of a few lines, each window is fingerprinted with a rolling
+// hash and remembered together with the post it first appeared in.
+// Repeated windows are replaced by a single back-reference line, so they
+// never reach layout.
+//
+// Posts must be fed in thread order. Not thread safe.
+class QuoteDedup
+{
+public:
+	QuoteDedup();
+
+	// Returns the post content with repeated quote lines collapsed. Posts
+	// are numbered from 1 in the order they are fed.
+	std::string Process( const std::string& content );
+
+	void Clear();
+
+	size_t QuoteLines() const
+	{
+		return quoteLines;
+	}
+	size_t CollapsedLines() const
+	{
+		return collapsedLines;
+	}
+
+private:
+	struct Origin {
+		size_t offset; // of the window's first line in lineHashes
+		int    post;
+	};
+
+	std::unordered_map<uint64_t, Origin> windows;
+	// Line hashes of every quote run with new lines in it, stored once.
+	std::vector<uint64_t>                lineHashes;
+	int                                  postCount;
+	size_t                               quoteLines;
+	size_t                               collapsedLines;
+};
+
+#endif // #ifndef QUOTE_DEDUP_H_191025094512
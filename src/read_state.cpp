@@ -0,0 +1,140 @@
+#include <cstdio>
+#include <unordered_map>
+#include <windows.h>
+
+#include "bin_stream.h"
+#include "mapped_file.h"
+#include "roaring_bitmap.h"
+#include "read_state.h"
+
+static const char     READ_STATE_MAGIC[4] = { 'C', 'R', 'S', 'T' };
+static const uint32_t READ_STATE_VERSION  = 1;
+
+static struct ReadStateModule {
+	MappedFile                                     file;
+	std::unordered_map<std::string, RoaringBitmap> boards;
+	bool                                           dirty;
+
+	ReadStateModule() : dirty( false ) {
+	}
+} gsReadState;
+
+bool ReadState_ParseArticleUrl( const std::string& url, std::string& outBoard, uint32_t& outId )
+{
+	static const std::string ARTICLE = "/article/";
+	size_t index = url.find( ARTICLE );
+	if ( index == std::string::npos ) {
+		return false;
+	}
+	size_t begin = index + ARTICLE.length();
+	size_t slash = url.find( '/', begin );
+	if ( slash == std::string::npos || slash == begin ) {
+		return false;
+	}
+	uint64_t id = 0;
+	size_t i = slash + 1;
+	while ( i < url.length() && url[i] >= '0' && url[i] <= '9' && id <= UINT32_MAX ) {
+		id = id * 10 + ( url[i] - '0' );
+		++i;
+	}
+	if ( i == slash + 1 || id > UINT32_MAX ) {
+		return false;
+	}
+	outBoard = url.substr( begin, slash - begin );
+	outId    = (uint32_t)id;
+	return true;
+}
+
+bool ReadState_Load( const std::string& path )
+{
+	gsReadState.boards.clear();
+	gsReadState.dirty = false;
+	if ( !gsReadState.file.Open( path ) ) {
+		return false;
+	}
+
+	BinReader r( gsReadState.file.Data(), gsReadState.file.Size() );
+	char magic[4];
+	r.Bytes( magic, sizeof( magic ) );
+	uint32_t version = r.U32();
+	if ( memcmp( magic, READ_STATE_MAGIC, sizeof( magic ) ) != 0 || version != READ_STATE_VERSION ) {
+		gsReadState.file.Close();
+		return false;
+	}
+	uint32_t count = r.U32();
+	bool ok = true;
+	for ( uint32_t i = 0; i < count && ok && r.Ok(); ++i ) {
+		std::string board = r.Str();
+		r.Align( 4 );
+		ok = gsReadState.boards[board].Read( r );
+	}
+	// A damaged file is dropped as a whole, not kept up to the damage.
+	if ( !ok || !r.Ok() ) {
+		gsReadState.boards.clear();
+		gsReadState.file.Close();
+		return false;
+	}
+	return true;
+}
+
+bool ReadState_Save( const std::string& path )
+{
+	if ( !gsReadState.dirty ) {
+		return true;
+	}
+
+	BinWriter w;
+	w.Bytes( READ_STATE_MAGIC, sizeof( READ_STATE_MAGIC ) );
+	w.U32( READ_STATE_VERSION );
+	w.U32( (uint32_t)gsReadState.boards.size() );
+	for ( auto it = gsReadState.boards.begin(); it != gsReadState.boards.end(); ++it ) {
+		w.Str( it->first );
+		w.Align( 4 );
+		it->second.Write( w );
+	}
+
+	// The mapping keeps the old file locked, nothing may point into it.
+	for ( auto it = gsReadState.boards.begin(); it != gsReadState.boards.end(); ++it ) {
+		it->second.Detach();
+	}
+	gsReadState.file.Close();
+
+	std::string tempPath = path + ".tmp";
+	FILE* fp = fopen( tempPath.c_str(), "wb" );
+	if ( fp == nullptr ) {
+		return false;
+	}
+	bool ok = fwrite( w.Buffer().data(), 1, w.Size(), fp ) == w.Size();
+	ok = ( fclose( fp ) == 0 ) && ok;
+	if ( !ok ) {
+		remove( tempPath.c_str() );
+		return false;
+	}
+	if ( MoveFileExA( tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING ) == 0 ) {
+		return false;
+	}
+	gsReadState.dirty = false;
+	return true;
+}
+
+void ReadState_MarkRead( const std::string& articleUrl )
+{
+	std::string board;
+	uint32_t id = 0;
+	if ( ReadState_ParseArticleUrl( articleUrl, board, id ) ) {
+		if ( gsReadState.boards[board].Add( id ) ) {
+			gsReadState.dirty = true;
+		}
+	}
+}
+
+bool ReadState_IsRead( const std::string& articleUrl )
+{
+	std::string board;
+	uint32_t id = 0;
+	if ( !ReadState_ParseArticleUrl( articleUrl, board, id ) ) {
+		return false;
+	}
+	auto it = gsReadState.boards.find( board );
+	return it != gsReadState.boards.end() && it->second.Contains( id );
+}
@@ -0,0 +1,20 @@
+#ifndef READ_STATE_H_191025150218
+#define READ_STATE_H_191025150218
+
+#include <cstdint>
+#include <string>
+
+// Which threads were opened, one compressed bitmap of article ids per
+// board. The state file is mapped and used in place, only boards that
+// get new ids are copied into memory.
+
+bool ReadState_Load( const std::string& path );
+bool ReadState_Save( const std::string& path );
+
+// Board and article id of an article url, e.g. "/article/Joke/123456".
+bool ReadState_ParseArticleUrl( const std::string& url, std::string& outBoard, uint32_t& outId );
+
+void ReadState_MarkRead( const std::string& articleUrl );
+bool ReadState_IsRead( const std::string& articleUrl );
+
+#endif // #ifndef READ_STATE_H_191025150218
@@ -0,0 +1,192 @@
+#include <algorithm>
+
+#include "bin_stream.h"
+#include "roaring_bitmap.h"
+
+RoaringBitmap::Container::Container( const Container& other )
+	: key( other.key ), isBitmap( other.isBitmap ), cardinality( other.cardinality ),
+	  array( other.array ), bits( other.bits ), values( other.values ), words( other.words )
+{
+	if ( other.array != nullptr && other.array == other.values.data() ) {
+		array = values.data();
+	}
+	if ( other.bits != nullptr && other.bits == other.words.data() ) {
+		bits = words.data();
+	}
+}
+
+RoaringBitmap::Container& RoaringBitmap::Container::operator=( const Container& other )
+{
+	if ( this != &other ) {
+		Container copy( other );
+		*this = std::move( copy );
+	}
+	return *this;
+}
+
+int RoaringBitmap::Find( uint16_t key ) const
+{
+	size_t lo = 0;
+	size_t hi = containers.size();
+	while ( lo < hi ) {
+		size_t mid = ( lo + hi ) / 2;
+		if ( containers[mid].key < key ) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	if ( lo < containers.size() && containers[lo].key == key ) {
+		return (int)lo;
+	}
+	return -1;
+}
+
+bool RoaringBitmap::Contains( uint32_t value ) const
+{
+	int index = Find( (uint16_t)( value >> 16 ) );
+	if ( index < 0 ) {
+		return false;
+	}
+	const Container& c = containers[index];
+	uint16_t low = (uint16_t)value;
+	if ( c.isBitmap ) {
+		return ( c.bits[low >> 6] >> ( low & 63 ) ) & 1;
+	}
+	return std::binary_search( c.array, c.array + c.cardinality, low );
+}
+
+void RoaringBitmap::Own( Container& c )
+{
+	if ( c.isBitmap ) {
+		if ( c.words.size() == 0 ) {
+			c.words.assign( c.bits, c.bits + BITMAP_WORDS );
+		}
+		c.bits = c.words.data();
+	}
+	else {
+		if ( c.values.size() != c.cardinality ) {
+			c.values.assign( c.array, c.array + c.cardinality );
+		}
+		c.array = c.values.data();
+	}
+}
+
+bool RoaringBitmap::Add( uint32_t value )
+{
+	uint16_t key = (uint16_t)( value >> 16 );
+	uint16_t low = (uint16_t)value;
+
+	int index = Find( key );
+	if ( index < 0 ) {
+		Container c;
+		c.key         = key;
+		c.isBitmap    = false;
+		c.cardinality = 0;
+		c.array       = nullptr;
+		c.bits        = nullptr;
+		index = 0;
+		while ( index < (int)containers.size() && containers[index].key < key ) {
+			++index;
+		}
+		containers.insert( containers.begin() + index, c );
+	}
+	Container& c = containers[index];
+	if ( Contains( value ) ) {
+		return false;
+	}
+	Own( c );
+
+	if ( c.isBitmap ) {
+		c.words[low >> 6] |= (uint64_t)1 << ( low & 63 );
+		c.cardinality++;
+		return true;
+	}
+	if ( c.cardinality < ARRAY_MAX ) {
+		c.values.insert( std::lower_bound( c.values.begin(), c.values.end(), low ), low );
+		c.cardinality++;
+		c.array = c.values.data();
+		return true;
+	}
+
+	// The array is full, a bitmap is smaller from here on.
+	c.words.assign( BITMAP_WORDS, 0 );
+	for ( size_t i = 0; i < c.values.size(); ++i ) {
+		c.words[c.values[i] >> 6] |= (uint64_t)1 << ( c.values[i] & 63 );
+	}
+	c.words[low >> 6] |= (uint64_t)1 << ( low & 63 );
+	std::vector<uint16_t>().swap( c.values );
+	c.isBitmap = true;
+	c.array    = nullptr;
+	c.bits     = c.words.data();
+	c.cardinality++;
+	return true;
+}
+
+size_t RoaringBitmap::Cardinality() const
+{
+	size_t n = 0;
+	for ( size_t i = 0; i < containers.size(); ++i ) {
+		n += containers[i].cardinality;
+	}
+	return n;
+}
+
+void RoaringBitmap::Detach()
+{
+	for ( size_t i = 0; i < containers.size(); ++i ) {
+		Own( containers[i] );
+	}
+}
+
+// count, then per container: key, type, cardinality and the payload
+// aligned to 8 bytes so it can be used in place.
+void RoaringBitmap::Write( BinWriter& w ) const
+{
+	w.U32( (uint32_t)containers.size() );
+	for ( size_t i = 0; i < containers.size(); ++i ) {
+		const Container& c = containers[i];
+		w.U32( c.key );
+		w.U32( c.isBitmap ? 1 : 0 );
+		w.U32( c.cardinality );
+		w.Align( 8 );
+		if ( c.isBitmap ) {
+			w.Bytes( c.bits, BITMAP_WORDS * sizeof( uint64_t ) );
+		}
+		else {
+			w.Bytes( c.array, c.cardinality * sizeof( uint16_t ) );
+		}
+	}
+}
+
+bool RoaringBitmap::Read( BinReader& r )
+{
+	containers.clear();
+	uint32_t count = r.U32();
+	for ( uint32_t i = 0; i < count && r.Ok(); ++i ) {
+		Container c;
+		c.key         = (uint16_t)r.U32();
+		c.isBitmap    = r.U32() != 0;
+		c.cardinality = r.U32();
+		c.array       = nullptr;
+		c.bits        = nullptr;
+		r.Align( 8 );
+		if ( c.isBitmap ) {
+			c.bits = (const uint64_t*)r.Current();
+			r.Skip( BITMAP_WORDS * sizeof( uint64_t ) );
+		}
+		else {
+			if ( c.cardinality > ARRAY_MAX ) {
+				return false;
+			}
+			c.array = (const uint16_t*)r.Current();
+			r.Skip( c.cardinality * sizeof( uint16_t ) );
+		}
+		if ( c.cardinality == 0 || ( i > 0 && containers.back().key >= c.key ) ) {
+			return false;
+		}
+		containers.push_back( c );
+	}
+	return r.Ok();
+}
@@ -0,0 +1,66 @@
+#ifndef ROARING_BITMAP_H_191025143005
+#define ROARING_BITMAP_H_191025143005
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class BinWriter;
+class BinReader;
+
+// Compressed set of 32-bit values in the style of Roaring bitmaps. Values
+// are split by their high 16 bits into containers; a container holds up
+// to 4096 values as a sorted array of the low 16 bits and switches to a
+// plain 8KB bitmap when it grows past that.
+//
+// A bitmap read with Read() keeps pointing into the reader's buffer, e.g.
+// a mapped file, until a container is changed and copied out. Call
+// Detach() before that buffer goes away.
+class RoaringBitmap
+{
+public:
+	bool   Contains( uint32_t value ) const;
+	// Returns true if the value was not in the set yet.
+	bool   Add( uint32_t value );
+	size_t Cardinality() const;
+	size_t ContainerCount() const
+	{
+		return containers.size();
+	}
+
+	void   Write( BinWriter& w ) const;
+	bool   Read( BinReader& r );
+	void   Detach();
+
+private:
+	enum {
+		ARRAY_MAX      = 4096,
+		BITMAP_WORDS   = 65536 / 64,
+	};
+
+	struct Container {
+		uint16_t              key;
+		bool                  isBitmap;
+		uint32_t              cardinality;
+		// Either points into values/words or into a borrowed buffer.
+		const uint16_t*       array;
+		const uint64_t*       bits;
+		std::vector<uint16_t> values;
+		std::vector<uint64_t> words;
+
+		Container() = default;
+		// A copy points into its own values/words, a move keeps the
+		// vectors' storage and so the pointers.
+		Container( const Container& other );
+		Container& operator=( const Container& other );
+		Container( Container&& other ) = default;
+		Container& operator=( Container&& other ) = default;
+	};
+
+	int  Find( uint16_t key ) const;
+	void Own( Container& c );
+
+	std::vector<Container> containers; // sorted by key
+};
+
+#endif // #ifndef ROARING_BITMAP_H_191025143005
@@ -0,0 +1,407 @@
+#include <winsock2.h>
+#include <windows.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#include "archive_file.h"
+#include "fnv_hash.h"
+#include "net_util.h"
+#include "serve.h"
+
+// Bytes written per send when chunking or capping bandwidth.
+static const size_t      SERVE_SLICE = 4096;
+
+struct ServeOptions {
+	int    port;
+	int    latencyMs;
+	int    bandwidth;   // bytes per second, 0 for no cap
+	double stallRate;
+	int    stallMs;
+	double resetRate;
+	bool   chunked;
+	bool   quiet;       // no request log, for Serve_Start
+};
+
+static struct {
+	ServeOptions     options;
+	std::string      fixtureDir;
+	ArchiveReader    archive;
+	bool             useArchive;
+	std::mutex       archiveMutex;
+	std::mutex       logMutex;
+} gsServe;
+
+struct ServeRequest {
+	std::string method;
+	std::string path;
+	std::string ifNoneMatch;
+	std::string body;
+	bool        keepAlive;
+};
+
+// "/article/Python/123?p=2" is article/Python/123@p=2.html in the
+// fixture directory; '?' cannot be part of a file name on Windows. Paths
+// that could leave the directory get an empty name.
+static std::string Serve_FixturePath( const std::string& path )
+{
+	if ( path.empty() || path[0] != '/' || path.find( ".." ) != std::string::npos
+			|| path.find_first_of( "\\:" ) != std::string::npos || path.find( "//" ) != std::string::npos ) {
+		return "";
+	}
+	std::string name = path.length() > 1 ? path.substr( 1 ) : "index";
+	for ( size_t i = 0; i < name.length(); ++i ) {
+		if ( name[i] == '?' ) {
+			name[i] = '@';
+		}
+	}
+	return gsServe.fixtureDir + "/" + name + ".html";
+}
+
+static bool Serve_LoadPage( const std::string& path, std::string& outHtml )
+{
+	if ( gsServe.useArchive ) {
+		std::lock_guard<std::mutex> lock( gsServe.archiveMutex );
+		return gsServe.archive.Find( SMTH_DOMAIN + ( path == "/" ? "" : path ), outHtml );
+	}
+	std::string file = Serve_FixturePath( path );
+	if ( file.empty() ) {
+		return false;
+	}
+	std::ifstream is( file.c_str(), std::ifstream::binary );
+	if ( !is ) {
+		return false;
+	}
+	std::stringstream ss;
+	ss << is.rdbuf();
+	outHtml = ss.str();
+	return true;
+}
+
+static std::string Serve_ETag( const std::string& body )
+{
+	uint64_t h = Fnv_Hash64( body.data(), body.length() );
+	char text[32];
+	snprintf( text, sizeof( text ), "\"%016llx\"", (unsigned long long)h );
+	return text;
+}
+
+static bool Serve_SendAll( SOCKET s, const char* data, size_t size )
+{
+	while ( size > 0 ) {
+		int n = send( s, data, (int)size, 0 );
+		if ( n <= 0 ) {
+			return false;
+		}
+		data += n;
+		size -= (size_t)n;
+	}
+	return true;
+}
+
+// Sends in slices, sleeping between them to hold the bandwidth cap.
+static bool Serve_SendBody( SOCKET s, const std::string& body, size_t limit )
+{
+	const ServeOptions& o = gsServe.options;
+	for ( size_t pos = 0; pos < limit; pos += SERVE_SLICE ) {
+		size_t n = std::min( SERVE_SLICE, limit - pos );
+		if ( o.chunked ) {
+			char size[16];
+			snprintf( size, sizeof( size ), "%x\r\n", (unsigned)n );
+			if ( !Serve_SendAll( s, size, strlen( size ) ) || !Serve_SendAll( s, body.data() + pos, n ) || !Serve_SendAll( s, "\r\n", 2 ) ) {
+				return false;
+			}
+		}
+		else if ( !Serve_SendAll( s, body.data() + pos, n ) ) {
+			return false;
+		}
+		if ( o.bandwidth > 0 ) {
+			Sleep( (DWORD)( n * 1000 / (size_t)o.bandwidth ) );
+		}
+	}
+	if ( o.chunked && limit == body.length() ) {
+		return Serve_SendAll( s, "0\r\n\r\n", 5 );
+	}
+	return true;
+}
+
+// Closing with a zero linger time sends a RST instead of a FIN.
+static void Serve_Reset( SOCKET s )
+{
+	LINGER lg;
+	lg.l_onoff  = 1;
+	lg.l_linger = 0;
+	setsockopt( s, SOL_SOCKET, SO_LINGER, (const char*)&lg, sizeof( lg ) );
+}
+
+static bool Serve_Respond( SOCKET s, const ServeRequest& req, std::minstd_rand& rng )
+{
+	const ServeOptions& o = gsServe.options;
+	std::uniform_real_distribution<double> chance( 0.0, 1.0 );
+
+	int status = 200;
+	std::string body, extra;
+	if ( req.method == "POST" && req.path == "/user/login" ) {
+		// Any id is accepted; the client looks for its id in the jar. The
+		// cookies are host-only so they stick to whatever host served them.
+		std::string id;
+		size_t at = req.body.find( "id=" );
+		if ( at != std::string::npos ) {
+			id = req.body.substr( at + 3, req.body.find( '&', at ) - at - 3 );
+		}
+		extra += "Set-Cookie: main[UTMPUSERID]=" + id + "; path=/\r\n";
+		extra += "Set-Cookie: main[UTMPKEY]=" + std::to_string( rng() ) + "; path=/\r\n";
+		body = "<html><body>ok</body></html>";
+	}
+	else if ( req.method != "GET" ) {
+		status = 405;
+	}
+	else if ( !Serve_LoadPage( req.path, body ) ) {
+		status = 404;
+		body = "<html><body>not found</body></html>";
+	}
+
+	std::string etag = Serve_ETag( body );
+	if ( status == 200 && req.ifNoneMatch == etag ) {
+		status = 304;
+		body.clear();
+	}
+
+	if ( o.latencyMs > 0 ) {
+		Sleep( (DWORD)o.latencyMs );
+	}
+	bool stall = ( o.stallRate > 0 && chance( rng ) < o.stallRate );
+	bool reset = ( o.resetRate > 0 && chance( rng ) < o.resetRate );
+	if ( !o.quiet ) {
+		std::lock_guard<std::mutex> lock( gsServe.logMutex );
+		printf( "%s %s %d %d%s%s\n", req.method.c_str(), req.path.c_str(), status, (int)body.length(),
+				stall ? " stall" : "", reset ? " reset" : "" );
+		fflush( stdout );
+	}
+	if ( stall ) {
+		Sleep( (DWORD)o.stallMs );
+	}
+
+	const char* reason = status == 200 ? "OK" : status == 304 ? "Not Modified" : status == 404 ? "Not Found" : "Method Not Allowed";
+	std::string head = "HTTP/1.1 " + std::to_string( status ) + " " + reason + "\r\n";
+	head += "Content-Type: text/html; charset=utf-8\r\n";
+	head += "ETag: " + etag + "\r\n";
+	head += extra;
+	if ( o.chunked && status != 304 ) {
+		head += "Transfer-Encoding: chunked\r\n";
+	}
+	else {
+		head += "Content-Length: " + std::to_string( body.length() ) + "\r\n";
+	}
+	head += req.keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+	if ( !Serve_SendAll( s, head.data(), head.length() ) ) {
+		return false;
+	}
+
+	if ( reset ) {
+		// Half the body, then the connection goes away.
+		Serve_SendBody( s, body, body.length() / 2 );
+		Serve_Reset( s );
+		return false;
+	}
+	return Serve_SendBody( s, body, body.length() ) && req.keepAlive;
+}
+
+static bool Serve_HeaderIs( const std::string& line, const char* name, std::string& outValue )
+{
+	size_t len = strlen( name );
+	if ( line.length() <= len || line[len] != ':' || _strnicmp( line.c_str(), name, len ) != 0 ) {
+		return false;
+	}
+	size_t start = line.find_first_not_of( ' ', len + 1 );
+	outValue = start == std::string::npos ? "" : line.substr( start );
+	return true;
+}
+
+// Reads one request off the connection, buffer keeps what follows it.
+static bool Serve_ReadRequest( SOCKET s, std::string& buffer, ServeRequest& outReq )
+{
+	char chunk[4096];
+	size_t end;
+	while ( ( end = buffer.find( "\r\n\r\n" ) ) == std::string::npos ) {
+		int n = recv( s, chunk, sizeof( chunk ), 0 );
+		if ( n <= 0 || buffer.length() > 64 * 1024 ) {
+			return false;
+		}
+		buffer.append( chunk, (size_t)n );
+	}
+
+	std::istringstream head( buffer.substr( 0, end ) );
+	std::string line, version;
+	std::getline( head, line );
+	std::istringstream first( line );
+	first >> outReq.method >> outReq.path >> version;
+	outReq.keepAlive = ( version == "HTTP/1.1" );
+	outReq.ifNoneMatch.clear();
+
+	size_t contentLength = 0;
+	while ( std::getline( head, line ) ) {
+		if ( line.length() > 0 && line.back() == '\r' ) {
+			line.pop_back();
+		}
+		std::string value;
+		if ( Serve_HeaderIs( line, "Content-Length", value ) ) {
+			contentLength = (size_t)atoi( value.c_str() );
+		}
+		else if ( Serve_HeaderIs( line, "If-None-Match", value ) ) {
+			outReq.ifNoneMatch = value;
+		}
+		else if ( Serve_HeaderIs( line, "Connection", value ) ) {
+			outReq.keepAlive = ( _strnicmp( value.c_str(), "close", 5 ) != 0 );
+		}
+	}
+	buffer.erase( 0, end + 4 );
+
+	while ( buffer.length() < contentLength ) {
+		int n = recv( s, chunk, sizeof( chunk ), 0 );
+		if ( n <= 0 ) {
+			return false;
+		}
+		buffer.append( chunk, (size_t)n );
+	}
+	outReq.body = buffer.substr( 0, contentLength );
+	buffer.erase( 0, contentLength );
+	return true;
+}
+
+static void Serve_Connection( SOCKET s, unsigned seed )
+{
+	std::minstd_rand rng( seed );
+	std::string buffer;
+	ServeRequest req;
+	while ( Serve_ReadRequest( s, buffer, req ) && Serve_Respond( s, req, rng ) ) {
+	}
+	closesocket( s );
+}
+
+static void Serve_SetDefaults( void )
+{
+	ServeOptions& o = gsServe.options;
+	o.port      = 8080;
+	o.latencyMs = 0;
+	o.bandwidth = 0;
+	o.stallRate = 0;
+	o.stallMs   = 2000;
+	o.resetRate = 0;
+	o.chunked   = false;
+	o.quiet     = false;
+}
+
+// Opens the fixtures or the archive and listens on the loopback port.
+static SOCKET Serve_Listen( const std::string& source )
+{
+	gsServe.useArchive = gsServe.archive.Open( source );
+	gsServe.fixtureDir = source;
+
+	WSADATA wsaData;
+	if ( WSAStartup( MAKEWORD( 2, 2 ), &wsaData ) != 0 ) {
+		return INVALID_SOCKET;
+	}
+	SOCKET listener = socket( AF_INET, SOCK_STREAM, IPPROTO_TCP );
+	int reuse = 1;
+	setsockopt( listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof( reuse ) );
+
+	sockaddr_in addr;
+	memset( &addr, 0, sizeof( addr ) );
+	addr.sin_family      = AF_INET;
+	addr.sin_port        = htons( (unsigned short)gsServe.options.port );
+	addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+	if ( listener == INVALID_SOCKET || bind( listener, (sockaddr*)&addr, sizeof( addr ) ) == SOCKET_ERROR
+			|| listen( listener, 64 ) == SOCKET_ERROR ) {
+		if ( listener != INVALID_SOCKET ) {
+			closesocket( listener );
+		}
+		WSACleanup();
+		return INVALID_SOCKET;
+	}
+	return listener;
+}
+
+// One thread per connection, the client opens only a handful.
+static void Serve_Accept( SOCKET listener )
+{
+	unsigned seed = 1;
+	while ( true ) {
+		SOCKET s = accept( listener, nullptr, nullptr );
+		if ( s == INVALID_SOCKET ) {
+			break;
+		}
+		int noDelay = 1;
+		setsockopt( s, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof( noDelay ) );
+		std::thread( Serve_Connection, s, seed++ ).detach();
+	}
+	closesocket( listener );
+	WSACleanup();
+}
+
+bool Serve_Start( const std::string& source, int port )
+{
+	Serve_SetDefaults();
+	gsServe.options.port  = port;
+	gsServe.options.quiet = true;
+	SOCKET listener = Serve_Listen( source );
+	if ( listener == INVALID_SOCKET ) {
+		return false;
+	}
+	std::thread( Serve_Accept, listener ).detach();
+	return true;
+}
+
+int Serve_Run( int argc, char* argv[] )
+{
+	Serve_SetDefaults();
+	ServeOptions& o = gsServe.options;
+
+	std::string source;
+	for ( int i = 0; i < argc; ++i ) {
+		bool hasValue = ( i + 1 < argc );
+		if ( strcmp( argv[i], "--port" ) == 0 && hasValue ) {
+			o.port = atoi( argv[++i] );
+		}
+		else if ( strcmp( argv[i], "--latency" ) == 0 && hasValue ) {
+			o.latencyMs = atoi( argv[++i] );
+		}
+		else if ( strcmp( argv[i], "--bandwidth" ) == 0 && hasValue ) {
+			o.bandwidth = atoi( argv[++i] );
+		}
+		else if ( strcmp( argv[i], "--stall" ) == 0 && i + 2 < argc ) {
+			o.stallRate = atof( argv[++i] );
+			o.stallMs   = atoi( argv[++i] );
+		}
+		else if ( strcmp( argv[i], "--reset" ) == 0 && hasValue ) {
+			o.resetRate = atof( argv[++i] );
+		}
+		else if ( strcmp( argv[i], "--chunked" ) == 0 ) {
+			o.chunked = true;
+		}
+		else {
+			source = argv[i];
+		}
+	}
+	if ( source.length() == 0 ) {
+		fwprintf( stderr, L"usage: csmth serve <fixture-dir|archive-file> [--port N] [--latency ms] [--bandwidth bytes/s]\n"
+				L"                   [--stall rate ms] [--reset rate] [--chunked]\n" );
+		return 1;
+	}
+	SOCKET listener = Serve_Listen( source );
+	if ( listener == INVALID_SOCKET ) {
+		fwprintf( stderr, L"cannot listen on port %d\n", o.port );
+		return 1;
+	}
+	printf( "serving %s %s on http://127.0.0.1:%d\n", gsServe.useArchive ? "archive" : "fixtures", source.c_str(), o.port );
+	fflush( stdout );
+
+	Serve_Accept( listener );
+	return 0;
+}
@@ -0,0 +1,20 @@
+#ifndef SERVE_H_191108194233
+#define SERVE_H_191108194233
+
+#include <string>
+
+// Runs "csmth serve <fixture-dir|archive-file> [options]", a local HTTP/1.1
+// stand-in for m.newsmth.net to point the client at with --base-url or
+// CSMTH_BASE_URL. Pages come from a directory of captured pages or from an
+// archive written by "csmth archive". Latency, bandwidth, stalls,
+// connection resets and chunked encoding can be injected per request;
+// responses carry an ETag and answer If-None-Match with 304, and
+// POST /user/login sets a session cookie for any id and password.
+// Paths with "..", '\\' or ':' in them are not found, whatever is on disk.
+int Serve_Run( int argc, char* argv[] );
+
+// The same server on a background thread with no injected faults and no
+// request log, for checks that point the client at it from one process.
+bool Serve_Start( const std::string& source, int port );
+
+#endif // #ifndef SERVE_H_191108194233
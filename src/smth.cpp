@@ -6,19 +6,45 @@
 #include <codecvt>
 #include <locale>
 #include <stack>
+#include <map>
+#include <set>
+#include <deque>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <atomic>
+#include <condition_variable>
 #include <io.h>
 #include <fstream>
 #include <fcntl.h>
 #include <conio.h>
 #include <windows.h>
-
+#include <wincrypt.h>
+
+#include "alloc_profile.h"
+#include "config.h"
+#include "fnv_hash.h"
+#include "filter.h"
+#include "quote_dedup.h"
+#include "read_state.h"
+#include "board_finder.h"
+#include "archive_file.h"
 #include "net_util.h"
+#include "task_pool.h"
+#include "snapshot.h"
 #include "smth.h"
 
 
+// Local page merging all hot topics, it is built from the other home pages
+// and never fetched.
+static const char* SMTH_HOT_ALL_URL = "m.newsmth.net/hot/all";
+
 static const char* SMTH_HOMEPAGES[] = {
 	"m.newsmth.net/section",
 	"m.newsmth.net",
+	SMTH_HOT_ALL_URL,
 	"m.newsmth.net/hot/1",
 	"m.newsmth.net/hot/2",
 	"m.newsmth.net/hot/3",
@@ -32,9 +58,55 @@ static const char* SMTH_HOMEPAGES[] = {
 
 static const int SMTH_HOMEPAGE_COUNT = sizeof(SMTH_HOMEPAGES)/sizeof(SMTH_HOMEPAGES[0]);
 
-struct PageRecord {
-	std::string url;
-	int posIndex;
+// Board pages probed by the go to date search are reused for this long.
+static const time_t SMTH_PROBE_CACHE_SECONDS = 5 * 60;
+
+// Probed pages kept at most, a search takes about log2 of the page count.
+static const size_t SMTH_PROBE_CACHE_KEEP = 64;
+
+// Home pages fetched at startup are reused for this long.
+static const time_t SMTH_HOMEPAGE_CACHE_SECONDS = 5 * 60;
+
+struct HomePageCache {
+	SectionPage page;
+	time_t      fetchTime;
+};
+
+struct ProbedPage {
+	std::string html;
+	BoardPage   page;
+	time_t      fetchTime;
+};
+
+struct BackgroundTask {
+	std::thread                        thread;
+	std::shared_ptr<std::atomic<bool>> done;
+};
+
+// Fetch of the link under the cursor started before the user asks for it.
+struct Speculation {
+	std::string             url;
+	std::atomic<bool>       cancel;
+	std::mutex              lock;
+	std::condition_variable cond;
+	bool                    done;
+	std::string             html;
+	ULONGLONG               doneTick;
+};
+
+// Number of finished but not yet used speculations kept around.
+static const size_t SMTH_SPECULATION_KEEP = 8;
+
+// A finished speculation older than this is thrown away unused.
+static const ULONGLONG SMTH_SPECULATION_MAX_AGE_MS = 60 * 1000;
+
+// One page of a thread loaded by the whole thread loader, parsed and laid
+// out off the ui thread.
+struct ThreadPageResult {
+	size_t                    pageIndex;
+	ArticlePage               page;
+	std::vector<PageViewItem> viewItems;
+	bool                      quotesCollapsed;
 };
 
 static struct SmthModule {
@@ -47,18 +119,75 @@ static struct SmthModule {
 	SectionPage section;
 
 	PageView    view;
+	bool        quotesExpanded;
+
+	std::map<std::string, HomePageCache> homeCache;
+	SectionPage hotAll;
+
+	// Board pages fetched while searching by date, keyed by url.
+	std::map<std::string, ProbedPage> probeCache;
+
+	// Pages fetched ahead of time, used once by the next visit.
+	std::map<std::string, std::string> htmlCache;
+	std::string shownUrl;
+	uint64_t    pageHash;
+	bool        reload;
+
+	// Work handed back to the ui thread by background threads.
+	std::mutex                         uiLock;
+	std::vector<std::function<void()>> uiTasks;
+	std::vector<BackgroundTask>        background;
+	bool                               redraw;
+
+	// Whole thread loading, the pages of the opened thread are stitched
+	// into one view as they arrive. Loaders stop once the generation they
+	// were started with is no longer current.
+	std::atomic<int>                   threadLoadGeneration;
+	size_t                             threadPageCount;
+	size_t                             threadNextPage;
+	std::vector<int>                   threadPageStarts;
+	std::vector<size_t>                threadArticleStarts;
+	std::map<size_t, ThreadPageResult> threadPages;
+	bool                               threadWaitingDown;
+
+	// Dwell based speculation on board and section pages.
+	std::string                               dwellUrl;
+	ULONGLONG                                 dwellSince;
+	std::shared_ptr<Speculation>              speculation;
+	std::deque<std::shared_ptr<Speculation>>  specFinished;
+	int                                       specStarted;
+	int                                       specHits;
+	int                                       specCancelled;
+	int                                       specWasted;
+
+	// Directory of all boards, crawled in the background and cached in
+	// boards.txt so the finder works right after start.
+	BoardFinder                        boardFinder;
+	time_t                             boardDirTime;
+	bool                               boardDirCrawling;
+	std::atomic<bool>                  boardDirCancel;
+
+	// Set while browsing an archive, pages come from it and nothing is
+	// fetched from the network.
+	ArchiveReader*                     archive;
 
 	std::string cookiePath;
 
+	TaskPool*   pool;
+
 	// Added class name and ctor/dtor to avoid compiling error (c2280 in windows)
-	SmthModule() {
+	SmthModule() : quotesExpanded( false ), pageHash( 0 ), reload( false ), redraw( false ), threadLoadGeneration( 0 ),
+		threadPageCount( 0 ), threadNextPage( 0 ), threadWaitingDown( false ), dwellSince( 0 ),
+		specStarted( 0 ), specHits( 0 ), specCancelled( 0 ), specWasted( 0 ),
+		boardDirTime( 0 ), boardDirCrawling( false ), boardDirCancel( false ), archive( nullptr ), pool( nullptr ) {
 	}
 	~SmthModule() {
 	}
 
 } gsSmth;
 
-static const std::string SMTH_DOMAIN = "m.newsmth.net";
+// How long the run loop waits for a key before it looks at background work.
+static const int SMTH_KEY_WAIT_MS = 50;
 
 
 static int Smth_GetHomePageIndex( const std::string& url )
@@ -183,6 +312,21 @@ static bool Smth_IsWhiteSpaces( char c )
 	return false;
 }
 
+std::string Smth_GetAuthorId( const std::string& author )
+{
+	// The id follows the floor label in article posts.
+	size_t bar = author.find( '|' );
+	size_t begin = bar != std::string::npos ? author.find_first_not_of( ' ', bar + 1 ) : 0;
+	if ( begin == std::string::npos ) {
+		return "";
+	}
+	size_t end = begin;
+	while ( end < author.length() && ( isalnum( (unsigned char)author[end] ) || author[end] == '_' ) ) {
+		++end;
+	}
+	return author.substr( begin, end - begin );
+}
+
 static std::string Smth_StripWhiteSpaces( const std::string& text )
 {
 	std::string result = text;
@@ -229,6 +373,9 @@ enum SMTH_KEY {
 	SK_ENTER,
 	SK_SPACE,
 	SK_H,
+	SK_G,
+	SK_Q,
+	SK_B,
 	SK_TAB,
 	SK_STAB,
 	SK_QUIT,
@@ -299,6 +446,21 @@ static int Smth_CheckPressedKey( void ) {
 						return SK_H;
 					}
 					break;
+				case 0x47:
+					if ( ( (!capsOn && shiftPressed) || (capsOn && !shiftPressed) ) ) {
+						return SK_G;
+					}
+					break;
+				case 0x42:
+					if ( ( (!capsOn && shiftPressed) || (capsOn && !shiftPressed) ) ) {
+						return SK_B;
+					}
+					break;
+				case 0x51:
+					if ( ( (!capsOn && shiftPressed) || (capsOn && !shiftPressed) ) ) {
+						return SK_Q;
+					}
+					break;
 				case VK_SPACE:
 					return SK_SPACE;
 				case VK_RETURN:
@@ -342,6 +504,16 @@ static int Smth_CheckPressedKey( void ) {
 
 };
 
+// Waits up to timeoutMs for console input, so the run loop gets to handle
+// results of background work while no key is pressed.
+static int Smth_WaitPressedKey( int timeoutMs )
+{
+	if ( WaitForSingleObject( GetStdHandle( STD_INPUT_HANDLE ), (DWORD)timeoutMs ) != WAIT_OBJECT_0 ) {
+		return SK_NONE;
+	}
+	return Smth_CheckPressedKey();
+}
+
 static void Smth_PrintLn( VIEWLINE_TYPE type, const std::wstring& text )
 {
 	HANDLE h = GetStdHandle( STD_OUTPUT_HANDLE );
@@ -373,6 +545,20 @@ static void Smth_PrintLn( VIEWLINE_TYPE type, const std::wstring& text )
 	SetConsoleTextAttribute( h, wOldColorAttrs );
 }
 
+std::string Smth_GetDataDir( void )
+{
+	static const std::string dataDir = []() {
+		const char* base = getenv( "APPDATA" );
+		if ( base == nullptr || base[0] == '\0' ) {
+			base = getenv( "TEMP" );
+		}
+		std::string dir = std::string( base != nullptr ? base : "." ) + "/csmth";
+		CreateDirectoryA( dir.c_str(), nullptr );
+		return dir;
+	}();
+	return dataDir;
+}
+
 std::wstring Smth_Utf8StringToWString( const std::string& text )
 {
 	std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
@@ -537,11 +723,56 @@ static std::string Smth_ProcessArticleContent( const std::string& text )
 	return s;
 }
 
-void Smth_CreateViewFromArticlePage( const ArticlePage& page, PageView& view )
+std::vector<std::string> Smth_GetAttachmentUrls( const std::string& htmlText )
 {
-	view.Clear();
+	std::vector<std::string> urls = Smth_ExtractImgUrl( htmlText );
+	for ( size_t i = 0; i < urls.size(); ++i ) {
+		// Links are protocol or site relative.
+		if ( urls[i].compare( 0, 2, "//" ) == 0 ) {
+			urls[i] = urls[i].substr( 2 );
+		}
+		else if ( urls[i].length() > 0 && urls[i][0] == '/' ) {
+			urls[i] = SMTH_DOMAIN + urls[i];
+		}
+	}
+	return urls;
+}
+
+static std::string Smth_GetArticleItemText( const ArticleItem& item )
+{
+	return ( item.highlight ? "[*] " : "" ) + item.author + "\n\n" + item.content;
+}
+
+void Smth_CreateViewFromArticlePage( const ArticlePage& page, PageView& view, TaskPool* pool, QuoteDedup* dedup )
+{
+	AllocPhase allocPhase( ALLOC_PHASE_LAYOUT );
+	// Dedup has to see the posts in order, layout does not.
+	std::vector<std::string> texts( page.items.size() );
 	for ( size_t i = 0; i < page.items.size(); ++i ) {
-		view.ParseArticle( page.items[i].author + "\n\n" + page.items[i].content );
+		ArticleItem item = page.items[i];
+		if ( dedup != nullptr ) {
+			item.content = dedup->Process( item.content );
+		}
+		texts[i] = Smth_GetArticleItemText( item );
+	}
+
+	view.Clear();
+	if ( pool != nullptr && texts.size() > 1 ) {
+		// Lay out the items in parallel, then append them in order.
+		std::vector<std::vector<PageViewItem>> itemViews = pool->Map<std::vector<PageViewItem>>( texts.size(), [&]( size_t i ) {
+			AllocPhase allocPhase( ALLOC_PHASE_LAYOUT );
+			std::vector<PageViewItem> out;
+			view.Layout( texts[i], out );
+			return out;
+		} );
+		for ( size_t i = 0; i < itemViews.size(); ++i ) {
+			view.AppendItems( itemViews[i] );
+		}
+	}
+	else {
+		for ( size_t i = 0; i < texts.size(); ++i ) {
+			view.ParseArticle( texts[i] );
+		}
 	}
 	view.SetItemIndex( 0 );
 }
@@ -549,6 +780,7 @@ void Smth_CreateViewFromArticlePage( const ArticlePage& page, PageView& view )
 
 void Smth_OutputSectionPage( const SectionPage& page, LinkPositionState* state )
 {
+	AllocPhase allocPhase( ALLOC_PHASE_RENDER );
 	std::wstring s = Smth_Utf8StringToWString(page.name);
 	wprintf( L"  === %s ===\n", s.c_str() );
 
@@ -576,6 +808,10 @@ void Smth_OutputSectionPage( const SectionPage& page, LinkPositionState* state )
 
 void Smth_OutputBoardPage( const BoardPage& page, LinkPositionState* state )
 {
+	AllocPhase allocPhase( ALLOC_PHASE_RENDER );
+	// Author shown for deleted posts.
+	static const SymbolId deletedAuthor = Intern_Get( "\xE5\x8E\x9F\xE5\xB8\x96\xE5\xB7\xB2\xE5\x88\xA0\xE9\x99\xA4" );
+
 	std::wstring s = Smth_Utf8StringToWString(page.name_cn);
 	std::wstring t = Smth_Utf8StringToWString(page.name_en);
 	wprintf( L"  === %s(%s) ===\n", s.c_str(), t.c_str() );
@@ -586,16 +822,21 @@ void Smth_OutputBoardPage( const BoardPage& page, LinkPositionState* state )
 		s = Smth_Utf8StringToWString(page.items[index].title);
 		int x, y;
 		Smth_GetCursorXY( x, y );
-		std::wstring time = Smth_Utf8StringToWString(page.items[index].replier_time);
-		t = Smth_Utf8StringToWString(page.items[index].author);
-		if ( t.length() == 5 ) {
-			if ( (int)t[0] == 0x539F && (int)t[1] == 0X5E16 
-					&& (int)t[2] == 0x5DF2 && (int)t[3] == 0x5220 && (int)t[4] == 0x9664 ) {
-				t = L"[DELETED]";
-			}
+		std::wstring time = Smth_Utf8StringToWString(Intern_String(page.items[index].replier_time));
+		t = Smth_Utf8StringToWString(Intern_String(page.items[index].author));
+		if ( page.items[index].author == deletedAuthor ) {
+			t = L"[DELETED]";
 		}
 		std::wstring top = page.items[index].is_top ? L"*" : L"";
-		wprintf( L"  %1s %-12s %-10s %s\n", top.c_str(), t.c_str(), time.c_str(), s.c_str() );
+		std::wstring unread = ReadState_IsRead( page.items[index].url ) ? L"" : L"+";
+		HANDLE h = GetStdHandle( STD_OUTPUT_HANDLE );
+		CONSOLE_SCREEN_BUFFER_INFO csbiInfo;
+		GetConsoleScreenBufferInfo( h, &csbiInfo );
+		if ( page.items[index].highlight ) {
+			SetConsoleTextAttribute( h, FOREGROUND_INTENSITY | FOREGROUND_GREEN );
+		}
+		wprintf( L" %1s%1s %-12s %-10s %s\n", unread.c_str(), top.c_str(), t.c_str(), time.c_str(), s.c_str() );
+		SetConsoleTextAttribute( h, csbiInfo.wAttributes );
 
 		if ( state != nullptr && x >= 0 && y >= 0 ) {
 			state->Append( x, y, SMTH_DOMAIN + page.items[index].url );
@@ -606,6 +847,7 @@ void Smth_OutputBoardPage( const BoardPage& page, LinkPositionState* state )
 
 void Smth_OutputArticlePage( const ArticlePage& page, LinkPositionState* state )
 {
+	AllocPhase allocPhase( ALLOC_PHASE_RENDER );
 	std::wstring s = Smth_Utf8StringToWString(page.name);
 	wprintf( L"  === %s ===\n", s.c_str() );
 	int x, y;
@@ -634,6 +876,7 @@ void Smth_OutputArticlePage( const ArticlePage& page, LinkPositionState* state )
 
 void Smth_GetSectionPage( const std::string& htmlText, SectionPage& page )
 {
+	AllocPhase allocPhase( ALLOC_PHASE_PARSE );
 	page = SectionPage();
 
 	// Get the board name
@@ -692,6 +935,7 @@ void Smth_GetSectionPage( const std::string& htmlText, SectionPage& page )
 
 void Smth_GetBoardPage( const std::string& htmlText, BoardPage& page )
 {
+	AllocPhase allocPhase( ALLOC_PHASE_PARSE );
 	page = BoardPage();
 
 	// Get the board name
@@ -729,7 +973,12 @@ void Smth_GetBoardPage( const std::string& htmlText, BoardPage& page )
 				std::smatch um;
 				std::string mstr = m.str();
 				BoardItem item;
-				item.is_top = false;
+				item.is_top       = false;
+				item.highlight    = false;
+				item.author       = SYMBOL_EMPTY;
+				item.author_time  = SYMBOL_EMPTY;
+				item.last_replier = SYMBOL_EMPTY;
+				item.replier_time = SYMBOL_EMPTY;
 				std::regex rr( "<div><a href=\"(.*?)\".*?>(.+?)</a>", std::regex::ECMAScript );
 				if (std::regex_search( mstr, um, rr ) ) {
 					item.url   = um.str(1);
@@ -747,13 +996,17 @@ void Smth_GetBoardPage( const std::string& htmlText, BoardPage& page )
 				for ( size_t k = 0; k < sizeof( PATERN ) / sizeof( PATERN[0] ); ++k ) {
 					rr.assign( PATERN[k], std::regex::ECMAScript );
 					if (std::regex_search( mstr, um, rr ) ) {
-						item.author_time  = um.str(1);
-						item.author       = um.str(3);
-						item.replier_time = um.str(4);
-						item.last_replier = um.str(6);
+						item.author_time  = Intern_Get( um.str(1) );
+						item.author       = Intern_Get( um.str(3) );
+						item.replier_time = Intern_Get( um.str(4) );
+						item.last_replier = Intern_Get( um.str(6) );
 					}
 				}
-				page.items.push_back( item );
+				uint32_t flags = Filter_MatchItem( Smth_GetAuthorId( Intern_String( item.author ) ), item.title );
+				item.highlight = ( flags & FILTER_HIGHLIGHT ) != 0;
+				if ( ( flags & FILTER_KILL ) == 0 ) {
+					page.items.push_back( item );
+				}
 				titleText = m.suffix();
 			}
 		}
@@ -762,6 +1015,7 @@ void Smth_GetBoardPage( const std::string& htmlText, BoardPage& page )
 
 void Smth_GetArticlePage( const std::string& htmlText, ArticlePage& page )
 {
+	AllocPhase allocPhase( ALLOC_PHASE_PARSE );
 	page = ArticlePage();
 
 	// Get the board name
@@ -796,6 +1050,7 @@ void Smth_GetArticlePage( const std::string& htmlText, ArticlePage& page )
 				}
 				else {
 					ArticleItem item;
+					item.highlight = false;
 					std::string tt = m.str();
 					std::regex rr( "<div><a class=\"plant\">(.+?)</div>", std::regex::ECMAScript );
 					if (std::regex_search( tt, um, rr ) ) {
@@ -805,7 +1060,11 @@ void Smth_GetArticlePage( const std::string& htmlText, ArticlePage& page )
 					if (std::regex_search( tt, um, rr ) ) {
 						item.content = Smth_ProcessArticleContent( um.str(1) );
 					}
-					page.items.push_back( item );
+					uint32_t flags = Filter_MatchItem( Smth_GetAuthorId( item.author ), item.content );
+					item.highlight = ( flags & FILTER_HIGHLIGHT ) != 0;
+					if ( ( flags & FILTER_KILL ) == 0 ) {
+						page.items.push_back( item );
+					}
 				}
 				titleText = m.suffix();
 			}
@@ -813,6 +1072,34 @@ void Smth_GetArticlePage( const std::string& htmlText, ArticlePage& page )
 	}
 }
 
+void Smth_GetBoardPages( const std::vector<std::string>& htmlTexts, std::vector<BoardPage>& outPages, TaskPool* pool )
+{
+	outPages.resize( htmlTexts.size() );
+	if ( pool == nullptr ) {
+		for ( size_t i = 0; i < htmlTexts.size(); ++i ) {
+			Smth_GetBoardPage( Smth_ClearHtmlComments( htmlTexts[i] ), outPages[i] );
+		}
+		return;
+	}
+	pool->ParallelFor( htmlTexts.size(), [&]( size_t i ) {
+		Smth_GetBoardPage( Smth_ClearHtmlComments( htmlTexts[i] ), outPages[i] );
+	} );
+}
+
+void Smth_GetArticlePages( const std::vector<std::string>& htmlTexts, std::vector<ArticlePage>& outPages, TaskPool* pool )
+{
+	outPages.resize( htmlTexts.size() );
+	if ( pool == nullptr ) {
+		for ( size_t i = 0; i < htmlTexts.size(); ++i ) {
+			Smth_GetArticlePage( Smth_ClearHtmlComments( htmlTexts[i] ), outPages[i] );
+		}
+		return;
+	}
+	pool->ParallelFor( htmlTexts.size(), [&]( size_t i ) {
+		Smth_GetArticlePage( Smth_ClearHtmlComments( htmlTexts[i] ), outPages[i] );
+	} );
+}
+
 static ArticleInfo Smth_GetArticleInfo(const std::string& htmlText)
 {
 	ArticleInfo info;
@@ -863,7 +1150,7 @@ static ArticleInfo Smth_GetArticleInfo(const std::string& htmlText)
 	return info;
 }
 
-static std::string Smth_GetUrlCategory( const std::string& fullUrl )
+std::string Smth_GetUrlCategory( const std::string& fullUrl )
 {
 	size_t index = fullUrl.find( SMTH_DOMAIN );
 	if ( index != std::string::npos ) {
@@ -901,175 +1188,1403 @@ static std::string Smth_GetPrevPageUrl( const std::string& fullUrl )
 	return fullUrl;
 }
 
-static void Smth_GotoUrl( const std::string& fullUrl, LinkPositionState* state=nullptr )
+static void Smth_BuildHotAllPage( void )
 {
-	system( "cls" );
-	std::string cat = Smth_GetUrlCategory( fullUrl );
-	std::string result;
-
-	PageRecord pageRec;
-	pageRec.posIndex = -1;
-	pageRec.url  = fullUrl;
+	SectionPage& all = gsSmth.hotAll;
+	all = SectionPage();
+	all.name = "All Hot Topics";
 
-	if ( state != nullptr ) {
-		pageRec.posIndex  = state->PosIndex();
-		state->Clear();
+	std::set<std::string> seen;
+	for ( int i = 0; i < SMTH_HOMEPAGE_COUNT; ++i ) {
+		auto it = gsSmth.homeCache.find( SMTH_HOMEPAGES[i] );
+		if ( it == gsSmth.homeCache.end() ) {
+			continue;
+		}
+		const SectionPage& page = it->second.page;
+		for ( size_t k = 0; k < page.items.size(); ++k ) {
+			const SectionItem& item = page.items[k];
+			if ( item.type != "article" ) {
+				continue;
+			}
+			if ( seen.insert( item.url ).second ) {
+				all.items.push_back( item );
+			}
+		}
 	}
+}
 
-	if ( cat == "board" ) { 
-		result = Net_Get( fullUrl, gsSmth.cookiePath );
-		result = Smth_ClearHtmlComments( result );
-		Smth_GetBoardPage( result, gsSmth.board );
-		Smth_OutputBoardPage( gsSmth.board, state );
-	}
-	else if ( cat == "article" ) { 
-		result = Net_Get( fullUrl, gsSmth.cookiePath );
-		result = Smth_ClearHtmlComments( result );
-		Smth_GetArticlePage( result, gsSmth.article );
-		Smth_CreateViewFromArticlePage( gsSmth.article, gsSmth.view );
+static void Smth_PostToUi( const std::function<void()>& task )
+{
+	std::lock_guard<std::mutex> guard( gsSmth.uiLock );
+	gsSmth.uiTasks.push_back( task );
+}
+
+static void Smth_RunUiTasks( void )
+{
+	std::vector<std::function<void()>> tasks;
+	{
+		std::lock_guard<std::mutex> guard( gsSmth.uiLock );
+		tasks.swap( gsSmth.uiTasks );
 	}
-	else {
-		result = Net_Get( fullUrl, gsSmth.cookiePath );
-		result = Smth_ClearHtmlComments( result );
-		Smth_GetSectionPage( result, gsSmth.section );
-		Smth_OutputSectionPage( gsSmth.section, state );
+	for ( size_t i = 0; i < tasks.size(); ++i ) {
+		tasks[i]();
 	}
+}
 
-	if ( gsSmth.urlStack.size() > 0 && gsSmth.urlStack.top().url != fullUrl ) {
-		if ( Smth_IsHomePageUrl( fullUrl ) ) {
-			gsSmth.urlStack.pop();
+// Background threads are joined at exit, they must not touch gsSmth other
+// than through Smth_PostToUi and its atomic members.
+static void Smth_RunInBackground( const std::function<void()>& fn )
+{
+	// Reap the tasks that have finished.
+	for ( size_t i = 0; i < gsSmth.background.size(); ) {
+		if ( *gsSmth.background[i].done ) {
+			gsSmth.background[i].thread.join();
+			gsSmth.background.erase( gsSmth.background.begin() + i );
 		}
-		if ( !Smth_IsSubPageUrl( fullUrl ) ) {
-			gsSmth.urlStack.push( pageRec );
+		else {
+			++i;
 		}
 	}
-	else if ( gsSmth.urlStack.size() == 0 ) {
-		gsSmth.urlStack.push( pageRec );
-	}
+
+	BackgroundTask task;
+	task.done = std::make_shared<std::atomic<bool>>( false );
+	std::shared_ptr<std::atomic<bool>> done = task.done;
+	task.thread = std::thread( [fn, done]() {
+		fn();
+		*done = true;
+	} );
+	gsSmth.background.push_back( std::move( task ) );
 }
 
-static bool Smth_CheckCookie( const std::string& cookiePath, const std::string& userName )
+static uint64_t Smth_HashText( const std::string& text )
 {
-	std::string content;
-	std::ifstream is( cookiePath.c_str(), std::ifstream::binary );
-	if ( is ) {
-		is.seekg( 0, is.end );
-		int length = (int)is.tellg();
-		is.seekg( 0, is.beg );
+	return Fnv_Hash64( text.data(), text.length() );
+}
 
-		if ( length > 0 ) {
-			char* buffer = new char[length];
-			is.read( buffer, length );
-			content = buffer;
-			delete[] buffer;
+// Fetches all home pages concurrently and parses them on the task pool
+// while the slower transfers are still running. Safe to run off the ui
+// thread, it waits for its own parse tasks only.
+static void Smth_FetchHomePages( const std::string& cookiePath, TaskPool* pool, std::map<std::string, HomePageCache>& outPages )
+{
+	std::vector<std::string> urls;
+	for ( int i = 0; i < SMTH_HOMEPAGE_COUNT; ++i ) {
+		if ( strcmp( SMTH_HOMEPAGES[i], SMTH_HOT_ALL_URL ) != 0 ) {
+			urls.push_back( SMTH_HOMEPAGES[i] );
 		}
-		is.close();
 	}
-	if ( content.find( userName ) != std::string::npos ) {
-		return true;
+	std::vector<SectionPage> pages( urls.size() );
+
+	NetMultiHandle m = Net_MultiCreate( cookiePath, (int)urls.size() );
+	for ( size_t i = 0; i < urls.size(); ++i ) {
+		Net_MultiAdd( m, (int)i, urls[i] );
+	}
+	TaskGroup parses( *pool );
+	std::vector<NetResult> done;
+	int pending = 0;
+	do {
+		done.clear();
+		pending = Net_MultiPoll( m, 50, done );
+		for ( size_t i = 0; i < done.size(); ++i ) {
+			if ( !done[i].ok ) {
+				continue;
+			}
+			int id = done[i].id;
+			std::shared_ptr<std::string> body = std::make_shared<std::string>();
+			body->swap( done[i].body );
+			parses.Submit( [&pages, id, body]() {
+				Smth_GetSectionPage( Smth_ClearHtmlComments( *body ), pages[id] );
+			} );
+		}
+	} while ( pending > 0 );
+	Net_MultiDestroy( m );
+	parses.Wait();
+
+	time_t now = time( nullptr );
+	for ( size_t i = 0; i < urls.size(); ++i ) {
+		if ( pages[i].items.size() == 0 ) {
+			continue;
+		}
+		HomePageCache& c = outPages[urls[i]];
+		c.page.items.swap( pages[i].items );
+		c.page.name = pages[i].name;
+		c.fetchTime = now;
 	}
-	return false;
 }
 
-bool Smth_Init( void )
+static void Smth_StoreHomePages( std::map<std::string, HomePageCache>& pages )
 {
-	if ( Net_Init() ) {
-		_setmode(_fileno(stdout), _O_U16TEXT);
-
-		gsSmth.gotoUrl = SMTH_HOMEPAGES[0];
-		gsSmth.gotoPosIndex = -1;
-		gsSmth.cookiePath = "";
-		return true;
+	for ( auto it = pages.begin(); it != pages.end(); ++it ) {
+		gsSmth.homeCache[it->first] = it->second;
 	}
-	return false;
+	Smth_BuildHotAllPage();
 }
 
-void Smth_Deinit( void )
+static void Smth_PrefetchHomePages( bool inBackground )
 {
-	// Remove cookie file.
-	if ( gsSmth.cookiePath.length() > 0 ) {
-		remove( gsSmth.cookiePath.c_str() );
+	if ( !inBackground ) {
+		std::map<std::string, HomePageCache> pages;
+		Smth_FetchHomePages( gsSmth.cookiePath, gsSmth.pool, pages );
+		Smth_StoreHomePages( pages );
+		return;
+	}
+
+	std::string cookiePath = gsSmth.cookiePath;
+	TaskPool* pool = gsSmth.pool;
+	Smth_RunInBackground( [cookiePath, pool]() {
+		std::shared_ptr<std::map<std::string, HomePageCache>> pages = std::make_shared<std::map<std::string, HomePageCache>>();
+		Smth_FetchHomePages( cookiePath, pool, *pages );
+		Smth_PostToUi( [pages]() {
+			Smth_StoreHomePages( *pages );
+		} );
+	} );
+}
+
+static bool Smth_GetCachedHomePage( const std::string& url, SectionPage& outPage )
+{
+	auto it = gsSmth.homeCache.find( url );
+	if ( it == gsSmth.homeCache.end() ) {
+		return false;
 	}
-	Net_Deinit();
+	if ( time( nullptr ) - it->second.fetchTime > SMTH_HOMEPAGE_CACHE_SECONDS ) {
+		gsSmth.homeCache.erase( it );
+		return false;
+	}
+	outPage = it->second.page;
+	return true;
 }
 
-bool Smth_Login( void )
+// hot/all is merged from the other home pages; it is as old as the oldest
+// of them and has to be rebuilt once one is missing or stale.
+static bool Smth_IsHotAllFresh( void )
 {
-	std::string name, pwd;
-	char input[256];
-	while ( name.length() == 0 ) {
-		wprintf( L"login as: " );
-		if ( fgets( input, 256, stdin ) != nullptr ) {
-			name = Smth_StripWhiteSpaces( input );
+	time_t now = time( nullptr );
+	for ( int i = 0; i < SMTH_HOMEPAGE_COUNT; ++i ) {
+		if ( strcmp( SMTH_HOMEPAGES[i], SMTH_HOT_ALL_URL ) == 0 ) {
+			continue;
 		}
-		if ( name.length() == 0 ) {
-			wprintf( L"\n" );
+		auto it = gsSmth.homeCache.find( SMTH_HOMEPAGES[i] );
+		if ( it == gsSmth.homeCache.end() || now - it->second.fetchTime > SMTH_HOMEPAGE_CACHE_SECONDS ) {
+			return false;
 		}
 	}
+	return true;
+}
 
-	if ( name == "guest" ) return false;
+static bool Smth_IsWholeThread( void )
+{
+	return gsSmth.threadPageCount > 0;
+}
 
-	while ( pwd.length() == 0 ) {
-		wprintf( L"password: " );
-		if ( fgets( input, 256, stdin ) != nullptr ) {
-			pwd = Smth_StripWhiteSpaces( input );
-		}
-		if ( pwd.length() == 0 ) {
-			wprintf( L"\n" );
-		}
-	}
+static bool Smth_IsWholeThreadLoading( void )
+{
+	return gsSmth.threadPageCount > 0 && gsSmth.threadNextPage <= gsSmth.threadPageCount;
+}
 
-	std::string data = "id=" + name + "&passwd=" + pwd;
-	std::string tempDir = getenv("TEMP");
-	if ( tempDir.length() == 0 ) {
-		tempDir = getenv( "TMP" );
+static void Smth_StopWholeThread( void )
+{
+	gsSmth.threadLoadGeneration++;
+	gsSmth.threadPageCount = 0;
+	gsSmth.threadNextPage = 0;
+	gsSmth.threadPageStarts.clear();
+	gsSmth.threadArticleStarts.clear();
+	gsSmth.threadPages.clear();
+	gsSmth.threadWaitingDown = false;
+}
+
+// Lays out the shown thread again after quotes were expanded or
+// collapsed, keeping the stitched page boundaries.
+static void Smth_RebuildArticleView( void )
+{
+	QuoteDedup dedup;
+	QuoteDedup* d = gsSmth.quotesExpanded ? nullptr : &dedup;
+	int itemIndex = gsSmth.view.ItemIndex();
+
+	std::vector<size_t> articleStarts = gsSmth.threadArticleStarts;
+	if ( articleStarts.size() == 0 ) {
+		articleStarts.push_back( 0 );
+	}
+	std::vector<int> pageStarts;
+	gsSmth.view.Clear();
+	for ( size_t k = 0; k < articleStarts.size(); ++k ) {
+		size_t end = k + 1 < articleStarts.size() ? articleStarts[k + 1] : gsSmth.article.items.size();
+		ArticlePage part;
+		part.items.assign( gsSmth.article.items.begin() + articleStarts[k], gsSmth.article.items.begin() + end );
+		PageView partView;
+		Smth_CreateViewFromArticlePage( part, partView, gsSmth.pool, d );
+		std::vector<PageViewItem> partItems;
+		for ( int i = 0; i < partView.ItemCount(); ++i ) {
+			partItems.push_back( partView.Item( i ) );
+		}
+		pageStarts.push_back( gsSmth.view.ItemCount() );
+		gsSmth.view.AppendItems( partItems );
 	}
-	if ( tempDir.length() == 0 ) {
-		gsSmth.cookiePath = "";
-		return false;
+	if ( gsSmth.threadPageStarts.size() > 0 ) {
+		gsSmth.threadPageStarts = pageStarts;
 	}
-	gsSmth.cookiePath = tempDir + "/csmth.cookie";
 
-	Net_Login( "m.newsmth.net/user/login", data, gsSmth.cookiePath );
-	if ( Smth_CheckCookie( gsSmth.cookiePath, name ) ) {
-		return true;
+	if ( itemIndex >= gsSmth.view.ItemCount() ) {
+		itemIndex = gsSmth.view.ItemCount() - 1;
 	}
-	// Clear cookie path if login failed.
-	gsSmth.cookiePath = "";
-	return false;
+	gsSmth.view.SetItemIndex( itemIndex < 0 ? 0 : itemIndex );
+	gsSmth.redraw = true;
 }
 
-void Smth_RunLoop( void )
+// Appends the arrived pages that continue the stitched prefix, pages that
+// arrive early wait until the gap before them is filled.
+static void Smth_OnThreadPageLoaded( int generation, ThreadPageResult& result )
 {
-	int c = 0;
-
-	bool quit = false;
+	if ( generation != gsSmth.threadLoadGeneration ) {
+		return;
+	}
+	size_t pageIndex = result.pageIndex;
+	gsSmth.threadPages[pageIndex] = std::move( result );
+	// Quotes were toggled after the loader started.
+	bool relayout = false;
+
+	auto it = gsSmth.threadPages.find( gsSmth.threadNextPage );
+	while ( it != gsSmth.threadPages.end() ) {
+		ThreadPageResult& r = it->second;
+		gsSmth.threadPageStarts.push_back( gsSmth.view.ItemCount() );
+		gsSmth.threadArticleStarts.push_back( gsSmth.article.items.size() );
+		gsSmth.view.AppendItems( r.viewItems );
+		if ( r.quotesCollapsed == gsSmth.quotesExpanded ) {
+			relayout = true;
+		}
+		gsSmth.article.items.insert( gsSmth.article.items.end(), r.page.items.begin(), r.page.items.end() );
 
-	int artileIndex = -1;
+		gsSmth.threadPages.erase( it );
+		gsSmth.threadNextPage++;
+		it = gsSmth.threadPages.find( gsSmth.threadNextPage );
+	}
+	if ( relayout ) {
+		Smth_RebuildArticleView();
+	}
 
-	LinkPositionState linkState;
+	if ( gsSmth.threadWaitingDown && gsSmth.view.ItemIndex() < gsSmth.view.ItemCount() - 1 ) {
+		gsSmth.view.SetItemIndex( gsSmth.view.ItemIndex() + 1 );
+		gsSmth.threadWaitingDown = false;
+		gsSmth.redraw = true;
+	}
+}
 
-	std::string curUrl = "";
-	std::string cat = "";
-	do {
+// Fetches pages 2..pageCount of the thread with bounded parallelism and
+// stitches them into the current view.
+static void Smth_LoadWholeThread( const std::string& url, size_t pageCount )
+{
+	int generation = gsSmth.threadLoadGeneration;
+	gsSmth.threadPageCount = pageCount;
+	gsSmth.threadNextPage = 2;
+	gsSmth.threadPageStarts.assign( 1, 0 );
+	gsSmth.threadArticleStarts.assign( 1, 0 );
+
+	int maxParallel = Config_GetInt( "whole_thread_parallel", 4 );
+	std::string cookiePath = gsSmth.cookiePath;
+	TaskPool* pool = gsSmth.pool;
+	bool collapse = !gsSmth.quotesExpanded;
+	std::shared_ptr<ArticlePage> firstPage = std::make_shared<ArticlePage>( gsSmth.article );
+
+	Smth_RunInBackground( [url, pageCount, generation, maxParallel, cookiePath, pool, collapse, firstPage]() {
+		// Pages arrive in any order but are deduplicated in thread order,
+		// starting from the first page the ui already shows.
+		QuoteDedup dedup;
+		for ( size_t i = 0; i < firstPage->items.size(); ++i ) {
+			dedup.Process( firstPage->items[i].content );
+		}
+		std::map<size_t, std::shared_ptr<ThreadPageResult>> parsed;
+		size_t nextPage = 2;
 
-		if ( gsSmth.gotoUrl.length() > 0 && gsSmth.gotoUrl != curUrl ) {
-			curUrl = gsSmth.gotoUrl;
-			Smth_GotoUrl(gsSmth.gotoUrl, &linkState );
-			gsSmth.gotoUrl = "";
+		NetMultiHandle m = Net_MultiCreate( cookiePath, maxParallel );
+		for ( size_t p = 2; p <= pageCount; ++p ) {
+			Net_MultiAdd( m, (int)p, url + "?p=" + std::to_string( p ) );
+		}
+		std::vector<NetResult> done;
+		int pending = 0;
+		do {
+			if ( gsSmth.threadLoadGeneration != generation ) {
+				break;
+			}
+			done.clear();
+			pending = Net_MultiPoll( m, 50, done );
+			for ( size_t i = 0; i < done.size(); ++i ) {
+				std::shared_ptr<ThreadPageResult> result = std::make_shared<ThreadPageResult>();
+				result->pageIndex = (size_t)done[i].id;
+				if ( done[i].ok ) {
+					Smth_GetArticlePage( Smth_ClearHtmlComments( done[i].body ), result->page );
+				}
+				if ( result->page.items.size() == 0 ) {
+					ArticleItem item;
+					item.highlight = false;
+					item.content = "[page " + std::to_string( result->pageIndex ) + " could not be loaded]";
+					result->page.items.push_back( item );
+				}
+				parsed[result->pageIndex] = result;
+			}
+			for ( auto it = parsed.find( nextPage ); it != parsed.end(); it = parsed.find( ++nextPage ) ) {
+				std::shared_ptr<ThreadPageResult> result = it->second;
+				parsed.erase( it );
+				PageView view;
+				Smth_CreateViewFromArticlePage( result->page, view, pool, collapse ? &dedup : nullptr );
+				for ( int k = 0; k < view.ItemCount(); ++k ) {
+					result->viewItems.push_back( view.Item( k ) );
+				}
+				result->quotesCollapsed = collapse;
+				Smth_PostToUi( [generation, result]() {
+					Smth_OnThreadPageLoaded( generation, *result );
+				} );
+			}
+		} while ( pending > 0 );
+		Net_MultiDestroy( m );
+	} );
+}
 
-			cat = Smth_GetUrlCategory( curUrl );
-			if ( cat == "article" ) {
-				artileIndex = 0;
+// Index of the first view item of the stitched page after (direction > 0)
+// or before (direction < 0) the given item, -1 if there is none.
+static int Smth_GetThreadPageStart( int itemIndex, int direction )
+{
+	const std::vector<int>& starts = gsSmth.threadPageStarts;
+	if ( direction > 0 ) {
+		for ( size_t i = 0; i < starts.size(); ++i ) {
+			if ( starts[i] > itemIndex ) {
+				return starts[i];
 			}
-			else {
-				artileIndex = -1;
+		}
+	}
+	else {
+		for ( size_t i = starts.size(); i > 0; --i ) {
+			if ( starts[i - 1] < itemIndex ) {
+				return starts[i - 1];
 			}
 		}
+	}
+	return -1;
+}
 
-		if ( artileIndex >= 0 ) {
-			gsSmth.view.Output( &linkState );
-			artileIndex = -1;
+static void Smth_StartSpeculation( const std::string& url )
+{
+	std::shared_ptr<Speculation> spec = std::make_shared<Speculation>();
+	spec->url    = url;
+	spec->cancel   = false;
+	spec->done     = false;
+	spec->doneTick = 0;
+	gsSmth.speculation = spec;
+	gsSmth.specStarted++;
+
+	std::string cookiePath = gsSmth.cookiePath;
+	Smth_RunInBackground( [spec, cookiePath]() {
+		// Real navigation must not wait behind a guess.
+		SetThreadPriority( GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL );
+		std::string html = Net_GetCancellable( spec->url, cookiePath, spec->cancel );
+
+		std::lock_guard<std::mutex> guard( spec->lock );
+		spec->html.swap( html );
+		spec->done     = true;
+		spec->doneTick = GetTickCount64();
+		spec->cond.notify_all();
+	} );
+}
+
+// Called when the cursor leaves the item the speculation was made for.
+static void Smth_DropSpeculation( void )
+{
+	std::shared_ptr<Speculation> spec = gsSmth.speculation;
+	if ( spec == nullptr ) {
+		return;
+	}
+	gsSmth.speculation = nullptr;
+
+	bool done = false;
+	{
+		std::lock_guard<std::mutex> guard( spec->lock );
+		done = spec->done;
+	}
+	if ( !done ) {
+		spec->cancel = true;
+		gsSmth.specCancelled++;
+		return;
+	}
+	// The user may come back to it, keep the result for a while.
+	gsSmth.specFinished.push_back( spec );
+	if ( gsSmth.specFinished.size() > SMTH_SPECULATION_KEEP ) {
+		gsSmth.specFinished.pop_front();
+		gsSmth.specWasted++;
+	}
+}
+
+// Drops the finished speculations that are too old to be shown.
+static void Smth_PruneSpeculations( void )
+{
+	ULONGLONG now = GetTickCount64();
+	for ( size_t i = 0; i < gsSmth.specFinished.size(); ) {
+		if ( now - gsSmth.specFinished[i]->doneTick > SMTH_SPECULATION_MAX_AGE_MS ) {
+			gsSmth.specFinished.erase( gsSmth.specFinished.begin() + i );
+			gsSmth.specWasted++;
+		}
+		else {
+			++i;
+		}
+	}
+}
+
+// Takes the speculative result for url, waits for it if it is still in
+// flight. Returns false if there is none or it is too old.
+static bool Smth_TakeSpeculation( const std::string& url, std::string& outHtml )
+{
+	Smth_PruneSpeculations();
+	std::shared_ptr<Speculation> spec;
+	if ( gsSmth.speculation != nullptr && gsSmth.speculation->url == url ) {
+		spec = gsSmth.speculation;
+		gsSmth.speculation = nullptr;
+	}
+	else {
+		for ( size_t i = 0; i < gsSmth.specFinished.size(); ++i ) {
+			if ( gsSmth.specFinished[i]->url == url ) {
+				spec = gsSmth.specFinished[i];
+				gsSmth.specFinished.erase( gsSmth.specFinished.begin() + i );
+				break;
+			}
+		}
+	}
+	if ( spec == nullptr ) {
+		return false;
+	}
+
+	std::unique_lock<std::mutex> guard( spec->lock );
+	spec->cond.wait( guard, [&spec]() { return spec->done; } );
+	if ( spec->html.length() == 0 || GetTickCount64() - spec->doneTick > SMTH_SPECULATION_MAX_AGE_MS ) {
+		gsSmth.specWasted++;
+		return false;
+	}
+	outHtml.swap( spec->html );
+	gsSmth.specHits++;
+	return true;
+}
+
+// Starts a speculative fetch once the cursor rested on a board or article
+// link for speculate_dwell_ms, and cancels it when the cursor moves on.
+static void Smth_UpdateSpeculation( const std::string& cat, const LinkPositionState& state )
+{
+	int dwellMs = Config_GetInt( "speculate_dwell_ms", 300 );
+	if ( dwellMs <= 0 || cat == "article" || gsSmth.archive != nullptr ) {
+		return;
+	}
+
+	std::string url = state.Url();
+	if ( url != gsSmth.dwellUrl ) {
+		Smth_DropSpeculation();
+		gsSmth.dwellUrl   = url;
+		gsSmth.dwellSince = GetTickCount64();
+		return;
+	}
+	if ( gsSmth.speculation != nullptr || GetTickCount64() - gsSmth.dwellSince < (ULONGLONG)dwellMs ) {
+		return;
+	}
+
+	std::string linkCat = Smth_GetUrlCategory( url );
+	if ( linkCat != "article" && linkCat != "board" ) {
+		return;
+	}
+	Smth_PruneSpeculations();
+	for ( size_t i = 0; i < gsSmth.specFinished.size(); ++i ) {
+		if ( gsSmth.specFinished[i]->url == url ) {
+			return;
+		}
+	}
+	Smth_StartSpeculation( url );
+}
+
+static void Smth_ReportSpeculation( void )
+{
+	Smth_DropSpeculation();
+	gsSmth.specWasted += (int)gsSmth.specFinished.size();
+	gsSmth.specFinished.clear();
+
+	if ( gsSmth.specStarted == 0 ) {
+		return;
+	}
+	double hitRatio   = 100.0 * gsSmth.specHits / gsSmth.specStarted;
+	double wasteRatio = 100.0 * ( gsSmth.specCancelled + gsSmth.specWasted ) / gsSmth.specStarted;
+	wprintf( L"speculation: %d started, %d hits (%.0f%%), %d cancelled, %d wasted (%.0f%% waste)\n",
+			gsSmth.specStarted, gsSmth.specHits, hitRatio, gsSmth.specCancelled, gsSmth.specWasted, wasteRatio );
+
+	FILE* fp = fopen( ( Smth_GetDataDir() + "/speculation.log" ).c_str(), "a" );
+	if ( fp != nullptr ) {
+		fprintf( fp, "%lld dwell_ms=%d started=%d hits=%d cancelled=%d wasted=%d\n", (long long)time( nullptr ),
+				Config_GetInt( "speculate_dwell_ms", 300 ), gsSmth.specStarted, gsSmth.specHits,
+				gsSmth.specCancelled, gsSmth.specWasted );
+		fclose( fp );
+	}
+}
+
+static std::string Smth_FetchHtml( const std::string& fullUrl )
+{
+	std::string result;
+	auto it = gsSmth.htmlCache.find( fullUrl );
+	if ( it != gsSmth.htmlCache.end() ) {
+		result.swap( it->second );
+		gsSmth.htmlCache.erase( it );
+	}
+	else if ( gsSmth.archive != nullptr ) {
+		gsSmth.archive->Find( fullUrl, result );
+	}
+	else if ( !Smth_TakeSpeculation( fullUrl, result ) ) {
+		result = Net_Get( fullUrl, gsSmth.cookiePath );
+	}
+	gsSmth.pageHash = Smth_HashText( result );
+	return Smth_ClearHtmlComments( result );
+}
+
+static void Smth_GotoUrl( const std::string& fullUrl, LinkPositionState* state=nullptr )
+{
+	system( "cls" );
+	std::string cat = Smth_GetUrlCategory( fullUrl );
+	std::string result;
+
+	PageRecord pageRec;
+	pageRec.posIndex = -1;
+	pageRec.url  = fullUrl;
+
+	if ( state != nullptr ) {
+		pageRec.posIndex  = state->PosIndex();
+		state->Clear();
+	}
+
+	gsSmth.shownUrl = fullUrl;
+	gsSmth.pageHash = 0;
+	Smth_StopWholeThread();
+
+	if ( cat == "board" ) { 
+		result = Smth_FetchHtml( fullUrl );
+		Smth_GetBoardPage( result, gsSmth.board );
+		Smth_OutputBoardPage( gsSmth.board, state );
+	}
+	else if ( cat == "article" ) { 
+		result = Smth_FetchHtml( fullUrl );
+		Smth_GetArticlePage( result, gsSmth.article );
+		ReadState_MarkRead( fullUrl );
+		QuoteDedup dedup;
+		Smth_CreateViewFromArticlePage( gsSmth.article, gsSmth.view, gsSmth.pool, gsSmth.quotesExpanded ? nullptr : &dedup );
+		if ( Config_GetBool( "whole_thread", false ) && !Smth_IsSubPageUrl( fullUrl ) && gsSmth.article.pageCount > 1
+				&& gsSmth.archive == nullptr ) {
+			Smth_LoadWholeThread( fullUrl, gsSmth.article.pageCount );
+		}
+	}
+	else if ( fullUrl == SMTH_HOT_ALL_URL ) {
+		if ( gsSmth.archive == nullptr && !Smth_IsHotAllFresh() ) {
+			Smth_PrefetchHomePages( false );
+		}
+		gsSmth.section = gsSmth.hotAll;
+		Smth_OutputSectionPage( gsSmth.section, state );
+	}
+	else {
+		if ( !Smth_GetCachedHomePage( fullUrl, gsSmth.section ) ) {
+			result = Smth_FetchHtml( fullUrl );
+			Smth_GetSectionPage( result, gsSmth.section );
+			if ( Smth_IsHomePageUrl( fullUrl ) && gsSmth.section.items.size() > 0 ) {
+				HomePageCache& c = gsSmth.homeCache[fullUrl];
+				c.page = gsSmth.section;
+				c.fetchTime = time( nullptr );
+			}
+		}
+		Smth_OutputSectionPage( gsSmth.section, state );
+	}
+
+	if ( gsSmth.urlStack.size() > 0 && gsSmth.urlStack.top().url != fullUrl ) {
+		if ( Smth_IsHomePageUrl( fullUrl ) ) {
+			gsSmth.urlStack.pop();
+		}
+		if ( !Smth_IsSubPageUrl( fullUrl ) ) {
+			gsSmth.urlStack.push( pageRec );
+		}
+	}
+	else if ( gsSmth.urlStack.size() == 0 ) {
+		gsSmth.urlStack.push( pageRec );
+	}
+}
+
+static std::string Smth_GetSessionPath( void )
+{
+	return Smth_GetDataDir() + "/session.snap";
+}
+
+static void Smth_SaveSession( const std::string& url, int posIndex )
+{
+	if ( url.length() == 0 ) {
+		return;
+	}
+	SessionSnapshot snap;
+	std::stack<PageRecord> records = gsSmth.urlStack;
+	while ( records.size() > 0 ) {
+		snap.urlStack.insert( snap.urlStack.begin(), records.top() );
+		records.pop();
+	}
+	snap.url      = url;
+	snap.posIndex = posIndex;
+	snap.pageHash = gsSmth.pageHash;
+	snap.section  = gsSmth.section;
+	snap.board    = gsSmth.board;
+	snap.article  = gsSmth.article;
+	snap.view     = gsSmth.view;
+
+	Snapshot_Save( Smth_GetSessionPath(), snap );
+}
+
+static bool Smth_RestoreSession( std::string& outUrl )
+{
+	SessionSnapshot snap;
+	if ( !Snapshot_Load( Smth_GetSessionPath(), snap ) || snap.url.length() == 0 ) {
+		return false;
+	}
+	while ( gsSmth.urlStack.size() > 0 ) {
+		gsSmth.urlStack.pop();
+	}
+	for ( size_t i = 0; i < snap.urlStack.size(); ++i ) {
+		gsSmth.urlStack.push( snap.urlStack[i] );
+	}
+	gsSmth.section  = snap.section;
+	gsSmth.board    = snap.board;
+	gsSmth.article  = snap.article;
+	gsSmth.view     = snap.view;
+	gsSmth.pageHash = snap.pageHash;
+	gsSmth.shownUrl = snap.url;
+	gsSmth.gotoPosIndex = snap.posIndex;
+
+	outUrl = snap.url;
+	return true;
+}
+
+// Draws a page restored from the session snapshot, articles are drawn by
+// the run loop from the restored view.
+static void Smth_ShowRestoredPage( const std::string& url, LinkPositionState* state )
+{
+	system( "cls" );
+	state->Clear();
+
+	std::string cat = Smth_GetUrlCategory( url );
+	if ( cat == "board" ) {
+		Smth_OutputBoardPage( gsSmth.board, state );
+	}
+	else if ( cat != "article" ) {
+		Smth_OutputSectionPage( gsSmth.section, state );
+	}
+}
+
+// Refetches the restored page and reloads it if it changed meanwhile.
+static void Smth_RevalidateInBackground( const std::string& url, uint64_t pageHash )
+{
+	if ( url == SMTH_HOT_ALL_URL ) {
+		return;
+	}
+	std::string cookiePath = gsSmth.cookiePath;
+	Smth_RunInBackground( [url, pageHash, cookiePath]() {
+		std::string html = Net_Get( url, cookiePath );
+		if ( html.length() == 0 || Smth_HashText( html ) == pageHash ) {
+			return;
+		}
+		Smth_PostToUi( [url, html]() {
+			if ( gsSmth.shownUrl != url ) {
+				return;
+			}
+			gsSmth.htmlCache[url] = html;
+			gsSmth.gotoUrl = url;
+			gsSmth.reload = true;
+		} );
+	} );
+}
+
+static std::string Smth_GetBoardPageUrl( const std::string& boardUrl, size_t pageIndex )
+{
+	size_t index = boardUrl.rfind( "?p=" );
+	std::string base = index != std::string::npos ? boardUrl.substr( 0, index ) : boardUrl;
+	if ( pageIndex <= 1 ) {
+		return base;
+	}
+	return base + "?p=" + std::to_string( pageIndex );
+}
+
+// Board times are either a date or, for today, a time of day.
+static std::string Smth_NormalizeBoardDate( const std::string& text )
+{
+	if ( text.length() == 10 && text[4] == '-' && text[7] == '-' ) {
+		return text;
+	}
+	if ( text.length() == 8 && text[2] == ':' && text[5] == ':' ) {
+		char today[16];
+		time_t now = time( nullptr );
+		strftime( today, sizeof( today ), "%Y-%m-%d", localtime( &now ) );
+		return today;
+	}
+	return "";
+}
+
+// Range of last reply dates of the non top items of a board page.
+static bool Smth_GetBoardPageDates( const BoardPage& page, std::string& outFirst, std::string& outLast )
+{
+	outFirst.clear();
+	outLast.clear();
+	for ( size_t i = 0; i < page.items.size(); ++i ) {
+		if ( page.items[i].is_top ) {
+			continue;
+		}
+		std::string date = Smth_NormalizeBoardDate( Intern_String( page.items[i].replier_time ) );
+		if ( date.length() == 0 ) {
+			continue;
+		}
+		if ( outFirst.length() == 0 || date < outFirst ) {
+			outFirst = date;
+		}
+		if ( outLast.length() == 0 || date > outLast ) {
+			outLast = date;
+		}
+	}
+	return outFirst.length() > 0;
+}
+
+static const ProbedPage* Smth_ProbeBoardPage( const std::string& boardUrl, size_t pageIndex )
+{
+	std::string url = Smth_GetBoardPageUrl( boardUrl, pageIndex );
+	auto it = gsSmth.probeCache.find( url );
+	if ( it != gsSmth.probeCache.end() && time( nullptr ) - it->second.fetchTime <= SMTH_PROBE_CACHE_SECONDS ) {
+		return &it->second;
+	}
+
+	// Make room: expired pages go first, then the oldest.
+	time_t now = time( nullptr );
+	for ( auto old = gsSmth.probeCache.begin(); old != gsSmth.probeCache.end(); ) {
+		if ( now - old->second.fetchTime > SMTH_PROBE_CACHE_SECONDS ) {
+			old = gsSmth.probeCache.erase( old );
+		}
+		else {
+			++old;
+		}
+	}
+	while ( gsSmth.probeCache.size() >= SMTH_PROBE_CACHE_KEEP ) {
+		auto oldest = gsSmth.probeCache.begin();
+		for ( auto c = gsSmth.probeCache.begin(); c != gsSmth.probeCache.end(); ++c ) {
+			if ( c->second.fetchTime < oldest->second.fetchTime ) {
+				oldest = c;
+			}
+		}
+		gsSmth.probeCache.erase( oldest );
+	}
+
+	wprintf( L"\r  probing page %d ...      ", (int)pageIndex );
+	ProbedPage& probe = gsSmth.probeCache[url];
+	if ( gsSmth.archive != nullptr ) {
+		gsSmth.archive->Find( url, probe.html );
+	}
+	else {
+		probe.html = Net_Get( url, gsSmth.cookiePath );
+	}
+	Smth_GetBoardPage( Smth_ClearHtmlComments( probe.html ), probe.page );
+	probe.fetchTime = time( nullptr );
+	return &probe;
+}
+
+// Binary search over the pages of a board for the page holding posts of
+// the given date (YYYY-MM-DD). Takes O(log pageCount) fetches, the probed
+// pages are cached. Returns 0 if the board has no usable dates. A probed
+// page may be evicted by the next probe, use it right away.
+static size_t Smth_FindBoardPageByDate( const std::string& boardUrl, size_t pageCount, const std::string& date )
+{
+	if ( pageCount <= 1 ) {
+		return 1;
+	}
+
+	std::string firstOld, firstNew, lastOld, lastNew;
+	if ( !Smth_GetBoardPageDates( Smth_ProbeBoardPage( boardUrl, 1 )->page, firstOld, firstNew )
+			|| !Smth_GetBoardPageDates( Smth_ProbeBoardPage( boardUrl, pageCount )->page, lastOld, lastNew ) ) {
+		return 0;
+	}
+	// Boards list their newest posts either on the first or on the last
+	// page, search in the right direction.
+	bool newestFirst = firstNew >= lastNew;
+
+	size_t lo = 1, hi = pageCount;
+	while ( lo < hi ) {
+		size_t mid = lo + ( hi - lo ) / 2;
+		std::string oldest, newest;
+		if ( !Smth_GetBoardPageDates( Smth_ProbeBoardPage( boardUrl, mid )->page, oldest, newest ) ) {
+			// No dated items, narrow down from the side we know.
+			if ( newestFirst ) lo = mid + 1; else hi = mid;
+			continue;
+		}
+		if ( newestFirst ) {
+			// First page whose oldest post is not newer than the date.
+			if ( oldest <= date ) hi = mid; else lo = mid + 1;
+		}
+		else {
+			// First page whose newest post is not older than the date.
+			if ( newest >= date ) hi = mid; else lo = mid + 1;
+		}
+	}
+	return lo;
+}
+
+static std::string Smth_PromptLine( const std::wstring& prompt )
+{
+	wprintf( L"\n  %s", prompt.c_str() );
+	char input[256];
+	if ( fgets( input, sizeof( input ), stdin ) == nullptr ) {
+		return "";
+	}
+	return Smth_StripWhiteSpaces( input );
+}
+
+static void Smth_GotoBoardDate( const std::string& boardUrl )
+{
+	std::string date = Smth_PromptLine( L"go to date (YYYY-MM-DD): " );
+	if ( Smth_NormalizeBoardDate( date ) != date || date.length() == 0 ) {
+		return;
+	}
+	size_t pageIndex = Smth_FindBoardPageByDate( boardUrl, gsSmth.board.pageCount, date );
+	if ( pageIndex == 0 ) {
+		return;
+	}
+	std::string url = Smth_GetBoardPageUrl( boardUrl, pageIndex );
+	auto it = gsSmth.probeCache.find( url );
+	if ( it != gsSmth.probeCache.end() ) {
+		gsSmth.htmlCache[url] = it->second.html;
+	}
+	gsSmth.gotoUrl = url;
+}
+
+static std::string Smth_GetBoardDirPath( void )
+{
+	return Smth_GetDataDir() + "/boards.txt";
+}
+
+// First line is the crawl time, then one "name_en<TAB>name_cn<TAB>url" per board.
+static bool Smth_LoadBoardDirectory( std::vector<BoardEntry>& outBoards, time_t& outTime )
+{
+	std::ifstream is( Smth_GetBoardDirPath().c_str(), std::ifstream::binary );
+	std::string line;
+	if ( !is || !std::getline( is, line ) ) {
+		return false;
+	}
+	outTime = (time_t)atoll( line.c_str() );
+	while ( std::getline( is, line ) ) {
+		size_t tab1 = line.find( '\t' );
+		size_t tab2 = tab1 != std::string::npos ? line.find( '\t', tab1 + 1 ) : std::string::npos;
+		if ( tab2 == std::string::npos ) {
+			continue;
+		}
+		BoardEntry entry;
+		entry.name_en = line.substr( 0, tab1 );
+		entry.name_cn = line.substr( tab1 + 1, tab2 - tab1 - 1 );
+		entry.url     = line.substr( tab2 + 1 );
+		outBoards.push_back( entry );
+	}
+	return outBoards.size() > 0;
+}
+
+static void Smth_SaveBoardDirectory( const std::vector<BoardEntry>& boards, time_t crawlTime )
+{
+	std::string path = Smth_GetBoardDirPath();
+	std::string tempPath = path + ".tmp";
+	{
+		std::ofstream os( tempPath.c_str(), std::ofstream::binary );
+		os << (long long)crawlTime << "\n";
+		for ( size_t i = 0; i < boards.size(); ++i ) {
+			os << boards[i].name_en << "\t" << boards[i].name_cn << "\t" << boards[i].url << "\n";
+		}
+		if ( !os ) {
+			return;
+		}
+	}
+	MoveFileExA( tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING );
+}
+
+// Walks the section tree breadth first from the section home page, with
+// up to maxParallel section pages in flight. Subsections are queued as
+// soon as their parent page arrives.
+static void Smth_CrawlBoardDirectory( const std::string& cookiePath, int maxParallel, const std::atomic<bool>& cancel, std::vector<BoardEntry>& outBoards )
+{
+	std::set<std::string> seenSections;
+	std::set<std::string> seenBoards;
+	NetMultiHandle m = Net_MultiCreate( cookiePath, maxParallel );
+
+	std::string root = SMTH_HOMEPAGES[0];
+	seenSections.insert( root.substr( SMTH_DOMAIN.length() ) );
+	Net_MultiAdd( m, 0, root );
+
+	std::vector<NetResult> done;
+	int pending = 1;
+	while ( pending > 0 && !cancel ) {
+		done.clear();
+		pending = Net_MultiPoll( m, 50, done );
+		for ( size_t i = 0; i < done.size(); ++i ) {
+			if ( !done[i].ok ) {
+				continue;
+			}
+			SectionPage page;
+			Smth_GetSectionPage( Smth_ClearHtmlComments( done[i].body ), page );
+			for ( size_t k = 0; k < page.items.size(); ++k ) {
+				const SectionItem& item = page.items[k];
+				if ( item.type == "section" && seenSections.insert( item.url ).second ) {
+					Net_MultiAdd( m, (int)seenSections.size(), SMTH_DOMAIN + item.url );
+					pending++;
+				}
+				else if ( item.type == "board" && seenBoards.insert( item.url ).second ) {
+					BoardEntry entry;
+					entry.url     = item.url;
+					entry.name_en = item.url.substr( item.url.rfind( '/' ) + 1 );
+					entry.name_cn = item.title;
+					// Titles may carry the English name in parentheses.
+					size_t paren = entry.name_cn.rfind( '(' );
+					if ( paren != std::string::npos && paren > 0 ) {
+						entry.name_cn = entry.name_cn.substr( 0, paren );
+					}
+					outBoards.push_back( entry );
+				}
+			}
+		}
+	}
+	Net_MultiDestroy( m );
+}
+
+// Loads the cached directory once and crawls again in the background
+// when it is older than board_dir_refresh_hours.
+static void Smth_RefreshBoardDirectory( void )
+{
+	if ( gsSmth.boardFinder.Count() == 0 && gsSmth.boardDirTime == 0 ) {
+		std::vector<BoardEntry> boards;
+		time_t crawlTime = 0;
+		if ( Smth_LoadBoardDirectory( boards, crawlTime ) ) {
+			gsSmth.boardFinder.Build( boards );
+			gsSmth.boardDirTime = crawlTime;
+		}
+	}
+
+	time_t refresh = (time_t)Config_GetInt( "board_dir_refresh_hours", 24 ) * 3600;
+	if ( gsSmth.boardDirCrawling || time( nullptr ) - gsSmth.boardDirTime < refresh ) {
+		return;
+	}
+	gsSmth.boardDirCrawling = true;
+
+	std::string cookiePath = gsSmth.cookiePath;
+	int maxParallel = Config_GetInt( "board_dir_parallel", 4 );
+	Smth_RunInBackground( [cookiePath, maxParallel]() {
+		SetThreadPriority( GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL );
+		std::shared_ptr<std::vector<BoardEntry>> boards = std::make_shared<std::vector<BoardEntry>>();
+		Smth_CrawlBoardDirectory( cookiePath, maxParallel, gsSmth.boardDirCancel, *boards );
+		time_t crawlTime = time( nullptr );
+		if ( boards->size() > 0 && !gsSmth.boardDirCancel ) {
+			Smth_SaveBoardDirectory( *boards, crawlTime );
+		}
+		Smth_PostToUi( [boards, crawlTime]() {
+			gsSmth.boardDirCrawling = false;
+			if ( boards->size() > 0 ) {
+				gsSmth.boardFinder.Build( *boards );
+				gsSmth.boardDirTime = crawlTime;
+			}
+		} );
+	} );
+}
+
+static void Smth_ShowBoardMatches( const std::wstring& query, const std::vector<size_t>& matches, size_t selected, double ms )
+{
+	system( "cls" );
+	wprintf( L"\n  find board: %s\n\n", query.c_str() );
+	const BoardFinder& finder = gsSmth.boardFinder;
+	for ( size_t i = 0; i < matches.size(); ++i ) {
+		const BoardEntry& e = finder.Entry( matches[i] );
+		std::wstring en = Smth_Utf8StringToWString( e.name_en );
+		std::wstring cn = Smth_Utf8StringToWString( e.name_cn );
+		wprintf( L"  %1s %-20s %s\n", i == selected ? L">" : L"", en.c_str(), cn.c_str() );
+	}
+	if ( finder.Count() == 0 ) {
+		wprintf( L"  (board directory is being built)\n" );
+	}
+	else {
+		wprintf( L"\n  %d boards, %.3f ms\n", (int)finder.Count(), ms );
+	}
+}
+
+// Type-to-jump: the matches are refreshed on every key, Enter goes to the
+// selected board, Esc cancels.
+static void Smth_FindBoard( void )
+{
+	if ( gsSmth.archive == nullptr ) {
+		Smth_RefreshBoardDirectory();
+	}
+
+	static const size_t SMTH_FINDER_RESULTS = 15;
+	std::wstring query;
+	std::vector<size_t> matches;
+	size_t selected = 0;
+	double ms = 0.0;
+	HANDLE input = GetStdHandle( STD_INPUT_HANDLE );
+	bool find = false;
+	while ( true ) {
+		if ( find ) {
+			std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
+			LARGE_INTEGER freq, t0, t1;
+			QueryPerformanceFrequency( &freq );
+			QueryPerformanceCounter( &t0 );
+			matches = gsSmth.boardFinder.Find( converter.to_bytes( query ), SMTH_FINDER_RESULTS );
+			QueryPerformanceCounter( &t1 );
+			ms = ( t1.QuadPart - t0.QuadPart ) * 1000.0 / freq.QuadPart;
+			selected = 0;
+			find = false;
+		}
+		Smth_ShowBoardMatches( query, matches, selected, ms );
+
+		// The crawl hands its directory over as a ui task, run those while
+		// no key is pressed and search again once it is there.
+		size_t boardCount = gsSmth.boardFinder.Count();
+		while ( WaitForSingleObject( input, (DWORD)SMTH_KEY_WAIT_MS ) != WAIT_OBJECT_0 && gsSmth.boardFinder.Count() == boardCount ) {
+			Smth_RunUiTasks();
+		}
+		if ( gsSmth.boardFinder.Count() != boardCount ) {
+			find = query.length() > 0;
+			continue;
+		}
+
+		INPUT_RECORD record;
+		DWORD recNum = 0;
+		if ( !ReadConsoleInputW( input, &record, 1, &recNum ) ) {
+			return;
+		}
+		if ( record.EventType != KEY_EVENT || !record.Event.KeyEvent.bKeyDown ) {
+			continue;
+		}
+		WORD key = record.Event.KeyEvent.wVirtualKeyCode;
+		wchar_t c = record.Event.KeyEvent.uChar.UnicodeChar;
+		if ( key == VK_ESCAPE ) {
+			return;
+		}
+		if ( key == VK_RETURN ) {
+			if ( selected < matches.size() ) {
+				gsSmth.gotoUrl = SMTH_DOMAIN + gsSmth.boardFinder.Entry( matches[selected] ).url;
+			}
+			return;
+		}
+		if ( key == VK_UP || key == VK_DOWN ) {
+			if ( key == VK_UP && selected > 0 ) {
+				selected--;
+			}
+			if ( key == VK_DOWN && selected + 1 < matches.size() ) {
+				selected++;
+			}
+			continue;
+		}
+		if ( key == VK_BACK ) {
+			if ( query.length() == 0 ) {
+				continue;
+			}
+			query.pop_back();
+		}
+		else if ( c >= 32 ) {
+			query.push_back( c );
+		}
+		else {
+			continue;
+		}
+		find = true;
+	}
+}
+
+size_t Smth_ShowUrl( const std::string& fullUrl )
+{
+	Smth_GotoUrl( fullUrl );
+	std::string cat = Smth_GetUrlCategory( fullUrl );
+	if ( cat == "board" ) {
+		return gsSmth.board.items.size();
+	}
+	if ( cat == "article" ) {
+		return gsSmth.article.items.size();
+	}
+	return gsSmth.section.items.size();
+}
+
+static bool Smth_CheckCookie( const std::string& cookiePath, const std::string& userName )
+{
+	std::string content;
+	std::ifstream is( cookiePath.c_str(), std::ifstream::binary );
+	if ( is ) {
+		is.seekg( 0, is.end );
+		int length = (int)is.tellg();
+		is.seekg( 0, is.beg );
+
+		if ( length > 0 ) {
+			char* buffer = new char[length];
+			is.read( buffer, length );
+			content = buffer;
+			delete[] buffer;
+		}
+		is.close();
+	}
+	if ( content.find( userName ) != std::string::npos ) {
+		return true;
+	}
+	return false;
+}
+
+// mbedTLS cannot read the Windows certificate store, the trusted roots in
+// it are written out as a PEM bundle for curl instead.
+static bool Smth_WriteSystemCaFile( const std::string& path )
+{
+	HCERTSTORE store = CertOpenSystemStoreA( 0, "ROOT" );
+	if ( store == nullptr ) {
+		return false;
+	}
+	std::string pem;
+	PCCERT_CONTEXT cert = nullptr;
+	while ( ( cert = CertEnumCertificatesInStore( store, cert ) ) != nullptr ) {
+		DWORD size = 0;
+		if ( !CryptBinaryToStringA( cert->pbCertEncoded, cert->cbCertEncoded, CRYPT_STRING_BASE64HEADER, nullptr, &size ) ) {
+			continue;
+		}
+		std::string text( size, '\0' );
+		if ( CryptBinaryToStringA( cert->pbCertEncoded, cert->cbCertEncoded, CRYPT_STRING_BASE64HEADER, &text[0], &size ) ) {
+			text.resize( size );
+			pem += text;
+		}
+	}
+	CertCloseStore( store, 0 );
+	if ( pem.empty() ) {
+		return false;
+	}
+
+	std::string tempPath = path + ".tmp";
+	FILE* fp = fopen( tempPath.c_str(), "wb" );
+	if ( fp == nullptr ) {
+		return false;
+	}
+	bool ok = fwrite( pem.data(), 1, pem.length(), fp ) == pem.length();
+	ok = ( fclose( fp ) == 0 ) && ok;
+	return ok && MoveFileExA( tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING );
+}
+
+bool Smth_NetInit( void )
+{
+	if ( !Net_Init() ) {
+		return false;
+	}
+	Config_Load( Smth_GetDataDir() + "/csmth.ini" );
+	NetPolicy policy = Net_GetPolicy();
+	policy.connectTimeoutMs = Config_GetInt( "net_connect_timeout_ms", policy.connectTimeoutMs );
+	policy.deadlineMs       = Config_GetInt( "net_deadline_ms", policy.deadlineMs );
+	policy.retries          = Config_GetInt( "net_retries", policy.retries );
+	policy.backoffMs        = Config_GetInt( "net_backoff_ms", policy.backoffMs );
+	policy.hedge            = Config_GetBool( "net_hedge", policy.hedge );
+	Net_SetPolicy( policy );
+
+	// The CA bundle is net_ca_file, or cacert.pem in the data directory, or
+	// else the system store written out. Plain HTTP only when asked for, the
+	// login posts the password.
+	bool https = Config_GetBool( "net_https", true );
+	std::string caFile = Config_GetString( "net_ca_file", "" );
+	if ( https && caFile.empty() ) {
+		caFile = Smth_GetDataDir() + "/cacert.pem";
+		if ( GetFileAttributesA( caFile.c_str() ) == INVALID_FILE_ATTRIBUTES ) {
+			caFile = Smth_GetDataDir() + "/system_ca.pem";
+			if ( !Smth_WriteSystemCaFile( caFile ) ) {
+				caFile.clear();
+			}
+		}
+	}
+	if ( https && ( caFile.empty() || GetFileAttributesA( caFile.c_str() ) == INVALID_FILE_ATTRIBUTES ) ) {
+		wprintf( L"no CA certificates for HTTPS: set net_ca_file in csmth.ini, or net_https=false for plain HTTP\n" );
+		Net_Deinit();
+		return false;
+	}
+	Net_SetHttps( https, caFile );
+	if ( https ) {
+		Net_LoadTlsSessions( Smth_GetDataDir() + "/tls_sessions.bin" );
+	}
+	return true;
+}
+
+void Smth_NetDeinit( void )
+{
+	long handshakes = 0, resumed = 0;
+	Net_GetTlsStats( handshakes, resumed );
+	if ( handshakes > 0 ) {
+		Net_SaveTlsSessions( Smth_GetDataDir() + "/tls_sessions.bin" );
+	}
+	Net_Deinit();
+}
+
+bool Smth_Init( void )
+{
+	if ( Smth_NetInit() ) {
+		_setmode(_fileno(stdout), _O_U16TEXT);
+
+		gsSmth.gotoUrl = SMTH_HOMEPAGES[0];
+		gsSmth.gotoPosIndex = -1;
+		gsSmth.cookiePath = "";
+		gsSmth.pool = new TaskPool();
+
+		Filter_Load( Config_GetString( "kill_file", Smth_GetDataDir() + "/killfile.txt" ) );
+		ReadState_Load( Smth_GetDataDir() + "/readstate.bin" );
+		return true;
+	}
+	return false;
+}
+
+void Smth_Deinit( void )
+{
+	// Remove cookie file.
+	if ( gsSmth.cookiePath.length() > 0 ) {
+		remove( gsSmth.cookiePath.c_str() );
+	}
+	Smth_StopWholeThread();
+	gsSmth.boardDirCancel = true;
+	for ( size_t i = 0; i < gsSmth.background.size(); ++i ) {
+		gsSmth.background[i].thread.join();
+	}
+	gsSmth.background.clear();
+	ReadState_Save( Smth_GetDataDir() + "/readstate.bin" );
+	delete gsSmth.archive;
+	gsSmth.archive = nullptr;
+	delete gsSmth.pool;
+	gsSmth.pool = nullptr;
+	Smth_NetDeinit();
+}
+
+bool Smth_OpenArchive( const std::string& path )
+{
+	ArchiveReader* archive = new ArchiveReader();
+	if ( !archive->Open( path ) ) {
+		delete archive;
+		return false;
+	}
+	delete gsSmth.archive;
+	gsSmth.archive = archive;
+	return true;
+}
+
+static bool Smth_AskCredentials( std::string& outName, std::string& outData )
+{
+	std::string name, pwd;
+	char input[256];
+	while ( name.length() == 0 ) {
+		wprintf( L"login as: " );
+		if ( fgets( input, 256, stdin ) != nullptr ) {
+			name = Smth_StripWhiteSpaces( input );
+		}
+		if ( name.length() == 0 ) {
+			wprintf( L"\n" );
+		}
+	}
+
+	if ( name == "guest" ) return false;
+
+	while ( pwd.length() == 0 ) {
+		wprintf( L"password: " );
+		if ( fgets( input, 256, stdin ) != nullptr ) {
+			pwd = Smth_StripWhiteSpaces( input );
+		}
+		if ( pwd.length() == 0 ) {
+			wprintf( L"\n" );
+		}
+	}
+
+	outName = name;
+	outData = "id=" + name + "&passwd=" + pwd;
+	return true;
+}
+
+bool Smth_LoginToFile( const std::string& cookiePath )
+{
+	std::string name, data;
+	if ( !Smth_AskCredentials( name, data ) ) {
+		return false;
+	}
+	Net_Login( "m.newsmth.net/user/login", data, cookiePath );
+	return Smth_CheckCookie( cookiePath, name );
+}
+
+bool Smth_Login( void )
+{
+	std::string name, data;
+	if ( !Smth_AskCredentials( name, data ) ) {
+		return false;
+	}
+	std::string tempDir = getenv("TEMP");
+	if ( tempDir.length() == 0 ) {
+		tempDir = getenv( "TMP" );
+	}
+	if ( tempDir.length() == 0 ) {
+		gsSmth.cookiePath = "";
+		return false;
+	}
+	gsSmth.cookiePath = tempDir + "/csmth.cookie";
+
+	Net_Login( "m.newsmth.net/user/login", data, gsSmth.cookiePath );
+	if ( Smth_CheckCookie( gsSmth.cookiePath, name ) ) {
+		return true;
+	}
+	// Clear cookie path if login failed.
+	gsSmth.cookiePath = "";
+	return false;
+}
+
+void Smth_RunLoop( void )
+{
+	int c = 0;
+
+	bool quit = false;
+
+	int artileIndex = -1;
+
+	LinkPositionState linkState;
+
+	std::string curUrl = "";
+	std::string cat = "";
+
+	// Draw the last screen of the previous run first, the network catches
+	// up in the background.
+	if ( gsSmth.archive != nullptr ) {
+		gsSmth.gotoUrl = gsSmth.archive->StartUrl();
+	}
+	else if ( Smth_RestoreSession( curUrl ) ) {
+		gsSmth.gotoUrl = "";
+		cat = Smth_GetUrlCategory( curUrl );
+		Smth_ShowRestoredPage( curUrl, &linkState );
+		artileIndex = ( cat == "article" ) ? 0 : -1;
+
+		Smth_RevalidateInBackground( curUrl, gsSmth.pageHash );
+		Smth_PrefetchHomePages( true );
+	}
+	else {
+		Smth_PrefetchHomePages( false );
+	}
+	if ( gsSmth.archive == nullptr ) {
+		Smth_RefreshBoardDirectory();
+	}
+
+	do {
+
+		if ( gsSmth.gotoUrl.length() > 0 && ( gsSmth.gotoUrl != curUrl || gsSmth.reload ) ) {
+			// A reload keeps the cursor where it was.
+			int itemIndex = -1;
+			if ( gsSmth.reload ) {
+				gsSmth.gotoPosIndex = linkState.PosIndex();
+				itemIndex = gsSmth.view.ItemIndex();
+			}
+
+			curUrl = gsSmth.gotoUrl;
+			Smth_GotoUrl(gsSmth.gotoUrl, &linkState );
+			gsSmth.gotoUrl = "";
+
+			cat = Smth_GetUrlCategory( curUrl );
+			if ( cat == "article" ) {
+				artileIndex = 0;
+				if ( gsSmth.reload && itemIndex >= 0 && itemIndex < gsSmth.view.ItemCount() ) {
+					gsSmth.view.SetItemIndex( itemIndex );
+				}
+			}
+			else {
+				artileIndex = -1;
+			}
+			gsSmth.reload = false;
+		}
+
+		if ( artileIndex >= 0 ) {
+			gsSmth.view.Output( &linkState );
+			artileIndex = -1;
 		}
 
 		if ( gsSmth.gotoPosIndex != -1 ) {
@@ -1078,10 +2593,44 @@ void Smth_RunLoop( void )
 		}
 		Smth_SetPosMarker( linkState.PosX(), linkState.PosY() );
 
-		c = Smth_CheckPressedKey();
+		c = Smth_WaitPressedKey( SMTH_KEY_WAIT_MS );
+		Smth_RunUiTasks();
+		if ( gsSmth.redraw ) {
+			gsSmth.redraw = false;
+			if ( cat == "article" ) {
+				artileIndex = gsSmth.view.ItemIndex();
+			}
+		}
+		Smth_UpdateSpeculation( cat, linkState );
+
 		switch( c ) {
 		case SK_H:
-			gsSmth.gotoUrl = SMTH_HOMEPAGES[0];
+			gsSmth.gotoUrl = gsSmth.archive != nullptr ? gsSmth.archive->StartUrl() : SMTH_HOMEPAGES[0];
+			break;
+		case SK_G:
+			if ( cat == "board" ) {
+				Smth_GotoBoardDate( curUrl );
+				if ( gsSmth.gotoUrl.length() == 0 ) {
+					gsSmth.gotoUrl = curUrl;
+				}
+				// Staying on this page still draws it again over the prompt.
+				gsSmth.reload = ( gsSmth.gotoUrl == curUrl );
+			}
+			break;
+		case SK_B:
+			Smth_FindBoard();
+			if ( gsSmth.gotoUrl.length() == 0 ) {
+				gsSmth.gotoUrl = curUrl;
+			}
+			// Cancelling still draws the page again over the finder.
+			gsSmth.reload = ( gsSmth.gotoUrl == curUrl );
+			break;
+		case SK_Q:
+			if ( cat == "article" ) {
+				gsSmth.quotesExpanded = !gsSmth.quotesExpanded;
+				Smth_RebuildArticleView();
+				artileIndex = gsSmth.view.ItemIndex();
+			}
 			break;
 		case SK_UP:
 			Smth_ClearPosMarker( linkState.PosX(), linkState.PosY() );
@@ -1107,6 +2656,10 @@ void Smth_RunLoop( void )
 					gsSmth.view.SetItemIndex( gsSmth.view.ItemIndex() + 1 );
 					artileIndex = gsSmth.view.ItemIndex();
 				}
+				else if ( Smth_IsWholeThread() ) {
+					// Scroll on as soon as the next page is stitched in.
+					gsSmth.threadWaitingDown = Smth_IsWholeThreadLoading();
+				}
 				else {
 					if (gsSmth.article.pageIndex < gsSmth.article.pageCount) {
 						gsSmth.gotoUrl = Smth_GetNextPageUrl( curUrl );
@@ -1165,7 +2718,14 @@ void Smth_RunLoop( void )
 			break;
 		case SK_PREVPAGE:
 			{
-				if ( cat == "article" ) {
+				if ( cat == "article" && Smth_IsWholeThread() ) {
+					int start = Smth_GetThreadPageStart( gsSmth.view.ItemIndex(), -1 );
+					if ( start >= 0 ) {
+						gsSmth.view.SetItemIndex( start );
+						artileIndex = start;
+					}
+				}
+				else if ( cat == "article" ) {
 					if ( gsSmth.article.pageIndex > 1 ) {
 						gsSmth.gotoUrl = Smth_GetPrevPageUrl( curUrl );
 					}
@@ -1179,7 +2739,14 @@ void Smth_RunLoop( void )
 			break;
 		case SK_NEXTPAGE:
 			{
-				if ( cat == "article" ) {
+				if ( cat == "article" && Smth_IsWholeThread() ) {
+					int start = Smth_GetThreadPageStart( gsSmth.view.ItemIndex(), 1 );
+					if ( start >= 0 ) {
+						gsSmth.view.SetItemIndex( start );
+						artileIndex = start;
+					}
+				}
+				else if ( cat == "article" ) {
 					if ( gsSmth.article.pageIndex < gsSmth.article.pageCount ) {
 						gsSmth.gotoUrl = Smth_GetNextPageUrl( curUrl );
 					}
@@ -1205,6 +2772,11 @@ void Smth_RunLoop( void )
 		}
 
 	} while ( !quit );
+
+	if ( gsSmth.archive == nullptr ) {
+		Smth_SaveSession( curUrl, linkState.PosIndex() );
+	}
+	Smth_ReportSpeculation();
 }
 
 
@@ -1276,6 +2848,16 @@ void PageView::ParseSection( const std::string& text )
 }
 
 void PageView::ParseArticle( const std::string& text )
+{
+	Layout( text, items );
+}
+
+void PageView::AppendItems( const std::vector<PageViewItem>& newItems )
+{
+	items.insert( items.end(), newItems.begin(), newItems.end() );
+}
+
+void PageView::Layout( const std::string& text, std::vector<PageViewItem>& outItems ) const
 {
 	std::wstring wt = Smth_Utf8StringToWString( text );
 	
@@ -1297,7 +2879,7 @@ void PageView::ParseArticle( const std::string& text )
 			prevLineType = line.Type();
 			item.Append( line );
 			if ( item.LineCount() == height ) {
-				items.push_back( item );
+				outItems.push_back( item );
 				item.Clear();
 			}
 
@@ -1311,7 +2893,7 @@ void PageView::ParseArticle( const std::string& text )
 			prevLineType = line.Type();
 			item.Append( line );
 			if ( item.LineCount() == height ) {
-				items.push_back( item );
+				outItems.push_back( item );
 				item.Clear();
 			}
 
@@ -1331,12 +2913,13 @@ void PageView::ParseArticle( const std::string& text )
 		item.Append( line );
 	}
 	if ( item.LineCount() > 0 ) {
-		items.push_back( item );
+		outItems.push_back( item );
 	}
 }
 
 void PageView::Output( LinkPositionState* state ) const
 {
+	AllocPhase allocPhase( ALLOC_PHASE_RENDER );
 	if ( state != nullptr ) {
 		state->Clear();
 	}
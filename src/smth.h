@@ -5,6 +5,11 @@
 #include <string>
 #include <vector>
 
+#include "intern.h"
+
+class TaskPool;
+class QuoteDedup;
+
 struct SectionItem {
 	std::string type;
 	std::string url;
@@ -16,14 +21,17 @@ struct SectionPage {
 	std::vector<SectionItem> items;
 };
 
+// Author ids and times repeat across a board, they are kept as interned
+// symbols, see intern.h.
 struct BoardItem {
 	bool        is_top;
+	bool        highlight;
 	std::string url;
 	std::string title;
-	std::string author;
-	std::string author_time;
-	std::string last_replier;
-	std::string replier_time;
+	SymbolId    author;
+	SymbolId    author_time;
+	SymbolId    last_replier;
+	SymbolId    replier_time;
 };
 
 struct BoardPage {
@@ -35,6 +43,7 @@ struct BoardPage {
 };
 
 struct ArticleItem {
+	bool        highlight;
 	std::string author;
 	std::string content;
 };
@@ -54,6 +63,11 @@ struct ArticleInfo {
 	std::string author_time;
 };
 
+struct PageRecord {
+	std::string url;
+	int posIndex;
+};
+
 struct LinkPos {
 	int x;
 	int y;
@@ -151,6 +165,10 @@ public:
 		: type( t )
 	{
 	}
+	ViewLine( VIEWLINE_TYPE t, const std::wstring& text )
+		: type( t ), content( text )
+	{
+	}
 	void SetType( VIEWLINE_TYPE t )
 	{
 		type = t;
@@ -198,6 +216,10 @@ public:
 	{
 		return lines.size();
 	}
+	const ViewLine& Line( size_t i ) const
+	{
+		return lines[i];
+	}
 	void Output() const
 	{
 		for ( size_t i = 0; i < lines.size(); ++i ) {
@@ -215,6 +237,10 @@ public:
 	PageView( size_t w=80, size_t h=24 );
 	void ParseArticle( const std::string& text );
 	void ParseSection( const std::string& text );
+	// Lays out text into items without touching the view, safe to call
+	// from several threads at once.
+	void Layout( const std::string& text, std::vector<PageViewItem>& outItems ) const;
+	void AppendItems( const std::vector<PageViewItem>& newItems );
 	void Output( LinkPositionState* state = nullptr ) const;
 	VIEWLINE_TYPE AdjustLineType( const ViewLine& line, VIEWLINE_TYPE prevLineType ) const;
 	void SetItemIndex( int idx )
@@ -229,6 +255,10 @@ public:
 	{
 		return (int)items.size();
 	}
+	const PageViewItem& Item( int i ) const
+	{
+		return items[i];
+	}
 	void Clear()
 	{
 		itemIndex = -1;
@@ -246,6 +276,21 @@ private:
 void Smth_GetSectionPage( const std::string& htmlText, SectionPage& outPage );
 void Smth_GetBoardPage( const std::string& htmlText, BoardPage& outPage );
 void Smth_GetArticlePage( const std::string& htmlText, ArticlePage& outPage );
+// Absolute urls of the images and attachments of an article page.
+std::vector<std::string> Smth_GetAttachmentUrls( const std::string& htmlText );
+// First path segment of a site url: "board", "article", "section", ...
+std::string Smth_GetUrlCategory( const std::string& fullUrl );
+// Id of the author of a board item, or of an article post whose author
+// line also carries the floor and the time: "<floor>|someone|<time>".
+std::string Smth_GetAuthorId( const std::string& author );
+
+// Parse many pages at once, in parallel when a pool is given.
+void Smth_GetBoardPages( const std::vector<std::string>& htmlTexts, std::vector<BoardPage>& outPages, TaskPool* pool=nullptr );
+void Smth_GetArticlePages( const std::vector<std::string>& htmlTexts, std::vector<ArticlePage>& outPages, TaskPool* pool=nullptr );
+
+// Quotes repeated from earlier posts are collapsed when a dedup is given,
+// it carries on across calls for the pages of one thread.
+void Smth_CreateViewFromArticlePage( const ArticlePage& page, PageView& view, TaskPool* pool=nullptr, QuoteDedup* dedup=nullptr );
 
 void Smth_OutputSectionPage( const SectionPage& page, LinkPositionState* state=nullptr );
 void Smth_OutputBoardPage( const BoardPage& page, LinkPositionState* state=nullptr );
@@ -254,11 +299,28 @@ void Smth_OutputArticlePage( const ArticlePage& page, LinkPositionState* state=n
 
 std::wstring Smth_Utf8StringToWString( const std::string& text );
 
+// Per user directory for files kept between runs, created on demand.
+std::string Smth_GetDataDir( void );
+
 bool Smth_Init( void );
 void Smth_Deinit( void );
 
+// Net_Init/Net_Deinit with the network settings of csmth.ini applied and
+// the TLS sessions of the last run restored, then saved for the next one.
+bool Smth_NetInit( void );
+void Smth_NetDeinit( void );
+
+// Browse an archive written by "csmth archive" instead of the site.
+bool Smth_OpenArchive( const std::string& path );
+
 bool Smth_Login( );
+// Asks for id and password and keeps the session cookie in cookiePath.
+bool Smth_LoginToFile( const std::string& cookiePath );
 
 void Smth_RunLoop( void );
 
+// Goes to a url as the ui does and returns the number of items shown,
+// for "csmth bench fixtures". Needs only Net_Init, not Smth_Init.
+size_t Smth_ShowUrl( const std::string& fullUrl );
+
 #endif // #ifndef SMTH_H_170505112940
@@ -0,0 +1,227 @@
+#include <cstdio>
+#include <windows.h>
+
+#include "bin_stream.h"
+#include "fnv_hash.h"
+#include "mapped_file.h"
+#include "snapshot.h"
+
+static const char     SNAPSHOT_MAGIC[4] = { 'C', 'S', 'N', 'P' };
+static const uint32_t SNAPSHOT_VERSION  = 2;
+
+// magic, version, wchar_t size, payload size, payload checksum
+static const size_t   SNAPSHOT_HEADER_SIZE = 4 + 4 * 4;
+
+static void Snapshot_WriteSection( BinWriter& w, const SectionPage& page )
+{
+	w.Str( page.name );
+	w.U32( (uint32_t)page.items.size() );
+	for ( size_t i = 0; i < page.items.size(); ++i ) {
+		w.Str( page.items[i].type );
+		w.Str( page.items[i].url );
+		w.Str( page.items[i].title );
+	}
+}
+
+static void Snapshot_ReadSection( BinReader& r, SectionPage& page )
+{
+	page.name = r.Str();
+	uint32_t count = r.U32();
+	for ( uint32_t i = 0; i < count && r.Ok(); ++i ) {
+		SectionItem item;
+		item.type  = r.Str();
+		item.url   = r.Str();
+		item.title = r.Str();
+		page.items.push_back( item );
+	}
+}
+
+static void Snapshot_WriteBoard( BinWriter& w, const BoardPage& page )
+{
+	w.Str( page.name_cn );
+	w.Str( page.name_en );
+	w.U32( (uint32_t)page.pageIndex );
+	w.U32( (uint32_t)page.pageCount );
+	w.U32( (uint32_t)page.items.size() );
+	for ( size_t i = 0; i < page.items.size(); ++i ) {
+		const BoardItem& item = page.items[i];
+		w.U8( item.is_top ? 1 : 0 );
+		w.U8( item.highlight ? 1 : 0 );
+		w.Str( item.url );
+		w.Str( item.title );
+		// Symbol ids are only valid inside one process, keep the text.
+		w.Str( Intern_String( item.author ) );
+		w.Str( Intern_String( item.author_time ) );
+		w.Str( Intern_String( item.last_replier ) );
+		w.Str( Intern_String( item.replier_time ) );
+	}
+}
+
+static void Snapshot_ReadBoard( BinReader& r, BoardPage& page )
+{
+	page.name_cn   = r.Str();
+	page.name_en   = r.Str();
+	page.pageIndex = r.U32();
+	page.pageCount = r.U32();
+	uint32_t count = r.U32();
+	for ( uint32_t i = 0; i < count && r.Ok(); ++i ) {
+		BoardItem item;
+		item.is_top       = r.U8() != 0;
+		item.highlight    = r.U8() != 0;
+		item.url          = r.Str();
+		item.title        = r.Str();
+		item.author       = Intern_Get( r.Str() );
+		item.author_time  = Intern_Get( r.Str() );
+		item.last_replier = Intern_Get( r.Str() );
+		item.replier_time = Intern_Get( r.Str() );
+		page.items.push_back( item );
+	}
+}
+
+static void Snapshot_WriteArticle( BinWriter& w, const ArticlePage& page )
+{
+	w.Str( page.boardName );
+	w.Str( page.name );
+	w.U32( (uint32_t)page.pageIndex );
+	w.U32( (uint32_t)page.pageCount );
+	w.U32( (uint32_t)page.items.size() );
+	for ( size_t i = 0; i < page.items.size(); ++i ) {
+		w.U8( page.items[i].highlight ? 1 : 0 );
+		w.Str( page.items[i].author );
+		w.Str( page.items[i].content );
+	}
+}
+
+static void Snapshot_ReadArticle( BinReader& r, ArticlePage& page )
+{
+	page.boardName = r.Str();
+	page.name      = r.Str();
+	page.pageIndex = r.U32();
+	page.pageCount = r.U32();
+	uint32_t count = r.U32();
+	for ( uint32_t i = 0; i < count && r.Ok(); ++i ) {
+		ArticleItem item;
+		item.highlight = r.U8() != 0;
+		item.author  = r.Str();
+		item.content = r.Str();
+		page.items.push_back( item );
+	}
+}
+
+static void Snapshot_WriteView( BinWriter& w, const PageView& view )
+{
+	w.I32( view.ItemIndex() );
+	w.U32( (uint32_t)view.ItemCount() );
+	for ( int i = 0; i < view.ItemCount(); ++i ) {
+		const PageViewItem& item = view.Item( i );
+		w.U32( (uint32_t)item.LineCount() );
+		for ( size_t k = 0; k < item.LineCount(); ++k ) {
+			w.U8( (uint8_t)item.Line( k ).Type() );
+			w.WStr( item.Line( k ).Text() );
+		}
+	}
+}
+
+static void Snapshot_ReadView( BinReader& r, PageView& view )
+{
+	view.Clear();
+	int itemIndex = r.I32();
+	uint32_t count = r.U32();
+	std::vector<PageViewItem> items;
+	for ( uint32_t i = 0; i < count && r.Ok(); ++i ) {
+		PageViewItem item;
+		uint32_t lineCount = r.U32();
+		for ( uint32_t k = 0; k < lineCount && r.Ok(); ++k ) {
+			VIEWLINE_TYPE type = (VIEWLINE_TYPE)r.U8();
+			item.Append( ViewLine( type, r.WStr() ) );
+		}
+		items.push_back( item );
+	}
+	view.AppendItems( items );
+	view.SetItemIndex( itemIndex );
+}
+
+bool Snapshot_Save( const std::string& path, const SessionSnapshot& snap )
+{
+	BinWriter w;
+	w.U32( (uint32_t)snap.urlStack.size() );
+	for ( size_t i = 0; i < snap.urlStack.size(); ++i ) {
+		w.Str( snap.urlStack[i].url );
+		w.I32( snap.urlStack[i].posIndex );
+	}
+	w.Str( snap.url );
+	w.I32( snap.posIndex );
+	w.U64( snap.pageHash );
+	Snapshot_WriteSection( w, snap.section );
+	Snapshot_WriteBoard( w, snap.board );
+	Snapshot_WriteArticle( w, snap.article );
+	Snapshot_WriteView( w, snap.view );
+
+	const std::vector<char>& payload = w.Buffer();
+
+	BinWriter header;
+	header.Bytes( SNAPSHOT_MAGIC, sizeof( SNAPSHOT_MAGIC ) );
+	header.U32( SNAPSHOT_VERSION );
+	header.U32( (uint32_t)sizeof( wchar_t ) );
+	header.U32( (uint32_t)payload.size() );
+	header.U32( Fnv_Hash32( payload.data(), payload.size() ) );
+
+	// Write aside and swap in, a crash never leaves a half written file.
+	std::string tempPath = path + ".tmp";
+	FILE* fp = fopen( tempPath.c_str(), "wb" );
+	if ( fp == nullptr ) {
+		return false;
+	}
+	bool ok = fwrite( header.Buffer().data(), 1, header.Size(), fp ) == header.Size()
+		&& fwrite( payload.data(), 1, payload.size(), fp ) == payload.size();
+	ok = ( fclose( fp ) == 0 ) && ok;
+	if ( !ok ) {
+		remove( tempPath.c_str() );
+		return false;
+	}
+	return MoveFileExA( tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING ) != 0;
+}
+
+bool Snapshot_Load( const std::string& path, SessionSnapshot& snap )
+{
+	MappedFile file;
+	if ( !file.Open( path ) || file.Size() < SNAPSHOT_HEADER_SIZE ) {
+		return false;
+	}
+
+	BinReader header( file.Data(), SNAPSHOT_HEADER_SIZE );
+	char magic[4];
+	header.Bytes( magic, sizeof( magic ) );
+	uint32_t version   = header.U32();
+	uint32_t wcharSize = header.U32();
+	uint32_t size      = header.U32();
+	uint32_t checksum  = header.U32();
+
+	if ( memcmp( magic, SNAPSHOT_MAGIC, sizeof( magic ) ) != 0 || version != SNAPSHOT_VERSION
+			|| wcharSize != sizeof( wchar_t ) || size != file.Size() - SNAPSHOT_HEADER_SIZE ) {
+		return false;
+	}
+	const char* payload = file.Data() + SNAPSHOT_HEADER_SIZE;
+	if ( Fnv_Hash32( payload, size ) != checksum ) {
+		return false;
+	}
+
+	BinReader r( payload, size );
+	snap = SessionSnapshot();
+	uint32_t count = r.U32();
+	for ( uint32_t i = 0; i < count && r.Ok(); ++i ) {
+		PageRecord rec;
+		rec.url      = r.Str();
+		rec.posIndex = r.I32();
+		snap.urlStack.push_back( rec );
+	}
+	snap.url      = r.Str();
+	snap.posIndex = r.I32();
+	snap.pageHash = r.U64();
+	Snapshot_ReadSection( r, snap.section );
+	Snapshot_ReadBoard( r, snap.board );
+	Snapshot_ReadArticle( r, snap.article );
+	Snapshot_ReadView( r, snap.view );
+
+	return r.Ok();
+}
@@ -0,0 +1,29 @@
+#ifndef SNAPSHOT_H_191022170245
+#define SNAPSHOT_H_191022170245
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "smth.h"
+
+// Everything needed to draw the last screen again without the network.
+struct SessionSnapshot {
+	std::vector<PageRecord> urlStack; // Bottom first.
+	std::string             url;
+	int                     posIndex;
+	uint64_t                pageHash;
+
+	SectionPage section;
+	BoardPage   board;
+	ArticlePage article;
+	PageView    view;
+};
+
+bool Snapshot_Save( const std::string& path, const SessionSnapshot& snap );
+
+// Maps the snapshot file and reads it back, fails on any damaged or
+// foreign file.
+bool Snapshot_Load( const std::string& path, SessionSnapshot& outSnap );
+
+#endif // #ifndef SNAPSHOT_H_191022170245
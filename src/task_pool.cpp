@@ -0,0 +1,220 @@
+#include "task_pool.h"
+
+// Pool and worker index of the current thread, -1 for non worker threads.
+static thread_local const TaskPool* tlsPool = nullptr;
+static thread_local int             tlsWorkerIndex = -1;
+
+TaskPool::TaskPool( unsigned int threadCount )
+	: queued( 0 ), pending( 0 ), nextWorker( 0 ), quit( false )
+{
+	if ( threadCount == 0 ) {
+		threadCount = std::thread::hardware_concurrency();
+	}
+	for ( unsigned int i = 1; i < threadCount; ++i ) {
+		workers.push_back( std::unique_ptr<Worker>( new Worker ) );
+	}
+	for ( size_t i = 0; i < workers.size(); ++i ) {
+		workers[i]->thread = std::thread( &TaskPool::WorkerMain, this, (int)i );
+	}
+}
+
+TaskPool::~TaskPool()
+{
+	WaitAll();
+	{
+		std::lock_guard<std::mutex> guard( sleepLock );
+		quit = true;
+	}
+	wakeCond.notify_all();
+	for ( size_t i = 0; i < workers.size(); ++i ) {
+		workers[i]->thread.join();
+	}
+}
+
+void TaskPool::Submit( const Task& task )
+{
+	if ( workers.size() == 0 ) {
+		task();
+		return;
+	}
+
+	int index = ( tlsPool == this ) ? tlsWorkerIndex : -1;
+	if ( index < 0 ) {
+		index = (int)( nextWorker++ % workers.size() );
+	}
+
+	pending++;
+	{
+		std::lock_guard<std::mutex> guard( sleepLock );
+		queued++;
+	}
+	{
+		std::lock_guard<std::mutex> guard( workers[index]->lock );
+		workers[index]->tasks.push_back( task );
+	}
+	wakeCond.notify_one();
+}
+
+bool TaskPool::PopTask( int index, Task& task )
+{
+	// Own tasks first, newest first so the working set stays warm.
+	if ( index >= 0 ) {
+		Worker& w = *workers[index];
+		std::lock_guard<std::mutex> guard( w.lock );
+		if ( w.tasks.size() > 0 ) {
+			task = std::move( w.tasks.back() );
+			w.tasks.pop_back();
+			return true;
+		}
+	}
+	// Steal the oldest task of another worker.
+	size_t count = workers.size();
+	size_t start = index >= 0 ? (size_t)index + 1 : 0;
+	for ( size_t i = 0; i < count; ++i ) {
+		Worker& w = *workers[( start + i ) % count];
+		std::lock_guard<std::mutex> guard( w.lock );
+		if ( w.tasks.size() > 0 ) {
+			task = std::move( w.tasks.front() );
+			w.tasks.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+bool TaskPool::RunOne( int index )
+{
+	Task task;
+	if ( !PopTask( index, task ) ) {
+		return false;
+	}
+	queued--;
+	task();
+	if ( --pending == 0 ) {
+		std::lock_guard<std::mutex> guard( sleepLock );
+		doneCond.notify_all();
+	}
+	return true;
+}
+
+void TaskPool::WorkerMain( int index )
+{
+	tlsPool = this;
+	tlsWorkerIndex = index;
+
+	while ( true ) {
+		if ( RunOne( index ) ) {
+			continue;
+		}
+		std::unique_lock<std::mutex> guard( sleepLock );
+		wakeCond.wait( guard, [this]() { return quit || queued > 0; } );
+		if ( quit && queued == 0 ) {
+			break;
+		}
+	}
+}
+
+void TaskPool::WaitAll()
+{
+	int index = ( tlsPool == this ) ? tlsWorkerIndex : -1;
+	while ( pending > 0 ) {
+		if ( RunOne( index ) ) {
+			continue;
+		}
+		std::unique_lock<std::mutex> guard( sleepLock );
+		doneCond.wait_for( guard, std::chrono::milliseconds( 1 ), [this]() { return pending == 0; } );
+	}
+}
+
+void TaskPool::ParallelFor( size_t count, const std::function<void(size_t)>& fn )
+{
+	if ( count == 0 ) {
+		return;
+	}
+	if ( workers.size() == 0 || count == 1 ) {
+		for ( size_t i = 0; i < count; ++i ) {
+			fn( i );
+		}
+		return;
+	}
+
+	// Split into a few ranges per thread, stealing balances the rest.
+	size_t rangeCount = ThreadCount() * 4;
+	if ( rangeCount > count ) {
+		rangeCount = count;
+	}
+	size_t rangeSize = ( count + rangeCount - 1 ) / rangeCount;
+	rangeCount = ( count + rangeSize - 1 ) / rangeSize;
+
+	std::atomic<size_t> remaining( rangeCount );
+	for ( size_t r = 1; r < rangeCount; ++r ) {
+		size_t begin = r * rangeSize;
+		size_t end   = begin + rangeSize < count ? begin + rangeSize : count;
+		Submit( [&fn, &remaining, begin, end]() {
+			for ( size_t i = begin; i < end; ++i ) {
+				fn( i );
+			}
+			remaining--;
+		} );
+	}
+	// The first range runs on the calling thread.
+	for ( size_t i = 0; i < rangeSize && i < count; ++i ) {
+		fn( i );
+	}
+	remaining--;
+
+	int index = ( tlsPool == this ) ? tlsWorkerIndex : -1;
+	while ( remaining > 0 ) {
+		if ( !RunOne( index ) ) {
+			std::this_thread::yield();
+		}
+	}
+}
+
+TaskGroup::TaskGroup( TaskPool& pool )
+	: pool( pool ), state( std::make_shared<State>() )
+{
+	state->pending = 0;
+}
+
+TaskGroup::~TaskGroup()
+{
+	Wait();
+}
+
+void TaskGroup::Submit( const TaskPool::Task& task )
+{
+	{
+		std::lock_guard<std::mutex> guard( state->lock );
+		state->pending++;
+	}
+	std::shared_ptr<State> s = state;
+	pool.Submit( [s, task]() {
+		task();
+		std::lock_guard<std::mutex> guard( s->lock );
+		if ( --s->pending == 0 ) {
+			s->doneCond.notify_all();
+		}
+	} );
+}
+
+void TaskGroup::Wait()
+{
+	// Workers help as in WaitAll, a worker blocking here could leave the
+	// group's tasks queued behind it.
+	if ( tlsPool == &pool ) {
+		while ( true ) {
+			{
+				std::lock_guard<std::mutex> guard( state->lock );
+				if ( state->pending == 0 ) {
+					return;
+				}
+			}
+			if ( !pool.RunOne( tlsWorkerIndex ) ) {
+				std::this_thread::yield();
+			}
+		}
+	}
+	std::unique_lock<std::mutex> guard( state->lock );
+	state->doneCond.wait( guard, [this]() { return state->pending == 0; } );
+}
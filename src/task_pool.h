@@ -0,0 +1,101 @@
+#ifndef TASK_POOL_H_191021093512
+#define TASK_POOL_H_191021093512
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Small work-stealing executor. Every worker owns a deque, it pops its own
+// tasks from the back and steals from the front of the other deques when
+// it runs dry. Threads waiting on the pool (WaitAll, ParallelFor) help
+// running tasks instead of blocking, so nested use from a task is fine.
+class TaskPool
+{
+public:
+	typedef std::function<void()> Task;
+
+	// threadCount counts the thread that waits on the pool as well, 0 means
+	// one per hardware thread.
+	explicit TaskPool( unsigned int threadCount=0 );
+	~TaskPool();
+
+	void Submit( const Task& task );
+	void WaitAll();
+
+	// Runs fn(i) for i in [0, count) and returns when all of them are done.
+	void ParallelFor( size_t count, const std::function<void(size_t)>& fn );
+
+	// Runs fn(i) for i in [0, count) and collects the results in order.
+	template<typename T, typename F>
+	std::vector<T> Map( size_t count, F fn )
+	{
+		std::vector<T> results( count );
+		ParallelFor( count, [&]( size_t i ) { results[i] = fn( i ); } );
+		return results;
+	}
+
+	unsigned int ThreadCount() const
+	{
+		return (unsigned int)workers.size() + 1;
+	}
+
+private:
+	struct Worker {
+		std::mutex       lock;
+		std::deque<Task> tasks;
+		std::thread      thread;
+	};
+
+	void WorkerMain( int index );
+	bool RunOne( int index );
+	bool PopTask( int index, Task& task );
+
+	std::vector<std::unique_ptr<Worker>> workers;
+
+	std::mutex              sleepLock;
+	std::condition_variable wakeCond;
+	std::condition_variable doneCond;
+
+	std::atomic<size_t>       queued;
+	std::atomic<size_t>       pending;
+	std::atomic<unsigned int> nextWorker;
+	bool                      quit;
+
+	TaskPool( const TaskPool& ) = delete;
+	TaskPool& operator=( const TaskPool& ) = delete;
+
+	friend class TaskGroup;
+};
+
+// A batch of tasks on a pool that can be waited for apart from the rest
+// of the pool. A thread that is not a worker of the pool sleeps in Wait
+// instead of helping, so it never runs tasks submitted by other threads.
+class TaskGroup
+{
+public:
+	explicit TaskGroup( TaskPool& pool );
+	~TaskGroup();
+
+	void Submit( const TaskPool::Task& task );
+	void Wait();
+
+private:
+	struct State {
+		std::mutex              lock;
+		std::condition_variable doneCond;
+		size_t                  pending;
+	};
+
+	TaskPool&              pool;
+	std::shared_ptr<State> state;
+
+	TaskGroup( const TaskGroup& ) = delete;
+	TaskGroup& operator=( const TaskGroup& ) = delete;
+};
+
+#endif // #ifndef TASK_POOL_H_191021093512